@@ -0,0 +1,111 @@
+/*
+ * queue_t microbenchmark: the ring buffer in src/stl.c against the linked
+ * list it replaced (one malloc/free per item), copied below.
+ *
+ * Workloads follow the two users of queue_t on the hot path:
+ *   steady: one enqueue then one dequeue (accept/recv keeping up)
+ *   burst:  N enqueues, then drain (a backlog of connections or datagrams)
+ *
+ * Usage: xmake build queue-bench && xmake run queue-bench [items]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "stl.h"
+
+typedef struct list_node_s {
+  void* data;
+  struct list_node_s* next;
+} list_node_t;
+
+typedef struct {
+  list_node_t* head;
+  list_node_t* tail;
+  size_t size;
+} list_queue_t;
+
+static int list_enqueue(list_queue_t* q, void* data) {
+  list_node_t* node = (list_node_t*)malloc(sizeof(list_node_t));
+  if (!node) return -1;
+  node->data = data;
+  node->next = NULL;
+  if (q->tail) {
+    q->tail->next = node;
+  } else {
+    q->head = node;
+  }
+  q->tail = node;
+  q->size++;
+  return 0;
+}
+
+static void* list_dequeue(list_queue_t* q) {
+  list_node_t* node = q->head;
+  if (!node) return NULL;
+  void* data = node->data;
+  q->head = node->next;
+  if (!q->head) q->tail = NULL;
+  free(node);
+  q->size--;
+  return data;
+}
+
+static double seconds(clock_t start) { return (double)(clock() - start) / CLOCKS_PER_SEC; }
+
+// Sum of dequeued values, so the compiler cannot drop the work
+static volatile size_t g_sink;
+
+static double bench_ring(size_t items, size_t burst) {
+  queue_t* q = queue_init();
+  size_t sum = 0;
+  clock_t start = clock();
+  for (size_t done = 0; done < items; done += burst) {
+    for (size_t i = 0; i < burst; i++) {
+      queue_enqueue(q, (void*)(done + i + 1));
+    }
+    for (size_t i = 0; i < burst; i++) {
+      sum += (size_t)queue_dequeue(q);
+    }
+  }
+  double t = seconds(start);
+  g_sink = sum;
+  queue_destroy(q);
+  return t;
+}
+
+static double bench_list(size_t items, size_t burst) {
+  list_queue_t q = {NULL, NULL, 0};
+  size_t sum = 0;
+  clock_t start = clock();
+  for (size_t done = 0; done < items; done += burst) {
+    for (size_t i = 0; i < burst; i++) {
+      list_enqueue(&q, (void*)(done + i + 1));
+    }
+    for (size_t i = 0; i < burst; i++) {
+      sum += (size_t)list_dequeue(&q);
+    }
+  }
+  double t = seconds(start);
+  g_sink = sum;
+  return t;
+}
+
+int main(int argc, char** argv) {
+  size_t items = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 20000000;
+  static const size_t bursts[] = {1, 16, 1024, 65536};
+
+  printf("%-8s %10s %12s %12s %8s\n", "burst", "items", "list ns/op", "ring ns/op", "speedup");
+  for (size_t b = 0; b < sizeof(bursts) / sizeof(bursts[0]); b++) {
+    size_t burst = bursts[b];
+    size_t n = items / burst * burst;
+    if (n == 0) continue;
+    bench_ring(n / 10 + burst, burst);  // warm up the allocator and caches
+    double list = bench_list(n, burst);
+    double ring = bench_ring(n, burst);
+    printf("%-8zu %10zu %12.2f %12.2f %7.1fx\n", burst, n, list * 1e9 / (double)n, ring * 1e9 / (double)n,
+           ring > 0 ? list / ring : 0.0);
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/env luajit
+--[[
+  Compile an app directory into a C file of embedded bytecode (see include/embed.h).
+
+  Usage:
+    luajit bin/embed_bytecode.lua <appdir> <out.c> <main-module|-> <file.lua>...
+
+  Every file must live under appdir. "appdir/app/handlers.lua" is embedded as
+  module "app.handlers" and "appdir/app/init.lua" as "app". Bytecode keeps its
+  debug info, so tracebacks name the file relative to appdir. Run this with the
+  same LuaJIT the binary links against: bytecode is not portable across
+  versions.
+]]
+
+local appdir, out, main = arg[1], arg[2], arg[3]
+if not (appdir and out and main) then
+    io.stderr:write("usage: embed_bytecode.lua <appdir> <out.c> <main-module|-> <file.lua>...\n")
+    os.exit(1)
+end
+appdir = appdir:gsub("\\", "/"):gsub("/+$", "") .. "/"
+
+local modules, by_name = {}, {}
+for i = 4, #arg do
+    local file = arg[i]:gsub("\\", "/")
+    local rel = file:sub(1, #appdir) == appdir and file:sub(#appdir + 1) or file
+    local name = rel:gsub("%.lua$", ""):gsub("/init$", ""):gsub("/", ".")
+
+    local f = assert(io.open(arg[i], "rb"))
+    local src = f:read("*a")
+    f:close()
+    src = src:gsub("^#[^\n]*", "")  -- shebang, as loadfile does
+    local fn, err = loadstring(src, "@" .. rel)
+    if not fn then
+        io.stderr:write("embed_bytecode: " .. err .. "\n")
+        os.exit(1)
+    end
+
+    -- "app.lua" wins over "app/init.lua", like package.path order
+    local prev = by_name[name]
+    if not prev or prev.rel:match("/init%.lua$") then
+        local m = { name = name, rel = rel, bc = string.dump(fn) }
+        if prev then
+            modules[prev.index] = m
+            m.index = prev.index
+        else
+            modules[#modules + 1] = m
+            m.index = #modules
+        end
+        by_name[name] = m
+    end
+end
+
+-- embed.c looks modules up with a binary search
+table.sort(modules, function(a, b) return a.name < b.name end)
+
+local function cstring(s)
+    return '"' .. s:gsub('[\\"]', "\\%0") .. '"'
+end
+
+local lines = {
+    "/* Generated by bin/embed_bytecode.lua. Do not edit. */",
+    '#include "embed.h"',
+    "",
+}
+for i, m in ipairs(modules) do
+    lines[#lines + 1] = ("static const unsigned char lunet_embed_%d[] = { /* %s */"):format(i, m.rel)
+    local bc = m.bc
+    for pos = 1, #bc, 16 do
+        local row = {}
+        for j = pos, math.min(pos + 15, #bc) do
+            row[#row + 1] = ("0x%02x,"):format(bc:byte(j))
+        end
+        lines[#lines + 1] = "  " .. table.concat(row)
+    end
+    lines[#lines + 1] = "};"
+end
+lines[#lines + 1] = ""
+lines[#lines + 1] = "const lunet_embed_module_t lunet_embed_modules[] = {"
+for i, m in ipairs(modules) do
+    lines[#lines + 1] = ("  {%s, %s, lunet_embed_%d, sizeof(lunet_embed_%d)},")
+        :format(cstring(m.name), cstring("@" .. m.rel), i, i)
+end
+lines[#lines + 1] = "  {NULL, NULL, NULL, 0}"
+lines[#lines + 1] = "};"
+lines[#lines + 1] = ("const size_t lunet_embed_count = %d;"):format(#modules)
+if main ~= "-" then
+    if not by_name[main] then
+        io.stderr:write("embed_bytecode: main module '" .. main .. "' not found in " .. appdir .. "\n")
+        os.exit(1)
+    end
+    lines[#lines + 1] = ("const char *const lunet_embed_main_name = %s;"):format(cstring(main))
+else
+    lines[#lines + 1] = "const char *const lunet_embed_main_name = NULL;"
+end
+lines[#lines + 1] = ""
+
+local text = table.concat(lines, "\n")
+
+-- Leave the file alone when nothing changed so the build does not recompile it
+local f = io.open(out, "rb")
+local old = f and f:read("*a")
+if f then f:close() end
+if old ~= text then
+    f = assert(io.open(out, "wb"))
+    f:write(text)
+    f:close()
+end
+print(("embedded %d module%s into %s"):format(#modules, #modules == 1 and "" or "s", out))
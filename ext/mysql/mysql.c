@@ -6,6 +6,9 @@
 #include <string.h>
 
 #include "co.h"
+#include "pool.h"
+#include "rt.h"
+#include "slab.h"
 #include "trace.h"
 #include "uv.h"
 
@@ -102,12 +105,7 @@ static void db_open_after_cb(uv_work_t* req, int status) {
     lua_pushnil(co);
     lua_pushstring(co, ctx->err);
   }
-  int rc = lua_resume(co, 2);
-  if (rc != 0 && rc != LUA_YIELD) {
-    const char* err = lua_tostring(co, -1);
-    if (err) fprintf(stderr, "lua_resume error in db.open: %s\n", err);
-    lua_pop(co, 1);
-  }
+  lunet_co_resume(co, 2, "db.open");
   free(ctx);
 }
 
@@ -303,12 +301,12 @@ int lunet_db_open(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_open_work_cb, db_open_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_open_work_cb, db_open_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx);
     lua_pushnil(L);
-    lua_pushfstring(L, "db.open: uv_queue_work failed: %s", uv_strerror(ret));
+    lua_pushfstring(L, "db.open: queue work failed: %s", uv_strerror(ret));
     return lua_error(L);
   }
 
@@ -629,12 +627,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
   if (ctx->err[0] != '\0') {
     lua_pushnil(co);
     lua_pushstring(co, ctx->err);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.query: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.query");
   } else {
       lua_newtable(co);
       int row_idx = 1;
@@ -671,12 +664,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
       }
       
       lua_pushnil(co);
-      int rc = lua_resume(co, 2);
-      if (rc != 0 && rc != LUA_YIELD) {
-          const char* err = lua_tostring(co, -1);
-          if (err) fprintf(stderr, "lua_resume error in db.query: %s\n", err);
-          lua_pop(co, 1);
-      }
+      lunet_co_resume(co, 2, "db.query");
   }
 
 cleanup:
@@ -697,7 +685,7 @@ cleanup:
   
   free(ctx->query);
   free_params(ctx->params, ctx->nparams);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_db_query(lua_State* L) {
@@ -727,7 +715,7 @@ int lunet_db_query(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
 
-  db_query_ctx_t* ctx = malloc(sizeof(db_query_ctx_t));
+  db_query_ctx_t* ctx = LUNET_SLAB_NEW(db_query_ctx_t);
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
@@ -738,7 +726,7 @@ int lunet_db_query(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -747,7 +735,7 @@ int lunet_db_query(lua_State* L) {
   ctx->params = collect_params(L, 3, &ctx->nparams);
   if (ctx->nparams < 0) {
       free(ctx->query);
-      free(ctx);
+      LUNET_SLAB_FREE(ctx);
       lua_pushnil(L);
       lua_pushstring(L, "out of memory");
       return 2;
@@ -755,12 +743,12 @@ int lunet_db_query(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_query_work_cb, db_query_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -874,7 +862,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
     fprintf(stderr, "invalid coroutine in db.exec\n");
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     return;
   }
   lua_State* co = lua_tothread(L, -1);
@@ -883,12 +871,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
   if (ctx->err[0] != '\0') {
     lua_pushnil(co);
     lua_pushstring(co, ctx->err);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.exec: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.exec");
   } else {
     lua_newtable(co);
     lua_pushstring(co, "affected_rows");
@@ -898,17 +881,12 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
     lua_pushinteger(co, ctx->insert_id);
     lua_settable(co, -3);
     lua_pushnil(co);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.exec: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.exec");
   }
 
   free(ctx->query);
   free_params(ctx->params, ctx->nparams);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_db_exec(lua_State* L) {
@@ -938,7 +916,7 @@ int lunet_db_exec(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
   
-  db_exec_ctx_t* ctx = malloc(sizeof(db_exec_ctx_t));
+  db_exec_ctx_t* ctx = LUNET_SLAB_NEW(db_exec_ctx_t);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
@@ -950,7 +928,7 @@ int lunet_db_exec(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -959,7 +937,7 @@ int lunet_db_exec(lua_State* L) {
   ctx->params = collect_params(L, 3, &ctx->nparams);
   if (ctx->nparams < 0) {
       free(ctx->query);
-      free(ctx);
+      LUNET_SLAB_FREE(ctx);
       lua_pushnil(L);
       lua_pushstring(L, "out of memory");
       return 2;
@@ -967,12 +945,12 @@ int lunet_db_exec(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -1038,7 +1016,7 @@ int lunet_db_query_params(lua_State* L) {
   
   const char* query = luaL_checkstring(L, 2);
   
-  db_query_ctx_t* ctx = malloc(sizeof(db_query_ctx_t));
+  db_query_ctx_t* ctx = LUNET_SLAB_NEW(db_query_ctx_t);
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
@@ -1049,7 +1027,7 @@ int lunet_db_query_params(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -1058,7 +1036,7 @@ int lunet_db_query_params(lua_State* L) {
   ctx->params = collect_params(L, 3, &ctx->nparams);
   if (ctx->nparams < 0) {
       free(ctx->query);
-      free(ctx);
+      LUNET_SLAB_FREE(ctx);
       lua_pushnil(L);
       lua_pushstring(L, "out of memory");
       return 2;
@@ -1066,12 +1044,12 @@ int lunet_db_query_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_query_work_cb, db_query_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -1108,7 +1086,7 @@ int lunet_db_exec_params(lua_State* L) {
   
   const char* query = luaL_checkstring(L, 2);
   
-  db_exec_ctx_t* ctx = malloc(sizeof(db_exec_ctx_t));
+  db_exec_ctx_t* ctx = LUNET_SLAB_NEW(db_exec_ctx_t);
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
@@ -1119,7 +1097,7 @@ int lunet_db_exec_params(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -1128,7 +1106,7 @@ int lunet_db_exec_params(lua_State* L) {
   ctx->params = collect_params(L, 3, &ctx->nparams);
   if (ctx->nparams < 0) {
       free(ctx->query);
-      free(ctx);
+      LUNET_SLAB_FREE(ctx);
       lua_pushnil(L);
       lua_pushstring(L, "out of memory");
       return 2;
@@ -1136,12 +1114,12 @@ int lunet_db_exec_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
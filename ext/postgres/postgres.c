@@ -5,6 +5,9 @@
 #include <string.h>
 
 #include "co.h"
+#include "pool.h"
+#include "rt.h"
+#include "slab.h"
 #include "trace.h"
 #include "uv.h"
 
@@ -202,12 +205,7 @@ static void db_open_after_cb(uv_work_t* req, int status) {
     lua_pushnil(co);
     lua_pushstring(co, ctx->err);
   }
-  int rc = lua_resume(co, 2);
-  if (rc != 0 && rc != LUA_YIELD) {
-    const char* err = lua_tostring(co, -1);
-    if (err) fprintf(stderr, "lua_resume error in db.open: %s\n", err);
-    lua_pop(co, 1);
-  }
+  lunet_co_resume(co, 2, "db.open");
   free(ctx);
 }
 
@@ -258,12 +256,12 @@ int lunet_db_open(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_open_work_cb, db_open_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_open_work_cb, db_open_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx);
     lua_pushnil(L);
-    lua_pushfstring(L, "db.open: uv_queue_work failed: %s", uv_strerror(ret));
+    lua_pushfstring(L, "db.open: queue work failed: %s", uv_strerror(ret));
     return lua_error(L);
   }
 
@@ -382,7 +380,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
     if (ctx->result) PQclear(ctx->result);
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     return;
   }
   lua_State* co = lua_tothread(L, -1);
@@ -433,26 +431,16 @@ static void db_query_after_cb(uv_work_t* req, int status) {
     ctx->result = NULL;
 
     lua_pushnil(co);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.query: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.query");
   } else {
     lua_pushnil(co);
     lua_pushstring(co, ctx->err);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.query: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.query");
   }
 
   free(ctx->query);
   free_params(ctx->params, ctx->nparams);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_db_query(lua_State* L) {
@@ -480,7 +468,7 @@ int lunet_db_query(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
 
-  db_query_ctx_t* ctx = malloc(sizeof(db_query_ctx_t));
+  db_query_ctx_t* ctx = LUNET_SLAB_NEW(db_query_ctx_t);
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
@@ -491,7 +479,7 @@ int lunet_db_query(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -499,11 +487,11 @@ int lunet_db_query(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_query_work_cb, db_query_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -607,7 +595,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
     fprintf(stderr, "invalid coroutine in db.exec\n");
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     return;
   }
   lua_State* co = lua_tothread(L, -1);
@@ -616,12 +604,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
   if (ctx->err[0] != '\0') {
     lua_pushnil(co);
     lua_pushstring(co, ctx->err);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.exec: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.exec");
   } else {
     lua_newtable(co);
     lua_pushstring(co, "affected_rows");
@@ -631,17 +614,12 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
     lua_pushinteger(co, ctx->insert_id);
     lua_settable(co, -3);
     lua_pushnil(co);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.exec: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.exec");
   }
 
   free(ctx->query);
   free_params(ctx->params, ctx->nparams);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_db_exec(lua_State* L) {
@@ -668,7 +646,7 @@ int lunet_db_exec(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
 
-  db_exec_ctx_t* ctx = malloc(sizeof(db_exec_ctx_t));
+  db_exec_ctx_t* ctx = LUNET_SLAB_NEW(db_exec_ctx_t);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
@@ -680,7 +658,7 @@ int lunet_db_exec(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -688,11 +666,11 @@ int lunet_db_exec(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -753,7 +731,7 @@ int lunet_db_query_params(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
 
-  db_query_ctx_t* ctx = malloc(sizeof(db_query_ctx_t));
+  db_query_ctx_t* ctx = LUNET_SLAB_NEW(db_query_ctx_t);
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
@@ -764,7 +742,7 @@ int lunet_db_query_params(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -773,7 +751,7 @@ int lunet_db_query_params(lua_State* L) {
   ctx->params = collect_params(L, 3, &ctx->nparams);
   if (ctx->nparams < 0) {
     free(ctx->query);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -781,12 +759,12 @@ int lunet_db_query_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_query_work_cb, db_query_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -820,7 +798,7 @@ int lunet_db_exec_params(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
 
-  db_exec_ctx_t* ctx = malloc(sizeof(db_exec_ctx_t));
+  db_exec_ctx_t* ctx = LUNET_SLAB_NEW(db_exec_ctx_t);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
@@ -832,7 +810,7 @@ int lunet_db_exec_params(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -841,7 +819,7 @@ int lunet_db_exec_params(lua_State* L) {
   ctx->params = collect_params(L, 3, &ctx->nparams);
   if (ctx->nparams < 0) {
     free(ctx->query);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -849,12 +827,12 @@ int lunet_db_exec_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -5,6 +5,9 @@
 #include <string.h>
 
 #include "co.h"
+#include "pool.h"
+#include "rt.h"
+#include "slab.h"
 #include "trace.h"
 #include "uv.h"
 
@@ -236,12 +239,7 @@ static void db_open_after_cb(uv_work_t* req, int status) {
     lua_pushnil(co);
     lua_pushstring(co, ctx->err);
   }
-  int rc = lua_resume(co, 2);
-  if (rc != 0 && rc != LUA_YIELD) {
-    const char* err = lua_tostring(co, -1);
-    if (err) fprintf(stderr, "lua_resume error in db.open: %s\n", err);
-    lua_pop(co, 1);
-  }
+  lunet_co_resume(co, 2, "db.open");
   free(ctx);
 }
 
@@ -273,12 +271,12 @@ int lunet_db_open(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_open_work_cb, db_open_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_open_work_cb, db_open_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx);
     lua_pushnil(L);
-    lua_pushfstring(L, "db.open: uv_queue_work failed: %s", uv_strerror(ret));
+    lua_pushfstring(L, "db.open: queue work failed: %s", uv_strerror(ret));
     return lua_error(L);
   }
 
@@ -481,12 +479,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
   if (ctx->err[0] != '\0') {
     lua_pushnil(co);
     lua_pushstring(co, ctx->err);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.query: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.query");
     goto cleanup;
   }
 
@@ -519,14 +512,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
   }
 
   lua_pushnil(co);
-  {
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.query: %s\n", err);
-      lua_pop(co, 1);
-    }
-  }
+  lunet_co_resume(co, 2, "db.query");
 
 cleanup:
   for (int i = 0; i < ctx->nrows; i++) {
@@ -543,7 +529,7 @@ cleanup:
   free(ctx->col_types);
   free(ctx->query);
   free_params(ctx->params, ctx->nparams);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_db_query(lua_State* L) {
@@ -571,7 +557,7 @@ int lunet_db_query(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
 
-  db_query_ctx_t* ctx = malloc(sizeof(db_query_ctx_t));
+  db_query_ctx_t* ctx = LUNET_SLAB_NEW(db_query_ctx_t);
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
@@ -582,7 +568,7 @@ int lunet_db_query(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -590,11 +576,11 @@ int lunet_db_query(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_query_work_cb, db_query_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -678,7 +664,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
     fprintf(stderr, "invalid coroutine in db.exec\n");
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     return;
   }
   lua_State* co = lua_tothread(L, -1);
@@ -687,12 +673,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
   if (ctx->err[0] != '\0') {
     lua_pushnil(co);
     lua_pushstring(co, ctx->err);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.exec: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.exec");
   } else {
     lua_newtable(co);
     lua_pushstring(co, "affected_rows");
@@ -702,17 +683,12 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
     lua_pushinteger(co, ctx->insert_id);
     lua_settable(co, -3);
     lua_pushnil(co);
-    int rc = lua_resume(co, 2);
-    if (rc != 0 && rc != LUA_YIELD) {
-      const char* err = lua_tostring(co, -1);
-      if (err) fprintf(stderr, "lua_resume error in db.exec: %s\n", err);
-      lua_pop(co, 1);
-    }
+    lunet_co_resume(co, 2, "db.exec");
   }
 
   free(ctx->query);
   free_params(ctx->params, ctx->nparams);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_db_exec(lua_State* L) {
@@ -740,7 +716,7 @@ int lunet_db_exec(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
 
-  db_exec_ctx_t* ctx = malloc(sizeof(db_exec_ctx_t));
+  db_exec_ctx_t* ctx = LUNET_SLAB_NEW(db_exec_ctx_t);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
@@ -752,7 +728,7 @@ int lunet_db_exec(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -760,11 +736,11 @@ int lunet_db_exec(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -818,7 +794,7 @@ int lunet_db_query_params(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
 
-  db_query_ctx_t* ctx = malloc(sizeof(db_query_ctx_t));
+  db_query_ctx_t* ctx = LUNET_SLAB_NEW(db_query_ctx_t);
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
@@ -829,7 +805,7 @@ int lunet_db_query_params(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -838,7 +814,7 @@ int lunet_db_query_params(lua_State* L) {
   ctx->params = collect_params(L, 3, &ctx->nparams);
   if (ctx->nparams < 0) {
     free(ctx->query);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -846,12 +822,12 @@ int lunet_db_query_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_query_work_cb, db_query_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
@@ -885,7 +861,7 @@ int lunet_db_exec_params(lua_State* L) {
 
   const char* query = luaL_checkstring(L, 2);
 
-  db_exec_ctx_t* ctx = malloc(sizeof(db_exec_ctx_t));
+  db_exec_ctx_t* ctx = LUNET_SLAB_NEW(db_exec_ctx_t);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
@@ -897,7 +873,7 @@ int lunet_db_exec_params(lua_State* L) {
   ctx->wrapper = wrapper;
   ctx->query = strdup(query);
   if (!ctx->query) {
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -906,7 +882,7 @@ int lunet_db_exec_params(lua_State* L) {
   ctx->params = collect_params(L, 3, &ctx->nparams);
   if (ctx->nparams < 0) {
     free(ctx->query);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, "out of memory");
     return 2;
@@ -914,12 +890,12 @@ int lunet_db_exec_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = lunet_pool_queue_work(lunet_db_pool(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     free(ctx->query);
     free_params(ctx->params, ctx->nparams);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(ret));
     return 2;
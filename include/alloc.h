@@ -0,0 +1,86 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lunet_lua.h"
+#include "rt.h"
+
+/*
+ * lua_Alloc used by lunet-run for each loop's Lua state.
+ *
+ * Blocks up to LUNET_ALLOC_SMALL_MAX bytes come from per-state size-class
+ * freelists carved out of 64 KiB slabs. A state is only ever touched by its
+ * own loop thread, so the freelists need no locking. Larger blocks go to
+ * malloc. Lua passes the old size on every call, so blocks carry no header.
+ *
+ * Live and peak bytes are always counted. With attribution enabled, every
+ * allocation is also charged to the task (lunet.spawn function) of the
+ * coroutine running at the time.
+ */
+
+#define LUNET_ALLOC_CLASS_SHIFT 4  /* 16-byte size classes */
+#define LUNET_ALLOC_SMALL_MAX 256
+#define LUNET_ALLOC_CLASSES (LUNET_ALLOC_SMALL_MAX >> LUNET_ALLOC_CLASS_SHIFT)
+#define LUNET_ALLOC_SLAB_SIZE (64 * 1024)
+#define LUNET_ALLOC_LABEL_MAX 96
+
+typedef struct lunet_alloc_block_s {
+  struct lunet_alloc_block_s *next;
+} lunet_alloc_block_t;
+
+typedef struct {
+  char label[LUNET_ALLOC_LABEL_MAX];  /* "file.lua:line" of the spawned function */
+  uint64_t bytes;
+  uint64_t allocs;
+} lunet_alloc_task_t;
+
+typedef struct {
+  lua_State *co;
+  int task;
+} lunet_alloc_coslot_t;
+
+typedef struct lunet_alloc_s {
+  lunet_rt_t *rt;  /* for current_co; NULL until the runtime is set up */
+
+  lunet_alloc_block_t *free[LUNET_ALLOC_CLASSES];
+  void *slabs;     /* singly linked through the first word */
+  char *bump;      /* unused tail of the newest slab */
+  size_t bump_left;
+
+  size_t current;  /* bytes Lua holds */
+  size_t peak;
+  size_t reserved; /* slab bytes + large blocks obtained from malloc */
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t small_allocs;
+  uint64_t small_reused; /* small allocations served from a freelist */
+
+  /* Per-task attribution, off unless lunet.set_mem_attribution(true) */
+  int attribute;
+  lunet_alloc_task_t *tasks;  /* [0] = main, [1] = other */
+  int task_count;
+  int task_cap;
+  lunet_alloc_coslot_t *cos;  /* open addressing: coroutine -> task */
+  size_t cos_cap;
+  size_t cos_len;
+  lua_State *last_co;         /* one-entry cache in front of cos */
+  int last_task;
+} lunet_alloc_t;
+
+/* Create a Lua state on a zeroed a; falls back to luaL_newstate (a unused) when LuaJIT refuses */
+lua_State *lunet_alloc_newstate(lunet_alloc_t *a);
+
+/* Release slabs and tables; call after lua_close */
+void lunet_alloc_destroy(lunet_alloc_t *a);
+
+/* Charge coroutine co to the function at fn_idx of L (from lunet.spawn) */
+void lunet_alloc_label(lunet_alloc_t *a, lua_State *L, int fn_idx, lua_State *co);
+
+/* lunet.mem_stats([reset]) -> table | nil, err */
+int lunet_mem_stats(lua_State *L);
+/* lunet.set_mem_attribution(enabled) */
+int lunet_set_mem_attribution(lua_State *L);
+
+#endif  // ALLOC_H
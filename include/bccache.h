@@ -0,0 +1,34 @@
+#ifndef BCCACHE_H
+#define BCCACHE_H
+
+#include "lunet_lua.h"
+
+/*
+ * Bytecode cache for lunet-run (--bytecode-cache DIR).
+ *
+ * Scripts and modules found on package.path are compiled once and their
+ * string.dump output stored in DIR. Each entry is keyed by the file's real
+ * path, mtime, size and the LuaJIT version, so an edited file or a new
+ * LuaJIT simply misses and is recompiled. Any cache failure falls back to
+ * loading the source.
+ */
+
+#define LUNET_BCCACHE_ENV "LUNET_BYTECODE_CACHE"
+
+/* Create the cache directory and enable the cache. Returns 0 or a libuv error. */
+int lunet_bccache_init(const char *dir);
+
+/* luaL_loadfile that goes through the cache when it is enabled */
+int lunet_bccache_loadfile(lua_State *L, const char *path);
+
+/* Replace the package.path loader with one that uses the cache (no-op when disabled) */
+void lunet_bccache_install(lua_State *L);
+
+/*
+ * Compile path (a .lua file, or every .lua file below a directory) into the
+ * cache. Returns the number of files cached; *failed counts files that did
+ * not compile or could not be written.
+ */
+int lunet_bccache_precompile(lua_State *L, const char *path, int *failed);
+
+#endif  // BCCACHE_H
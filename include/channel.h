@@ -0,0 +1,9 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "lunet_lua.h"
+
+/* lunet.channel(capacity) -> channel */
+int lunet_channel_new(lua_State *L);
+
+#endif  // CHANNEL_H
@@ -3,7 +3,35 @@
 
 #include "lunet_lua.h"
 
+/* Default number of idle coroutines kept for reuse by lunet.spawn */
+#define LUNET_CO_POOL_DEFAULT 128
+
+/* Default number of deferred resumes run per loop iteration */
+#define LUNET_READY_BUDGET_DEFAULT 1024
+
+/* VM instructions between time slice checks when lunet.set_timeslice is on */
+#define LUNET_TIMESLICE_INSTRUCTIONS 1000
+
 int lunet_spawn(lua_State *L);
+int lunet_spawn_pool(lua_State *L);
+int lunet_set_spawn_pool_size(lua_State *L);
+int lunet_set_resume_budget(lua_State *L);
+int lunet_set_timeslice(lua_State *L);
+int lunet_timeslice_overruns(lua_State *L);
+
+/*
+ * Resume a suspended coroutine from a libuv callback.
+ *
+ * The caller has already pushed nargs results onto co. Instead of resuming
+ * inside the callback, co is anchored and appended to the loop's ready queue,
+ * which a uv_check handle drains once per iteration (at most ready_budget
+ * coroutines). site names the callback in resume error messages.
+ */
+void lunet_co_resume(lua_State *co, int nargs, const char *site);
+
+/* Set up rt's ready queue handles; called from lunet_rt_init. Returns 0 or -1. */
+struct lunet_rt_s;
+int lunet_ready_init(struct lunet_rt_s *rt);
 
 /*
  * Internal: Do not call directly - use lunet_ensure_coroutine() instead.
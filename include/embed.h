@@ -0,0 +1,33 @@
+#ifndef EMBED_H
+#define EMBED_H
+
+#include <stddef.h>
+
+#include "lunet_lua.h"
+
+/*
+ * Lua modules compiled into the binary (xmake build lunet-app).
+ *
+ * bin/embed_bytecode.lua turns an app directory into a generated C file
+ * holding each module's bytecode and a table sorted by module name. Builds
+ * without LUNET_EMBED have no embedded modules and every call here is a
+ * no-op.
+ */
+
+typedef struct {
+  const char *name;       /* module name as passed to require ("app.handlers") */
+  const char *chunkname;  /* "@handlers.lua", kept for tracebacks */
+  const unsigned char *data;
+  size_t size;
+} lunet_embed_module_t;
+
+/* Add a package.loaders entry that serves embedded modules, ahead of the file loaders */
+void lunet_embed_install(lua_State *L);
+
+/* Name of the embedded main module to run when no script is given, or NULL */
+const char *lunet_embed_main(void);
+
+/* Load embedded module name as a function on top of L; returns 0 or a lua_load error */
+int lunet_embed_load(lua_State *L, const char *name);
+
+#endif  // EMBED_H
@@ -0,0 +1,30 @@
+#ifndef GC_H
+#define GC_H
+
+#include "lunet_lua.h"
+#include "rt.h"
+
+/*
+ * Idle-time GC stepping.
+ *
+ * Right before the loop blocks in poll, a uv_prepare handle advances the
+ * collector with lua_gc(LUA_GCSTEP) for at most the configured budget. The
+ * step is skipped when anything is ready to run (poll would not block), so
+ * incremental work moves out of the request path into time the loop would
+ * otherwise spend waiting. Finishing cycles while idle also resets LuaJIT's
+ * threshold, so allocation-driven steps in the middle of a request are rare.
+ */
+
+#define LUNET_GC_STEP_DEFAULT 16   /* KB of GC work per lua_gc step */
+#define LUNET_GC_BUDGET_DEFAULT 1  /* ms of stepping per idle iteration */
+
+/* Start idle stepping with the default settings; called from lunet_rt_init. */
+int lunet_gc_init(lunet_rt_t *rt);
+
+/* Close rt's prepare handle (from lunet_rt_close). */
+void lunet_gc_close(lunet_rt_t *rt);
+
+/* lunet.set_gc({step = KB, budget = ms} | false) */
+int lunet_set_gc(lua_State *L);
+
+#endif  // GC_H
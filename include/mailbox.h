@@ -0,0 +1,28 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stddef.h>
+
+#include "lunet_lua.h"
+#include "rt.h"
+
+#define LUNET_MAILBOX_NAME_MAX 64
+
+/* mailbox.open(name) -> mailbox | nil, err */
+int lunet_mailbox_open(lua_State *L);
+/* mailbox.lookup(name) -> remote | nil, err */
+int lunet_mailbox_lookup(lua_State *L);
+/* mailbox.send(name, value) -> true | nil, err */
+int lunet_mailbox_send(lua_State *L);
+
+/*
+ * Post raw bytes to a named mailbox from any thread; the receiver gets them
+ * as a Lua string. Returns 0, UV_ENOENT if no such mailbox, UV_EPIPE if it
+ * is closing, or UV_ENOMEM.
+ */
+int lunet_mailbox_post(const char *name, const void *data, size_t len);
+
+/* Close every mailbox owned by rt and its wakeup handle (from lunet_rt_close). */
+void lunet_mailbox_close_all(lunet_rt_t *rt);
+
+#endif  // MAILBOX_H
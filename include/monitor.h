@@ -0,0 +1,58 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+#include <uv.h>
+
+#include "lunet_lua.h"
+#include "rt.h"
+
+/*
+ * Log-linear histogram of microsecond values: 16 linear sub-buckets per power
+ * of two, so any recorded value is within ~6% of its bucket. Fixed size, no
+ * allocation on record.
+ */
+#define LUNET_HIST_SUB_BITS 4
+#define LUNET_HIST_SUB (1 << LUNET_HIST_SUB_BITS)
+#define LUNET_HIST_MAX_BITS 36  /* values are clamped to ~19 hours */
+#define LUNET_HIST_BUCKETS ((LUNET_HIST_MAX_BITS - LUNET_HIST_SUB_BITS + 2) * LUNET_HIST_SUB)
+
+typedef struct {
+  uint64_t counts[LUNET_HIST_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t max;
+} lunet_hist_t;
+
+void lunet_hist_record(lunet_hist_t *h, uint64_t value);
+/* Value at quantile q (0..1), or 0 if empty */
+uint64_t lunet_hist_quantile(const lunet_hist_t *h, double q);
+
+#define LUNET_MONITOR_INTERVAL_DEFAULT 100  /* ms between lag samples */
+#define LUNET_MONITOR_SLOW_DEFAULT 50       /* ms; resumes above this are logged */
+
+/* Event loop lag and resume latency monitor (one per loop, see lunet.set_monitor) */
+typedef struct lunet_monitor_s {
+  uv_timer_t timer;
+  uint64_t interval_ns;
+  uint64_t expected;   /* uv_hrtime() at which the timer should fire next */
+  uint64_t slow_ns;    /* 0 = no slow-resume logging */
+  uint64_t slow_count;
+  const char *worst_site;
+  uint64_t worst_ns;
+  lunet_hist_t lag;    /* microseconds */
+  lunet_hist_t resume; /* microseconds */
+} lunet_monitor_t;
+
+/* Record one resume issued from C; called by the scheduler when a monitor is set */
+void lunet_monitor_resume(lunet_rt_t *rt, const char *site, uint64_t elapsed_ns);
+
+/* Stop rt's monitor and free it (from lunet_rt_close). */
+void lunet_monitor_close(lunet_rt_t *rt);
+
+/* lunet.set_monitor({interval = ms, slow = ms} | false) */
+int lunet_set_monitor(lua_State *L);
+/* lunet.monitor_stats([reset]) -> table | nil */
+int lunet_monitor_stats(lua_State *L);
+
+#endif  // MONITOR_H
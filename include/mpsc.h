@@ -0,0 +1,85 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+/*
+ * Intrusive lock-free multi-producer single-consumer queue (Vyukov).
+ *
+ * Any thread may push; only the owning loop thread may pop. Producers never
+ * block each other: a push is one atomic exchange plus one release store.
+ * Embed lunet_mpsc_node_t in the message struct and recover it on pop.
+ */
+
+#include <stddef.h>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define LUNET_ATOMIC_XCHG_PTR(p, v) InterlockedExchangePointer((PVOID volatile *)(p), (PVOID)(v))
+#define LUNET_ATOMIC_LOAD_PTR(p) InterlockedCompareExchangePointer((PVOID volatile *)(p), NULL, NULL)
+#define LUNET_ATOMIC_STORE_PTR(p, v) ((void)InterlockedExchangePointer((PVOID volatile *)(p), (PVOID)(v)))
+#define LUNET_ATOMIC_ADD(p, v) (InterlockedExchangeAdd((LONG volatile *)(p), (LONG)(v)) + (v))
+#define LUNET_ATOMIC_LOAD(p) InterlockedCompareExchange((LONG volatile *)(p), 0, 0)
+#define LUNET_ATOMIC_STORE(p, v) ((void)InterlockedExchange((LONG volatile *)(p), (LONG)(v)))
+#else
+#define LUNET_ATOMIC_XCHG_PTR(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#define LUNET_ATOMIC_LOAD_PTR(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define LUNET_ATOMIC_STORE_PTR(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define LUNET_ATOMIC_ADD(p, v) __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define LUNET_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define LUNET_ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#endif
+
+typedef struct lunet_mpsc_node_s {
+  struct lunet_mpsc_node_s *volatile next;
+} lunet_mpsc_node_t;
+
+typedef struct {
+  lunet_mpsc_node_t *volatile head;  // producers push here
+  lunet_mpsc_node_t *tail;           // consumer pops here
+  lunet_mpsc_node_t stub;
+} lunet_mpsc_t;
+
+static inline void lunet_mpsc_init(lunet_mpsc_t *q) {
+  q->stub.next = NULL;
+  q->head = &q->stub;
+  q->tail = &q->stub;
+}
+
+static inline void lunet_mpsc_push(lunet_mpsc_t *q, lunet_mpsc_node_t *node) {
+  node->next = NULL;
+  lunet_mpsc_node_t *prev = (lunet_mpsc_node_t *)LUNET_ATOMIC_XCHG_PTR(&q->head, node);
+  LUNET_ATOMIC_STORE_PTR(&prev->next, node);
+}
+
+/*
+ * Pop the oldest node, or NULL if the queue is empty. NULL is also returned
+ * while a producer is between its exchange and its store; that producer
+ * signals the consumer afterwards, so the node is picked up on the next pass.
+ */
+static inline lunet_mpsc_node_t *lunet_mpsc_pop(lunet_mpsc_t *q) {
+  lunet_mpsc_node_t *tail = q->tail;
+  lunet_mpsc_node_t *next = (lunet_mpsc_node_t *)LUNET_ATOMIC_LOAD_PTR(&tail->next);
+  if (tail == &q->stub) {
+    if (!next) {
+      return NULL;
+    }
+    q->tail = next;
+    tail = next;
+    next = (lunet_mpsc_node_t *)LUNET_ATOMIC_LOAD_PTR(&next->next);
+  }
+  if (next) {
+    q->tail = next;
+    return tail;
+  }
+  if (tail != (lunet_mpsc_node_t *)LUNET_ATOMIC_LOAD_PTR(&q->head)) {
+    return NULL;
+  }
+  lunet_mpsc_push(q, &q->stub);
+  next = (lunet_mpsc_node_t *)LUNET_ATOMIC_LOAD_PTR(&tail->next);
+  if (next) {
+    q->tail = next;
+    return tail;
+  }
+  return NULL;
+}
+
+#endif  // MPSC_H
@@ -0,0 +1,62 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <uv.h>
+
+#include "lunet_lua.h"
+#include "rt.h"
+
+/*
+ * Dedicated thread pools.
+ *
+ * libuv's threadpool is shared by fs requests, DNS and every uv_queue_work
+ * caller, so a few slow database calls can stall unrelated filesystem work.
+ * A lunet pool runs uv_work_t requests on its own threads and posts the
+ * completions back to the submitting loop, with the same callbacks and
+ * semantics as uv_queue_work.
+ */
+
+#define LUNET_POOL_MAX_THREADS 128
+#define LUNET_DB_POOL_DEFAULT 4
+#define LUNET_WORK_POOL_DEFAULT 4
+
+typedef struct lunet_pool_s lunet_pool_t;
+
+typedef struct {
+  int size;           /* configured thread count */
+  int started;        /* threads created so far */
+  int queued;         /* jobs waiting for a thread */
+  int active;         /* jobs running */
+  uint64_t completed;
+} lunet_pool_stats_t;
+
+/* Create a pool; threads are started on first use. Lives for the process. */
+lunet_pool_t *lunet_pool_new(const char *name, int size);
+
+/* Change the thread count. Returns 0 or a libuv error code. */
+int lunet_pool_resize(lunet_pool_t *pool, int size);
+
+/*
+ * Like uv_queue_work on the current loop, but run work_cb on pool.
+ * Falls back to uv_queue_work when pool is NULL or no runtime is attached.
+ */
+int lunet_pool_queue_work(lunet_pool_t *pool, uv_work_t *req, uv_work_cb work_cb, uv_after_work_cb after_cb);
+
+void lunet_pool_stats(lunet_pool_t *pool, lunet_pool_stats_t *stats);
+
+/* Push a {size, started, queued, active, completed} table */
+void lunet_pool_push_stats(lua_State *L, lunet_pool_t *pool);
+
+/* Close rt's completion handle (from lunet_rt_close). */
+void lunet_pool_close_loop(lunet_rt_t *rt);
+
+/* Pool shared by the database driver loaded in this module */
+lunet_pool_t *lunet_db_pool(void);
+
+/* db.set_pool_size(n) */
+int lunet_db_set_pool_size(lua_State *L);
+/* db.pool_stats() -> table */
+int lunet_db_pool_stats(lua_State *L);
+
+#endif  // POOL_H
@@ -0,0 +1,44 @@
+#ifndef PREFORK_H
+#define PREFORK_H
+
+#include <uv.h>
+
+/*
+ * Prefork supervisor (lunet-run --processes N).
+ *
+ * The supervisor process runs no Lua. It re-executes lunet-run N times with an
+ * IPC pipe on fd 3, binds TCP listeners on behalf of its children and hands
+ * the bound socket to every child that asks with uv_write2. Children that
+ * crash are restarted with backoff while the listening socket stays open in
+ * the supervisor, so pending connections are not dropped.
+ */
+
+/* Environment variables set by the supervisor for each child */
+#define LUNET_PREFORK_ENV_FD "LUNET_IPC_FD"
+#define LUNET_PREFORK_ENV_ID "LUNET_WORKER_ID"
+#define LUNET_PREFORK_ENV_COUNT "LUNET_WORKER_COUNT"
+
+/*
+ * Run the supervisor. argv is the supervisor's own command line; the two
+ * entries starting at skip_index (--processes N) are dropped when building
+ * the child command line. Returns the process exit status.
+ */
+int lunet_prefork_supervise(int argc, char **argv, int skip_index, int process_count);
+
+/*
+ * Detect whether this process was started by a supervisor. Returns the
+ * worker id (1..count) and stores the worker count, or returns 0.
+ */
+int lunet_prefork_child_init(int *worker_count);
+
+/* Non-zero when running as a supervised child */
+int lunet_prefork_is_child(void);
+
+/*
+ * Ask the supervisor for a TCP listener bound to host:port and adopt it into
+ * tcp, which must already be initialized. Blocks until the supervisor answers.
+ * Returns 0 or a libuv error code.
+ */
+int lunet_prefork_listen(uv_tcp_t *tcp, const char *host, int port);
+
+#endif  // PREFORK_H
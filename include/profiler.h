@@ -0,0 +1,22 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "lunet_lua.h"
+#include "rt.h"
+
+#define LUNET_PROFILER_INTERVAL_DEFAULT 10  /* ms between samples */
+#define LUNET_PROFILER_DEPTH_DEFAULT 64     /* Lua frames kept per sample */
+
+/* Label the task about to run on co with the function at fn_idx of L (from lunet.spawn) */
+void lunet_profiler_label(lua_State *L, int fn_idx, lua_State *co);
+
+/* Stop the profiler if rt owns it (from lunet_rt_close, before lua_close). */
+void lunet_profiler_close(lunet_rt_t *rt);
+
+/* lunet.profiler.start([{interval = ms, depth = n}]) -> true | nil, err */
+int lunet_profiler_start(lua_State *L);
+
+/* lunet.profiler.stop([path]) -> folded stacks | samples written | nil, err */
+int lunet_profiler_stop(lua_State *L);
+
+#endif  // PROFILER_H
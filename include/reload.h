@@ -0,0 +1,9 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "lunet_lua.h"
+
+/* lunet.reload(name | {names}) -> count | nil, err */
+int lunet_reload(lua_State *L);
+
+#endif  // RELOAD_H
@@ -1,7 +1,153 @@
 #ifndef RT_H
 #define RT_H
 
+#include <stdint.h>
+#include <uv.h>
+
 #include "lunet_lua.h"
-void set_default_luaL(lua_State *L);
+#include "mpsc.h"
+#include "slab.h"
+#include "trace_ring.h"
+
+/*
+ * Thread-local storage qualifier. In --workers mode every worker thread owns
+ * its own loop and lua_State, so the "current runtime" is per thread.
+ */
+#if defined(_MSC_VER)
+#define LUNET_THREAD_LOCAL __declspec(thread)
+#else
+#define LUNET_THREAD_LOCAL __thread
+#endif
+
+/* A coroutine waiting in the ready queue, with nargs values already pushed */
+typedef struct {
+  lua_State *co;
+  int ref;           /* registry anchor while queued */
+  int nargs;
+  const char *site;  /* callback name for error reports */
+} lunet_ready_t;
+
+struct lunet_mailbox_s;
+struct lunet_monitor_s;
+
+/* Always-on counters reported by lunet.stats(); only touched on the loop thread */
+typedef struct {
+  int64_t corefs;            /* live coroutine registry references */
+  uint64_t bytes_read;       /* socket and UDP payload bytes */
+  uint64_t bytes_written;
+  int64_t fs_pending;        /* fs requests on the libuv threadpool */
+  uint64_t loop_iterations;
+  uint64_t util_hrtime;      /* loop utilization window start (lunet.stats) */
+  uint64_t util_idle;
+  uint64_t gc_steps;         /* idle-time lua_gc steps (see gc.c) */
+  uint64_t gc_cycles;        /* GC cycles finished by them */
+  uint64_t gc_ns;            /* time spent stepping */
+  uint64_t gc_max_ns;        /* longest stepping in one iteration */
+} lunet_stats_t;
+
+#define LUNET_STAT_ADD(field, n) \
+  do { \
+    lunet_rt_t *stat_rt_ = lunet_rt(); \
+    if (stat_rt_) stat_rt_->stats.field += (n); \
+  } while (0)
+
+/* Append an event to the current loop's trace ring (see trace_ring.h) */
+#define LUNET_TRACE_EVENT(event, handle, size) LUNET_TRACE_EVENT_NAMED(event, handle, size, NULL)
+#define LUNET_TRACE_EVENT_NAMED(event, handle, size, name) \
+  do { \
+    lunet_rt_t *trace_rt_ = lunet_rt(); \
+    if (trace_rt_ && trace_rt_->trace.recs) \
+      lunet_trace_ring_record(&trace_rt_->trace, (event), (handle), (uint32_t)(size), (name)); \
+  } while (0)
+
+/*
+ * Per-loop runtime state.
+ *
+ * Exactly one lunet_rt_t exists per event loop. A pointer to it is stored in
+ * the Lua registry so that separately loaded driver modules (lunet.sqlite3,
+ * lunet.mysql, ...) can attach to the same loop as the core.
+ */
+typedef struct lunet_rt_s {
+  uv_loop_t *loop;
+  lua_State *L;      /* main state of this loop */
+  int worker_id;     /* 1..worker_count */
+  int worker_count;  /* number of loops started by lunet-run */
+
+  /* Idle coroutine pool used by lunet.spawn (see co.c) */
+  int co_pool_max;
+  int co_pool_idle;
+  uint64_t co_pool_hits;
+  uint64_t co_pool_misses;
+
+  /* Preemptive time slicing (see lunet_set_timeslice) */
+  lua_State *current_co;  /* coroutine currently resumed by lunet */
+  const char *current_site;  /* resume site of current_co */
+  uint64_t slice_ns;      /* 0 = disabled */
+  uint64_t slice_start;   /* uv_hrtime() when current_co was resumed */
+  uint64_t preemptions;
+
+  /* Ready queue drained once per loop iteration (see lunet_co_resume) */
+  uv_check_t ready_check;
+  uv_idle_t ready_idle;  /* active while the queue is non-empty: keeps poll from blocking */
+  int ready_init;
+  int ready_budget;      /* max resumes per iteration, 0 = unlimited */
+  lunet_ready_t *ready;  /* ring buffer */
+  size_t ready_head;
+  size_t ready_len;
+  size_t ready_cap;
+
+  /* Cross-thread mailboxes owned by this loop (see mailbox.c) */
+  uv_async_t *mail_async;  /* one wakeup for all of them; ref'd while receivers wait */
+  struct lunet_mailbox_s *mailboxes;
+  int mail_waiting;
+
+  /* Completions posted back by lunet thread pools (see pool.c) */
+  uv_async_t *pool_async;
+  lunet_mpsc_t pool_done;
+  int pool_pending;  /* jobs submitted from this loop and not yet completed */
+
+  lunet_stats_t stats;
+
+  /* Binary event trace, always on (see trace_ring.c) */
+  lunet_trace_ring_t trace;
+
+  /* Sampling profiler: Lua frames kept per sample, 0 = not profiling (see profiler.c) */
+  int prof_depth;
+
+  /* Loop lag / resume latency monitor, NULL unless enabled (see monitor.c) */
+  struct lunet_monitor_s *monitor;
+
+  /* Allocator of this loop's Lua state, NULL when it is not lunet's (see alloc.c) */
+  struct lunet_alloc_s *alloc;
+
+  /* Idle-time GC stepping before poll (see gc.c) */
+  uv_prepare_t gc_prepare;
+  int gc_init;
+  int gc_step_kb;
+  uint64_t gc_budget_ns;  /* 0 = disabled */
+  int gc_done_kb;         /* heap size after the last idle cycle, -1 while one is running */
+
+  /* Pool for per-operation context structs (see slab.c) */
+  lunet_slab_t slab;
+} lunet_rt_t;
+
+/* Bind rt to L and loop, publish it in the registry and make it current. */
+void lunet_rt_init(lunet_rt_t *rt, lua_State *L, uv_loop_t *loop, int worker_id, int worker_count);
+
+/* Release loop handles owned by rt; call after uv_run returns, before lua_close. */
+void lunet_rt_close(lunet_rt_t *rt);
+
+/* Adopt the runtime recorded in L's registry, creating a default one if absent. */
+lunet_rt_t *lunet_rt_attach(lua_State *L);
+
+/* Runtime of the calling thread (NULL before init/attach). */
+lunet_rt_t *lunet_rt(void);
+
 lua_State *default_luaL(void);
+
+/* Event loop of the calling thread; falls back to uv_default_loop(). */
+uv_loop_t *default_loop(void);
+
+int lunet_worker_id(lua_State *L);
+int lunet_worker_count(lua_State *L);
 #endif // RT_H
@@ -0,0 +1,36 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <stddef.h>
+
+#include "lunet_lua.h"
+
+/*
+ * Flat binary encoding of Lua values for handing them to another lua_State
+ * (another loop or worker VM). Supports nil, booleans, numbers, strings and
+ * tables of those; functions, userdata, threads and cyclic tables are
+ * rejected.
+ */
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} lunet_buf_t;
+
+void lunet_buf_init(lunet_buf_t *buf);
+void lunet_buf_free(lunet_buf_t *buf);
+
+/*
+ * Append the values at stack indices first..last to buf.
+ * Returns 0, or -1 with a message in *err.
+ */
+int lunet_serialize(lua_State *L, int first, int last, lunet_buf_t *buf, const char **err);
+
+/*
+ * Push every value encoded in data onto L.
+ * Returns the number of values pushed, or -1 if data is malformed.
+ */
+int lunet_deserialize(lua_State *L, const char *data, size_t len);
+
+#endif  // SERIALIZE_H
@@ -0,0 +1,52 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-loop pool for the context structs of async operations.
+ *
+ * Every sleep, write, connect, fs request and DB query allocates a context
+ * and frees it in its callback. Contexts are carved from 64 KiB chunks in
+ * 64-byte size classes and recycled through per-class freelists, so once a
+ * loop has warmed up these operations do no malloc at all. Allocation and
+ * release must both happen on the loop thread that owns the pool; the
+ * caller passes the size back on release, so blocks carry no header.
+ * Blocks larger than LUNET_SLAB_MAX go to malloc.
+ */
+
+#define LUNET_SLAB_GRAIN 64
+#define LUNET_SLAB_MAX 4096
+#define LUNET_SLAB_CLASSES (LUNET_SLAB_MAX / LUNET_SLAB_GRAIN)
+#define LUNET_SLAB_CHUNK (64 * 1024)
+
+typedef struct lunet_slab_block_s {
+  struct lunet_slab_block_s *next;
+} lunet_slab_block_t;
+
+typedef struct {
+  lunet_slab_block_t *free[LUNET_SLAB_CLASSES];
+  void *chunks;      /* singly linked through the first word */
+  char *bump;        /* unused tail of the newest chunk */
+  size_t bump_left;
+  uint64_t allocs;   /* blocks handed out */
+  uint64_t reused;   /* of which came from a freelist */
+  uint64_t mallocs;  /* chunks plus blocks over LUNET_SLAB_MAX */
+  int64_t live;
+  size_t reserved;   /* bytes in chunks */
+} lunet_slab_t;
+
+/* Allocate size bytes from the current loop's pool (malloc without a loop). */
+void *lunet_slab_alloc(size_t size);
+
+/* Return a block from lunet_slab_alloc; size must match the allocation. */
+void lunet_slab_free(void *p, size_t size);
+
+/* Release all chunks; blocks still handed out become invalid. */
+void lunet_slab_destroy(lunet_slab_t *s);
+
+#define LUNET_SLAB_NEW(type) ((type *)lunet_slab_alloc(sizeof(type)))
+#define LUNET_SLAB_FREE(p) lunet_slab_free((p), sizeof(*(p)))
+
+#endif  // SLAB_H
@@ -1,13 +1,43 @@
 #ifndef SOCKET_H
 #define SOCKET_H
 
+#include <uv.h>
+
 #include "lunet_lua.h"
+
+/* Unread bytes per connection above which lunet stops reading from the socket */
+#define LUNET_SOCKET_READ_HIGH_WATER (64 * 1024)
+
+/* Unsent bytes per connection above which socket.write waits for its data to go out */
+#define LUNET_SOCKET_WRITE_HIGH_WATER (64 * 1024)
+
 int lunet_socket_listen(lua_State *L);
 int lunet_socket_accept(lua_State *L);
 int lunet_socket_getpeername(lua_State *L);
 int lunet_socket_close(lua_State *L);
 int lunet_socket_read(lua_State *L);
+int lunet_socket_read_exact(lua_State *L);
+int lunet_socket_read_until(lua_State *L);
+int lunet_socket_read_line(lua_State *L);
 int lunet_socket_write(lua_State *L);
+int lunet_socket_writev(lua_State *L);
+int lunet_socket_drain(lua_State *L);
 int lunet_socket_connect(lua_State *L);
 int lunet_socket_set_read_buffer_size(lua_State *L);
+
+int lunet_set_reuseport(uv_handle_t *handle);
+
+/* Push an array of {address, pending, waiting} tables for this loop's listeners */
+void lunet_socket_push_listeners(lua_State *L);
+
+/* Visit this loop's listeners with their fd, protocol ("tcp" | "unix") and address */
+typedef void (*lunet_socket_listener_fn)(int fd, const char *proto, const char *addr, void *arg);
+void lunet_socket_each_listener(lunet_socket_listener_fn fn, void *arg);
+
+/*
+ * Stop accepting on all of this loop's listeners (after lunet.upgrade). Waiting
+ * accepts return nil, "listener closed"; connections already queued can still
+ * be accepted.
+ */
+void lunet_socket_stop_listeners(void);
 #endif  // SOCKET_H
\ No newline at end of file
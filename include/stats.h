@@ -0,0 +1,9 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "lunet_lua.h"
+
+/* lunet.stats() -> table of runtime counters for the current loop */
+int lunet_stats(lua_State *L);
+
+#endif  // STATS_H
@@ -4,20 +4,19 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-// Queue node
-typedef struct queue_node_s {
-  void* data;
-  struct queue_node_s* next;
-} queue_node_t;
-
-// FIFO queue
+// FIFO queue: a power-of-two ring buffer of pointers that only reallocates
+// when it grows. Storage is allocated on the first enqueue.
 typedef struct {
-  queue_node_t* head;  // queue head (dequeue end)
-  queue_node_t* tail;  // queue tail (enqueue end)
-  size_t size;         // queue size
+  void** items;  // ring storage, cap slots
+  size_t head;   // index of the oldest item (dequeue end)
+  size_t size;   // queue size
+  size_t cap;    // allocated slots, 0 or a power of two
+  size_t max;    // hard capacity, 0 = unbounded
 } queue_t;
 
 queue_t* queue_init(void);
+// Queue that refuses enqueues beyond max items (0 = unbounded)
+queue_t* queue_init_bounded(size_t max);
 void queue_destroy(queue_t* queue);
 
 int queue_enqueue(queue_t* queue, void* data);
@@ -27,4 +26,4 @@ void* queue_peek(queue_t* queue);
 bool queue_is_empty(queue_t* queue);
 size_t queue_size(queue_t* queue);
 
-#endif  // STL_H
\ No newline at end of file
+#endif  // STL_H
@@ -3,6 +3,7 @@
 
 #include "lunet_lua.h"
 #include "co.h"  /* For _lunet_ensure_coroutine */
+#include "rt.h"  /* For LUNET_STAT_ADD */
 
 /*
  * Coroutine Reference Tracing System
@@ -12,6 +13,8 @@
  * are prone to stack corruption bugs. In debug builds (LUNET_TRACE defined),
  * these wrappers verify stack integrity and track coroutine reference lifetimes.
  * In release builds, they compile to the minimal required code with zero overhead.
+ * Both builds record create/release events in the per-loop trace ring
+ * (trace_ring.h), which lunet.trace.dump() decodes.
  * 
  * SAFE API (use these):
  * ---------------------
@@ -146,6 +149,8 @@ static inline int _lunet_ensure_coroutine_checked(lua_State *L, const char *func
 #define lunet_coref_create(L, ref_var) do { \
     lua_pushthread(L); \
     (ref_var) = luaL_ref(L, LUA_REGISTRYINDEX); \
+    LUNET_STAT_ADD(corefs, 1); \
+    LUNET_TRACE_EVENT(LUNET_EV_COREF_ADD, L, (ref_var)); \
     lunet_trace_coref_add(__FILE__, __LINE__, (ref_var)); \
 } while(0)
 
@@ -157,6 +162,8 @@ static inline int _lunet_ensure_coroutine_checked(lua_State *L, const char *func
  */
 #define lunet_coref_release(L, ref) do { \
     luaL_unref(L, LUA_REGISTRYINDEX, ref); \
+    LUNET_STAT_ADD(corefs, -1); \
+    LUNET_TRACE_EVENT(LUNET_EV_COREF_RELEASE, L, (ref)); \
     lunet_trace_coref_remove(__FILE__, __LINE__, (ref)); \
 } while(0)
 
@@ -168,6 +175,8 @@ static inline int _lunet_ensure_coroutine_checked(lua_State *L, const char *func
  */
 #define lunet_coref_create_raw(L, ref_var) do { \
     (ref_var) = luaL_ref(L, LUA_REGISTRYINDEX); \
+    LUNET_STAT_ADD(corefs, 1); \
+    LUNET_TRACE_EVENT(LUNET_EV_COREF_ADD, L, (ref_var)); \
     lunet_trace_coref_add(__FILE__, __LINE__, (ref_var)); \
 } while(0)
 
@@ -194,18 +203,22 @@ static inline int lunet_ensure_coroutine(lua_State *L, const char *func_name) {
 }
 
 /*
- * lunet_coref_create - Just the essential operations, no tracking
+ * lunet_coref_create - Just the essential operations plus the live-ref counter
  */
 #define lunet_coref_create(L, ref_var) do { \
     lua_pushthread(L); \
     (ref_var) = luaL_ref(L, LUA_REGISTRYINDEX); \
+    LUNET_STAT_ADD(corefs, 1); \
+    LUNET_TRACE_EVENT(LUNET_EV_COREF_ADD, L, (ref_var)); \
 } while(0)
 
 /*
- * lunet_coref_release - Just the unref, no tracking
+ * lunet_coref_release - Just the unref plus the live-ref counter
  */
 #define lunet_coref_release(L, ref) do { \
     luaL_unref(L, LUA_REGISTRYINDEX, ref); \
+    LUNET_STAT_ADD(corefs, -1); \
+    LUNET_TRACE_EVENT(LUNET_EV_COREF_RELEASE, L, (ref)); \
 } while(0)
 
 /*
@@ -213,6 +226,8 @@ static inline int lunet_ensure_coroutine(lua_State *L, const char *func_name) {
  */
 #define lunet_coref_create_raw(L, ref_var) do { \
     (ref_var) = luaL_ref(L, LUA_REGISTRYINDEX); \
+    LUNET_STAT_ADD(corefs, 1); \
+    LUNET_TRACE_EVENT(LUNET_EV_COREF_ADD, L, (ref_var)); \
 } while(0)
 
 /*
@@ -0,0 +1,116 @@
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+#include <stdint.h>
+#include <uv.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "lunet_lua.h"
+
+/*
+ * Always-on event trace.
+ *
+ * Every loop keeps a fixed-size ring of binary records that is overwritten
+ * oldest-first. Only the loop thread writes to its ring, so recording is a
+ * counter read and four stores with no locking. Records are decoded to text
+ * only when lunet.trace.dump() is called.
+ *
+ * Timestamps are raw CPU ticks where a constant-rate counter is available
+ * (TSC on x86, CNTVCT on arm64) and converted to nanoseconds at dump time
+ * against uv_hrtime(); elsewhere they are uv_hrtime() itself.
+ */
+
+#define LUNET_TRACE_RING_DEFAULT 16384  /* records per loop (32 bytes each) */
+#define LUNET_TRACE_RING_MAX (1 << 24)
+
+/* Keep lunet_trace_event_names in trace_ring.c in the same order */
+typedef enum {
+  LUNET_EV_NONE = 0,
+  LUNET_EV_SPAWN,          /* handle = coroutine */
+  LUNET_EV_RESUME,         /* handle = coroutine, size = nargs, name = site */
+  LUNET_EV_COREF_ADD,      /* handle = state holding the ref, size = ref */
+  LUNET_EV_COREF_RELEASE,  /* handle = state holding the ref, size = ref */
+  LUNET_EV_SLEEP,          /* handle = timer, size = ms */
+  LUNET_EV_WAKE,           /* handle = timer */
+  LUNET_EV_FS_START,       /* handle = request, size = uv_fs_type */
+  LUNET_EV_FS_DONE,        /* handle = request, size = result (negative = error) */
+  LUNET_EV_TCP_LISTEN,     /* handle = server */
+  LUNET_EV_TCP_ACCEPT,     /* handle = accepted client */
+  LUNET_EV_TCP_CONNECT,    /* handle = client */
+  LUNET_EV_TCP_READ,       /* handle = stream, size = bytes */
+  LUNET_EV_TCP_WRITE,      /* handle = stream, size = bytes */
+  LUNET_EV_TCP_CLOSE,      /* handle = stream */
+  LUNET_EV_UDP_BIND,       /* handle = udp */
+  LUNET_EV_UDP_TX,         /* handle = udp, size = bytes */
+  LUNET_EV_UDP_RX,         /* handle = udp, size = bytes */
+  LUNET_EV_UDP_RECV_WAIT,  /* handle = udp */
+  LUNET_EV_UDP_CLOSE,      /* handle = udp */
+  LUNET_EV_READY,          /* a callback queued a resume: handle = coroutine, name = site */
+  LUNET_EV_YIELD,          /* handle = coroutine */
+  LUNET_EV_FINISH,         /* handle = coroutine, size = lua_resume status */
+  LUNET_EV_COUNT
+} lunet_trace_event_t;
+
+static inline uint64_t lunet_trace_clock(void) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t v;
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+  return v;
+#else
+  return uv_hrtime();
+#endif
+}
+
+typedef struct {
+  uint64_t ts;         /* lunet_trace_clock() */
+  const void *handle;
+  const char *name;    /* static string or NULL */
+  uint32_t size;
+  uint32_t event;
+} lunet_trace_rec_t;
+
+typedef struct {
+  lunet_trace_rec_t *recs;  /* NULL = tracing disabled */
+  uint64_t head;            /* total records written; slot = head & mask */
+  uint32_t mask;
+  uint64_t base_clock;      /* lunet_trace_clock() and uv_hrtime() at init, */
+  uint64_t base_ns;         /* to calibrate ticks against nanoseconds */
+} lunet_trace_ring_t;
+
+static inline void lunet_trace_ring_record(lunet_trace_ring_t *ring, int event, const void *handle,
+                                           uint32_t size, const char *name) {
+  lunet_trace_rec_t *rec = &ring->recs[ring->head++ & ring->mask];
+  rec->ts = lunet_trace_clock();
+  rec->handle = handle;
+  rec->name = name;
+  rec->size = size;
+  rec->event = (uint32_t)event;
+}
+
+/* (Re)allocate the ring with capacity rounded up to a power of two; 0 frees it.
+   On UV_ENOMEM the old ring and its records are kept. */
+int lunet_trace_ring_init(lunet_trace_ring_t *ring, uint32_t capacity);
+void lunet_trace_ring_free(lunet_trace_ring_t *ring);
+
+/* Name of an event id ("tcp.read"), "?" if unknown */
+const char *lunet_trace_event_name(int event);
+
+/* lunet.trace.dump(path [, seconds]) -> records written | nil, err */
+int lunet_trace_ring_dump(lua_State *L);
+
+/* lunet.trace.export(path [, seconds]) -> events written | nil, err (Chrome Trace Event JSON) */
+int lunet_trace_ring_export(lua_State *L);
+
+/* lunet.trace.set_size(records) -> capacity | nil, err (0 disables) */
+int lunet_trace_ring_set_size(lua_State *L);
+
+#endif  // TRACE_RING_H
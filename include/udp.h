@@ -3,13 +3,12 @@
 
 #include "lunet_lua.h"
 
+/* Datagrams queued per socket while no coroutine is in udp.recv; more are dropped */
+#define LUNET_UDP_PENDING_MAX 4096
+
 int lunet_udp_bind(lua_State *L);
 int lunet_udp_send(lua_State *L);
 int lunet_udp_recv(lua_State *L);
 int lunet_udp_close(lua_State *L);
 
-#ifdef LUNET_TRACE
-void lunet_udp_trace_summary(void);
-#endif
-
 #endif  // UDP_H
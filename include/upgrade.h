@@ -0,0 +1,35 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include "lunet_lua.h"
+
+/*
+ * Zero-downtime binary upgrade (lunet.upgrade).
+ *
+ * The running process re-executes lunet-run with the same command line and
+ * hands its listening sockets to the new process as fds 4, 5, ... listed in
+ * LUNET_LISTEN_FDS ("4:tcp:127.0.0.1:8080;5:unix:/tmp/app.sock"). When the
+ * new process calls socket.listen for one of those addresses it adopts the
+ * inherited fd instead of binding, so the kernel keeps queueing connections
+ * throughout. Once its script has loaded, the new process writes to the pipe
+ * on fd 3; only then does the old process stop accepting and drain. If the
+ * new process dies first, the old one keeps serving.
+ */
+
+#define LUNET_UPGRADE_ENV "LUNET_LISTEN_FDS"
+#define LUNET_UPGRADE_READY_FD 3
+#define LUNET_UPGRADE_FD_BASE 4
+
+/* Remember argv for re-exec and pick up listeners handed over by the previous binary */
+void lunet_upgrade_init(int argc, char **argv);
+
+/* Claim the inherited fd for proto ("tcp" | "unix") and addr; returns -1 if none */
+int lunet_upgrade_take_fd(const char *proto, const char *addr);
+
+/* lunet.upgrade() -> pid | nil, err; yields until the new process is ready */
+int lunet_upgrade(lua_State *L);
+
+/* Tell the process that started us that the script has loaded (no-op otherwise) */
+void lunet_upgrade_ready(void);
+
+#endif  // UPGRADE_H
@@ -3,6 +3,16 @@
 
 #include "lunet_lua.h"
 
+/* lunet.work.run(module, fn, ...) -> results... | nil, err */
 int lunet_work_create(lua_State *L);
 
-#endif
\ No newline at end of file
+/* lunet.work.prewarm(n [, modules]) -> number of idle worker VMs */
+int lunet_work_prewarm(lua_State *L);
+
+/* lunet.work.set_pool_size(n) -> true | nil, err */
+int lunet_work_set_pool_size(lua_State *L);
+
+/* lunet.work.pool_stats() -> table */
+int lunet_work_pool_stats(lua_State *L);
+
+#endif
@@ -0,0 +1,365 @@
+#include "alloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LUNET_ALLOC_SLAB_HEADER 16  /* keeps blocks 16-byte aligned */
+
+/*
+ * 64-bit LuaJIT without GC64 only runs on its own allocator: lua_newstate
+ * prints "Must use luaL_newstate() for 64 bit target" and fails. LuaJIT 2.0
+ * never has GC64; for 2.1 the public headers don't tell, so builds against a
+ * library compiled with LUAJIT_DISABLE_GC64 define LUNET_LUAJIT_NO_GC64
+ * (xmake f --gc64=n).
+ */
+#if UINTPTR_MAX > 0xffffffffu && \
+    (LUAJIT_VERSION_NUM < 20100 || defined(LUNET_LUAJIT_NO_GC64) || (defined(LJ_GC64) && !LJ_GC64))
+#define LUNET_ALLOC_CUSTOM 0
+#else
+#define LUNET_ALLOC_CUSTOM 1
+#endif
+#define LUNET_ALLOC_TASK_MAIN 0
+#define LUNET_ALLOC_TASK_OTHER 1
+
+static inline int alloc_is_small(size_t size) { return size <= LUNET_ALLOC_SMALL_MAX; }
+
+static inline int alloc_class(size_t size) { return (int)((size - 1) >> LUNET_ALLOC_CLASS_SHIFT); }
+
+static void *alloc_small(lunet_alloc_t *a, size_t size) {
+  int cls = alloc_class(size);
+  a->small_allocs++;
+  lunet_alloc_block_t *b = a->free[cls];
+  if (b) {
+    a->free[cls] = b->next;
+    a->small_reused++;
+    return b;
+  }
+
+  size_t block = (size_t)(cls + 1) << LUNET_ALLOC_CLASS_SHIFT;
+  if (a->bump_left < block) {
+    char *slab = (char *)malloc(LUNET_ALLOC_SLAB_SIZE);
+    if (!slab) {
+      return NULL;
+    }
+    *(void **)slab = a->slabs;
+    a->slabs = slab;
+    a->reserved += LUNET_ALLOC_SLAB_SIZE;
+    a->bump = slab + LUNET_ALLOC_SLAB_HEADER;
+    a->bump_left = LUNET_ALLOC_SLAB_SIZE - LUNET_ALLOC_SLAB_HEADER;
+  }
+  void *p = a->bump;
+  a->bump += block;
+  a->bump_left -= block;
+  return p;
+}
+
+static void free_block(lunet_alloc_t *a, void *p, size_t size) {
+  a->frees++;
+  if (alloc_is_small(size)) {
+    lunet_alloc_block_t *b = (lunet_alloc_block_t *)p;
+    int cls = alloc_class(size);
+    b->next = a->free[cls];
+    a->free[cls] = b;
+  } else {
+    a->reserved -= size;
+    free(p);
+  }
+}
+
+static int alloc_cos_find(const lunet_alloc_t *a, lua_State *co) {
+  if (!a->cos_cap) {
+    return LUNET_ALLOC_TASK_OTHER;
+  }
+  size_t mask = a->cos_cap - 1;
+  for (size_t i = ((uintptr_t)co >> 4) & mask;; i = (i + 1) & mask) {
+    if (a->cos[i].co == co) {
+      return a->cos[i].task;
+    }
+    if (!a->cos[i].co) {
+      return LUNET_ALLOC_TASK_OTHER;  // spawned before attribution was enabled
+    }
+  }
+}
+
+// Charge delta bytes to the task of the running coroutine
+static void alloc_attribute(lunet_alloc_t *a, size_t delta) {
+  lua_State *co = a->rt->current_co;
+  int task;
+  if (!co) {
+    task = LUNET_ALLOC_TASK_MAIN;
+  } else if (co == a->last_co) {
+    task = a->last_task;
+  } else {
+    task = alloc_cos_find(a, co);
+    a->last_co = co;
+    a->last_task = task;
+  }
+  a->tasks[task].bytes += delta;
+  a->tasks[task].allocs++;
+}
+
+static void *lunet_alloc_fn(void *ud, void *ptr, size_t osize, size_t nsize) {
+  lunet_alloc_t *a = (lunet_alloc_t *)ud;
+  if (!ptr) {
+    osize = 0;
+  }
+  if (nsize == 0) {
+    if (ptr) {
+      free_block(a, ptr, osize);
+      a->current -= osize;
+    }
+    return NULL;
+  }
+
+  void *p;
+  if (ptr && alloc_is_small(osize) && alloc_is_small(nsize) && alloc_class(osize) == alloc_class(nsize)) {
+    p = ptr;
+  } else if (ptr && !alloc_is_small(osize) && !alloc_is_small(nsize)) {
+    if (!(p = realloc(ptr, nsize))) {
+      return NULL;
+    }
+    a->reserved += nsize - osize;
+  } else {
+    if (alloc_is_small(nsize)) {
+      p = alloc_small(a, nsize);
+    } else if ((p = malloc(nsize)) != NULL) {
+      a->reserved += nsize;
+    }
+    if (!p) {
+      return NULL;
+    }
+    a->allocs++;
+    if (ptr) {
+      memcpy(p, ptr, osize < nsize ? osize : nsize);
+      free_block(a, ptr, osize);
+    }
+  }
+
+  a->current += nsize - osize;
+  if (a->current > a->peak) {
+    a->peak = a->current;
+  }
+  if (nsize > osize && a->attribute && a->rt) {
+    alloc_attribute(a, nsize - osize);
+  }
+  return p;
+}
+
+// Same as the panic handler luaL_newstate installs
+static int lunet_alloc_panic(lua_State *L) {
+  const char *msg = lua_tostring(L, -1);
+  fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", msg ? msg : "?");
+  fflush(stderr);
+  return 0;
+}
+
+lua_State *lunet_alloc_newstate(lunet_alloc_t *a) {
+#if LUNET_ALLOC_CUSTOM
+  lua_State *L = lua_newstate(lunet_alloc_fn, a);
+  if (L) {
+    lua_atpanic(L, lunet_alloc_panic);
+    return L;
+  }
+#else
+  (void)lunet_alloc_fn;
+  (void)lunet_alloc_panic;
+#endif
+  memset(a, 0, sizeof(*a));
+  return luaL_newstate();
+}
+
+void lunet_alloc_destroy(lunet_alloc_t *a) {
+  void *slab = a->slabs;
+  while (slab) {
+    void *next = *(void **)slab;
+    free(slab);
+    slab = next;
+  }
+  free(a->tasks);
+  free(a->cos);
+  memset(a, 0, sizeof(*a));
+}
+
+static int alloc_task_index(lunet_alloc_t *a, const char *label) {
+  for (int i = 0; i < a->task_count; i++) {
+    if (strcmp(a->tasks[i].label, label) == 0) {
+      return i;
+    }
+  }
+  if (a->task_count == a->task_cap) {
+    int cap = a->task_cap ? a->task_cap * 2 : 16;
+    lunet_alloc_task_t *tasks = (lunet_alloc_task_t *)realloc(a->tasks, (size_t)cap * sizeof(*tasks));
+    if (!tasks) {
+      return LUNET_ALLOC_TASK_OTHER;
+    }
+    a->tasks = tasks;
+    a->task_cap = cap;
+  }
+  lunet_alloc_task_t *t = &a->tasks[a->task_count];
+  snprintf(t->label, sizeof(t->label), "%s", label);
+  t->bytes = 0;
+  t->allocs = 0;
+  return a->task_count++;
+}
+
+static int alloc_cos_grow(lunet_alloc_t *a) {
+  size_t cap = a->cos_cap ? a->cos_cap * 2 : 256;
+  lunet_alloc_coslot_t *cos = (lunet_alloc_coslot_t *)calloc(cap, sizeof(*cos));
+  if (!cos) {
+    return -1;
+  }
+  for (size_t j = 0; j < a->cos_cap; j++) {
+    if (a->cos[j].co) {
+      size_t i = ((uintptr_t)a->cos[j].co >> 4) & (cap - 1);
+      while (cos[i].co) {
+        i = (i + 1) & (cap - 1);
+      }
+      cos[i] = a->cos[j];
+    }
+  }
+  free(a->cos);
+  a->cos = cos;
+  a->cos_cap = cap;
+  return 0;
+}
+
+void lunet_alloc_label(lunet_alloc_t *a, lua_State *L, int fn_idx, lua_State *co) {
+  if (!a->attribute) {
+    return;
+  }
+  lua_Debug ar;
+  char label[LUNET_ALLOC_LABEL_MAX];
+  lua_pushvalue(L, fn_idx);
+  lua_getinfo(L, ">S", &ar);
+  snprintf(label, sizeof(label), "%s:%d", ar.short_src, ar.linedefined);
+  int task = alloc_task_index(a, label);
+
+  // Pooled coroutines run many tasks: overwrite the slot on every spawn
+  if ((a->cos_len + 1) * 2 > a->cos_cap && alloc_cos_grow(a) != 0) {
+    return;
+  }
+  size_t mask = a->cos_cap - 1;
+  size_t i = ((uintptr_t)co >> 4) & mask;
+  while (a->cos[i].co && a->cos[i].co != co) {
+    i = (i + 1) & mask;
+  }
+  if (!a->cos[i].co) {
+    a->cos[i].co = co;
+    a->cos_len++;
+  }
+  a->cos[i].task = task;
+  if (a->last_co == co) {
+    a->last_task = task;
+  }
+}
+
+int lunet_set_mem_attribution(lua_State *L) {
+  lunet_rt_t *rt = lunet_rt();
+  lunet_alloc_t *a = rt ? rt->alloc : NULL;
+  if (!a) {
+    lua_pushnil(L);
+    lua_pushstring(L, "lunet allocator not in use");
+    return 2;
+  }
+  int enable = lua_toboolean(L, 1);
+  if (enable && !a->tasks) {
+    if (alloc_task_index(a, "main") != LUNET_ALLOC_TASK_MAIN ||
+        alloc_task_index(a, "other") != LUNET_ALLOC_TASK_OTHER) {
+      lua_pushnil(L);
+      lua_pushstring(L, "out of memory");
+      return 2;
+    }
+  }
+  a->attribute = enable;
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+static int alloc_task_cmp(const void *x, const void *y) {
+  const lunet_alloc_task_t *a = *(const lunet_alloc_task_t *const *)x;
+  const lunet_alloc_task_t *b = *(const lunet_alloc_task_t *const *)y;
+  return a->bytes < b->bytes ? 1 : a->bytes > b->bytes ? -1 : 0;
+}
+
+int lunet_mem_stats(lua_State *L) {
+  lunet_rt_t *rt = lunet_rt();
+  lunet_alloc_t *a = rt ? rt->alloc : NULL;
+  if (!a) {
+    lua_pushnil(L);
+    lua_pushstring(L, "lunet allocator not in use");
+    return 2;
+  }
+  int reset = lua_toboolean(L, 1);
+
+  // Read everything before building the result: pushing allocates
+  size_t current = a->current;
+  size_t peak = a->peak;
+  size_t reserved = a->reserved;
+  uint64_t allocs = a->allocs;
+  uint64_t frees = a->frees;
+  uint64_t small_allocs = a->small_allocs;
+  uint64_t small_reused = a->small_reused;
+  int n = a->attribute ? a->task_count : 0;
+  lunet_alloc_task_t *tasks = n ? (lunet_alloc_task_t *)malloc((size_t)n * sizeof(*tasks)) : NULL;
+  lunet_alloc_task_t **order = n ? (lunet_alloc_task_t **)malloc((size_t)n * sizeof(*order)) : NULL;
+  if (n && (!tasks || !order)) {
+    n = 0;
+  }
+  for (int i = 0; i < n; i++) {
+    tasks[i] = a->tasks[i];
+    order[i] = &tasks[i];
+  }
+  if (reset) {
+    a->peak = a->current;
+    a->allocs = 0;
+    a->frees = 0;
+    a->small_allocs = 0;
+    a->small_reused = 0;
+    for (int i = 0; i < a->task_count; i++) {
+      a->tasks[i].bytes = 0;
+      a->tasks[i].allocs = 0;
+    }
+  }
+  if (n > 1) {
+    qsort(order, (size_t)n, sizeof(*order), alloc_task_cmp);
+  }
+
+  lua_createtable(L, 0, 8);
+  lua_pushnumber(L, (lua_Number)current);
+  lua_setfield(L, -2, "current");
+  lua_pushnumber(L, (lua_Number)peak);
+  lua_setfield(L, -2, "peak");
+  lua_pushnumber(L, (lua_Number)reserved);
+  lua_setfield(L, -2, "reserved");
+  lua_pushnumber(L, (lua_Number)allocs);
+  lua_setfield(L, -2, "allocs");
+  lua_pushnumber(L, (lua_Number)frees);
+  lua_setfield(L, -2, "frees");
+  lua_pushnumber(L, (lua_Number)small_allocs);
+  lua_setfield(L, -2, "small_allocs");
+  lua_pushnumber(L, (lua_Number)small_reused);
+  lua_setfield(L, -2, "small_reused");
+  if (a->attribute) {
+    lua_createtable(L, n, 0);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+      if (order[i]->allocs == 0) {
+        continue;
+      }
+      lua_createtable(L, 0, 3);
+      lua_pushstring(L, order[i]->label);
+      lua_setfield(L, -2, "task");
+      lua_pushnumber(L, (lua_Number)order[i]->bytes);
+      lua_setfield(L, -2, "bytes");
+      lua_pushnumber(L, (lua_Number)order[i]->allocs);
+      lua_setfield(L, -2, "allocs");
+      lua_rawseti(L, -2, ++k);
+    }
+    lua_setfield(L, -2, "tasks");
+  }
+  free(tasks);
+  free(order);
+  return 1;
+}
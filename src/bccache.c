@@ -0,0 +1,289 @@
+#include "bccache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+/*
+ * Entry layout: magic, the key, a NUL, then the lua_dump output.
+ *
+ * The entry file name is a hash of the real path and LuaJIT version only, so
+ * rewriting a source file replaces its entry instead of leaving old ones
+ * behind. The full key stored in the entry (which adds mtime and size) decides
+ * whether it is still valid. Entries are written to a temporary file and
+ * renamed into place, so workers and processes sharing the directory never
+ * read a partial entry.
+ */
+
+#define LUNET_BCCACHE_MAGIC "LUNETBC1"
+#define LUNET_BCCACHE_KEY_MAX 4352
+
+static char *g_bccache_dir = NULL;  // set once before any loop starts
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} bccache_buf_t;
+
+static int bccache_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+  (void)L;
+  bccache_buf_t *buf = (bccache_buf_t *)ud;
+  if (buf->len + sz > buf->cap) {
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + sz) {
+      cap *= 2;
+    }
+    char *data = (char *)realloc(buf->data, cap);
+    if (!data) {
+      return 1;
+    }
+    buf->data = data;
+    buf->cap = cap;
+  }
+  memcpy(buf->data + buf->len, p, sz);
+  buf->len += sz;
+  return 0;
+}
+
+static uint64_t bccache_hash(const char *s, uint64_t h) {
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 1099511628211ULL;  // FNV-1a
+  }
+  return h;
+}
+
+// Fill key and the entry path for the source file at path
+static int bccache_entry(const char *path, char *key, size_t keylen, char *entry, size_t entrylen) {
+  uv_fs_t req;
+  if (uv_fs_realpath(NULL, &req, path, NULL) != 0) {
+    uv_fs_req_cleanup(&req);
+    return -1;
+  }
+  char real[4096];
+  snprintf(real, sizeof(real), "%s", (const char *)req.ptr);
+  uv_fs_req_cleanup(&req);
+
+  if (uv_fs_stat(NULL, &req, real, NULL) != 0) {
+    uv_fs_req_cleanup(&req);
+    return -1;
+  }
+  int n = snprintf(key, keylen, "%s\n%s\n%lld.%09ld\n%llu", real, LUAJIT_VERSION,
+                   (long long)req.statbuf.st_mtim.tv_sec, (long)req.statbuf.st_mtim.tv_nsec,
+                   (unsigned long long)req.statbuf.st_size);
+  uv_fs_req_cleanup(&req);
+  if (n < 0 || (size_t)n >= keylen) {
+    return -1;
+  }
+
+  uint64_t h = bccache_hash(LUAJIT_VERSION, bccache_hash(real, 14695981039346656037ULL));
+  n = snprintf(entry, entrylen, "%s/%016llx.ljbc", g_bccache_dir, (unsigned long long)h);
+  return n < 0 || (size_t)n >= entrylen ? -1 : 0;
+}
+
+// Load a valid entry as a function on top of L; returns 0, or -1 with the stack unchanged
+static int bccache_load(lua_State *L, const char *entry, const char *key, const char *path) {
+  FILE *f = fopen(entry, "rb");
+  if (!f) {
+    return -1;
+  }
+  bccache_buf_t buf = {NULL, 0, 0};
+  char chunk[16384];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    if (bccache_writer(L, chunk, n, &buf) != 0) {
+      break;
+    }
+  }
+  int ok = n == 0 && !ferror(f);
+  fclose(f);
+
+  size_t magic_len = sizeof(LUNET_BCCACHE_MAGIC) - 1;
+  size_t header_len = magic_len + strlen(key) + 1;
+  int status = -1;
+  if (ok && buf.len > header_len && memcmp(buf.data, LUNET_BCCACHE_MAGIC, magic_len) == 0 &&
+      memcmp(buf.data + magic_len, key, header_len - magic_len) == 0) {
+    lua_pushfstring(L, "@%s", path);
+    if (luaL_loadbufferx(L, buf.data + header_len, buf.len - header_len, lua_tostring(L, -1), "b") == 0) {
+      lua_remove(L, -2);
+      status = 0;
+    } else {
+      lua_pop(L, 2);  // bytecode from an incompatible build; recompile
+    }
+  }
+  free(buf.data);
+  return status;
+}
+
+// Dump the function on top of L into entry; leaves the stack unchanged
+static int bccache_store(lua_State *L, const char *entry, const char *key) {
+  bccache_buf_t buf = {NULL, 0, 0};
+  if (bccache_writer(L, LUNET_BCCACHE_MAGIC, sizeof(LUNET_BCCACHE_MAGIC) - 1, &buf) != 0 ||
+      bccache_writer(L, key, strlen(key) + 1, &buf) != 0 || lua_dump(L, bccache_writer, &buf) != 0) {
+    free(buf.data);
+    return -1;
+  }
+
+  char tmpl[4200];
+  snprintf(tmpl, sizeof(tmpl), "%s/.tmp-XXXXXX", g_bccache_dir);
+  uv_fs_t req;
+  int fd = uv_fs_mkstemp(NULL, &req, tmpl, NULL);
+  char tmp[4200];
+  snprintf(tmp, sizeof(tmp), "%s", req.path ? req.path : "");
+  uv_fs_req_cleanup(&req);
+  if (fd < 0) {
+    free(buf.data);
+    return -1;
+  }
+
+  uv_buf_t iov = uv_buf_init(buf.data, (unsigned int)buf.len);
+  int written = uv_fs_write(NULL, &req, (uv_file)fd, &iov, 1, -1, NULL);
+  uv_fs_req_cleanup(&req);
+  uv_fs_close(NULL, &req, (uv_file)fd, NULL);
+  uv_fs_req_cleanup(&req);
+  free(buf.data);
+
+  int rc = written == (int)iov.len ? uv_fs_rename(NULL, &req, tmp, entry, NULL) : -1;
+  uv_fs_req_cleanup(&req);
+  if (rc != 0) {
+    uv_fs_unlink(NULL, &req, tmp, NULL);
+    uv_fs_req_cleanup(&req);
+    return -1;
+  }
+  return 0;
+}
+
+int lunet_bccache_init(const char *dir) {
+  uv_fs_t req;
+  int rc = uv_fs_mkdir(NULL, &req, dir, 0755, NULL);
+  uv_fs_req_cleanup(&req);
+  if (rc != 0 && rc != UV_EEXIST) {
+    return rc;
+  }
+  free(g_bccache_dir);
+  g_bccache_dir = strdup(dir);
+  return g_bccache_dir ? 0 : UV_ENOMEM;
+}
+
+int lunet_bccache_loadfile(lua_State *L, const char *path) {
+  char key[LUNET_BCCACHE_KEY_MAX];
+  char entry[4200];
+  if (!g_bccache_dir || bccache_entry(path, key, sizeof(key), entry, sizeof(entry)) != 0) {
+    return luaL_loadfile(L, path);
+  }
+  if (bccache_load(L, entry, key, path) == 0) {
+    return 0;
+  }
+  int status = luaL_loadfile(L, path);
+  if (status == 0) {
+    bccache_store(L, entry, key);  // best effort
+  }
+  return status;
+}
+
+// package.loaders[2] replacement: same search and errors as the stock Lua loader
+static int bccache_loader(lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "searchpath");
+  lua_pushvalue(L, 1);
+  lua_getfield(L, -3, "path");
+  lua_call(L, 2, 2);
+  if (lua_isnil(L, -2)) {
+    return 1;  // "\n\tno file ..." message
+  }
+  const char *filename = lua_tostring(L, -2);
+  if (lunet_bccache_loadfile(L, filename) != 0) {
+    return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, filename,
+                      lua_tostring(L, -1));
+  }
+  return 1;
+}
+
+void lunet_bccache_install(lua_State *L) {
+  if (!g_bccache_dir) {
+    return;
+  }
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "loaders");
+  if (lua_istable(L, -1)) {
+    lua_pushcfunction(L, bccache_loader);
+    lua_rawseti(L, -2, 2);
+  }
+  lua_pop(L, 2);
+}
+
+static int bccache_has_lua_suffix(const char *name) {
+  size_t n = strlen(name);
+  return n > 4 && strcmp(name + n - 4, ".lua") == 0;
+}
+
+int lunet_bccache_precompile(lua_State *L, const char *path, int *failed) {
+  uv_fs_t req;
+  if (uv_fs_stat(NULL, &req, path, NULL) != 0) {
+    fprintf(stderr, "precompile: cannot stat %s\n", path);
+    uv_fs_req_cleanup(&req);
+    (*failed)++;
+    return 0;
+  }
+  int is_dir = (req.statbuf.st_mode & S_IFMT) == S_IFDIR;
+  uv_fs_req_cleanup(&req);
+
+  if (!is_dir) {
+    char key[LUNET_BCCACHE_KEY_MAX];
+    char entry[4200];
+    if (bccache_entry(path, key, sizeof(key), entry, sizeof(entry)) != 0) {
+      fprintf(stderr, "precompile: cannot resolve %s\n", path);
+      (*failed)++;
+      return 0;
+    }
+    if (luaL_loadfile(L, path) != 0) {
+      fprintf(stderr, "precompile: %s\n", lua_tostring(L, -1));
+      lua_pop(L, 1);
+      (*failed)++;
+      return 0;
+    }
+    int rc = bccache_store(L, entry, key);
+    lua_pop(L, 1);
+    if (rc != 0) {
+      fprintf(stderr, "precompile: cannot write %s\n", entry);
+      (*failed)++;
+      return 0;
+    }
+    return 1;
+  }
+
+  if (uv_fs_scandir(NULL, &req, path, 0, NULL) < 0) {
+    fprintf(stderr, "precompile: cannot read %s\n", path);
+    uv_fs_req_cleanup(&req);
+    (*failed)++;
+    return 0;
+  }
+  int cached = 0;
+  uv_dirent_t ent;
+  while (uv_fs_scandir_next(&req, &ent) != UV_EOF) {
+    if (ent.name[0] == '.') {
+      continue;
+    }
+    char child[4096];
+    snprintf(child, sizeof(child), "%s/%s", path, ent.name);
+    if (ent.type == UV_DIRENT_FILE) {
+      if (bccache_has_lua_suffix(ent.name)) {
+        cached += lunet_bccache_precompile(L, child, failed);
+      }
+      continue;
+    }
+    // directories, links and unknown types: stat decides
+    uv_fs_t st;
+    int dir = uv_fs_stat(NULL, &st, child, NULL) == 0 && (st.statbuf.st_mode & S_IFMT) == S_IFDIR;
+    uv_fs_req_cleanup(&st);
+    if (dir || bccache_has_lua_suffix(ent.name)) {
+      cached += lunet_bccache_precompile(L, child, failed);
+    }
+  }
+  uv_fs_req_cleanup(&req);
+  return cached;
+}
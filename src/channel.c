@@ -0,0 +1,357 @@
+#include "channel.h"
+
+#include <stdlib.h>
+
+#include "co.h"
+#include "trace.h"
+
+#define LUNET_CHANNEL_MT "lunet.channel"
+#define LUNET_CHANNEL_CLOSED "channel closed"
+
+/*
+ * Bounded channel between coroutines of one loop.
+ *
+ * Buffered values live in the userdata's environment table at integer keys
+ * 1..capacity, used as a ring buffer. Coroutines that cannot proceed park
+ * with a registry reference, like socket reads and accepts do, and are woken
+ * through the ready queue. A blocked sender's value waits in env.pending
+ * keyed by its coroutine reference.
+ */
+
+// FIFO of parked coroutine references
+typedef struct {
+  int *refs;
+  int head;
+  int len;
+  int cap;
+} channel_waitq_t;
+
+typedef struct {
+  int capacity;  // 0 = unbuffered: send waits for a receiver
+  int head;      // ring index of the oldest buffered value
+  int count;
+  int closed;
+  channel_waitq_t recvq;
+  channel_waitq_t sendq;
+} channel_t;
+
+static int waitq_push(channel_waitq_t *q, int ref) {
+  if (q->len == q->cap) {
+    int cap = q->cap ? q->cap * 2 : 4;
+    int *refs = (int *)malloc((size_t)cap * sizeof(int));
+    if (!refs) {
+      return -1;
+    }
+    for (int i = 0; i < q->len; i++) {
+      refs[i] = q->refs[(q->head + i) % q->cap];
+    }
+    free(q->refs);
+    q->refs = refs;
+    q->head = 0;
+    q->cap = cap;
+  }
+  q->refs[(q->head + q->len) % q->cap] = ref;
+  q->len++;
+  return 0;
+}
+
+static int waitq_pop(channel_waitq_t *q) {
+  int ref = q->refs[q->head];
+  q->head = (q->head + 1) % q->cap;
+  q->len--;
+  return ref;
+}
+
+static channel_t *check_channel(lua_State *L) {
+  return (channel_t *)luaL_checkudata(L, 1, LUNET_CHANNEL_MT);
+}
+
+// Pop a parked coroutine; it stays anchored by *ref until channel_wake
+static lua_State *channel_take_waiter(lua_State *L, channel_waitq_t *q, int *ref) {
+  *ref = waitq_pop(q);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, *ref);
+  lua_State *co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  return co;
+}
+
+// Queue a parked coroutine (results already pushed) and drop its parking reference
+static void channel_wake(lua_State *L, lua_State *co, int ref, int nargs, const char *site) {
+  lunet_co_resume(co, nargs, site);
+  lunet_coref_release(L, ref);
+}
+
+// Hand the value at index idx straight to a parked receiver
+static void channel_wake_receiver(lua_State *L, channel_t *ch, int idx) {
+  int ref;
+  lua_State *co = channel_take_waiter(L, &ch->recvq, &ref);
+  lua_pushvalue(L, idx);
+  lua_xmove(L, co, 1);
+  lua_pushnil(co);
+  channel_wake(L, co, ref, 2, "channel.recv");
+}
+
+// Take the oldest parked sender's value and push it onto L; wakes the sender
+static void channel_take_sender_value(lua_State *L, channel_t *ch, int env) {
+  int ref;
+  lua_State *co = channel_take_waiter(L, &ch->sendq, &ref);
+
+  lua_getfield(L, env, "pending");
+  lua_rawgeti(L, -1, ref);
+  lua_pushnil(L);
+  lua_rawseti(L, -3, ref);
+  lua_remove(L, -2);
+
+  lua_pushboolean(co, 1);
+  channel_wake(L, co, ref, 1, "channel.send");
+}
+
+// Store value at idx in the ring buffer (caller checked there is room)
+static void channel_buffer_push(lua_State *L, channel_t *ch, int env, int idx) {
+  lua_pushvalue(L, idx);
+  lua_rawseti(L, env, (ch->head + ch->count) % ch->capacity + 1);
+  ch->count++;
+}
+
+// Push the oldest buffered value onto L and free its slot
+static void channel_buffer_pop(lua_State *L, channel_t *ch, int env) {
+  lua_rawgeti(L, env, ch->head + 1);
+  lua_pushnil(L);
+  lua_rawseti(L, env, ch->head + 1);
+  ch->head = (ch->head + 1) % ch->capacity;
+  ch->count--;
+}
+
+/*
+ * Deliver without blocking. Returns 1 if the value was handed to a receiver
+ * or buffered, 0 if the channel is full.
+ */
+static int channel_offer(lua_State *L, channel_t *ch, int env) {
+  if (ch->recvq.len > 0) {
+    channel_wake_receiver(L, ch, 2);
+    return 1;
+  }
+  if (ch->count < ch->capacity) {
+    channel_buffer_push(L, ch, env, 2);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Receive without blocking. Pushes the value and returns 1, or returns 0 if
+ * nothing is available.
+ */
+static int channel_poll(lua_State *L, channel_t *ch, int env) {
+  if (ch->count > 0) {
+    channel_buffer_pop(L, ch, env);
+    // a slot just opened: move the oldest blocked sender's value in
+    if (ch->sendq.len > 0) {
+      channel_take_sender_value(L, ch, env);
+      lua_rawseti(L, env, (ch->head + ch->count) % ch->capacity + 1);
+      ch->count++;
+    }
+    return 1;
+  }
+  if (ch->sendq.len > 0) {
+    channel_take_sender_value(L, ch, env);  // unbuffered hand-off
+    return 1;
+  }
+  return 0;
+}
+
+static int channel_send(lua_State *L) {
+  channel_t *ch = check_channel(L);
+  luaL_checkany(L, 2);
+  luaL_argcheck(L, !lua_isnil(L, 2), 2, "cannot send nil");
+  lua_settop(L, 2);
+
+  if (ch->closed) {
+    lua_pushnil(L);
+    lua_pushstring(L, LUNET_CHANNEL_CLOSED);
+    return 2;
+  }
+  lua_getfenv(L, 1);
+  if (channel_offer(L, ch, 3)) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+
+  // full: park until a receiver makes room or the channel is closed
+  if (lunet_ensure_coroutine(L, "channel.send") != 0) {
+    return lua_error(L);
+  }
+  int ref;
+  lunet_coref_create(L, ref);
+  if (waitq_push(&ch->sendq, ref) != 0) {
+    lunet_coref_release(L, ref);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  lua_getfield(L, 3, "pending");
+  lua_pushvalue(L, 2);
+  lua_rawseti(L, -2, ref);
+  lua_settop(L, 0);
+  return lua_yield(L, 0);
+}
+
+static int channel_try_send(lua_State *L) {
+  channel_t *ch = check_channel(L);
+  luaL_checkany(L, 2);
+  luaL_argcheck(L, !lua_isnil(L, 2), 2, "cannot send nil");
+  lua_settop(L, 2);
+
+  if (ch->closed) {
+    lua_pushnil(L);
+    lua_pushstring(L, LUNET_CHANNEL_CLOSED);
+    return 2;
+  }
+  lua_getfenv(L, 1);
+  if (channel_offer(L, ch, 3)) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  lua_pushnil(L);
+  lua_pushstring(L, "channel full");
+  return 2;
+}
+
+static int channel_recv(lua_State *L) {
+  channel_t *ch = check_channel(L);
+  lua_settop(L, 1);
+  lua_getfenv(L, 1);
+
+  if (channel_poll(L, ch, 2)) {
+    lua_pushnil(L);
+    return 2;
+  }
+  if (ch->closed) {
+    lua_pushnil(L);
+    lua_pushstring(L, LUNET_CHANNEL_CLOSED);
+    return 2;
+  }
+
+  // empty: park until a sender delivers or the channel is closed
+  if (lunet_ensure_coroutine(L, "channel.recv") != 0) {
+    return lua_error(L);
+  }
+  int ref;
+  lunet_coref_create(L, ref);
+  if (waitq_push(&ch->recvq, ref) != 0) {
+    lunet_coref_release(L, ref);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  lua_settop(L, 0);
+  return lua_yield(L, 0);
+}
+
+static int channel_try_recv(lua_State *L) {
+  channel_t *ch = check_channel(L);
+  lua_settop(L, 1);
+  lua_getfenv(L, 1);
+
+  if (channel_poll(L, ch, 2)) {
+    lua_pushnil(L);
+    return 2;
+  }
+  lua_pushnil(L);
+  lua_pushstring(L, ch->closed ? LUNET_CHANNEL_CLOSED : "channel empty");
+  return 2;
+}
+
+/*
+ * Closing wakes every parked coroutine with nil, "channel closed". Values
+ * already buffered can still be received.
+ */
+static int channel_close(lua_State *L) {
+  channel_t *ch = check_channel(L);
+  if (ch->closed) {
+    return 0;
+  }
+  ch->closed = 1;
+
+  int ref;
+  while (ch->recvq.len > 0) {
+    lua_State *co = channel_take_waiter(L, &ch->recvq, &ref);
+    lua_pushnil(co);
+    lua_pushstring(co, LUNET_CHANNEL_CLOSED);
+    channel_wake(L, co, ref, 2, "channel.recv");
+  }
+  // blocked senders' values are dropped
+  lua_getfenv(L, 1);
+  lua_newtable(L);
+  lua_setfield(L, -2, "pending");
+  lua_pop(L, 1);
+  while (ch->sendq.len > 0) {
+    lua_State *co = channel_take_waiter(L, &ch->sendq, &ref);
+    lua_pushnil(co);
+    lua_pushstring(co, LUNET_CHANNEL_CLOSED);
+    channel_wake(L, co, ref, 2, "channel.send");
+  }
+  return 0;
+}
+
+static int channel_len(lua_State *L) {
+  channel_t *ch = check_channel(L);
+  lua_pushinteger(L, ch->count);
+  return 1;
+}
+
+static int channel_is_closed(lua_State *L) {
+  channel_t *ch = check_channel(L);
+  lua_pushboolean(L, ch->closed);
+  return 1;
+}
+
+static int channel_gc(lua_State *L) {
+  channel_t *ch = check_channel(L);
+  // parked coroutines keep the channel reachable, so both queues are empty here
+  free(ch->recvq.refs);
+  free(ch->sendq.refs);
+  ch->recvq.refs = NULL;
+  ch->sendq.refs = NULL;
+  return 0;
+}
+
+int lunet_channel_new(lua_State *L) {
+  int capacity = (int)luaL_optinteger(L, 1, 0);
+  luaL_argcheck(L, capacity >= 0, 1, "capacity must be >= 0");
+
+  channel_t *ch = (channel_t *)lua_newuserdata(L, sizeof(channel_t));
+  ch->capacity = capacity;
+  ch->head = 0;
+  ch->count = 0;
+  ch->closed = 0;
+  ch->recvq.refs = NULL;
+  ch->recvq.head = ch->recvq.len = ch->recvq.cap = 0;
+  ch->sendq.refs = NULL;
+  ch->sendq.head = ch->sendq.len = ch->sendq.cap = 0;
+
+  if (luaL_newmetatable(L, LUNET_CHANNEL_MT)) {
+    luaL_Reg methods[] = {{"send", channel_send},
+                          {"try_send", channel_try_send},
+                          {"recv", channel_recv},
+                          {"try_recv", channel_try_recv},
+                          {"close", channel_close},
+                          {"len", channel_len},
+                          {"is_closed", channel_is_closed},
+                          {NULL, NULL}};
+    lua_newtable(L);
+    luaL_register(L, NULL, methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, channel_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, channel_len);
+    lua_setfield(L, -2, "__len");
+  }
+  lua_setmetatable(L, -2);
+
+  lua_createtable(L, capacity, 1);
+  lua_newtable(L);
+  lua_setfield(L, -2, "pending");
+  lua_setfenv(L, -2);
+  return 1;
+}
@@ -1,28 +1,428 @@
 #include "co.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "monitor.h"
+#include "alloc.h"
+#include "profiler.h"
+#include "rt.h"
+#include "trace.h"
+
+#define LUNET_CO_POOL_KEY "lunet.co.pool"
+#define LUNET_CO_TRAMPOLINE_KEY "lunet.co.trampoline"
+
+/*
+ * Body of every coroutine created by lunet.spawn. After a task returns, the
+ * thread parks itself in the idle pool and the next spawn resumes it with a
+ * new function. park() returns nothing when the pool is full, so the thread
+ * finishes and is left to the GC.
+ */
+static const char lunet_co_trampoline_src[] =
+    "local park = ...\n"
+    "return function(fn)\n"
+    "  while fn do\n"
+    "    fn()\n"
+    "    fn = nil\n"
+    "    fn = park()\n"
+    "  end\n"
+    "end\n";
+
+#define LUNET_TIMESLICE_OVERRUNS_KEY "lunet.timeslice.overruns"
+
+// lua_resume that records which coroutine is running, for the time slice hook,
+// and reports its duration to the loop monitor when one is enabled
+static int lunet_co_run(lua_State *co, int nargs, const char *site) {
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt) {
+    return lua_resume(co, nargs);
+  }
+  lua_State *prev = rt->current_co;
+  const char *prev_site = rt->current_site;
+  uint64_t prev_start = rt->slice_start;
+  uint64_t start = 0;
+  rt->current_co = co;
+  rt->current_site = site;
+  if (rt->slice_ns || rt->monitor) {
+    start = uv_hrtime();
+    rt->slice_start = start;
+  }
+  if (rt->trace.recs) {
+    lunet_trace_ring_record(&rt->trace, LUNET_EV_RESUME, co, (uint32_t)nargs, site);
+  }
+  int status = lua_resume(co, nargs);
+  if (rt->trace.recs) {
+    if (status == LUA_YIELD) {
+      lunet_trace_ring_record(&rt->trace, LUNET_EV_YIELD, co, 0, NULL);
+    } else {
+      lunet_trace_ring_record(&rt->trace, LUNET_EV_FINISH, co, (uint32_t)status, NULL);
+    }
+  }
+  rt->current_co = prev;
+  rt->current_site = prev_site;
+  rt->slice_start = prev_start;
+  if (rt->monitor && start) {
+    lunet_monitor_resume(rt, site, uv_hrtime() - start);
+  }
+  return status;
+}
+
+// Push the idle pool table, creating it on first use
+static void lunet_co_push_pool(lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_CO_POOL_KEY);
+  if (lua_istable(L, -1)) {
+    return;
+  }
+  lua_pop(L, 1);
+  lua_newtable(L);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_CO_POOL_KEY);
+}
+
+static int lunet_co_park(lua_State *co) {
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt || rt->co_pool_idle >= rt->co_pool_max) {
+    return 0;
+  }
+  // the task is done; the yield below only parks the thread
+  LUNET_TRACE_EVENT(LUNET_EV_FINISH, co, 0);
+  lua_settop(co, 0);
+  lunet_co_push_pool(co);
+  lua_pushthread(co);
+  lua_rawseti(co, -2, ++rt->co_pool_idle);
+  lua_pop(co, 1);
+  return lua_yield(co, 0);
+}
+
+// Push the trampoline function onto L, or return -1 if it cannot be built
+static int lunet_co_push_trampoline(lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_CO_TRAMPOLINE_KEY);
+  if (lua_isfunction(L, -1)) {
+    return 0;
+  }
+  lua_pop(L, 1);
+  if (luaL_loadbuffer(L, lunet_co_trampoline_src, strlen(lunet_co_trampoline_src), "=lunet.spawn") != 0) {
+    lua_pop(L, 1);
+    return -1;
+  }
+  lua_pushcfunction(L, lunet_co_park);
+  lua_call(L, 1, 1);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_CO_TRAMPOLINE_KEY);
+  return 0;
+}
+
+// A reused thread starts a new task: drop the overrun record of the previous one
+static void lunet_timeslice_forget(lua_State *L, int idx) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_TIMESLICE_OVERRUNS_KEY);
+  if (lua_istable(L, -1)) {
+    lua_pushvalue(L, idx);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+  }
+  lua_pop(L, 1);
+}
+
+// Pop an idle coroutine and push it onto L; returns NULL when the pool is empty
+static lua_State *lunet_co_pool_take(lua_State *L, lunet_rt_t *rt) {
+  if (!rt || rt->co_pool_idle == 0) {
+    return NULL;
+  }
+  lunet_co_push_pool(L);
+  lua_rawgeti(L, -1, rt->co_pool_idle);
+  lua_pushnil(L);
+  lua_rawseti(L, -3, rt->co_pool_idle);
+  rt->co_pool_idle--;
+  lua_remove(L, -2);
+  lunet_timeslice_forget(L, lua_gettop(L));
+  return lua_tothread(L, -1);
+}
 
 int lunet_spawn(lua_State *L) {
   luaL_checktype(L, 1, LUA_TFUNCTION);
-  // create new coroutine
-  lua_State *co = lua_newthread(L);
+  lunet_rt_t *rt = lunet_rt();
+  int nargs;
+
+  // reuse a parked coroutine: park() returns the function we pass in
+  lua_State *co = lunet_co_pool_take(L, rt);
+  if (co) {
+    rt->co_pool_hits++;
+    nargs = 1;
+  } else {
+    if (rt) {
+      rt->co_pool_misses++;
+    }
+    // create new coroutine running the trampoline
+    co = lua_newthread(L);
+    if (lunet_co_push_trampoline(L) == 0) {
+      lua_xmove(L, co, 1);
+      nargs = 1;
+    } else {
+      nargs = 0;  // run the function directly, without recycling
+    }
+  }
 
   // copy function to new coroutine
   lua_pushvalue(L, 1);
   lua_xmove(L, co, 1);
 
+  if (rt && rt->prof_depth) {
+    lunet_profiler_label(L, 1, co);
+  }
+  if (rt && rt->alloc && rt->alloc->attribute) {
+    lunet_alloc_label(rt->alloc, L, 1, co);
+  }
+
   // start coroutine
-  int status = lua_resume(co, 0);
+  LUNET_TRACE_EVENT(LUNET_EV_SPAWN, co, 0);
+  int status = lunet_co_run(co, nargs, "spawn");
   if (status != LUA_OK && status != LUA_YIELD) {
     fprintf(stderr, "Coroutine error: %s\n", lua_tostring(co, -1));
   }
 
-  // pop coroutine (let gc handle)
+  // pop coroutine (parked in the pool or left to the gc)
+  lua_pop(L, 1);
+
+  return 0;
+}
+
+int lunet_spawn_pool(lua_State *L) {
+  lunet_rt_t *rt = lunet_rt();
+  lua_createtable(L, 0, 4);
+  lua_pushinteger(L, rt ? rt->co_pool_max : 0);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, rt ? rt->co_pool_idle : 0);
+  lua_setfield(L, -2, "idle");
+  lua_pushnumber(L, rt ? (lua_Number)rt->co_pool_hits : 0);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, rt ? (lua_Number)rt->co_pool_misses : 0);
+  lua_setfield(L, -2, "misses");
+  return 1;
+}
+
+int lunet_set_spawn_pool_size(lua_State *L) {
+  int size = (int)luaL_checkinteger(L, 1);
+  luaL_argcheck(L, size >= 0, 1, "pool size must be >= 0");
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt) {
+    return 0;
+  }
+  rt->co_pool_max = size;
+
+  // drop idle coroutines beyond the new limit and let the gc collect them
+  if (rt->co_pool_idle > size) {
+    lunet_co_push_pool(L);
+    while (rt->co_pool_idle > size) {
+      lua_pushnil(L);
+      lua_rawseti(L, -2, rt->co_pool_idle--);
+    }
+    lua_pop(L, 1);
+  }
+  return 0;
+}
+
+static void lunet_co_resume_now(lua_State *co, int nargs, const char *site) {
+  int status = lunet_co_run(co, nargs, site);
+  if (status != LUA_OK && status != LUA_YIELD) {
+    const char *err = lua_tostring(co, -1);
+    if (err) {
+      fprintf(stderr, "[lunet] resume error in %s: %s\n", site, err);
+    }
+  }
+}
+
+static void lunet_ready_check_cb(uv_check_t *handle) {
+  lunet_rt_t *rt = (lunet_rt_t *)handle->data;
+  rt->stats.loop_iterations++;
+
+  // Only run what was queued before this pass; coroutines queued while
+  // draining wait for the next iteration so one task cannot starve the loop
+  size_t n = rt->ready_len;
+  if (rt->ready_budget > 0 && n > (size_t)rt->ready_budget) {
+    n = (size_t)rt->ready_budget;
+  }
+  while (n-- > 0 && rt->ready_len > 0) {
+    lunet_ready_t r = rt->ready[rt->ready_head];
+    rt->ready_head = (rt->ready_head + 1) % rt->ready_cap;
+    rt->ready_len--;
+
+    lunet_co_resume_now(r.co, r.nargs, r.site);
+    lunet_coref_release(rt->L, r.ref);
+  }
+
+  if (rt->ready_len == 0) {
+    uv_idle_stop(&rt->ready_idle);
+  }
+}
+
+static void lunet_ready_idle_cb(uv_idle_t *handle) {
+  (void)handle;  // only here so the loop polls without blocking
+}
+
+int lunet_ready_init(lunet_rt_t *rt) {
+  if (rt->ready_init) {
+    return 0;
+  }
+  if (uv_check_init(rt->loop, &rt->ready_check) != 0) {
+    return -1;
+  }
+  uv_idle_init(rt->loop, &rt->ready_idle);
+  rt->ready_check.data = rt;
+  rt->ready_idle.data = rt;
+  uv_check_start(&rt->ready_check, lunet_ready_check_cb);
+  // the check handle alone must not keep the loop alive
+  uv_unref((uv_handle_t *)&rt->ready_check);
+  rt->ready_init = 1;
+  return 0;
+}
+
+static int lunet_ready_reserve(lunet_rt_t *rt) {
+  if (lunet_ready_init(rt) != 0) {
+    return -1;
+  }
+  if (rt->ready_len < rt->ready_cap) {
+    return 0;
+  }
+
+  size_t cap = rt->ready_cap ? rt->ready_cap * 2 : 64;
+  lunet_ready_t *ready = (lunet_ready_t *)malloc(cap * sizeof(lunet_ready_t));
+  if (!ready) {
+    return -1;
+  }
+  for (size_t i = 0; i < rt->ready_len; i++) {
+    ready[i] = rt->ready[(rt->ready_head + i) % rt->ready_cap];
+  }
+  free(rt->ready);
+  rt->ready = ready;
+  rt->ready_head = 0;
+  rt->ready_cap = cap;
+  return 0;
+}
+
+void lunet_co_resume(lua_State *co, int nargs, const char *site) {
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt || lunet_ready_reserve(rt) != 0) {
+    lunet_co_resume_now(co, nargs, site);
+    return;
+  }
+
+  LUNET_TRACE_EVENT_NAMED(LUNET_EV_READY, co, nargs, site);
+  lunet_ready_t *r = &rt->ready[(rt->ready_head + rt->ready_len) % rt->ready_cap];
+  r->co = co;
+  r->nargs = nargs;
+  r->site = site;
+  // anchor the thread while queued; the pushed results stay below it on co
+  lua_pushthread(co);
+  lunet_coref_create_raw(co, r->ref);
+  rt->ready_len++;
+
+  if (!uv_is_active((uv_handle_t *)&rt->ready_idle)) {
+    uv_idle_start(&rt->ready_idle, lunet_ready_idle_cb);
+  }
+}
+
+int lunet_set_resume_budget(lua_State *L) {
+  int budget = (int)luaL_checkinteger(L, 1);
+  luaL_argcheck(L, budget >= 0, 1, "budget must be >= 0");
+  lunet_rt_t *rt = lunet_rt();
+  if (rt) {
+    rt->ready_budget = budget;
+  }
+  return 0;
+}
+
+// Push the weak table of per-coroutine overrun records, creating it on first use
+static void lunet_timeslice_push_overruns(lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_TIMESLICE_OVERRUNS_KEY);
+  if (lua_istable(L, -1)) {
+    return;
+  }
   lua_pop(L, 1);
+  lua_newtable(L);
+  lua_createtable(L, 0, 1);
+  lua_pushliteral(L, "k");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_TIMESLICE_OVERRUNS_KEY);
+}
+
+// overruns[co] = { count = n, where = "source:line" of the latest preemption }
+static void lunet_timeslice_record(lua_State *co, lua_Debug *ar) {
+  lunet_timeslice_push_overruns(co);
+  lua_pushthread(co);
+  lua_rawget(co, -2);
+  if (!lua_istable(co, -1)) {
+    lua_pop(co, 1);
+    lua_createtable(co, 0, 2);
+    lua_pushthread(co);
+    lua_pushvalue(co, -2);
+    lua_rawset(co, -4);
+  }
+  lua_getfield(co, -1, "count");
+  lua_pushnumber(co, lua_tonumber(co, -1) + 1);
+  lua_setfield(co, -3, "count");
+  lua_pop(co, 1);
+  if (lua_getinfo(co, "Sl", ar)) {
+    lua_pushfstring(co, "%s:%d", ar->short_src, ar->currentline);
+    lua_setfield(co, -2, "where");
+  }
+  lua_pop(co, 2);
+}
+
+/*
+ * Count hook: when the coroutine lunet resumed has run past its slice, queue
+ * it behind everything else that is ready and yield. Only lunet's own
+ * coroutines are preempted, and only where a yield is legal (not across a
+ * C call such as a metamethod or table.sort comparator).
+ */
+static void lunet_timeslice_hook(lua_State *L, lua_Debug *ar) {
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt || rt->slice_ns == 0 || L != rt->current_co) {
+    return;
+  }
+  if (uv_hrtime() - rt->slice_start < rt->slice_ns || !lua_isyieldable(L)) {
+    return;
+  }
+  rt->preemptions++;
+  lunet_timeslice_record(L, ar);
+  lunet_co_resume(L, 0, "timeslice");
+  lua_yield(L, 0);
+}
 
+int lunet_set_timeslice(lua_State *L) {
+  lua_Number ms = luaL_checknumber(L, 1);
+  luaL_argcheck(L, ms >= 0, 1, "time slice must be >= 0");
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt) {
+    return 0;
+  }
+  rt->slice_ns = (uint64_t)(ms * 1e6);
+  // LuaJIT hooks are per VM, so this covers every coroutine of this loop
+  if (rt->slice_ns) {
+    lua_sethook(L, lunet_timeslice_hook, LUA_MASKCOUNT, LUNET_TIMESLICE_INSTRUCTIONS);
+  } else {
+    lua_sethook(L, NULL, 0, 0);
+  }
   return 0;
 }
 
+int lunet_timeslice_overruns(lua_State *L) {
+  lunet_rt_t *rt = lunet_rt();
+  lua_newtable(L);
+  lunet_timeslice_push_overruns(L);
+  lua_pushnil(L);
+  while (lua_next(L, -2) != 0) {
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, -5);
+  }
+  lua_pop(L, 1);
+  lua_pushnumber(L, rt ? (lua_Number)rt->preemptions : 0);
+  return 2;
+}
+
 int _lunet_ensure_coroutine(lua_State *L, const char *func_name) {
   if (lua_pushthread(L)) {
     lua_pop(L, 1);
@@ -0,0 +1,81 @@
+#include "embed.h"
+
+#include <string.h>
+
+#ifdef LUNET_EMBED
+/* Defined by the file bin/embed_bytecode.lua generates */
+extern const lunet_embed_module_t lunet_embed_modules[];
+extern const size_t lunet_embed_count;
+extern const char *const lunet_embed_main_name;
+
+static const lunet_embed_module_t *embed_find(const char *name) {
+  size_t lo = 0;
+  size_t hi = lunet_embed_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(name, lunet_embed_modules[mid].name);
+    if (cmp == 0) {
+      return &lunet_embed_modules[mid];
+    }
+    if (cmp < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return NULL;
+}
+#else
+static const lunet_embed_module_t *embed_find(const char *name) {
+  (void)name;
+  return NULL;
+}
+#endif
+
+int lunet_embed_load(lua_State *L, const char *name) {
+  const lunet_embed_module_t *m = embed_find(name);
+  if (!m) {
+    lua_pushfstring(L, "no embedded module '%s'", name);
+    return LUA_ERRFILE;
+  }
+  return luaL_loadbuffer(L, (const char *)m->data, m->size, m->chunkname);
+}
+
+const char *lunet_embed_main(void) {
+#ifdef LUNET_EMBED
+  return lunet_embed_main_name;
+#else
+  return NULL;
+#endif
+}
+
+#ifdef LUNET_EMBED
+static int embed_loader(lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  if (!embed_find(name)) {
+    lua_pushfstring(L, "\n\tno embedded module '%s'", name);
+    return 1;
+  }
+  if (lunet_embed_load(L, name) != 0) {
+    return luaL_error(L, "error loading embedded module '%s':\n\t%s", name, lua_tostring(L, -1));
+  }
+  return 1;
+}
+
+void lunet_embed_install(lua_State *L) {
+  // package.loaders is {preload, lua, c, croot}; insert ours as [2]
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "loaders");
+  if (lua_istable(L, -1)) {
+    for (int i = (int)lua_objlen(L, -1); i >= 2; i--) {
+      lua_rawgeti(L, -1, i);
+      lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushcfunction(L, embed_loader);
+    lua_rawseti(L, -2, 2);
+  }
+  lua_pop(L, 2);
+}
+#else
+void lunet_embed_install(lua_State *L) { (void)L; }
+#endif
@@ -1,13 +1,20 @@
 #include "fs.h"
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <uv.h>
 
 #include "co.h"
+#include "rt.h"
+#include "slab.h"
 #include "trace.h"
 
+// Largest single fs.read; longer requests are shortened (reads may be short)
+#define LUNET_FS_READ_MAX ((size_t)INT_MAX)
+
 typedef struct {
   uv_fs_t req;
   lua_State *L;
@@ -39,11 +46,13 @@ static void lunet_fs_open_cb(uv_fs_t *req) {
     lua_pushstring(co, uv_strerror((int)req->result));
   }
 
-  lua_resume(co, 2);
+  lunet_co_resume(co, 2, "fs.open");
 
 cleanup:
+  LUNET_STAT_ADD(fs_pending, -1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_DONE, req, req->result);
   uv_fs_req_cleanup(req);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 // mode to uv_fs_open flags
@@ -121,7 +130,7 @@ int lunet_fs_open(lua_State *L) {
     return 2;
   }
 
-  fs_ctx_t *ctx = malloc(sizeof(fs_ctx_t));
+  fs_ctx_t *ctx = LUNET_SLAB_NEW(fs_ctx_t);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "fs.open: out of memory");
@@ -132,15 +141,17 @@ int lunet_fs_open(lua_State *L) {
   lunet_coref_create(L, ctx->co_ref);
   ctx->req.data = ctx;
 
-  int rc = uv_fs_open(uv_default_loop(), &ctx->req, path, flags, 0644, lunet_fs_open_cb);
+  int rc = uv_fs_open(default_loop(), &ctx->req, path, flags, 0644, lunet_fs_open_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(rc));
     return 2;
   }
 
+  LUNET_STAT_ADD(fs_pending, 1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_START, &ctx->req, ctx->req.fs_type);
   return lua_yield(L, 0);
 }
 
@@ -173,11 +184,13 @@ static void lunet_fs_close_cb(uv_fs_t *req) {
     lua_pushstring(co, uv_strerror((int)req->result));
   }
 
-  lua_resume(co, 1);
+  lunet_co_resume(co, 1, "fs.close");
 
 cleanup:
+  LUNET_STAT_ADD(fs_pending, -1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_DONE, req, req->result);
   uv_fs_req_cleanup(req);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_fs_close(lua_State *L) {
@@ -191,7 +204,7 @@ int lunet_fs_close(lua_State *L) {
 
   uv_file fd = (uv_file)lua_tointeger(L, 1);
 
-  fs_close_ctx_t *ctx = malloc(sizeof(fs_close_ctx_t));
+  fs_close_ctx_t *ctx = LUNET_SLAB_NEW(fs_close_ctx_t);
   if (!ctx) {
     lua_pushstring(L, "fs.close: out of memory");
     return 1;
@@ -201,14 +214,16 @@ int lunet_fs_close(lua_State *L) {
   lunet_coref_create(L, ctx->co_ref);
   ctx->req.data = ctx;
 
-  int rc = uv_fs_close(uv_default_loop(), &ctx->req, fd, lunet_fs_close_cb);
+  int rc = uv_fs_close(default_loop(), &ctx->req, fd, lunet_fs_close_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushstring(L, uv_strerror(rc));
     return 1;
   }
 
+  LUNET_STAT_ADD(fs_pending, 1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_START, &ctx->req, ctx->req.fs_type);
   return lua_yield(L, 0);
 }
 
@@ -292,11 +307,13 @@ static void lunet_fs_stat_cb(uv_fs_t *req) {
     lua_pushstring(co, uv_strerror((int)req->result));
   }
 
-  lua_resume(co, 2);
+  lunet_co_resume(co, 2, "fs.stat");
 
 cleanup:
+  LUNET_STAT_ADD(fs_pending, -1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_DONE, req, req->result);
   uv_fs_req_cleanup(req);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_fs_stat(lua_State *L) {
@@ -312,7 +329,7 @@ int lunet_fs_stat(lua_State *L) {
 
   const char *path = luaL_checkstring(L, 1);
 
-  fs_stat_ctx_t *ctx = malloc(sizeof(fs_stat_ctx_t));
+  fs_stat_ctx_t *ctx = LUNET_SLAB_NEW(fs_stat_ctx_t);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "fs.fstat out of memory");
@@ -323,15 +340,17 @@ int lunet_fs_stat(lua_State *L) {
   lunet_coref_create(L, ctx->co_ref);
   ctx->req.data = ctx;
 
-  int rc = uv_fs_stat(uv_default_loop(), &ctx->req, path, lunet_fs_stat_cb);
+  int rc = uv_fs_stat(default_loop(), &ctx->req, path, lunet_fs_stat_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(rc));
     return 2;
   }
 
+  LUNET_STAT_ADD(fs_pending, 1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_START, &ctx->req, ctx->req.fs_type);
   return lua_yield(L, 0);
 }
 
@@ -340,7 +359,7 @@ typedef struct {
   lua_State *L;
   int co_ref;
   size_t len;
-  char *buf;
+  char *buf;  /* follows the struct in the same block */
 } fs_read_ctx_t;
 
 static void lunet_fs_read_cb(uv_fs_t *req) {
@@ -367,12 +386,13 @@ static void lunet_fs_read_cb(uv_fs_t *req) {
     lua_pushstring(co, uv_strerror((int)req->result));
   }
 
-  lua_resume(co, 2);
+  lunet_co_resume(co, 2, "fs.read");
 
 cleanup:
+  LUNET_STAT_ADD(fs_pending, -1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_DONE, req, req->result);
   uv_fs_req_cleanup(req);
-  free(ctx->buf);
-  free(ctx);
+  lunet_slab_free(ctx, sizeof(*ctx) + ctx->len);
 }
 int lunet_fs_read(lua_State *L) {
   if (lunet_ensure_coroutine(L, "fs.read") != 0) {
@@ -385,9 +405,17 @@ int lunet_fs_read(lua_State *L) {
   }
 
   uv_file fd = (uv_file)lua_tointeger(L, 1);
-  size_t len = (size_t)lua_tointeger(L, 2);
+  lua_Integer n = lua_tointeger(L, 2);
+  if (n < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, "fs.read length must be >= 0");
+    return 2;
+  }
+  // a read may return fewer bytes anyway; the cap keeps the buffer size
+  // within uv_buf_t and the allocation size below from overflowing
+  size_t len = (uint64_t)n > LUNET_FS_READ_MAX ? LUNET_FS_READ_MAX : (size_t)n;
 
-  fs_read_ctx_t *ctx = malloc(sizeof(fs_read_ctx_t));
+  fs_read_ctx_t *ctx = (fs_read_ctx_t *)lunet_slab_alloc(sizeof(fs_read_ctx_t) + len);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "fs.read out of memory");
@@ -397,27 +425,21 @@ int lunet_fs_read(lua_State *L) {
   ctx->L = L;
   lunet_coref_create(L, ctx->co_ref);
   ctx->len = len;
-  ctx->buf = malloc(len);
-  if (!ctx->buf) {
-    lunet_coref_release(L, ctx->co_ref);
-    free(ctx);
-    lua_pushnil(L);
-    lua_pushstring(L, "fs.read out of memory");
-    return 2;
-  }
+  ctx->buf = (char *)(ctx + 1);
   ctx->req.data = ctx;
 
   uv_buf_t buf = uv_buf_init(ctx->buf, len);
-  int rc = uv_fs_read(uv_default_loop(), &ctx->req, fd, &buf, 1, 0, lunet_fs_read_cb);
+  int rc = uv_fs_read(default_loop(), &ctx->req, fd, &buf, 1, 0, lunet_fs_read_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
-    free(ctx->buf);
-    free(ctx);
+    lunet_slab_free(ctx, sizeof(*ctx) + ctx->len);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(rc));
     return 2;
   }
 
+  LUNET_STAT_ADD(fs_pending, 1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_START, &ctx->req, ctx->req.fs_type);
   return lua_yield(L, 0);
 }
 
@@ -427,7 +449,7 @@ typedef struct {
   int co_ref;
 
   size_t len;
-  char *buf;
+  char *buf;  /* follows the struct in the same block */
 } fs_write_ctx_t;
 
 static void lunet_fs_write_cb(uv_fs_t *req) {
@@ -454,12 +476,13 @@ static void lunet_fs_write_cb(uv_fs_t *req) {
     lua_pushstring(co, uv_strerror((int)req->result));
   }
 
-  lua_resume(co, 2);
+  lunet_co_resume(co, 2, "fs.write");
 
 cleanup:
+  LUNET_STAT_ADD(fs_pending, -1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_DONE, req, req->result);
   uv_fs_req_cleanup(req);
-  free(ctx->buf);
-  free(ctx);
+  lunet_slab_free(ctx, sizeof(*ctx) + ctx->len);
 }
 
 int lunet_fs_write(lua_State *L) {
@@ -475,7 +498,7 @@ int lunet_fs_write(lua_State *L) {
   const char *data = luaL_checkstring(L, 2);
   size_t len = strlen(data);
 
-  fs_write_ctx_t *ctx = malloc(sizeof(fs_write_ctx_t));
+  fs_write_ctx_t *ctx = (fs_write_ctx_t *)lunet_slab_alloc(sizeof(fs_write_ctx_t) + len);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "fs.write out of memory");
@@ -485,29 +508,22 @@ int lunet_fs_write(lua_State *L) {
   ctx->L = L;
   lunet_coref_create(L, ctx->co_ref);
   ctx->len = len;
-  ctx->buf = malloc(len);
-  if (!ctx->buf) {
-    lunet_coref_release(L, ctx->co_ref);
-    free(ctx);
-    lua_pushnil(L);
-    lua_pushstring(L, "fs.write out of memory");
-    return 2;
-  }
-
+  ctx->buf = (char *)(ctx + 1);
   memcpy(ctx->buf, data, len);
   ctx->req.data = ctx;
 
   uv_buf_t buf = uv_buf_init(ctx->buf, len);
-  int rc = uv_fs_write(uv_default_loop(), &ctx->req, fd, &buf, 1, 0, lunet_fs_write_cb);
+  int rc = uv_fs_write(default_loop(), &ctx->req, fd, &buf, 1, 0, lunet_fs_write_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
-    free(ctx->buf);
-    free(ctx);
+    lunet_slab_free(ctx, sizeof(*ctx) + ctx->len);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(rc));
     return 2;
   }
 
+  LUNET_STAT_ADD(fs_pending, 1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_START, &ctx->req, ctx->req.fs_type);
   return lua_yield(L, 0);
 }
 
@@ -574,11 +590,13 @@ static void lunet_fs_scandir_cb(uv_fs_t *req) {
     lua_pushnil(co);
   }
 
-  lua_resume(co, 2);
+  lunet_co_resume(co, 2, "fs.scandir");
 
 cleanup:
+  LUNET_STAT_ADD(fs_pending, -1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_DONE, req, req->result);
   uv_fs_req_cleanup(req);
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_fs_scandir(lua_State *L) {
@@ -593,7 +611,7 @@ int lunet_fs_scandir(lua_State *L) {
 
   const char *path = luaL_checkstring(L, 1);
 
-  fs_scandir_ctx_t *ctx = malloc(sizeof(fs_scandir_ctx_t));
+  fs_scandir_ctx_t *ctx = LUNET_SLAB_NEW(fs_scandir_ctx_t);
   if (!ctx) {
     lua_pushnil(L);
     lua_pushstring(L, "fs.scandir out of memory");
@@ -604,14 +622,16 @@ int lunet_fs_scandir(lua_State *L) {
   lunet_coref_create(L, ctx->co_ref);
   ctx->req.data = ctx;
 
-  int rc = uv_fs_scandir(uv_default_loop(), &ctx->req, path, 0, lunet_fs_scandir_cb);
+  int rc = uv_fs_scandir(default_loop(), &ctx->req, path, 0, lunet_fs_scandir_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
-    free(ctx);
+    LUNET_SLAB_FREE(ctx);
     lua_pushnil(L);
     lua_pushstring(L, uv_strerror(rc));
     return 2;
   }
 
+  LUNET_STAT_ADD(fs_pending, 1);
+  LUNET_TRACE_EVENT(LUNET_EV_FS_START, &ctx->req, ctx->req.fs_type);
   return lua_yield(L, 0);
 }
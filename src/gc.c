@@ -0,0 +1,102 @@
+#include "gc.h"
+
+#include <uv.h>
+
+// A finished idle cycle is followed by the next once the heap grew by 1/8
+#define LUNET_GC_REGROW_SHIFT 3
+#define LUNET_GC_REGROW_MIN_KB 64
+
+static void lunet_gc_prepare_cb(uv_prepare_t *handle) {
+  lunet_rt_t *rt = (lunet_rt_t *)handle->data;
+  if (!rt->gc_budget_ns) {
+    return;
+  }
+  // 0 means poll will not block: the loop has work, stepping now would delay it
+  int timeout = uv_backend_timeout(rt->loop);
+  if (timeout == 0) {
+    return;
+  }
+  lua_State *L = rt->L;
+  int kb = lua_gc(L, LUA_GCCOUNT, 0);
+  if (rt->gc_done_kb >= 0) {
+    int regrow = rt->gc_done_kb >> LUNET_GC_REGROW_SHIFT;
+    if (kb - rt->gc_done_kb < (regrow > LUNET_GC_REGROW_MIN_KB ? regrow : LUNET_GC_REGROW_MIN_KB)) {
+      return;
+    }
+  }
+
+  // Never step past the next timer
+  uint64_t budget = rt->gc_budget_ns;
+  if (timeout > 0 && (uint64_t)timeout * 1000000 < budget) {
+    budget = (uint64_t)timeout * 1000000;
+  }
+  uint64_t start = uv_hrtime();
+  uint64_t elapsed;
+  rt->gc_done_kb = -1;
+  do {
+    rt->stats.gc_steps++;
+    if (lua_gc(L, LUA_GCSTEP, rt->gc_step_kb)) {
+      rt->stats.gc_cycles++;
+      rt->gc_done_kb = lua_gc(L, LUA_GCCOUNT, 0);
+      elapsed = uv_hrtime() - start;
+      break;
+    }
+    elapsed = uv_hrtime() - start;
+  } while (elapsed < budget);
+
+  rt->stats.gc_ns += elapsed;
+  if (elapsed > rt->stats.gc_max_ns) {
+    rt->stats.gc_max_ns = elapsed;
+  }
+}
+
+int lunet_gc_init(lunet_rt_t *rt) {
+  rt->gc_step_kb = LUNET_GC_STEP_DEFAULT;
+  rt->gc_budget_ns = (uint64_t)LUNET_GC_BUDGET_DEFAULT * 1000000;
+  rt->gc_done_kb = -1;
+  if (uv_prepare_init(rt->loop, &rt->gc_prepare) != 0) {
+    rt->gc_init = 0;
+    return -1;
+  }
+  rt->gc_prepare.data = rt;
+  uv_prepare_start(&rt->gc_prepare, lunet_gc_prepare_cb);
+  // idle stepping must not keep the loop alive
+  uv_unref((uv_handle_t *)&rt->gc_prepare);
+  rt->gc_init = 1;
+  return 0;
+}
+
+void lunet_gc_close(lunet_rt_t *rt) {
+  if (rt->gc_init) {
+    uv_close((uv_handle_t *)&rt->gc_prepare, NULL);
+    rt->gc_init = 0;
+  }
+}
+
+int lunet_set_gc(lua_State *L) {
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt) {
+    return 0;
+  }
+  if (lua_isboolean(L, 1) && !lua_toboolean(L, 1)) {
+    rt->gc_budget_ns = 0;
+    return 0;
+  }
+
+  lua_Number step = rt->gc_step_kb;
+  lua_Number budget = rt->gc_budget_ns ? (lua_Number)rt->gc_budget_ns / 1e6 : LUNET_GC_BUDGET_DEFAULT;
+  if (lua_istable(L, 1)) {
+    lua_getfield(L, 1, "step");
+    step = luaL_optnumber(L, -1, step);
+    lua_getfield(L, 1, "budget");
+    budget = luaL_optnumber(L, -1, budget);
+    lua_pop(L, 2);
+  }
+  luaL_argcheck(L, step >= 0, 1, "step must be >= 0");
+  luaL_argcheck(L, budget > 0, 1, "budget must be > 0 ms");
+
+  rt->gc_step_kb = (int)step;
+  rt->gc_budget_ns = (uint64_t)(budget * 1e6);
+  rt->gc_done_kb = -1;
+  return 0;
+}
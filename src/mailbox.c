@@ -0,0 +1,509 @@
+#include "mailbox.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "co.h"
+#include "mpsc.h"
+#include "serialize.h"
+#include "stl.h"
+#include "trace.h"
+
+#define LUNET_MAILBOX_MT "lunet.mailbox"
+#define LUNET_MAILBOX_REMOTE_MT "lunet.mailbox.remote"
+#define LUNET_MAILBOX_CLOSED "mailbox closed"
+
+/*
+ * Cross-thread mailboxes.
+ *
+ * A mailbox is owned by the loop that opened it; any thread may post to it.
+ * Messages go through a lock-free MPSC queue and each post signals the owner
+ * loop's single uv_async_t. libuv coalesces those signals, so one wakeup
+ * drains every pending message of every mailbox on that loop and hands them
+ * to parked receivers through the ready queue.
+ *
+ * Names are process wide and resolved under a mutex only at lookup time.
+ * Mailboxes are reference counted: the owner holds one reference and every
+ * remote handle another, so a handle that outlives the owner just sees
+ * "mailbox closed".
+ */
+
+typedef struct {
+  lunet_mpsc_node_t node;  // must be first
+  int raw;                 // data is a plain byte string, not serialized values
+  size_t len;
+  char data[];
+} lunet_mail_t;
+
+struct lunet_mailbox_s {
+  lunet_mpsc_t queue;
+  volatile long refs;
+  volatile long senders;  // posts in flight; close waits for them
+  volatile long closed;
+  uv_async_t *async;      // owner loop's wakeup handle
+  char name[LUNET_MAILBOX_NAME_MAX];
+  struct lunet_mailbox_s *next;  // name registry, under g_mailbox_lock
+
+  // owner thread only
+  lunet_rt_t *rt;                     // NULL once shut down
+  queue_t *waiting;                   // coroutine refs parked in recv
+  struct lunet_mailbox_s *loop_next;  // rt->mailboxes list
+};
+
+typedef struct lunet_mailbox_s lunet_mailbox_t;
+
+typedef struct {
+  lunet_mailbox_t *mb;
+} mailbox_ud_t;
+
+static uv_once_t g_mailbox_once = UV_ONCE_INIT;
+static uv_mutex_t g_mailbox_lock;
+static lunet_mailbox_t *g_mailboxes = NULL;
+
+static void mailbox_registry_init(void) { uv_mutex_init(&g_mailbox_lock); }
+
+// Caller holds g_mailbox_lock
+static lunet_mailbox_t *mailbox_find(const char *name) {
+  for (lunet_mailbox_t *mb = g_mailboxes; mb; mb = mb->next) {
+    if (strcmp(mb->name, name) == 0) {
+      return mb;
+    }
+  }
+  return NULL;
+}
+
+static lunet_mailbox_t *mailbox_acquire(const char *name) {
+  uv_once(&g_mailbox_once, mailbox_registry_init);
+  uv_mutex_lock(&g_mailbox_lock);
+  lunet_mailbox_t *mb = mailbox_find(name);
+  if (mb) {
+    LUNET_ATOMIC_ADD(&mb->refs, 1);
+  }
+  uv_mutex_unlock(&g_mailbox_lock);
+  return mb;
+}
+
+static void mailbox_release(lunet_mailbox_t *mb) {
+  if (LUNET_ATOMIC_ADD(&mb->refs, -1) > 0) {
+    return;
+  }
+  // last reference: nobody can post any more
+  lunet_mpsc_node_t *node;
+  while ((node = lunet_mpsc_pop(&mb->queue)) != NULL) {
+    free(node);
+  }
+  free(mb);
+}
+
+static lunet_mail_t *mail_new(const void *data, size_t len, int raw) {
+  lunet_mail_t *mail = (lunet_mail_t *)malloc(sizeof(lunet_mail_t) + len);
+  if (!mail) {
+    return NULL;
+  }
+  mail->raw = raw;
+  mail->len = len;
+  memcpy(mail->data, data, len);
+  return mail;
+}
+
+// Returns 0, or UV_EPIPE if the mailbox is closing (mail is not consumed)
+static int mailbox_post(lunet_mailbox_t *mb, lunet_mail_t *mail) {
+  LUNET_ATOMIC_ADD(&mb->senders, 1);
+  if (LUNET_ATOMIC_LOAD(&mb->closed)) {
+    LUNET_ATOMIC_ADD(&mb->senders, -1);
+    return UV_EPIPE;
+  }
+  lunet_mpsc_push(&mb->queue, &mail->node);
+  uv_async_send(mb->async);
+  LUNET_ATOMIC_ADD(&mb->senders, -1);
+  return 0;
+}
+
+// Push the message value onto L and free it; returns -1 if it is malformed
+static int mail_push(lua_State *L, lunet_mail_t *mail) {
+  int rc = 0;
+  if (mail->raw) {
+    lua_pushlstring(L, mail->data, mail->len);
+  } else {
+    int n = lunet_deserialize(L, mail->data, mail->len);
+    if (n != 1) {
+      if (n > 0) lua_pop(L, n);
+      rc = -1;
+    }
+  }
+  free(mail);
+  return rc;
+}
+
+static lua_State *mailbox_take_waiter(lunet_mailbox_t *mb, int *ref) {
+  lua_State *L = mb->rt->L;
+  *ref = (int)(intptr_t)queue_dequeue(mb->waiting);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, *ref);
+  lua_State *co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  return co;
+}
+
+static void mailbox_unpark(lunet_rt_t *rt) {
+  if (--rt->mail_waiting == 0) {
+    uv_unref((uv_handle_t *)rt->mail_async);
+  }
+}
+
+static void mailbox_async_cb(uv_async_t *handle) {
+  lunet_rt_t *rt = (lunet_rt_t *)handle->data;
+  for (lunet_mailbox_t *mb = rt->mailboxes; mb; mb = mb->loop_next) {
+    while (!queue_is_empty(mb->waiting)) {
+      lunet_mail_t *mail = (lunet_mail_t *)lunet_mpsc_pop(&mb->queue);
+      if (!mail) {
+        break;  // the rest waits in the queue for a later recv
+      }
+      int ref;
+      lua_State *co = mailbox_take_waiter(mb, &ref);
+      if (mail_push(co, mail) == 0) {
+        lua_pushnil(co);
+      } else {
+        lua_pushnil(co);
+        lua_pushstring(co, "malformed message");
+      }
+      lunet_co_resume(co, 2, "mailbox.recv");
+      lunet_coref_release(rt->L, ref);
+      mailbox_unpark(rt);
+    }
+  }
+}
+
+static void mailbox_async_close_cb(uv_handle_t *handle) { free(handle); }
+
+static int mailbox_loop_init(lunet_rt_t *rt) {
+  if (rt->mail_async) {
+    return 0;
+  }
+  uv_async_t *async = (uv_async_t *)malloc(sizeof(uv_async_t));
+  if (!async) {
+    return UV_ENOMEM;
+  }
+  int ret = uv_async_init(rt->loop, async, mailbox_async_cb);
+  if (ret < 0) {
+    free(async);
+    return ret;
+  }
+  async->data = rt;
+  // only parked receivers keep the loop alive
+  uv_unref((uv_handle_t *)async);
+  rt->mail_async = async;
+  rt->mail_waiting = 0;
+  return 0;
+}
+
+/*
+ * Stop accepting posts, unregister the name and fail parked receivers. With
+ * wake == 0 (loop already finished) receivers are just released.
+ */
+static void mailbox_shutdown(lunet_mailbox_t *mb, int wake) {
+  lunet_rt_t *rt = mb->rt;
+
+  uv_mutex_lock(&g_mailbox_lock);
+  for (lunet_mailbox_t **p = &g_mailboxes; *p; p = &(*p)->next) {
+    if (*p == mb) {
+      *p = mb->next;
+      break;
+    }
+  }
+  uv_mutex_unlock(&g_mailbox_lock);
+
+  LUNET_ATOMIC_STORE(&mb->closed, 1);
+  // a sender that saw closed == 0 is at most one push away from done; yield so
+  // a preempted sender on the same core gets to finish it
+  while (LUNET_ATOMIC_LOAD(&mb->senders) > 0) {
+    uv_sleep(0);
+  }
+
+  for (lunet_mailbox_t **p = &rt->mailboxes; *p; p = &(*p)->loop_next) {
+    if (*p == mb) {
+      *p = mb->loop_next;
+      break;
+    }
+  }
+
+  int ref;
+  while (!queue_is_empty(mb->waiting)) {
+    lua_State *co = mailbox_take_waiter(mb, &ref);
+    if (wake) {
+      lua_pushnil(co);
+      lua_pushstring(co, LUNET_MAILBOX_CLOSED);
+      lunet_co_resume(co, 2, "mailbox.recv");
+    }
+    lunet_coref_release(rt->L, ref);
+    mailbox_unpark(rt);
+  }
+  queue_destroy(mb->waiting);
+  mb->waiting = NULL;
+  mb->rt = NULL;
+}
+
+void lunet_mailbox_close_all(lunet_rt_t *rt) {
+  while (rt->mailboxes) {
+    mailbox_shutdown(rt->mailboxes, 0);
+  }
+  if (rt->mail_async) {
+    uv_close((uv_handle_t *)rt->mail_async, mailbox_async_close_cb);
+    rt->mail_async = NULL;
+  }
+}
+
+// Owner side
+
+static lunet_mailbox_t *check_mailbox(lua_State *L) {
+  mailbox_ud_t *ud = (mailbox_ud_t *)luaL_checkudata(L, 1, LUNET_MAILBOX_MT);
+  return ud->mb && ud->mb->rt ? ud->mb : NULL;
+}
+
+static int mailbox_recv(lua_State *L) {
+  lunet_mailbox_t *mb = check_mailbox(L);
+  lua_settop(L, 1);
+  if (!mb) {
+    lua_pushnil(L);
+    lua_pushstring(L, LUNET_MAILBOX_CLOSED);
+    return 2;
+  }
+
+  // earlier receivers are served first
+  if (queue_is_empty(mb->waiting)) {
+    lunet_mail_t *mail = (lunet_mail_t *)lunet_mpsc_pop(&mb->queue);
+    if (mail) {
+      if (mail_push(L, mail) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "malformed message");
+        return 2;
+      }
+      lua_pushnil(L);
+      return 2;
+    }
+  }
+
+  if (lunet_ensure_coroutine(L, "mailbox.recv") != 0) {
+    return lua_error(L);
+  }
+  int ref;
+  lunet_coref_create(L, ref);
+  if (queue_enqueue(mb->waiting, (void *)(intptr_t)ref) != 0) {
+    lunet_coref_release(L, ref);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  if (mb->rt->mail_waiting++ == 0) {
+    uv_ref((uv_handle_t *)mb->rt->mail_async);
+  }
+  lua_settop(L, 0);
+  return lua_yield(L, 0);
+}
+
+static int mailbox_try_recv(lua_State *L) {
+  lunet_mailbox_t *mb = check_mailbox(L);
+  lua_settop(L, 1);
+  if (!mb) {
+    lua_pushnil(L);
+    lua_pushstring(L, LUNET_MAILBOX_CLOSED);
+    return 2;
+  }
+  lunet_mail_t *mail = queue_is_empty(mb->waiting) ? (lunet_mail_t *)lunet_mpsc_pop(&mb->queue) : NULL;
+  if (!mail) {
+    lua_pushnil(L);
+    lua_pushstring(L, "mailbox empty");
+    return 2;
+  }
+  if (mail_push(L, mail) != 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, "malformed message");
+    return 2;
+  }
+  lua_pushnil(L);
+  return 2;
+}
+
+static int mailbox_close(lua_State *L) {
+  mailbox_ud_t *ud = (mailbox_ud_t *)luaL_checkudata(L, 1, LUNET_MAILBOX_MT);
+  if (!ud->mb) {
+    return 0;
+  }
+  if (ud->mb->rt) {
+    mailbox_shutdown(ud->mb, 1);
+  }
+  mailbox_release(ud->mb);
+  ud->mb = NULL;
+  return 0;
+}
+
+static int mailbox_name(lua_State *L) {
+  mailbox_ud_t *ud = (mailbox_ud_t *)luaL_checkudata(L, 1, LUNET_MAILBOX_MT);
+  if (!ud->mb) {
+    return 0;
+  }
+  lua_pushstring(L, ud->mb->name);
+  return 1;
+}
+
+int lunet_mailbox_open(lua_State *L) {
+  size_t len;
+  const char *name = luaL_checklstring(L, 1, &len);
+  luaL_argcheck(L, len > 0 && len < LUNET_MAILBOX_NAME_MAX, 1, "invalid mailbox name");
+
+  lunet_rt_t *rt = lunet_rt();
+  int ret = rt ? mailbox_loop_init(rt) : UV_EINVAL;
+  if (ret < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, uv_strerror(ret));
+    return 2;
+  }
+
+  lunet_mailbox_t *mb = (lunet_mailbox_t *)calloc(1, sizeof(lunet_mailbox_t));
+  queue_t *waiting = queue_init();
+  if (!mb || !waiting) {
+    free(mb);
+    if (waiting) queue_destroy(waiting);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  lunet_mpsc_init(&mb->queue);
+  mb->refs = 1;
+  mb->async = rt->mail_async;
+  memcpy(mb->name, name, len + 1);
+  mb->rt = rt;
+  mb->waiting = waiting;
+
+  uv_once(&g_mailbox_once, mailbox_registry_init);
+  uv_mutex_lock(&g_mailbox_lock);
+  if (mailbox_find(name)) {
+    uv_mutex_unlock(&g_mailbox_lock);
+    queue_destroy(waiting);
+    free(mb);
+    lua_pushnil(L);
+    lua_pushstring(L, "mailbox name in use");
+    return 2;
+  }
+  mb->next = g_mailboxes;
+  g_mailboxes = mb;
+  uv_mutex_unlock(&g_mailbox_lock);
+
+  mb->loop_next = rt->mailboxes;
+  rt->mailboxes = mb;
+
+  mailbox_ud_t *ud = (mailbox_ud_t *)lua_newuserdata(L, sizeof(mailbox_ud_t));
+  ud->mb = mb;
+  if (luaL_newmetatable(L, LUNET_MAILBOX_MT)) {
+    luaL_Reg methods[] = {{"recv", mailbox_recv},
+                          {"try_recv", mailbox_try_recv},
+                          {"close", mailbox_close},
+                          {"name", mailbox_name},
+                          {NULL, NULL}};
+    lua_newtable(L);
+    luaL_register(L, NULL, methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, mailbox_close);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+// Sender side
+
+// Serialize the value at idx and post it; pushes the Lua results
+static int mailbox_send_value(lua_State *L, lunet_mailbox_t *mb, int idx) {
+  lunet_buf_t buf;
+  const char *err;
+  lunet_buf_init(&buf);
+  if (lunet_serialize(L, idx, idx, &buf, &err) != 0) {
+    lunet_buf_free(&buf);
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  lunet_mail_t *mail = mail_new(buf.data, buf.len, 0);
+  lunet_buf_free(&buf);
+  if (!mail) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  if (mailbox_post(mb, mail) != 0) {
+    free(mail);
+    lua_pushnil(L);
+    lua_pushstring(L, LUNET_MAILBOX_CLOSED);
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+static int remote_send(lua_State *L) {
+  mailbox_ud_t *ud = (mailbox_ud_t *)luaL_checkudata(L, 1, LUNET_MAILBOX_REMOTE_MT);
+  luaL_checkany(L, 2);
+  luaL_argcheck(L, !lua_isnil(L, 2), 2, "cannot send nil");
+  return mailbox_send_value(L, ud->mb, 2);
+}
+
+static int remote_gc(lua_State *L) {
+  mailbox_ud_t *ud = (mailbox_ud_t *)luaL_checkudata(L, 1, LUNET_MAILBOX_REMOTE_MT);
+  if (ud->mb) {
+    mailbox_release(ud->mb);
+    ud->mb = NULL;
+  }
+  return 0;
+}
+
+int lunet_mailbox_lookup(lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  lunet_mailbox_t *mb = mailbox_acquire(name);
+  if (!mb) {
+    lua_pushnil(L);
+    lua_pushstring(L, "no such mailbox");
+    return 2;
+  }
+
+  mailbox_ud_t *ud = (mailbox_ud_t *)lua_newuserdata(L, sizeof(mailbox_ud_t));
+  ud->mb = mb;
+  if (luaL_newmetatable(L, LUNET_MAILBOX_REMOTE_MT)) {
+    luaL_Reg methods[] = {{"send", remote_send}, {NULL, NULL}};
+    lua_newtable(L);
+    luaL_register(L, NULL, methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, remote_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+int lunet_mailbox_send(lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  luaL_checkany(L, 2);
+  luaL_argcheck(L, !lua_isnil(L, 2), 2, "cannot send nil");
+  lunet_mailbox_t *mb = mailbox_acquire(name);
+  if (!mb) {
+    lua_pushnil(L);
+    lua_pushstring(L, "no such mailbox");
+    return 2;
+  }
+  int n = mailbox_send_value(L, mb, 2);
+  mailbox_release(mb);
+  return n;
+}
+
+int lunet_mailbox_post(const char *name, const void *data, size_t len) {
+  lunet_mailbox_t *mb = mailbox_acquire(name);
+  if (!mb) {
+    return UV_ENOENT;
+  }
+  lunet_mail_t *mail = mail_new(data, len, 1);
+  int ret = mail ? mailbox_post(mb, mail) : UV_ENOMEM;
+  if (ret != 0) {
+    free(mail);
+  }
+  mailbox_release(mb);
+  return ret;
+}
@@ -8,14 +8,29 @@
 
 #include "lunet_lua.h"
 #include "lunet_exports.h"
+#include "alloc.h"
+#include "bccache.h"
+#include "channel.h"
 #include "co.h"
+#include "embed.h"
 #include "fs.h"
+#include "gc.h"
 #include "lunet_signal.h"
+#include "mailbox.h"
+#include "monitor.h"
+#include "pool.h"
+#include "prefork.h"
+#include "profiler.h"
+#include "reload.h"
 #include "rt.h"
 #include "socket.h"
+#include "stats.h"
 #include "timer.h"
 #include "udp.h"
+#include "upgrade.h"
+#include "work.h"
 #include "trace.h"
+#include "trace_ring.h"
 #include "runtime.h"
 
 static char *lunet_resolve_executable_path(const char *argv0) {
@@ -30,7 +45,25 @@ lunet_runtime_config_t g_lunet_config = {0};
 
 // register core module
 int lunet_open_core(lua_State *L) {
-  luaL_Reg funcs[] = {{"spawn", lunet_spawn}, {"sleep", lunet_sleep}, {NULL, NULL}};
+  luaL_Reg funcs[] = {{"spawn", lunet_spawn},
+                      {"spawn_pool", lunet_spawn_pool},
+                      {"set_spawn_pool_size", lunet_set_spawn_pool_size},
+                      {"set_resume_budget", lunet_set_resume_budget},
+                      {"set_timeslice", lunet_set_timeslice},
+                      {"channel", lunet_channel_new},
+                      {"timeslice_overruns", lunet_timeslice_overruns},
+                      {"sleep", lunet_sleep},
+                      {"worker_id", lunet_worker_id},
+                      {"worker_count", lunet_worker_count},
+                      {"stats", lunet_stats},
+                      {"set_monitor", lunet_set_monitor},
+                      {"monitor_stats", lunet_monitor_stats},
+                      {"set_gc", lunet_set_gc},
+                      {"mem_stats", lunet_mem_stats},
+                      {"set_mem_attribution", lunet_set_mem_attribution},
+                      {"reload", lunet_reload},
+                      {"upgrade", lunet_upgrade},
+                      {NULL, NULL}};
   luaL_newlib(L, funcs);
   return 1;
 }
@@ -41,7 +74,12 @@ int lunet_open_socket(lua_State *L) {
                       {"getpeername", lunet_socket_getpeername},
                       {"close", lunet_socket_close},
                       {"read", lunet_socket_read},
+                      {"read_exact", lunet_socket_read_exact},
+                      {"read_until", lunet_socket_read_until},
+                      {"read_line", lunet_socket_read_line},
                       {"write", lunet_socket_write},
+                      {"writev", lunet_socket_writev},
+                      {"drain", lunet_socket_drain},
                       {"connect", lunet_socket_connect},
                       {"set_read_buffer_size", lunet_socket_set_read_buffer_size},
                       {NULL, NULL}};
@@ -77,6 +115,42 @@ int lunet_open_fs(lua_State *L) {
   return 1;
 }
 
+int lunet_open_mailbox(lua_State *L) {
+  luaL_Reg funcs[] = {{"open", lunet_mailbox_open},
+                      {"lookup", lunet_mailbox_lookup},
+                      {"send", lunet_mailbox_send},
+                      {NULL, NULL}};
+  luaL_newlib(L, funcs);
+  return 1;
+}
+
+int lunet_open_work(lua_State *L) {
+  luaL_Reg funcs[] = {{"run", lunet_work_create},
+                      {"prewarm", lunet_work_prewarm},
+                      {"set_pool_size", lunet_work_set_pool_size},
+                      {"pool_stats", lunet_work_pool_stats},
+                      {NULL, NULL}};
+  luaL_newlib(L, funcs);
+  return 1;
+}
+
+int lunet_open_profiler(lua_State *L) {
+  luaL_Reg funcs[] = {{"start", lunet_profiler_start},
+                      {"stop", lunet_profiler_stop},
+                      {NULL, NULL}};
+  luaL_newlib(L, funcs);
+  return 1;
+}
+
+int lunet_open_trace(lua_State *L) {
+  luaL_Reg funcs[] = {{"dump", lunet_trace_ring_dump},
+                      {"export", lunet_trace_ring_export},
+                      {"set_size", lunet_trace_ring_set_size},
+                      {NULL, NULL}};
+  luaL_newlib(L, funcs);
+  return 1;
+}
+
 // =============================================================================
 // Database Driver Support
 // =============================================================================
@@ -100,6 +174,8 @@ static int lunet_open_db(lua_State *L) {
                       {"escape", lunet_db_escape},
                       {"query_params", lunet_db_query_params},
                       {"exec_params", lunet_db_exec_params},
+                      {"set_pool_size", lunet_db_set_pool_size},
+                      {"pool_stats", lunet_db_pool_stats},
                       {NULL, NULL}};
   luaL_newlib(L, funcs);
   return 1;
@@ -110,7 +186,7 @@ static int lunet_open_db(lua_State *L) {
 #if defined(LUNET_DB_SQLITE3)
 LUNET_API int luaopen_lunet_sqlite3(lua_State *L) {
   lunet_trace_init();
-  set_default_luaL(L);
+  lunet_rt_attach(L);
   return lunet_open_db(L);
 }
 #endif
@@ -118,7 +194,7 @@ LUNET_API int luaopen_lunet_sqlite3(lua_State *L) {
 #if defined(LUNET_DB_MYSQL)
 LUNET_API int luaopen_lunet_mysql(lua_State *L) {
   lunet_trace_init();
-  set_default_luaL(L);
+  lunet_rt_attach(L);
   return lunet_open_db(L);
 }
 #endif
@@ -126,7 +202,7 @@ LUNET_API int luaopen_lunet_mysql(lua_State *L) {
 #if defined(LUNET_DB_POSTGRES)
 LUNET_API int luaopen_lunet_postgres(lua_State *L) {
   lunet_trace_init();
-  set_default_luaL(L);
+  lunet_rt_attach(L);
   return lunet_open_db(L);
 }
 #endif
@@ -163,9 +239,41 @@ void lunet_open(lua_State *L) {
   lua_pushcfunction(L, lunet_open_fs);
   lua_setfield(L, -2, "lunet.fs");
   lua_pop(L, 2);
+  // register mailbox module
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, lunet_open_mailbox);
+  lua_setfield(L, -2, "lunet.mailbox");
+  lua_pop(L, 2);
+  // register work module
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, lunet_open_work);
+  lua_setfield(L, -2, "lunet.work");
+  lua_pop(L, 2);
+  // register trace module
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, lunet_open_trace);
+  lua_setfield(L, -2, "lunet.trace");
+  lua_pop(L, 2);
+  // register profiler module
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, lunet_open_profiler);
+  lua_setfield(L, -2, "lunet.profiler");
+  lua_pop(L, 2);
 
   // Database drivers register themselves via luaopen_lunet_<driver>
   // No generic lunet.db registration here - each driver is a separate module
+#if defined(LUNET_DB_SQLITE3) && !defined(LUNET_NO_MAIN)
+  // lunet-app --embed_sqlite3: the driver is linked in, not loaded from cpath
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, luaopen_lunet_sqlite3);
+  lua_setfield(L, -2, "lunet.sqlite3");
+  lua_pop(L, 2);
+#endif
 }
 
 /**
@@ -181,27 +289,273 @@ void lunet_open(lua_State *L) {
  */
 LUNET_API int luaopen_lunet(lua_State *L) {
   lunet_trace_init();
-  set_default_luaL(L);
+  lunet_rt_attach(L);
   lunet_open(L);  // Register submodules in package.preload
   return lunet_open_core(L);  // Return core module table
 }
 
 #ifndef LUNET_NO_MAIN
+#define LUNET_MAX_WORKERS 256
+
+typedef struct {
+  uv_thread_t thread;
+  const char *argv0;
+  const char *script;
+  int worker_id;
+  int worker_count;
+  int loaded;
+  int exit_code;
+} lunet_worker_t;
+
+// Add binary's directory to cpath for finding driver .so files
+// Drivers are in same dir as binary, named like sqlite3.so, mysql.so
+// They're loaded as lunet.sqlite3, so we need lunet/?.so pattern
+// Create symlink-style lookup: binarydir/lunet/?.so -> binarydir/?.so
+static void lunet_setup_cpath(lua_State *L, const char *argv0) {
+  char *exe_path = lunet_resolve_executable_path(argv0);
+  if (!exe_path) {
+    return;
+  }
+
+  char *last_slash = strrchr(exe_path, '/');
+  char *last_backslash = strrchr(exe_path, '\\');
+  char *last_sep = last_slash;
+  if (!last_sep || (last_backslash && last_backslash > last_sep)) {
+    last_sep = last_backslash;
+  }
+  if (!last_sep) {
+    free(exe_path);
+    return;
+  }
+
+  *last_sep = '\0';
+
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "cpath");
+  const char *old_cpath = lua_tostring(L, -1);
+  lua_pop(L, 1);
+
+  char new_cpath[4096];
+#if defined(_WIN32)
+  snprintf(new_cpath, sizeof(new_cpath), "%s\\lunet\\?.dll;%s\\?.dll;%s",
+           exe_path, exe_path, old_cpath ? old_cpath : "");
+#else
+  snprintf(new_cpath, sizeof(new_cpath), "%s/lunet/?.so;%s/?.so;%s",
+           exe_path, exe_path, old_cpath ? old_cpath : "");
+#endif
+  lua_pushstring(L, new_cpath);
+  lua_setfield(L, -2, "cpath");
+  lua_pop(L, 1);
+
+  free(exe_path);
+}
+
+/*
+ * Run one script instance to completion: a private lua_State on the given loop.
+ * A NULL script runs the embedded main module (lunet-app). Returns the process
+ * exit status this instance asks for; *loaded is cleared when the script could
+ * not be loaded or raised at top level.
+ */
+static int lunet_run_script(const char *argv0, const char *script, uv_loop_t *loop,
+                            int worker_id, int worker_count, int *loaded) {
+  lunet_rt_t rt;
+  lunet_alloc_t alloc;
+  *loaded = 0;
+  memset(&alloc, 0, sizeof(alloc));
+  lua_State *L = lunet_alloc_newstate(&alloc);
+  if (!L) {
+    fprintf(stderr, "Error: cannot create Lua state\n");
+    return 1;
+  }
+  luaL_openlibs(L);
+  lunet_rt_init(&rt, L, loop, worker_id, worker_count);
+  void *alloc_ud = NULL;
+  lua_getallocf(L, &alloc_ud);
+  if (alloc_ud == &alloc) {
+    alloc.rt = &rt;
+    rt.alloc = &alloc;
+  }
+  lunet_open(L);
+  lunet_setup_cpath(L, argv0);
+  lunet_bccache_install(L);
+  lunet_embed_install(L);
+
+  // run lua file
+  int status = script ? lunet_bccache_loadfile(L, script) : lunet_embed_load(L, lunet_embed_main());
+  if (status != LUA_OK || lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK) {
+    const char *error = lua_tostring(L, -1);
+    if (worker_count > 1) {
+      fprintf(stderr, "Error (worker %d): %s\n", worker_id, error);
+    } else {
+      fprintf(stderr, "Error: %s\n", error);
+    }
+    lua_pop(L, 1);
+    lunet_rt_close(&rt);
+    lua_close(L);
+    lunet_alloc_destroy(&alloc);
+    return 1;
+  }
+  *loaded = 1;
+  lunet_upgrade_ready();
+
+  int ret = uv_run(loop, UV_RUN_DEFAULT);
+
+  /* Optional: allow Lua script to control process exit status.
+   * Used by stress tests so we can exit without os.exit() (which skips trace shutdown).
+   */
+  lua_getglobal(L, "__lunet_exit_code");
+  if (lua_isnumber(L, -1) && lua_tointeger(L, -1) >= 0) {
+    ret = (int)lua_tointeger(L, -1);
+  }
+  lua_pop(L, 1);
+
+  lunet_rt_close(&rt);
+  lua_close(L);
+  lunet_alloc_destroy(&alloc);
+  return ret;
+}
+
+// lunet-run --precompile: warm the bytecode cache and exit
+static int lunet_precompile(int argc, char **argv, int first) {
+  lua_State *L = luaL_newstate();
+  if (!L) {
+    fprintf(stderr, "Error: cannot create Lua state\n");
+    return 1;
+  }
+  int cached = 0;
+  int failed = 0;
+  for (int i = first; i < argc; i++) {
+    cached += lunet_bccache_precompile(L, argv[i], &failed);
+  }
+  lua_close(L);
+  fprintf(stderr, "precompile: %d file%s cached, %d failed\n", cached, cached == 1 ? "" : "s", failed);
+  return failed ? 1 : 0;
+}
+
+static void lunet_close_walk_cb(uv_handle_t *handle, void *arg) {
+  (void)arg;
+  if (!uv_is_closing(handle)) {
+    uv_close(handle, NULL);
+  }
+}
+
+static void lunet_worker_main(void *arg) {
+  lunet_worker_t *w = (lunet_worker_t *)arg;
+  uv_loop_t loop;
+
+  if (uv_loop_init(&loop) != 0) {
+    fprintf(stderr, "Error: worker %d failed to initialize its event loop\n", w->worker_id);
+    w->exit_code = 1;
+    return;
+  }
+  w->exit_code = lunet_run_script(w->argv0, w->script, &loop, w->worker_id, w->worker_count, &w->loaded);
+
+  // Close whatever handles the script left behind so the loop can be freed
+  uv_walk(&loop, lunet_close_walk_cb, NULL);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  uv_loop_close(&loop);
+}
+
+static int lunet_run_workers(const char *argv0, const char *script, int worker_count, int *loaded) {
+  lunet_worker_t *workers = (lunet_worker_t *)calloc((size_t)worker_count, sizeof(lunet_worker_t));
+  if (!workers) {
+    fprintf(stderr, "Error: out of memory\n");
+    return 1;
+  }
+
+  int started = 0;
+  for (int i = 0; i < worker_count; i++) {
+    workers[i].argv0 = argv0;
+    workers[i].script = script;
+    workers[i].worker_id = i + 1;
+    workers[i].worker_count = worker_count;
+    if (uv_thread_create(&workers[i].thread, lunet_worker_main, &workers[i]) != 0) {
+      fprintf(stderr, "Error: failed to start worker %d\n", i + 1);
+      break;
+    }
+    started++;
+  }
+
+  // First non-zero worker status wins
+  int ret = started == worker_count ? 0 : 1;
+  *loaded = 1;
+  for (int i = 0; i < started; i++) {
+    uv_thread_join(&workers[i].thread);
+    if (ret == 0 && workers[i].exit_code != 0) {
+      ret = workers[i].exit_code;
+    }
+    if (!workers[i].loaded) {
+      *loaded = 0;
+    }
+  }
+
+  free(workers);
+  return ret;
+}
+
 int main(int argc, char **argv) {
-  if (argc < 2) {
+  if (argc < 2 && !lunet_embed_main()) {
     fprintf(stderr, "Usage: %s [OPTIONS] <lua_file>\n", argv[0]);
     fprintf(stderr, "\nOptions:\n");
     fprintf(stderr, "  --dangerously-skip-loopback-restriction\n");
     fprintf(stderr, "      Allow binding to any network interface. By default, binding is restricted\n");
     fprintf(stderr, "      to loopback (127.0.0.1, ::1) or Unix sockets.\n");
+    fprintf(stderr, "  --workers N\n");
+    fprintf(stderr, "      Run the script in N threads, each with its own event loop and Lua state.\n");
+    fprintf(stderr, "      TCP and UDP listeners on the same address are shared via SO_REUSEPORT.\n");
+    fprintf(stderr, "  --processes N\n");
+    fprintf(stderr, "      Run the script in N child processes under a supervisor that owns the TCP\n");
+    fprintf(stderr, "      listeners and restarts children that crash.\n");
+    fprintf(stderr, "  --bytecode-cache DIR\n");
+    fprintf(stderr, "      Cache compiled bytecode for the script and required modules in DIR\n");
+    fprintf(stderr, "      (default: $%s). Entries are keyed by path, mtime and LuaJIT version.\n",
+            LUNET_BCCACHE_ENV);
+    fprintf(stderr, "  --precompile PATH...\n");
+    fprintf(stderr, "      Compile the given .lua files and directories into the bytecode cache\n");
+    fprintf(stderr, "      and exit without running anything.\n");
     return 1;
   }
 
   int script_index = 0;
+  int worker_count = 1;
+  int process_count = 1;
+  int processes_index = 0;
+  int precompile_index = 0;
+  const char *cache_dir = getenv(LUNET_BCCACHE_ENV);
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--dangerously-skip-loopback-restriction") == 0) {
       g_lunet_config.dangerously_skip_loopback_restriction = 1;
       fprintf(stderr, "WARNING: Loopback restriction disabled. Binding to public interfaces allowed.\n");
+    } else if (strcmp(argv[i], "--workers") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Error: --workers requires a count\n");
+        return 1;
+      }
+      worker_count = atoi(argv[++i]);
+      if (worker_count < 1 || worker_count > LUNET_MAX_WORKERS) {
+        fprintf(stderr, "Error: --workers must be between 1 and %d\n", LUNET_MAX_WORKERS);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--processes") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Error: --processes requires a count\n");
+        return 1;
+      }
+      processes_index = i;
+      process_count = atoi(argv[++i]);
+      if (process_count < 1 || process_count > LUNET_MAX_WORKERS) {
+        fprintf(stderr, "Error: --processes must be between 1 and %d\n", LUNET_MAX_WORKERS);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--bytecode-cache") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Error: --bytecode-cache requires a directory\n");
+        return 1;
+      }
+      cache_dir = argv[++i];
+    } else if (strcmp(argv[i], "--precompile") == 0) {
+      precompile_index = i + 1;
+      break;
     } else if (argv[i][0] == '-') {
       fprintf(stderr, "Unknown option: %s\n", argv[i]);
       return 1;
@@ -211,95 +565,66 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (script_index == 0) {
-    fprintf(stderr, "Error: No script file specified.\n");
-    return 1;
-  }
-
-  /* Initialize tracing (no-op in release builds) */
-  lunet_trace_init();
-
-  lua_State *L = luaL_newstate();
-  luaL_openlibs(L);
-  set_default_luaL(L);
-  lunet_open(L);
-
-  // Add binary's directory to cpath for finding driver .so files
-  // Drivers are in same dir as binary, named like sqlite3.so, mysql.so
-  // They're loaded as lunet.sqlite3, so we need lunet/?.so pattern
-  // Create symlink-style lookup: binarydir/lunet/?.so -> binarydir/?.so
-  {
-    char *exe_path = lunet_resolve_executable_path(argv[0]);
-    if (!exe_path) {
-      goto cpath_done;
+  if (cache_dir && cache_dir[0]) {
+    int rc = lunet_bccache_init(cache_dir);
+    if (rc != 0) {
+      fprintf(stderr, "Warning: bytecode cache disabled: %s: %s\n", cache_dir, uv_strerror(rc));
+      if (precompile_index) {
+        return 1;
+      }
     }
-
-    char *last_slash = strrchr(exe_path, '/');
-    char *last_backslash = strrchr(exe_path, '\\');
-    char *last_sep = last_slash;
-    if (!last_sep || (last_backslash && last_backslash > last_sep)) {
-      last_sep = last_backslash;
+  }
+  if (precompile_index) {
+    if (!cache_dir || !cache_dir[0]) {
+      fprintf(stderr, "Error: --precompile requires --bytecode-cache DIR or $%s\n", LUNET_BCCACHE_ENV);
+      return 1;
     }
-    if (!last_sep) {
-      free(exe_path);
-      goto cpath_done;
+    if (precompile_index >= argc) {
+      fprintf(stderr, "Error: --precompile requires at least one path\n");
+      return 1;
     }
-
-    *last_sep = '\0';
-
-    lua_getglobal(L, "package");
-    lua_getfield(L, -1, "cpath");
-    const char *old_cpath = lua_tostring(L, -1);
-    lua_pop(L, 1);
-
-    char new_cpath[4096];
-#if defined(_WIN32)
-    snprintf(new_cpath, sizeof(new_cpath), "%s\\lunet\\?.dll;%s\\?.dll;%s",
-             exe_path, exe_path, old_cpath ? old_cpath : "");
-#else
-    snprintf(new_cpath, sizeof(new_cpath), "%s/lunet/?.so;%s/?.so;%s",
-             exe_path, exe_path, old_cpath ? old_cpath : "");
-#endif
-    lua_pushstring(L, new_cpath);
-    lua_setfield(L, -2, "cpath");
-    lua_pop(L, 1);
-
-    free(exe_path);
-  cpath_done:;
+    return lunet_precompile(argc, argv, precompile_index);
   }
 
-  // run lua file
-  if (luaL_dofile(L, argv[script_index]) != LUA_OK) {
-    const char *error = lua_tostring(L, -1);
-    fprintf(stderr, "Error: %s\n", error);
-    lua_pop(L, 1);
-    lua_close(L);
+  const char *script = script_index ? argv[script_index] : NULL;
+  if (!script && !lunet_embed_main()) {
+    fprintf(stderr, "Error: No script file specified.\n");
+    return 1;
+  }
+  if (worker_count > 1 && process_count > 1) {
+    fprintf(stderr, "Error: --workers and --processes cannot be combined\n");
     return 1;
   }
 
-  int ret = uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+  lunet_upgrade_init(argc, argv);
 
-  /* Optional: allow Lua script to control process exit status.
-   * Used by stress tests so we can exit without os.exit() (which skips trace shutdown).
-   */
-  int lua_exit_code = -1;
-  lua_getglobal(L, "__lunet_exit_code");
-  if (lua_isnumber(L, -1)) {
-    lua_exit_code = (int)lua_tointeger(L, -1);
+  // The supervisor only manages children; it never loads the script itself
+  if (process_count > 1) {
+    return lunet_prefork_supervise(argc, argv, processes_index, process_count);
   }
-  lua_pop(L, 1);
-  
+  int child_count = 0;
+  int child_id = lunet_prefork_child_init(&child_count);
+
+  /* Initialize tracing (no-op in release builds) */
+  lunet_trace_init();
+
+  int loaded = 0;
+  int ret;
+  if (worker_count > 1) {
+    ret = lunet_run_workers(argv[0], script, worker_count, &loaded);
+  } else if (child_id > 0) {
+    ret = lunet_run_script(argv[0], script, uv_default_loop(), child_id, child_count, &loaded);
+  } else {
+    ret = lunet_run_script(argv[0], script, uv_default_loop(), 1, 1, &loaded);
+  }
+  if (!loaded) {
+    return ret;
+  }
+
   /* Dump trace statistics and assert balance (no-op in release builds) */
-#ifdef LUNET_TRACE
-  lunet_udp_trace_summary();
-#endif
   lunet_trace_dump();
   lunet_trace_assert_balanced("shutdown");
-  
-  lua_close(L);
-  if (lua_exit_code >= 0) {
-    return lua_exit_code;
-  }
+
   return ret;
 }
 #endif
@@ -0,0 +1,193 @@
+#include "monitor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Loop health monitor.
+ *
+ * Lag: an unreferenced repeating timer notes when it should fire; how late it
+ * actually runs is the time the loop spent on something else (callbacks,
+ * resumed Lua) before it could get back to timers.
+ *
+ * Resume latency: the scheduler times every lua_resume it issues and reports
+ * it here. Resumes slower than the threshold are logged with their call site,
+ * which is usually enough to find the handler that held the loop.
+ */
+
+static int hist_index(uint64_t v) {
+  if (v < LUNET_HIST_SUB) {
+    return (int)v;
+  }
+  int e = 63;
+  while (!(v >> e)) {
+    e--;
+  }
+  if (e > LUNET_HIST_MAX_BITS) {
+    return LUNET_HIST_BUCKETS - 1;
+  }
+  int sub = (int)((v >> (e - LUNET_HIST_SUB_BITS)) & (LUNET_HIST_SUB - 1));
+  return (e - LUNET_HIST_SUB_BITS + 1) * LUNET_HIST_SUB + sub;
+}
+
+// Midpoint of bucket idx
+static uint64_t hist_value(int idx) {
+  if (idx < LUNET_HIST_SUB) {
+    return (uint64_t)idx;
+  }
+  int e = idx / LUNET_HIST_SUB + LUNET_HIST_SUB_BITS - 1;
+  uint64_t sub = (uint64_t)(idx % LUNET_HIST_SUB);
+  uint64_t width = (uint64_t)1 << (e - LUNET_HIST_SUB_BITS);
+  return ((LUNET_HIST_SUB + sub) << (e - LUNET_HIST_SUB_BITS)) + width / 2;
+}
+
+void lunet_hist_record(lunet_hist_t *h, uint64_t value) {
+  h->counts[hist_index(value)]++;
+  h->total++;
+  h->sum += value;
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+uint64_t lunet_hist_quantile(const lunet_hist_t *h, double q) {
+  if (h->total == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(q * (double)h->total);
+  if (rank >= h->total) {
+    rank = h->total - 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < LUNET_HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen > rank) {
+      uint64_t v = hist_value(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+static void lunet_monitor_timer_cb(uv_timer_t *handle) {
+  lunet_monitor_t *m = (lunet_monitor_t *)handle->data;
+  uint64_t now = uv_hrtime();
+  uint64_t lag = now > m->expected ? now - m->expected : 0;
+  lunet_hist_record(&m->lag, lag / 1000);
+  m->expected = now + m->interval_ns;
+}
+
+void lunet_monitor_resume(lunet_rt_t *rt, const char *site, uint64_t elapsed_ns) {
+  lunet_monitor_t *m = rt->monitor;
+  lunet_hist_record(&m->resume, elapsed_ns / 1000);
+  if (elapsed_ns > m->worst_ns) {
+    m->worst_ns = elapsed_ns;
+    m->worst_site = site;
+  }
+  if (m->slow_ns && elapsed_ns >= m->slow_ns) {
+    m->slow_count++;
+    fprintf(stderr, "[lunet] slow resume: %s %.1fms\n", site ? site : "?", (double)elapsed_ns / 1e6);
+  }
+}
+
+static void lunet_monitor_close_cb(uv_handle_t *handle) { free(handle->data); }
+
+void lunet_monitor_close(lunet_rt_t *rt) {
+  if (rt->monitor) {
+    uv_close((uv_handle_t *)&rt->monitor->timer, lunet_monitor_close_cb);
+    rt->monitor = NULL;
+  }
+}
+
+int lunet_set_monitor(lua_State *L) {
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt) {
+    return 0;
+  }
+  if (lua_isboolean(L, 1) && !lua_toboolean(L, 1)) {
+    lunet_monitor_close(rt);
+    return 0;
+  }
+
+  lua_Number interval = LUNET_MONITOR_INTERVAL_DEFAULT;
+  lua_Number slow = LUNET_MONITOR_SLOW_DEFAULT;
+  if (lua_istable(L, 1)) {
+    lua_getfield(L, 1, "interval");
+    interval = luaL_optnumber(L, -1, interval);
+    lua_getfield(L, 1, "slow");
+    slow = luaL_optnumber(L, -1, slow);
+    lua_pop(L, 2);
+  }
+  luaL_argcheck(L, interval >= 1, 1, "interval must be >= 1 ms");
+  luaL_argcheck(L, slow >= 0, 1, "slow must be >= 0");
+
+  lunet_monitor_t *m = rt->monitor;
+  if (!m) {
+    m = (lunet_monitor_t *)calloc(1, sizeof(lunet_monitor_t));
+    if (!m) {
+      return luaL_error(L, "out of memory");
+    }
+    uv_timer_init(rt->loop, &m->timer);
+    m->timer.data = m;
+    // sampling lag must not keep the loop alive
+    uv_unref((uv_handle_t *)&m->timer);
+    rt->monitor = m;
+  }
+  m->interval_ns = (uint64_t)(interval * 1e6);
+  m->slow_ns = (uint64_t)(slow * 1e6);
+  m->expected = uv_hrtime() + m->interval_ns;
+  uv_timer_start(&m->timer, lunet_monitor_timer_cb, (uint64_t)interval, (uint64_t)interval);
+  return 0;
+}
+
+static void push_hist(lua_State *L, const lunet_hist_t *h) {
+  lua_createtable(L, 0, 7);
+  lua_pushnumber(L, (lua_Number)h->total);
+  lua_setfield(L, -2, "count");
+  lua_pushnumber(L, h->total ? (lua_Number)h->sum / (lua_Number)h->total / 1000.0 : 0);
+  lua_setfield(L, -2, "mean");
+  lua_pushnumber(L, (lua_Number)h->max / 1000.0);
+  lua_setfield(L, -2, "max");
+  lua_pushnumber(L, (lua_Number)lunet_hist_quantile(h, 0.50) / 1000.0);
+  lua_setfield(L, -2, "p50");
+  lua_pushnumber(L, (lua_Number)lunet_hist_quantile(h, 0.90) / 1000.0);
+  lua_setfield(L, -2, "p90");
+  lua_pushnumber(L, (lua_Number)lunet_hist_quantile(h, 0.99) / 1000.0);
+  lua_setfield(L, -2, "p99");
+  lua_pushnumber(L, (lua_Number)lunet_hist_quantile(h, 0.999) / 1000.0);
+  lua_setfield(L, -2, "p999");
+}
+
+int lunet_monitor_stats(lua_State *L) {
+  lunet_rt_t *rt = lunet_rt();
+  lunet_monitor_t *m = rt ? rt->monitor : NULL;
+  if (!m) {
+    lua_pushnil(L);
+    lua_pushstring(L, "monitor not enabled");
+    return 2;
+  }
+
+  lua_createtable(L, 0, 5);
+  push_hist(L, &m->lag);
+  lua_setfield(L, -2, "lag");
+  push_hist(L, &m->resume);
+  lua_setfield(L, -2, "resume");
+  lua_pushnumber(L, (lua_Number)m->slow_count);
+  lua_setfield(L, -2, "slow");
+  if (m->worst_site) {
+    lua_pushstring(L, m->worst_site);
+    lua_setfield(L, -2, "worst_site");
+    lua_pushnumber(L, (lua_Number)m->worst_ns / 1e6);
+    lua_setfield(L, -2, "worst_ms");
+  }
+
+  if (lua_toboolean(L, 1)) {
+    memset(&m->lag, 0, sizeof(m->lag));
+    memset(&m->resume, 0, sizeof(m->resume));
+    m->slow_count = 0;
+    m->worst_site = NULL;
+    m->worst_ns = 0;
+  }
+  return 1;
+}
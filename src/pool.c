@@ -0,0 +1,275 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+#include "mpsc.h"
+
+typedef struct lunet_pool_job_s {
+  lunet_mpsc_node_t node;         // must be first: rt->pool_done entry
+  struct lunet_pool_job_s *next;  // pool FIFO
+  uv_work_t *req;
+  lunet_rt_t *rt;
+} lunet_pool_job_t;
+
+struct lunet_pool_s {
+  const char *name;
+  uv_mutex_t lock;
+  uv_cond_t cond;
+  lunet_pool_job_t *head;
+  lunet_pool_job_t *tail;
+  int size;
+  int started;
+  int queued;
+  int active;
+  uint64_t completed;
+};
+
+typedef struct {
+  lunet_pool_t *pool;
+  int index;
+} lunet_pool_thread_arg_t;
+
+/*
+ * Threads above the configured size park instead of exiting, so shrinking a
+ * pool never leaves unjoined threads behind and growing it again is free.
+ */
+static void lunet_pool_thread(void *arg) {
+  lunet_pool_thread_arg_t *targ = (lunet_pool_thread_arg_t *)arg;
+  lunet_pool_t *pool = targ->pool;
+  int index = targ->index;
+  free(targ);
+
+  uv_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->head || index >= pool->size) {
+      uv_cond_wait(&pool->cond, &pool->lock);
+    }
+    lunet_pool_job_t *job = pool->head;
+    pool->head = job->next;
+    if (!pool->head) {
+      pool->tail = NULL;
+    }
+    pool->queued--;
+    pool->active++;
+    uv_mutex_unlock(&pool->lock);
+
+    job->req->work_cb(job->req);
+
+    uv_mutex_lock(&pool->lock);
+    pool->active--;
+    pool->completed++;
+    uv_mutex_unlock(&pool->lock);
+
+    lunet_rt_t *rt = job->rt;
+    lunet_mpsc_push(&rt->pool_done, &job->node);
+    uv_async_send(rt->pool_async);
+
+    uv_mutex_lock(&pool->lock);
+  }
+}
+
+// Caller holds pool->lock
+static int lunet_pool_start_threads(lunet_pool_t *pool) {
+  while (pool->started < pool->size) {
+    lunet_pool_thread_arg_t *arg = (lunet_pool_thread_arg_t *)malloc(sizeof(lunet_pool_thread_arg_t));
+    if (!arg) {
+      return UV_ENOMEM;
+    }
+    arg->pool = pool;
+    arg->index = pool->started;
+    uv_thread_t tid;
+    int ret = uv_thread_create(&tid, lunet_pool_thread, arg);
+    if (ret < 0) {
+      free(arg);
+      return ret;
+    }
+    pool->started++;
+  }
+  return 0;
+}
+
+lunet_pool_t *lunet_pool_new(const char *name, int size) {
+  lunet_pool_t *pool = (lunet_pool_t *)calloc(1, sizeof(lunet_pool_t));
+  if (!pool) {
+    return NULL;
+  }
+  if (uv_mutex_init(&pool->lock) != 0) {
+    free(pool);
+    return NULL;
+  }
+  if (uv_cond_init(&pool->cond) != 0) {
+    uv_mutex_destroy(&pool->lock);
+    free(pool);
+    return NULL;
+  }
+  pool->name = name;
+  pool->size = size;
+  return pool;
+}
+
+int lunet_pool_resize(lunet_pool_t *pool, int size) {
+  if (size < 1 || size > LUNET_POOL_MAX_THREADS) {
+    return UV_EINVAL;
+  }
+  int ret = 0;
+  uv_mutex_lock(&pool->lock);
+  pool->size = size;
+  if (pool->started > 0) {
+    ret = lunet_pool_start_threads(pool);
+  }
+  // parked threads below the new size may now take jobs
+  uv_cond_broadcast(&pool->cond);
+  uv_mutex_unlock(&pool->lock);
+  return ret;
+}
+
+static void lunet_pool_done_cb(uv_async_t *handle) {
+  lunet_rt_t *rt = (lunet_rt_t *)handle->data;
+  lunet_pool_job_t *job;
+  while ((job = (lunet_pool_job_t *)lunet_mpsc_pop(&rt->pool_done)) != NULL) {
+    uv_work_t *req = job->req;
+    free(job);
+    if (--rt->pool_pending == 0) {
+      uv_unref((uv_handle_t *)handle);
+    }
+    req->after_work_cb(req, 0);
+  }
+}
+
+static void lunet_pool_async_close_cb(uv_handle_t *handle) { free(handle); }
+
+static int lunet_pool_loop_init(lunet_rt_t *rt) {
+  if (rt->pool_async) {
+    return 0;
+  }
+  uv_async_t *async = (uv_async_t *)malloc(sizeof(uv_async_t));
+  if (!async) {
+    return UV_ENOMEM;
+  }
+  int ret = uv_async_init(rt->loop, async, lunet_pool_done_cb);
+  if (ret < 0) {
+    free(async);
+    return ret;
+  }
+  async->data = rt;
+  // referenced only while jobs are outstanding, like uv_queue_work
+  uv_unref((uv_handle_t *)async);
+  rt->pool_async = async;
+  return 0;
+}
+
+void lunet_pool_close_loop(lunet_rt_t *rt) {
+  if (rt->pool_async) {
+    uv_close((uv_handle_t *)rt->pool_async, lunet_pool_async_close_cb);
+    rt->pool_async = NULL;
+  }
+}
+
+int lunet_pool_queue_work(lunet_pool_t *pool, uv_work_t *req, uv_work_cb work_cb, uv_after_work_cb after_cb) {
+  lunet_rt_t *rt = lunet_rt();
+  if (!pool || !rt) {
+    return uv_queue_work(default_loop(), req, work_cb, after_cb);
+  }
+  int ret = lunet_pool_loop_init(rt);
+  if (ret < 0) {
+    return ret;
+  }
+  lunet_pool_job_t *job = (lunet_pool_job_t *)malloc(sizeof(lunet_pool_job_t));
+  if (!job) {
+    return UV_ENOMEM;
+  }
+  req->loop = rt->loop;
+  req->work_cb = work_cb;
+  req->after_work_cb = after_cb;
+  job->next = NULL;
+  job->req = req;
+  job->rt = rt;
+
+  uv_mutex_lock(&pool->lock);
+  ret = lunet_pool_start_threads(pool);
+  if (ret < 0 && pool->started == 0) {
+    uv_mutex_unlock(&pool->lock);
+    free(job);
+    return ret;
+  }
+  if (pool->tail) {
+    pool->tail->next = job;
+  } else {
+    pool->head = job;
+  }
+  pool->tail = job;
+  pool->queued++;
+  if (pool->started > pool->size) {
+    uv_cond_broadcast(&pool->cond);  // a parked thread might take the signal
+  } else {
+    uv_cond_signal(&pool->cond);
+  }
+  uv_mutex_unlock(&pool->lock);
+
+  if (rt->pool_pending++ == 0) {
+    uv_ref((uv_handle_t *)rt->pool_async);
+  }
+  return 0;
+}
+
+void lunet_pool_stats(lunet_pool_t *pool, lunet_pool_stats_t *stats) {
+  uv_mutex_lock(&pool->lock);
+  stats->size = pool->size;
+  stats->started = pool->started;
+  stats->queued = pool->queued;
+  stats->active = pool->active;
+  stats->completed = pool->completed;
+  uv_mutex_unlock(&pool->lock);
+}
+
+void lunet_pool_push_stats(lua_State *L, lunet_pool_t *pool) {
+  lunet_pool_stats_t stats;
+  lunet_pool_stats(pool, &stats);
+  lua_createtable(L, 0, 5);
+  lua_pushinteger(L, stats.size);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, stats.started);
+  lua_setfield(L, -2, "started");
+  lua_pushinteger(L, stats.queued);
+  lua_setfield(L, -2, "queued");
+  lua_pushinteger(L, stats.active);
+  lua_setfield(L, -2, "active");
+  lua_pushnumber(L, (lua_Number)stats.completed);
+  lua_setfield(L, -2, "completed");
+}
+
+// Database driver pool: each driver module compiles its own copy of this file
+
+static uv_once_t g_db_pool_once = UV_ONCE_INIT;
+static lunet_pool_t *g_db_pool = NULL;
+
+static void lunet_db_pool_init(void) { g_db_pool = lunet_pool_new("db", LUNET_DB_POOL_DEFAULT); }
+
+lunet_pool_t *lunet_db_pool(void) {
+  uv_once(&g_db_pool_once, lunet_db_pool_init);
+  return g_db_pool;
+}
+
+int lunet_db_set_pool_size(lua_State *L) {
+  int size = (int)luaL_checkinteger(L, 1);
+  lunet_pool_t *pool = lunet_db_pool();
+  int ret = pool ? lunet_pool_resize(pool, size) : UV_ENOMEM;
+  if (ret < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, uv_strerror(ret));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+int lunet_db_pool_stats(lua_State *L) {
+  lunet_pool_t *pool = lunet_db_pool();
+  if (!pool) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  lunet_pool_push_stats(L, pool);
+  return 1;
+}
@@ -0,0 +1,612 @@
+#include "prefork.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#define LUNET_PREFORK_IPC_FD 3
+#define LUNET_PREFORK_BACKLOG 128
+#define LUNET_PREFORK_LINE_MAX 256
+#define LUNET_PREFORK_BACKOFF_MIN_MS 100
+#define LUNET_PREFORK_BACKOFF_MAX_MS 10000
+// A child that stayed up this long is considered healthy again
+#define LUNET_PREFORK_STABLE_MS 10000
+
+// Child side: IPC fd inherited from the supervisor, -1 when not supervised
+static int g_ipc_fd = -1;
+
+#ifndef _WIN32
+
+/* ------------------------------------------------------------------------- */
+/* Supervisor                                                                */
+/* ------------------------------------------------------------------------- */
+
+typedef struct lunet_prefork_listener_s {
+  uv_tcp_t tcp;
+  char host[64];
+  int port;
+  struct lunet_prefork_listener_s *next;
+} lunet_prefork_listener_t;
+
+typedef struct lunet_prefork_sup_s lunet_prefork_sup_t;
+
+typedef struct {
+  uv_process_t proc;
+  uv_pipe_t ipc;
+  uv_timer_t restart_timer;
+  lunet_prefork_sup_t *sup;
+  int worker_id;
+  int running;       // process is alive
+  int open_handles;  // proc/ipc handles not yet closed after exit
+  int restart;       // respawn once open_handles reaches 0
+  uint64_t started_at;
+  uint64_t backoff_ms;
+  char env_id[32];
+  char line[LUNET_PREFORK_LINE_MAX];
+  size_t line_len;
+} lunet_prefork_child_t;
+
+struct lunet_prefork_sup_s {
+  uv_loop_t *loop;
+  char **child_args;
+  char **child_env;
+  int env_id_slot;
+  int count;
+  lunet_prefork_child_t *children;
+  lunet_prefork_listener_t *listeners;
+  uv_signal_t sigint;
+  uv_signal_t sigterm;
+  int stopping;
+  int active;  // children running or waiting to be restarted
+  int exit_code;
+};
+
+typedef struct {
+  uv_write_t req;
+  char msg[32];
+} lunet_prefork_reply_t;
+
+static void lunet_prefork_spawn(lunet_prefork_child_t *c);
+static void lunet_prefork_restart_cb(uv_timer_t *timer);
+
+static void lunet_prefork_finish(lunet_prefork_sup_t *sup) {
+  if (sup->active > 0) {
+    return;
+  }
+  lunet_prefork_listener_t *l = sup->listeners;
+  while (l) {
+    lunet_prefork_listener_t *next = l->next;
+    uv_close((uv_handle_t *)&l->tcp, (uv_close_cb)free);
+    l = next;
+  }
+  sup->listeners = NULL;
+  for (int i = 0; i < sup->count; i++) {
+    uv_close((uv_handle_t *)&sup->children[i].restart_timer, NULL);
+  }
+  uv_close((uv_handle_t *)&sup->sigint, NULL);
+  uv_close((uv_handle_t *)&sup->sigterm, NULL);
+}
+
+static void lunet_prefork_reply_cb(uv_write_t *req, int status) {
+  (void)status;
+  free(req);
+}
+
+static void lunet_prefork_reply(lunet_prefork_child_t *c, int err, lunet_prefork_listener_t *l) {
+  lunet_prefork_reply_t *r = (lunet_prefork_reply_t *)malloc(sizeof(lunet_prefork_reply_t));
+  if (!r) {
+    return;
+  }
+  if (err == 0) {
+    snprintf(r->msg, sizeof(r->msg), "ok\n");
+  } else {
+    snprintf(r->msg, sizeof(r->msg), "err %d\n", err);
+  }
+  uv_buf_t buf = uv_buf_init(r->msg, (unsigned int)strlen(r->msg));
+  int ret;
+  if (l) {
+    ret = uv_write2(&r->req, (uv_stream_t *)&c->ipc, &buf, 1, (uv_stream_t *)&l->tcp, lunet_prefork_reply_cb);
+  } else {
+    ret = uv_write(&r->req, (uv_stream_t *)&c->ipc, &buf, 1, lunet_prefork_reply_cb);
+  }
+  if (ret < 0) {
+    free(r);
+  }
+}
+
+// Bound listeners are cached so every child (and every restart) shares one socket
+static int lunet_prefork_get_listener(lunet_prefork_sup_t *sup, const char *host, int port,
+                                      lunet_prefork_listener_t **out) {
+  for (lunet_prefork_listener_t *l = sup->listeners; l; l = l->next) {
+    if (l->port == port && strcmp(l->host, host) == 0) {
+      *out = l;
+      return 0;
+    }
+  }
+
+  struct sockaddr_in addr;
+  int ret = uv_ip4_addr(host, port, &addr);
+  if (ret < 0) {
+    return ret;
+  }
+  lunet_prefork_listener_t *l = (lunet_prefork_listener_t *)calloc(1, sizeof(lunet_prefork_listener_t));
+  if (!l) {
+    return UV_ENOMEM;
+  }
+  if ((ret = uv_tcp_init(sup->loop, &l->tcp)) < 0) {
+    free(l);
+    return ret;
+  }
+  if ((ret = uv_tcp_bind(&l->tcp, (const struct sockaddr *)&addr, 0)) < 0) {
+    uv_close((uv_handle_t *)&l->tcp, (uv_close_cb)free);
+    return ret;
+  }
+  // Listen without polling: the kernel backlog stays open across child restarts
+  // while only the children ever accept from it
+  uv_os_fd_t fd;
+  if ((ret = uv_fileno((uv_handle_t *)&l->tcp, &fd)) < 0) {
+    uv_close((uv_handle_t *)&l->tcp, (uv_close_cb)free);
+    return ret;
+  }
+  if (listen(fd, LUNET_PREFORK_BACKLOG) != 0) {
+    ret = uv_translate_sys_error(errno);
+    uv_close((uv_handle_t *)&l->tcp, (uv_close_cb)free);
+    return ret;
+  }
+  snprintf(l->host, sizeof(l->host), "%s", host);
+  l->port = port;
+  l->next = sup->listeners;
+  sup->listeners = l;
+  *out = l;
+  return 0;
+}
+
+// Request line: "tcp <host> <port>"
+static void lunet_prefork_handle_request(lunet_prefork_child_t *c, const char *line) {
+  char proto[8];
+  char host[64];
+  int port = 0;
+  if (sscanf(line, "%7s %63s %d", proto, host, &port) != 3 || strcmp(proto, "tcp") != 0) {
+    lunet_prefork_reply(c, UV_EINVAL, NULL);
+    return;
+  }
+  lunet_prefork_listener_t *l = NULL;
+  int ret = lunet_prefork_get_listener(c->sup, host, port, &l);
+  lunet_prefork_reply(c, ret, ret == 0 ? l : NULL);
+}
+
+static void lunet_prefork_alloc_cb(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+  (void)suggested_size;
+  lunet_prefork_child_t *c = (lunet_prefork_child_t *)handle->data;
+  if (c->line_len >= sizeof(c->line) - 1) {
+    c->line_len = 0;  // oversized request, drop it
+  }
+  buf->base = c->line + c->line_len;
+  buf->len = sizeof(c->line) - 1 - c->line_len;
+}
+
+static void lunet_prefork_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  (void)buf;
+  lunet_prefork_child_t *c = (lunet_prefork_child_t *)stream->data;
+  if (nread < 0) {
+    uv_read_stop(stream);
+    return;
+  }
+  c->line_len += (size_t)nread;
+  char *nl;
+  while ((nl = memchr(c->line, '\n', c->line_len)) != NULL) {
+    *nl = '\0';
+    lunet_prefork_handle_request(c, c->line);
+    size_t used = (size_t)(nl - c->line) + 1;
+    memmove(c->line, nl + 1, c->line_len - used);
+    c->line_len -= used;
+  }
+}
+
+static void lunet_prefork_handle_closed_cb(uv_handle_t *handle) {
+  lunet_prefork_child_t *c = (lunet_prefork_child_t *)handle->data;
+  if (--c->open_handles > 0) {
+    return;
+  }
+  if (c->restart && !c->sup->stopping) {
+    uv_timer_start(&c->restart_timer, lunet_prefork_restart_cb, c->backoff_ms, 0);
+    return;
+  }
+  c->restart = 0;
+  c->sup->active--;
+  lunet_prefork_finish(c->sup);
+}
+
+static void lunet_prefork_restart_cb(uv_timer_t *timer) {
+  lunet_prefork_child_t *c = (lunet_prefork_child_t *)timer->data;
+  // Each restart in quick succession waits twice as long as the previous one
+  c->backoff_ms *= 2;
+  if (c->backoff_ms > LUNET_PREFORK_BACKOFF_MAX_MS) {
+    c->backoff_ms = LUNET_PREFORK_BACKOFF_MAX_MS;
+  }
+  lunet_prefork_spawn(c);
+}
+
+static void lunet_prefork_exit_cb(uv_process_t *proc, int64_t exit_status, int term_signal) {
+  lunet_prefork_child_t *c = (lunet_prefork_child_t *)proc->data;
+  lunet_prefork_sup_t *sup = c->sup;
+  c->running = 0;
+
+  int crashed = exit_status != 0 || term_signal != 0;
+  if (crashed && !sup->stopping) {
+    if (uv_now(sup->loop) - c->started_at >= LUNET_PREFORK_STABLE_MS) {
+      c->backoff_ms = LUNET_PREFORK_BACKOFF_MIN_MS;
+    }
+    fprintf(stderr, "lunet: worker %d (pid %d) exited (status %d, signal %d), restarting in %llu ms\n",
+            c->worker_id, proc->pid, (int)exit_status, term_signal, (unsigned long long)c->backoff_ms);
+    c->restart = 1;
+  } else if (exit_status != 0 && sup->exit_code == 0) {
+    sup->exit_code = (int)exit_status;
+  }
+
+  uv_close((uv_handle_t *)&c->ipc, lunet_prefork_handle_closed_cb);
+  uv_close((uv_handle_t *)proc, lunet_prefork_handle_closed_cb);
+}
+
+static void lunet_prefork_spawn(lunet_prefork_child_t *c) {
+  lunet_prefork_sup_t *sup = c->sup;
+  uv_stdio_container_t stdio[4];
+  uv_process_options_t options;
+
+  c->line_len = 0;
+  c->restart = 0;
+  c->open_handles = 2;
+  uv_pipe_init(sup->loop, &c->ipc, 1);
+  c->ipc.data = c;
+
+  stdio[0].flags = UV_INHERIT_FD;
+  stdio[0].data.fd = 0;
+  stdio[1].flags = UV_INHERIT_FD;
+  stdio[1].data.fd = 1;
+  stdio[2].flags = UV_INHERIT_FD;
+  stdio[2].data.fd = 2;
+  stdio[LUNET_PREFORK_IPC_FD].flags = (uv_stdio_flags)(UV_CREATE_PIPE | UV_READABLE_PIPE | UV_WRITABLE_PIPE);
+  stdio[LUNET_PREFORK_IPC_FD].data.stream = (uv_stream_t *)&c->ipc;
+
+  // uv_spawn has exec'd (or failed) by the time it returns, so the env slot can be reused
+  sup->child_env[sup->env_id_slot] = c->env_id;
+
+  memset(&options, 0, sizeof(options));
+  options.file = sup->child_args[0];
+  options.args = sup->child_args;
+  options.env = sup->child_env;
+  options.stdio = stdio;
+  options.stdio_count = 4;
+  options.exit_cb = lunet_prefork_exit_cb;
+
+  c->proc.data = c;
+  int ret = uv_spawn(sup->loop, &c->proc, &options);
+  if (ret < 0) {
+    fprintf(stderr, "lunet: failed to start worker %d: %s\n", c->worker_id, uv_strerror(ret));
+    c->restart = 1;
+    uv_close((uv_handle_t *)&c->ipc, lunet_prefork_handle_closed_cb);
+    uv_close((uv_handle_t *)&c->proc, lunet_prefork_handle_closed_cb);
+    return;
+  }
+  c->running = 1;
+  c->started_at = uv_now(sup->loop);
+  uv_read_start((uv_stream_t *)&c->ipc, lunet_prefork_alloc_cb, lunet_prefork_read_cb);
+}
+
+// SIGINT/SIGTERM: stop restarting, forward the signal and wait for the children
+static void lunet_prefork_signal_cb(uv_signal_t *handle, int signo) {
+  lunet_prefork_sup_t *sup = (lunet_prefork_sup_t *)handle->data;
+  sup->stopping = 1;
+  for (int i = 0; i < sup->count; i++) {
+    lunet_prefork_child_t *c = &sup->children[i];
+    if (c->running) {
+      uv_process_kill(&c->proc, signo);
+    } else if (c->restart && c->open_handles == 0) {
+      uv_timer_stop(&c->restart_timer);
+      c->restart = 0;
+      sup->active--;
+    }
+  }
+  lunet_prefork_finish(sup);
+}
+
+static char **lunet_prefork_build_env(lunet_prefork_sup_t *sup) {
+  uv_env_item_t *items = NULL;
+  int count = 0;
+  if (uv_os_environ(&items, &count) < 0) {
+    return NULL;
+  }
+
+  // inherited entries + fd + id + count + NULL
+  char **env = (char **)calloc((size_t)count + 4, sizeof(char *));
+  if (!env) {
+    uv_os_free_environ(items, count);
+    return NULL;
+  }
+  int n = 0;
+  for (int i = 0; i < count; i++) {
+    if (strcmp(items[i].name, LUNET_PREFORK_ENV_FD) == 0 || strcmp(items[i].name, LUNET_PREFORK_ENV_ID) == 0 ||
+        strcmp(items[i].name, LUNET_PREFORK_ENV_COUNT) == 0) {
+      continue;
+    }
+    size_t len = strlen(items[i].name) + strlen(items[i].value) + 2;
+    env[n] = (char *)malloc(len);
+    if (!env[n]) {
+      break;
+    }
+    snprintf(env[n], len, "%s=%s", items[i].name, items[i].value);
+    n++;
+  }
+  uv_os_free_environ(items, count);
+
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%s=%d", LUNET_PREFORK_ENV_FD, LUNET_PREFORK_IPC_FD);
+  env[n++] = strdup(buf);
+  snprintf(buf, sizeof(buf), "%s=%d", LUNET_PREFORK_ENV_COUNT, sup->count);
+  env[n++] = strdup(buf);
+  sup->env_id_slot = n;  // filled per child in lunet_prefork_spawn
+  return env;
+}
+
+int lunet_prefork_supervise(int argc, char **argv, int skip_index, int process_count) {
+  lunet_prefork_sup_t sup;
+  memset(&sup, 0, sizeof(sup));
+  sup.loop = uv_default_loop();
+  sup.count = process_count;
+
+  char exe[4096];
+  size_t exe_len = sizeof(exe);
+  if (uv_exepath(exe, &exe_len) < 0) {
+    fprintf(stderr, "Error: cannot resolve lunet executable path\n");
+    return 1;
+  }
+
+  // Same command line minus --processes N
+  sup.child_args = (char **)calloc((size_t)argc + 1, sizeof(char *));
+  sup.child_env = lunet_prefork_build_env(&sup);
+  sup.children = (lunet_prefork_child_t *)calloc((size_t)process_count, sizeof(lunet_prefork_child_t));
+  if (!sup.child_args || !sup.child_env || !sup.children) {
+    fprintf(stderr, "Error: out of memory\n");
+    return 1;
+  }
+  int n = 0;
+  sup.child_args[n++] = exe;
+  for (int i = 1; i < argc; i++) {
+    if (i == skip_index || i == skip_index + 1) {
+      continue;
+    }
+    sup.child_args[n++] = argv[i];
+  }
+
+  uv_signal_init(sup.loop, &sup.sigint);
+  uv_signal_init(sup.loop, &sup.sigterm);
+  sup.sigint.data = &sup;
+  sup.sigterm.data = &sup;
+  uv_signal_start(&sup.sigint, lunet_prefork_signal_cb, SIGINT);
+  uv_signal_start(&sup.sigterm, lunet_prefork_signal_cb, SIGTERM);
+
+  for (int i = 0; i < process_count; i++) {
+    lunet_prefork_child_t *c = &sup.children[i];
+    c->sup = &sup;
+    c->worker_id = i + 1;
+    c->backoff_ms = LUNET_PREFORK_BACKOFF_MIN_MS;
+    snprintf(c->env_id, sizeof(c->env_id), "%s=%d", LUNET_PREFORK_ENV_ID, c->worker_id);
+    uv_timer_init(sup.loop, &c->restart_timer);
+    c->restart_timer.data = c;
+    sup.active++;
+    lunet_prefork_spawn(c);
+  }
+
+  uv_run(sup.loop, UV_RUN_DEFAULT);
+  uv_loop_close(sup.loop);
+
+  for (char **e = sup.child_env; *e; e++) {
+    if (e - sup.child_env != sup.env_id_slot) {
+      free(*e);
+    }
+  }
+  free(sup.child_env);
+  free(sup.child_args);
+  free(sup.children);
+  return sup.exit_code;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Child                                                                     */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+  uv_pipe_t pipe;
+  uv_tcp_t tmp;
+  uv_write_t write;
+  char buf[64];
+  size_t len;
+  int status;
+  uv_os_sock_t sock;
+} lunet_prefork_exchange_t;
+
+static void lunet_prefork_exchange_write_cb(uv_write_t *req, int status) {
+  lunet_prefork_exchange_t *x = (lunet_prefork_exchange_t *)req->data;
+  if (status < 0) {
+    x->status = status;
+    uv_read_stop((uv_stream_t *)&x->pipe);
+  }
+}
+
+static void lunet_prefork_exchange_alloc_cb(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+  (void)suggested_size;
+  lunet_prefork_exchange_t *x = (lunet_prefork_exchange_t *)handle->data;
+  buf->base = x->buf + x->len;
+  buf->len = sizeof(x->buf) - 1 - x->len;
+}
+
+// Adopt the socket passed along with the reply; the temporary handle lives on the private loop
+static int lunet_prefork_exchange_take(lunet_prefork_exchange_t *x) {
+  if (uv_pipe_pending_count(&x->pipe) < 1 || uv_pipe_pending_type(&x->pipe) != UV_TCP) {
+    return UV_EPROTO;
+  }
+  int ret = uv_tcp_init(x->pipe.loop, &x->tmp);
+  if (ret < 0) {
+    return ret;
+  }
+  uv_os_fd_t fd;
+  if ((ret = uv_accept((uv_stream_t *)&x->pipe, (uv_stream_t *)&x->tmp)) == 0 &&
+      (ret = uv_fileno((uv_handle_t *)&x->tmp, &fd)) == 0) {
+    x->sock = dup(fd);
+    if (x->sock < 0) {
+      ret = uv_translate_sys_error(errno);
+    }
+  }
+  uv_close((uv_handle_t *)&x->tmp, NULL);
+  return ret;
+}
+
+static void lunet_prefork_exchange_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  (void)buf;
+  lunet_prefork_exchange_t *x = (lunet_prefork_exchange_t *)stream->data;
+  if (nread < 0) {
+    x->status = (int)nread;
+    uv_read_stop(stream);
+    return;
+  }
+  x->len += (size_t)nread;
+  x->buf[x->len] = '\0';
+  if (!strchr(x->buf, '\n')) {
+    if (x->len >= sizeof(x->buf) - 1) {
+      x->status = UV_EPROTO;
+      uv_read_stop(stream);
+    }
+    return;
+  }
+  uv_read_stop(stream);
+
+  int err = 0;
+  if (strncmp(x->buf, "ok", 2) == 0) {
+    x->status = lunet_prefork_exchange_take(x);
+  } else if (sscanf(x->buf, "err %d", &err) == 1 && err < 0) {
+    x->status = err;
+  } else {
+    x->status = UV_EPROTO;
+  }
+}
+
+int lunet_prefork_child_init(int *worker_count) {
+  char buf[32];
+  size_t len;
+  int fd, id, count;
+
+  len = sizeof(buf);
+  if (uv_os_getenv(LUNET_PREFORK_ENV_FD, buf, &len) != 0) {
+    return 0;
+  }
+  fd = atoi(buf);
+  len = sizeof(buf);
+  id = uv_os_getenv(LUNET_PREFORK_ENV_ID, buf, &len) == 0 ? atoi(buf) : 0;
+  len = sizeof(buf);
+  count = uv_os_getenv(LUNET_PREFORK_ENV_COUNT, buf, &len) == 0 ? atoi(buf) : 0;
+
+  // Don't leak supervisor wiring into processes the script spawns
+  uv_os_unsetenv(LUNET_PREFORK_ENV_FD);
+  uv_os_unsetenv(LUNET_PREFORK_ENV_ID);
+  uv_os_unsetenv(LUNET_PREFORK_ENV_COUNT);
+
+  if (fd < 0 || id < 1 || count < id) {
+    return 0;
+  }
+  g_ipc_fd = fd;
+  *worker_count = count;
+  return id;
+}
+
+int lunet_prefork_listen(uv_tcp_t *tcp, const char *host, int port) {
+  lunet_prefork_exchange_t x;
+  uv_loop_t loop;
+  int ret;
+
+  if (g_ipc_fd < 0) {
+    return UV_EINVAL;
+  }
+  memset(&x, 0, sizeof(x));
+  x.sock = -1;
+  x.status = UV_EPROTO;
+
+  // listen() is synchronous, so talk to the supervisor on a private loop.
+  // The pipe owns a dup of the IPC fd so closing it leaves fd 3 usable.
+  if ((ret = uv_loop_init(&loop)) < 0) {
+    return ret;
+  }
+  int fd = dup(g_ipc_fd);
+  if (fd < 0) {
+    uv_loop_close(&loop);
+    return uv_translate_sys_error(errno);
+  }
+  uv_pipe_init(&loop, &x.pipe, 1);
+  x.pipe.data = &x;
+  if ((ret = uv_pipe_open(&x.pipe, fd)) < 0) {
+    close(fd);
+    uv_close((uv_handle_t *)&x.pipe, NULL);
+    uv_run(&loop, UV_RUN_DEFAULT);
+    uv_loop_close(&loop);
+    return ret;
+  }
+
+  char req[128];
+  snprintf(req, sizeof(req), "tcp %s %d\n", host, port);
+  uv_buf_t buf = uv_buf_init(req, (unsigned int)strlen(req));
+  x.write.data = &x;
+  ret = uv_write(&x.write, (uv_stream_t *)&x.pipe, &buf, 1, lunet_prefork_exchange_write_cb);
+  if (ret == 0) {
+    ret = uv_read_start((uv_stream_t *)&x.pipe, lunet_prefork_exchange_alloc_cb, lunet_prefork_exchange_read_cb);
+  }
+  if (ret == 0) {
+    uv_run(&loop, UV_RUN_DEFAULT);
+    ret = x.status;
+  }
+
+  uv_close((uv_handle_t *)&x.pipe, NULL);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  uv_loop_close(&loop);
+
+  if (ret == 0) {
+    ret = uv_tcp_open(tcp, x.sock);
+  }
+  if (ret < 0 && x.sock >= 0) {
+    close(x.sock);
+  }
+  return ret;
+}
+
+#else  // _WIN32
+
+int lunet_prefork_supervise(int argc, char **argv, int skip_index, int process_count) {
+  (void)argc;
+  (void)argv;
+  (void)skip_index;
+  (void)process_count;
+  fprintf(stderr, "Error: --processes is not supported on Windows, use --workers\n");
+  return 1;
+}
+
+int lunet_prefork_child_init(int *worker_count) {
+  (void)worker_count;
+  return 0;
+}
+
+int lunet_prefork_listen(uv_tcp_t *tcp, const char *host, int port) {
+  (void)tcp;
+  (void)host;
+  (void)port;
+  return UV_ENOTSUP;
+}
+
+#endif  // _WIN32
+
+int lunet_prefork_is_child(void) { return g_ipc_fd >= 0; }
@@ -0,0 +1,399 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+/*
+ * Sampling profiler built on luaJIT_profile_start.
+ *
+ * Each sample is folded into one line for flamegraph.pl:
+ *
+ *   <task>;<outermost Lua frame>;...;<innermost>[;[GC]|;[JIT]] <count>
+ *
+ * <task> is the function passed to lunet.spawn for the coroutine lunet last
+ * resumed, so samples from library code are split by the request handler
+ * that called it. C functions show up as their lunet name (lunet.socket.read)
+ * instead of an address.
+ *
+ * LuaJIT only delivers a sample once the VM runs again, with the number of
+ * ticks that elapsed. Ticks that passed outside the VM (libuv callbacks,
+ * driver result conversion, pool threads) are folded into a "[C] <site>"
+ * frame under the task, named after the resume site that was running.
+ *
+ * LuaJIT supports one profiler per process, so only one loop can profile
+ * at a time.
+ */
+
+#define LUNET_PROFILER_COUNTS_KEY "lunet.profiler.counts"
+#define LUNET_PROFILER_TASKS_KEY "lunet.profiler.tasks"
+#define LUNET_PROFILER_TRAMPOLINE "=lunet.spawn"
+
+static uv_once_t g_profiler_once = UV_ONCE_INIT;
+static uv_mutex_t g_profiler_lock;
+static lunet_rt_t *g_profiler_owner = NULL;  // under g_profiler_lock
+
+static void profiler_lock_init(void) { uv_mutex_init(&g_profiler_lock); }
+
+// Push "file.lua:line" for the function on top of L, popping it
+static void profiler_push_funcname(lua_State *L) {
+  lua_Debug ar;
+  lua_getinfo(L, ">S", &ar);
+  lua_pushfstring(L, "%s:%d", ar.short_src, ar.linedefined);
+}
+
+void lunet_profiler_label(lua_State *L, int fn_idx, lua_State *co) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_PROFILER_TASKS_KEY);
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_pushlightuserdata(L, co);
+  lua_pushvalue(L, fn_idx);
+  profiler_push_funcname(L);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+}
+
+// Push the task label of co; labels coroutines spawned before start() from their stack
+static void profiler_push_task(lua_State *L, lua_State *co) {
+  if (!co) {
+    lua_pushliteral(L, "main");
+    return;
+  }
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_PROFILER_TASKS_KEY);
+  lua_pushlightuserdata(L, co);
+  lua_rawget(L, -2);
+  if (lua_isstring(L, -1)) {
+    lua_remove(L, -2);
+    return;
+  }
+  lua_pop(L, 1);
+
+  // outermost Lua function on co below the spawn trampoline
+  lua_Debug ar;
+  int found = 0;
+  for (int level = 0; lua_getstack(co, level, &ar); level++) {
+    if (lua_getinfo(co, "S", &ar) && strcmp(ar.what, "C") != 0 && strcmp(ar.source, LUNET_PROFILER_TRAMPOLINE) != 0) {
+      lua_pushfstring(L, "%s:%d", ar.short_src, ar.linedefined);
+      if (found) {
+        lua_remove(L, -2);
+      }
+      found = 1;
+    }
+  }
+  if (!found) {
+    lua_pushliteral(L, "coroutine");
+  }
+  lua_pushlightuserdata(L, co);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -4);
+  lua_remove(L, -2);
+}
+
+// counts[key at top] += n, popping the key; the counts table is at idx
+static void profiler_count(lua_State *L, int idx, int n) {
+  lua_pushvalue(L, -1);
+  lua_rawget(L, idx);
+  lua_Number count = lua_tonumber(L, -1) + n;
+  lua_pop(L, 1);
+  lua_pushnumber(L, count);
+  lua_rawset(L, idx);
+}
+
+static void lunet_profiler_cb(void *data, lua_State *L, int samples, int vmstate) {
+  lunet_rt_t *rt = (lunet_rt_t *)data;
+  if (!lua_checkstack(L, 8)) {
+    return;
+  }
+  int top = lua_gettop(L);
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_PROFILER_COUNTS_KEY);
+  if (!lua_istable(L, -1)) {
+    lua_settop(L, top);
+    return;
+  }
+  int counts = lua_gettop(L);
+
+  size_t len;
+  const char *stack = luaJIT_profile_dumpstack(L, "FZ;", -rt->prof_depth, &len);
+  profiler_push_task(L, rt->current_co);
+  int parts = 1;
+  if (len > 0) {
+    lua_pushliteral(L, ";");
+    lua_pushlstring(L, stack, len);
+    parts += 2;
+  }
+  if (vmstate == 'G') {
+    lua_pushliteral(L, ";[GC]");
+    parts++;
+  } else if (vmstate == 'J') {
+    lua_pushliteral(L, ";[JIT]");
+    parts++;
+  }
+  lua_concat(L, parts);
+  profiler_count(L, counts, 1);
+
+  if (samples > 1) {
+    profiler_push_task(L, rt->current_co);
+    lua_pushfstring(L, ";[C] %s", rt->current_site ? rt->current_site : "loop");
+    lua_concat(L, 2);
+    profiler_count(L, counts, samples - 1);
+  }
+  lua_settop(L, top);
+}
+
+int lunet_profiler_start(lua_State *L) {
+  lunet_rt_t *rt = lunet_rt();
+  int interval = LUNET_PROFILER_INTERVAL_DEFAULT;
+  int depth = LUNET_PROFILER_DEPTH_DEFAULT;
+  if (lua_istable(L, 1)) {
+    lua_getfield(L, 1, "interval");
+    interval = (int)luaL_optinteger(L, -1, interval);
+    lua_getfield(L, 1, "depth");
+    depth = (int)luaL_optinteger(L, -1, depth);
+    lua_pop(L, 2);
+  }
+  luaL_argcheck(L, interval >= 1, 1, "interval must be >= 1 ms");
+  luaL_argcheck(L, depth >= 1, 1, "depth must be >= 1");
+  if (!rt) {
+    lua_pushnil(L);
+    lua_pushstring(L, "no runtime");
+    return 2;
+  }
+
+  uv_once(&g_profiler_once, profiler_lock_init);
+  uv_mutex_lock(&g_profiler_lock);
+  if (g_profiler_owner) {
+    uv_mutex_unlock(&g_profiler_lock);
+    lua_pushnil(L);
+    lua_pushstring(L, "profiler already running");
+    return 2;
+  }
+  g_profiler_owner = rt;
+  uv_mutex_unlock(&g_profiler_lock);
+
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_PROFILER_COUNTS_KEY);
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_PROFILER_TASKS_KEY);
+
+  rt->prof_depth = depth;
+  char mode[32];
+  snprintf(mode, sizeof(mode), "fi%d", interval);
+  luaJIT_profile_start(L, mode, lunet_profiler_cb, rt);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+typedef struct {
+  lua_CFunction fn;
+  char name[64];
+} profiler_cfunc_t;
+
+typedef struct {
+  profiler_cfunc_t *items;
+  size_t len;
+  size_t cap;
+} profiler_cfuncs_t;
+
+static int profiler_cfunc_cmp(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)((const profiler_cfunc_t *)a)->fn;
+  uintptr_t y = (uintptr_t)((const profiler_cfunc_t *)b)->fn;
+  return x < y ? -1 : x > y;
+}
+
+// Collect the C functions of every loaded lunet module, sorted by address
+static void profiler_collect_cfuncs(lua_State *L, profiler_cfuncs_t *out) {
+  lua_getglobal(L, "package");
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_getfield(L, -1, "loaded");
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 2);
+    return;
+  }
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    if (lua_type(L, -2) == LUA_TSTRING && lua_istable(L, -1) && strncmp(lua_tostring(L, -2), "lunet", 5) == 0) {
+      const char *module = lua_tostring(L, -2);
+      lua_pushnil(L);
+      while (lua_next(L, -2)) {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1)) {
+          if (out->len == out->cap) {
+            size_t cap = out->cap ? out->cap * 2 : 64;
+            profiler_cfunc_t *items = (profiler_cfunc_t *)realloc(out->items, cap * sizeof(profiler_cfunc_t));
+            if (!items) {
+              lua_pop(L, 2);
+              break;
+            }
+            out->items = items;
+            out->cap = cap;
+          }
+          profiler_cfunc_t *item = &out->items[out->len++];
+          item->fn = lua_tocfunction(L, -1);
+          snprintf(item->name, sizeof(item->name), "%s.%s", module, lua_tostring(L, -2));
+        }
+        lua_pop(L, 1);
+      }
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 2);
+  if (out->len > 1) {
+    qsort(out->items, out->len, sizeof(profiler_cfunc_t), profiler_cfunc_cmp);
+  }
+}
+
+static const char *profiler_cfunc_name(const profiler_cfuncs_t *cfuncs, const char *frame) {
+  profiler_cfunc_t key;
+  key.fn = (lua_CFunction)(uintptr_t)strtoull(frame + 1, NULL, 16);
+  profiler_cfunc_t *item =
+      cfuncs->len ? (profiler_cfunc_t *)bsearch(&key, cfuncs->items, cfuncs->len, sizeof(key), profiler_cfunc_cmp)
+                  : NULL;
+  return item ? item->name : NULL;
+}
+
+typedef struct {
+  FILE *f;        // write to file, or
+  luaL_Buffer *b; // to the result string
+} profiler_out_t;
+
+static void profiler_emit(profiler_out_t *out, const char *s, size_t n) {
+  if (out->f) {
+    fwrite(s, 1, n, out->f);
+  } else {
+    luaL_addlstring(out->b, s, n);
+  }
+}
+
+// Write one folded line, replacing "@0x..." C frames with lunet function names
+static void profiler_emit_line(profiler_out_t *out, const profiler_cfuncs_t *cfuncs, const char *key,
+                               lua_Number count) {
+  const char *p = key;
+  while (*p) {
+    const char *end = strchr(p, ';');
+    size_t n = end ? (size_t)(end - p) : strlen(p);
+    const char *name = p[0] == '@' ? profiler_cfunc_name(cfuncs, p) : NULL;
+    if (name) {
+      profiler_emit(out, name, strlen(name));
+    } else {
+      profiler_emit(out, p, n);
+    }
+    p += n;
+    if (*p == ';') {
+      profiler_emit(out, ";", 1);
+      p++;
+    }
+  }
+  char num[32];
+  int len = snprintf(num, sizeof(num), " %.0f\n", (double)count);
+  profiler_emit(out, num, (size_t)len);
+}
+
+typedef struct {
+  char *key;
+  lua_Number count;
+} profiler_line_t;
+
+void lunet_profiler_close(lunet_rt_t *rt) {
+  uv_once(&g_profiler_once, profiler_lock_init);
+  uv_mutex_lock(&g_profiler_lock);
+  int owner = g_profiler_owner == rt;
+  if (owner) {
+    g_profiler_owner = NULL;
+  }
+  uv_mutex_unlock(&g_profiler_lock);
+  if (owner) {
+    luaJIT_profile_stop(rt->L);
+    rt->prof_depth = 0;
+  }
+}
+
+int lunet_profiler_stop(lua_State *L) {
+  const char *path = luaL_optstring(L, 1, NULL);
+  lunet_rt_t *rt = lunet_rt();
+  uv_once(&g_profiler_once, profiler_lock_init);
+  uv_mutex_lock(&g_profiler_lock);
+  int owner = rt && g_profiler_owner == rt;
+  uv_mutex_unlock(&g_profiler_lock);
+  if (!owner) {
+    lua_pushnil(L);
+    lua_pushstring(L, "profiler not running");
+    return 2;
+  }
+  profiler_out_t out = {NULL, NULL};
+  if (path) {
+    // before stopping, so a bad path loses nothing
+    out.f = fopen(path, "w");
+    if (!out.f) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "cannot open %s", path);
+      return 2;
+    }
+  }
+  lunet_profiler_close(rt);
+
+  // copy the counts out so the output buffer can use the stack freely
+  profiler_line_t *lines = NULL;
+  size_t nlines = 0, cap = 0;
+  lua_Number samples = 0;
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_PROFILER_COUNTS_KEY);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    if (nlines == cap) {
+      cap = cap ? cap * 2 : 256;
+      profiler_line_t *grown = (profiler_line_t *)realloc(lines, cap * sizeof(profiler_line_t));
+      if (!grown) {
+        lua_pop(L, 2);
+        break;
+      }
+      lines = grown;
+    }
+    size_t klen;
+    const char *key = lua_tolstring(L, -2, &klen);
+    char *copy = (char *)malloc(klen + 1);
+    if (copy) {
+      memcpy(copy, key, klen + 1);
+      lines[nlines].key = copy;
+      lines[nlines].count = lua_tonumber(L, -1);
+      samples += lines[nlines].count;
+      nlines++;
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  lua_pushnil(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_PROFILER_COUNTS_KEY);
+  lua_pushnil(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_PROFILER_TASKS_KEY);
+
+  profiler_cfuncs_t cfuncs = {NULL, 0, 0};
+  profiler_collect_cfuncs(L, &cfuncs);
+
+  luaL_Buffer b;
+  if (!path) {
+    luaL_buffinit(L, &b);
+    out.b = &b;
+  }
+  for (size_t i = 0; i < nlines; i++) {
+    profiler_emit_line(&out, &cfuncs, lines[i].key, lines[i].count);
+    free(lines[i].key);
+  }
+  free(lines);
+  free(cfuncs.items);
+
+  if (path) {
+    if (fclose(out.f) != 0) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "cannot write %s", path);
+      return 2;
+    }
+    lua_pushnumber(L, samples);
+  } else {
+    luaL_pushresult(&b);
+  }
+  return 1;
+}
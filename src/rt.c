@@ -1,7 +1,121 @@
 #include "rt.h"
 
-static lua_State *g_luaL = NULL;
+#include <stdlib.h>
+#include <string.h>
 
-void set_default_luaL(lua_State *L) { g_luaL = L; }
+#include "co.h"
+#include "gc.h"
+#include "mailbox.h"
+#include "monitor.h"
+#include "pool.h"
+#include "profiler.h"
 
-lua_State *default_luaL(void) { return g_luaL; }
\ No newline at end of file
+#define LUNET_RT_REGISTRY_KEY "lunet.rt"
+
+static LUNET_THREAD_LOCAL lunet_rt_t *g_rt = NULL;
+
+void lunet_rt_init(lunet_rt_t *rt, lua_State *L, uv_loop_t *loop, int worker_id, int worker_count) {
+  rt->loop = loop;
+  rt->L = L;
+  rt->worker_id = worker_id;
+  rt->worker_count = worker_count;
+  rt->co_pool_max = LUNET_CO_POOL_DEFAULT;
+  rt->co_pool_idle = 0;
+  rt->co_pool_hits = 0;
+  rt->co_pool_misses = 0;
+  rt->current_co = NULL;
+  rt->current_site = NULL;
+  rt->slice_ns = 0;
+  rt->slice_start = 0;
+  rt->preemptions = 0;
+  rt->ready_init = 0;
+  rt->ready_budget = LUNET_READY_BUDGET_DEFAULT;
+  rt->ready = NULL;
+  rt->ready_head = 0;
+  rt->ready_len = 0;
+  rt->ready_cap = 0;
+  rt->mail_async = NULL;
+  rt->mailboxes = NULL;
+  rt->mail_waiting = 0;
+  rt->pool_async = NULL;
+  lunet_mpsc_init(&rt->pool_done);
+  rt->pool_pending = 0;
+  memset(&rt->stats, 0, sizeof(rt->stats));
+  // idle time feeds the utilization figure in lunet.stats()
+  uv_loop_configure(loop, UV_METRICS_IDLE_TIME);
+  rt->stats.util_hrtime = uv_hrtime();
+  rt->monitor = NULL;
+  rt->alloc = NULL;
+  rt->prof_depth = 0;
+  memset(&rt->slab, 0, sizeof(rt->slab));
+  memset(&rt->trace, 0, sizeof(rt->trace));
+  lunet_trace_ring_init(&rt->trace, LUNET_TRACE_RING_DEFAULT);
+
+  lua_pushlightuserdata(L, rt);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_RT_REGISTRY_KEY);
+  g_rt = rt;
+  // started up front so lunet.stats() counts every loop iteration
+  lunet_ready_init(rt);
+  lunet_gc_init(rt);
+}
+
+void lunet_rt_close(lunet_rt_t *rt) {
+  int closing = rt->ready_init || rt->gc_init || rt->mail_async || rt->pool_async || rt->monitor;
+  lunet_mailbox_close_all(rt);
+  lunet_pool_close_loop(rt);
+  lunet_monitor_close(rt);
+  lunet_profiler_close(rt);
+  lunet_gc_close(rt);
+  if (rt->ready_init) {
+    uv_close((uv_handle_t *)&rt->ready_check, NULL);
+    uv_close((uv_handle_t *)&rt->ready_idle, NULL);
+    rt->ready_init = 0;
+  }
+  if (closing) {
+    // run the close callbacks now: rt may live on the caller's stack
+    uv_run(rt->loop, UV_RUN_NOWAIT);
+  }
+  lunet_trace_ring_free(&rt->trace);
+  // contexts still out belong to requests that never completed; leave their chunks
+  if (rt->slab.live == 0) {
+    lunet_slab_destroy(&rt->slab);
+  }
+  free(rt->ready);
+  rt->ready = NULL;
+  rt->ready_len = 0;
+  rt->ready_cap = 0;
+}
+
+lunet_rt_t *lunet_rt_attach(lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_RT_REGISTRY_KEY);
+  lunet_rt_t *rt = (lunet_rt_t *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (rt) {
+    g_rt = rt;
+    return rt;
+  }
+
+  // Loaded as a plain Lua module: run on the default loop, lives for the process
+  rt = (lunet_rt_t *)calloc(1, sizeof(lunet_rt_t));
+  if (!rt) {
+    return NULL;
+  }
+  lunet_rt_init(rt, L, uv_default_loop(), 1, 1);
+  return rt;
+}
+
+lunet_rt_t *lunet_rt(void) { return g_rt; }
+
+lua_State *default_luaL(void) { return g_rt ? g_rt->L : NULL; }
+
+uv_loop_t *default_loop(void) { return g_rt ? g_rt->loop : uv_default_loop(); }
+
+int lunet_worker_id(lua_State *L) {
+  lua_pushinteger(L, g_rt ? g_rt->worker_id : 1);
+  return 1;
+}
+
+int lunet_worker_count(lua_State *L) {
+  lua_pushinteger(L, g_rt ? g_rt->worker_count : 1);
+  return 1;
+}
@@ -0,0 +1,187 @@
+#include "serialize.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SER_NIL 0
+#define SER_FALSE 1
+#define SER_TRUE 2
+#define SER_NUMBER 3
+#define SER_STRING 4
+#define SER_TABLE 5
+#define SER_TABLE_END 6
+
+// Deeper nesting is treated as a cycle
+#define SER_MAX_DEPTH 64
+
+void lunet_buf_init(lunet_buf_t *buf) {
+  buf->data = NULL;
+  buf->len = 0;
+  buf->cap = 0;
+}
+
+void lunet_buf_free(lunet_buf_t *buf) {
+  free(buf->data);
+  lunet_buf_init(buf);
+}
+
+static int buf_put(lunet_buf_t *buf, const void *src, size_t n) {
+  if (buf->len + n > buf->cap) {
+    size_t cap = buf->cap ? buf->cap : 64;
+    while (cap < buf->len + n) {
+      cap *= 2;
+    }
+    char *data = (char *)realloc(buf->data, cap);
+    if (!data) {
+      return -1;
+    }
+    buf->data = data;
+    buf->cap = cap;
+  }
+  memcpy(buf->data + buf->len, src, n);
+  buf->len += n;
+  return 0;
+}
+
+static int buf_put_tag(lunet_buf_t *buf, uint8_t tag) { return buf_put(buf, &tag, 1); }
+
+static int serialize_value(lua_State *L, int idx, lunet_buf_t *buf, int depth, const char **err) {
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      return buf_put_tag(buf, SER_NIL);
+    case LUA_TBOOLEAN:
+      return buf_put_tag(buf, lua_toboolean(L, idx) ? SER_TRUE : SER_FALSE);
+    case LUA_TNUMBER: {
+      lua_Number n = lua_tonumber(L, idx);
+      if (buf_put_tag(buf, SER_NUMBER) != 0) return -1;
+      return buf_put(buf, &n, sizeof(n));
+    }
+    case LUA_TSTRING: {
+      size_t len;
+      const char *s = lua_tolstring(L, idx, &len);
+      uint32_t n = (uint32_t)len;
+      if (len > UINT32_MAX) {
+        *err = "string too large to serialize";
+        return -1;
+      }
+      if (buf_put_tag(buf, SER_STRING) != 0 || buf_put(buf, &n, sizeof(n)) != 0) return -1;
+      return buf_put(buf, s, len);
+    }
+    case LUA_TTABLE: {
+      if (depth >= SER_MAX_DEPTH) {
+        *err = "table nested too deeply or cyclic";
+        return -1;
+      }
+      if (!lua_checkstack(L, 3)) {
+        *err = "stack overflow";
+        return -1;
+      }
+      if (idx < 0) idx = lua_gettop(L) + idx + 1;
+      if (buf_put_tag(buf, SER_TABLE) != 0) return -1;
+      lua_pushnil(L);
+      while (lua_next(L, idx) != 0) {
+        if (serialize_value(L, -2, buf, depth + 1, err) != 0 ||
+            serialize_value(L, -1, buf, depth + 1, err) != 0) {
+          lua_pop(L, 2);
+          return -1;
+        }
+        lua_pop(L, 1);
+      }
+      return buf_put_tag(buf, SER_TABLE_END);
+    }
+    default:
+      *err = "cannot serialize value of this type";
+      return -1;
+  }
+}
+
+int lunet_serialize(lua_State *L, int first, int last, lunet_buf_t *buf, const char **err) {
+  *err = NULL;
+  for (int i = first; i <= last; i++) {
+    if (serialize_value(L, i, buf, 0, err) != 0) {
+      if (!*err) *err = "out of memory";
+      return -1;
+    }
+  }
+  return 0;
+}
+
+typedef struct {
+  const char *p;
+  const char *end;
+} ser_reader_t;
+
+static int read_bytes(ser_reader_t *r, void *dst, size_t n) {
+  if ((size_t)(r->end - r->p) < n) {
+    return -1;
+  }
+  memcpy(dst, r->p, n);
+  r->p += n;
+  return 0;
+}
+
+// Push one value; returns 0, 1 if the tag was SER_TABLE_END, or -1
+static int deserialize_value(lua_State *L, ser_reader_t *r, int depth) {
+  uint8_t tag;
+  if (read_bytes(r, &tag, 1) != 0 || !lua_checkstack(L, 3)) {
+    return -1;
+  }
+  switch (tag) {
+    case SER_NIL:
+      lua_pushnil(L);
+      return 0;
+    case SER_FALSE:
+    case SER_TRUE:
+      lua_pushboolean(L, tag == SER_TRUE);
+      return 0;
+    case SER_NUMBER: {
+      lua_Number n;
+      if (read_bytes(r, &n, sizeof(n)) != 0) return -1;
+      lua_pushnumber(L, n);
+      return 0;
+    }
+    case SER_STRING: {
+      uint32_t n;
+      if (read_bytes(r, &n, sizeof(n)) != 0 || (size_t)(r->end - r->p) < n) return -1;
+      lua_pushlstring(L, r->p, n);
+      r->p += n;
+      return 0;
+    }
+    case SER_TABLE: {
+      if (depth >= SER_MAX_DEPTH) return -1;
+      lua_newtable(L);
+      for (;;) {
+        int rc = deserialize_value(L, r, depth + 1);
+        if (rc == 1) return 0;
+        if (rc != 0) goto fail;
+        if (lua_isnil(L, -1) || deserialize_value(L, r, depth + 1) != 0) {
+          lua_pop(L, 1);
+          goto fail;
+        }
+        lua_rawset(L, -3);
+      }
+    fail:
+      lua_pop(L, 1);
+      return -1;
+    }
+    case SER_TABLE_END:
+      return depth > 0 ? 1 : -1;
+    default:
+      return -1;
+  }
+}
+
+int lunet_deserialize(lua_State *L, const char *data, size_t len) {
+  ser_reader_t r = {data, data + len};
+  int base = lua_gettop(L);
+  int n = 0;
+  while (r.p < r.end) {
+    if (deserialize_value(L, &r, 0) != 0) {
+      lua_settop(L, base);
+      return -1;
+    }
+    n++;
+  }
+  return n;
+}
@@ -6,6 +6,7 @@
 #include <uv.h>
 
 #include "co.h"
+#include "rt.h"
 #include "trace.h"
 
 typedef struct {
@@ -28,17 +29,17 @@ static void lunet_signal_cb(uv_signal_t *handle, int signo) {
     lua_pushstring(co, "HUP");
   else if (signo == SIGQUIT)
     lua_pushstring(co, "QUIT");
+#ifdef SIGUSR1
+  else if (signo == SIGUSR1)
+    lua_pushstring(co, "USR1");
+  else if (signo == SIGUSR2)
+    lua_pushstring(co, "USR2");
+#endif
   else
     lua_pushfstring(co, "SIGNAL_%d", signo);
   lua_pushnil(co);
 
-  int status = lua_resume(co, 2);
-  if (status != LUA_OK && status != LUA_YIELD) {
-    const char *err = lua_tostring(co, -1);
-    if (err) {
-      fprintf(stderr, "signal_cb resume error: %s\n", err);
-    }
-  }
+  lunet_co_resume(co, 2, "signal.wait");
 
   // cleanup
   lunet_coref_release(co, ctx->co_ref);
@@ -63,6 +64,12 @@ int lunet_signal_wait(lua_State *L) {
     signo = SIGHUP;
   else if (strcmp(sig_name, "QUIT") == 0)
     signo = SIGQUIT;
+#ifdef SIGUSR1
+  else if (strcmp(sig_name, "USR1") == 0)
+    signo = SIGUSR1;
+  else if (strcmp(sig_name, "USR2") == 0)
+    signo = SIGUSR2;
+#endif
   else {
     lua_pushnil(L);
     lua_pushstring(L, "unsupported signal name");
@@ -79,7 +86,7 @@ int lunet_signal_wait(lua_State *L) {
   ctx->L = L;
   lunet_coref_create(L, ctx->co_ref);
 
-  uv_signal_init(uv_default_loop(), &ctx->handle);
+  uv_signal_init(default_loop(), &ctx->handle);
   ctx->handle.data = ctx;
   uv_signal_start(&ctx->handle, lunet_signal_cb, signo);
 
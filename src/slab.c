@@ -0,0 +1,91 @@
+#include "slab.h"
+
+#include <stdlib.h>
+
+#include "rt.h"
+
+#define LUNET_SLAB_CHUNK_HEADER 16  /* chunk list link; keeps blocks 16-byte aligned */
+
+static inline int slab_class(size_t size) { return size ? (int)((size - 1) / LUNET_SLAB_GRAIN) : 0; }
+
+void *lunet_slab_alloc(size_t size) {
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt) {
+    return malloc(size);
+  }
+  lunet_slab_t *s = &rt->slab;
+  s->allocs++;
+  if (size > LUNET_SLAB_MAX) {
+    void *p = malloc(size);
+    if (p) {
+      s->mallocs++;
+      s->live++;
+    }
+    return p;
+  }
+
+  int cls = slab_class(size);
+  lunet_slab_block_t *b = s->free[cls];
+  if (b) {
+    s->free[cls] = b->next;
+    s->reused++;
+    s->live++;
+    return b;
+  }
+
+  size_t block = (size_t)(cls + 1) * LUNET_SLAB_GRAIN;
+  if (s->bump_left < block) {
+    char *chunk = (char *)malloc(LUNET_SLAB_CHUNK);
+    if (!chunk) {
+      return NULL;
+    }
+    *(void **)chunk = s->chunks;
+    s->chunks = chunk;
+    s->mallocs++;
+    s->reserved += LUNET_SLAB_CHUNK;
+    // the rest of the old chunk is lost; at most one block per chunk
+    s->bump = chunk + LUNET_SLAB_CHUNK_HEADER;
+    s->bump_left = LUNET_SLAB_CHUNK - LUNET_SLAB_CHUNK_HEADER;
+  }
+  void *p = s->bump;
+  s->bump += block;
+  s->bump_left -= block;
+  s->live++;
+  return p;
+}
+
+void lunet_slab_free(void *p, size_t size) {
+  if (!p) {
+    return;
+  }
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt || size > LUNET_SLAB_MAX) {
+    if (rt) {
+      rt->slab.live--;
+    }
+    free(p);
+    return;
+  }
+  lunet_slab_t *s = &rt->slab;
+  lunet_slab_block_t *b = (lunet_slab_block_t *)p;
+  int cls = slab_class(size);
+  b->next = s->free[cls];
+  s->free[cls] = b;
+  s->live--;
+}
+
+void lunet_slab_destroy(lunet_slab_t *s) {
+  void *chunk = s->chunks;
+  while (chunk) {
+    void *next = *(void **)chunk;
+    free(chunk);
+    chunk = next;
+  }
+  for (int i = 0; i < LUNET_SLAB_CLASSES; i++) {
+    s->free[i] = NULL;
+  }
+  s->chunks = NULL;
+  s->bump = NULL;
+  s->bump_left = 0;
+  s->reserved = 0;
+}
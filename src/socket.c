@@ -10,16 +10,52 @@
 #include <unistd.h> // for unlink
 #endif
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <uv.h>
 
 #include "co.h"
+#include "prefork.h"
+#include "rt.h"
+#include "slab.h"
 #include "stl.h"
 #include "trace.h"
 #include "runtime.h"
-
-static size_t read_buffer_size = 4096;
+#include "upgrade.h"
+
+// Per worker: each worker thread runs its own copy of the script
+static LUNET_THREAD_LOCAL size_t read_buffer_size = 4096;
+
+/*
+ * Reads: once socket.read is first called on a connection, the stream keeps
+ * reading into a per-connection buffer (uv_read_start stays on) and
+ * socket.read returns whatever is buffered without yielding. Reading stops
+ * only while more than LUNET_SOCKET_READ_HIGH_WATER bytes sit unread, which
+ * leaves TCP flow control to slow the peer down.
+ */
+
+/*
+ * In --workers mode every worker binds the same address. SO_REUSEPORT lets the
+ * kernel spread incoming connections (or datagrams) across the workers.
+ */
+int lunet_set_reuseport(uv_handle_t *handle) {
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+  uv_os_fd_t fd;
+  int ret = uv_fileno(handle, &fd);
+  if (ret < 0) {
+    return ret;
+  }
+  int on = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+    return uv_translate_sys_error(errno);
+  }
+  return 0;
+#else
+  (void)handle;
+  return UV_ENOTSUP;
+#endif
+}
 
 static int is_loopback_address(const char *host) {
   return strcmp(host, "127.0.0.1") == 0 ||
@@ -37,7 +73,14 @@ typedef enum {
   SOCKET_CLIENT,
 } socket_type_t;
 
-typedef struct {
+// What the waiting reader needs before it can be resumed
+typedef enum {
+  SOCKET_READ_ANY,    // socket.read: whatever is buffered
+  SOCKET_READ_EXACT,  // socket.read_exact: read_n bytes
+  SOCKET_READ_UNTIL,  // socket.read_until / read_line: up to delim, at most read_n bytes
+} socket_read_mode_t;
+
+typedef struct socket_ctx_s {
   union {
     uv_tcp_t tcp;
     uv_pipe_t pipe;
@@ -52,114 +95,323 @@ typedef struct {
     struct {
       int accept_ref;
       queue_t *pending_accepts;
+      struct socket_ctx_s *next_listener;  // this loop's listeners, for lunet.stats
+      char *addr;
+      int stopped;  // set by lunet_socket_stop_listeners: ctx outlives the handle until socket.close
+      int released;  // socket.close called on a stopped listener
     } server;
     struct {
       int read_ref;
-      int write_ref;
+      int drain_ref;
+      int writes_pending;  // uv_write requests not completed yet
+      int write_err;       // first failed write, reported by later writes and drain
+      int closing;         // socket.close called; the handle closes once writes_pending is 0
+      char *rbuf;     // unread input is rbuf[rpos, rlen)
+      size_t rpos;
+      size_t rlen;
+      size_t rcap;
+      int reading;    // uv_read_start is active
+      int read_err;   // UV_EOF or the error that ended the stream, 0 while open
+      socket_read_mode_t read_mode;
+      size_t read_n;
+      char *delim;        // copy of the delimiter; a yield does not keep the argument alive
+      size_t delim_len;
+      size_t delim_cap;
+      size_t scanned;     // bytes after rpos already searched for delim
+      int line;           // read_line: strip "\n" or "\r\n"
     } client;
   };
 
 } socket_ctx_t;
 
+// Listening sockets of this thread's loop
+static LUNET_THREAD_LOCAL socket_ctx_t *listeners = NULL;
+
+static void listener_remove(socket_ctx_t *ctx) {
+  for (socket_ctx_t **p = &listeners; *p; p = &(*p)->server.next_listener) {
+    if (*p == ctx) {
+      *p = ctx->server.next_listener;
+      return;
+    }
+  }
+}
+
 // write request structure
 typedef struct {
   uv_write_t req;
   socket_ctx_t *ctx;
-  char *data;
+  size_t size;   /* slab allocation size; data (write) or uv_bufs (writev) follow */
+  int data_ref;  /* writev: registry ref of the table anchoring the parts */
+  int co_ref;    /* writer suspended above the high-water mark, until this completes */
 } write_req_t;
 
+static void socket_client_init(socket_ctx_t *ctx) {
+  ctx->type = SOCKET_CLIENT;
+  ctx->client.read_ref = LUA_NOREF;
+  ctx->client.drain_ref = LUA_NOREF;
+  ctx->client.writes_pending = 0;
+  ctx->client.write_err = 0;
+  ctx->client.closing = 0;
+  ctx->client.rbuf = NULL;
+  ctx->client.rpos = 0;
+  ctx->client.rlen = 0;
+  ctx->client.rcap = 0;
+  ctx->client.reading = 0;
+  ctx->client.read_err = 0;
+  ctx->client.read_mode = SOCKET_READ_ANY;
+  ctx->client.delim = NULL;
+  ctx->client.delim_len = 0;
+  ctx->client.delim_cap = 0;
+}
+
 static void lunet_close_cb(uv_handle_t *handle) {
   socket_ctx_t *ctx = (socket_ctx_t *)handle->data;
+  if (ctx && ctx->type == SOCKET_SERVER && ctx->server.stopped) {
+    // stopped listener: queued connections stay acceptable until socket.close
+    ctx->server.stopped = 2;
+    if (!ctx->server.released) {
+      return;
+    }
+  }
   if (ctx) {
     if (ctx->type == SOCKET_SERVER) {
+      listener_remove(ctx);
       queue_destroy(ctx->server.pending_accepts);
+      free(ctx->server.addr);
+    } else {
+      free(ctx->client.rbuf);
+      free(ctx->client.delim);
     }
     free(ctx);
   }
 }
 
+/*
+ * Resume the coroutine behind *ref with (nil) or (error); status 0 is success.
+ * Writes complete after their writer moved on and ctx->co may be gone, so the
+ * registry is reached through the loop's main state.
+ */
+static void socket_wake_writer(int *ref, int status, const char *site) {
+  lua_State *co = default_luaL();
+  lua_rawgeti(co, LUA_REGISTRYINDEX, *ref);
+  lunet_coref_release(co, *ref);
+  *ref = LUA_NOREF;
+
+  if (lua_isthread(co, -1)) {
+    lua_State *waiting_co = lua_tothread(co, -1);
+    lua_pop(co, 1);
+
+    if (status == 0) {
+      lua_pushnil(waiting_co);
+    } else {
+      lua_pushstring(waiting_co, uv_strerror(status));
+    }
+
+    lunet_co_resume(waiting_co, 1, site);
+  } else {
+    lua_pop(co, 1);
+  }
+}
+
 // write complete callback
 static void lunet_write_cb(uv_write_t *req, int status) {
   write_req_t *write_req = (write_req_t *)req;
   socket_ctx_t *ctx = write_req->ctx;
 
-  if (ctx->client.write_ref != LUA_NOREF) {
-    lua_State *co = ctx->co;
-    lua_rawgeti(co, LUA_REGISTRYINDEX, ctx->client.write_ref);
-    lunet_coref_release(co, ctx->client.write_ref);
-    ctx->client.write_ref = LUA_NOREF;
+  ctx->client.writes_pending--;
+  if (status < 0 && !ctx->client.write_err) {
+    ctx->client.write_err = status;
+  }
+  if (write_req->co_ref != LUA_NOREF) {
+    socket_wake_writer(&write_req->co_ref, status, "socket.write");
+  }
+  if (ctx->client.writes_pending == 0 && ctx->client.drain_ref != LUA_NOREF) {
+    socket_wake_writer(&ctx->client.drain_ref, ctx->client.write_err, "socket.drain");
+  }
+  if (ctx->client.writes_pending == 0 && ctx->client.closing && !uv_is_closing(&ctx->u.handle)) {
+    uv_close(&ctx->u.handle, lunet_close_cb);
+  }
 
-    if (lua_isthread(co, -1)) {
-      lua_State *waiting_co = lua_tothread(co, -1);
-      lua_pop(co, 1);
+  // release write request and data
+  if (write_req->data_ref != LUA_NOREF) {
+    luaL_unref(default_luaL(), LUA_REGISTRYINDEX, write_req->data_ref);
+  }
+  lunet_slab_free(write_req, write_req->size);
+}
 
-      if (status == 0) {
-        lua_pushnil(waiting_co);
-      } else {
-        lua_pushstring(waiting_co, uv_strerror(status));
+// Make room for one read_buffer_size read at the end of the buffer
+static void alloc_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+  (void)suggested_size;
+  socket_ctx_t *ctx = (socket_ctx_t *)handle->data;
+  size_t unread = ctx->client.rlen - ctx->client.rpos;
+  if (ctx->client.rcap - ctx->client.rlen < read_buffer_size) {
+    if (ctx->client.rpos > 0) {
+      memmove(ctx->client.rbuf, ctx->client.rbuf + ctx->client.rpos, unread);
+      ctx->client.rpos = 0;
+      ctx->client.rlen = unread;
+    }
+    if (ctx->client.rcap - unread < read_buffer_size) {
+      size_t cap = ctx->client.rcap ? ctx->client.rcap : read_buffer_size;
+      while (cap - unread < read_buffer_size) {
+        cap *= 2;
       }
-
-      int resume_status = lua_resume(waiting_co, 1);
-      if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-        const char *err = lua_tostring(waiting_co, -1);
-        if (err) {
-          fprintf(stderr, "[lunet] resume error in lunet_write_cb: %s\n", err);
-        }
+      char *rbuf = (char *)realloc(ctx->client.rbuf, cap);
+      if (!rbuf) {
+        *buf = uv_buf_init(NULL, 0);  // read_cb gets UV_ENOBUFS
+        return;
       }
+      ctx->client.rbuf = rbuf;
+      ctx->client.rcap = cap;
     }
   }
+  *buf = uv_buf_init(ctx->client.rbuf + ctx->client.rlen, (unsigned int)(ctx->client.rcap - ctx->client.rlen));
+}
+
+static void socket_read_stop(socket_ctx_t *ctx) {
+  if (ctx->client.reading) {
+    uv_read_stop(&ctx->u.stream);
+    ctx->client.reading = 0;
+  }
+}
 
-  // release write request and data
-  if (write_req->data) {
-    free(write_req->data);
+static const char *const socket_read_sites[] = {"socket.read", "socket.read_exact", "socket.read_until"};
+
+// Unread bytes above which reading pauses; a waiting framed read may need more
+static size_t socket_read_limit(socket_ctx_t *ctx) {
+  if (ctx->client.read_ref != LUA_NOREF && ctx->client.read_mode != SOCKET_READ_ANY &&
+      ctx->client.read_n > LUNET_SOCKET_READ_HIGH_WATER) {
+    return ctx->client.read_n;
   }
-  free(write_req);
+  return LUNET_SOCKET_READ_HIGH_WATER;
 }
 
-static void alloc_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
-  buf->base = malloc(read_buffer_size);
-  buf->len = read_buffer_size;
+// memmem is not available everywhere: memchr for the first byte, then compare
+static const char *socket_find(const char *p, size_t n, const char *delim, size_t delim_len) {
+  const char *end = p + n;
+  while ((size_t)(end - p) >= delim_len) {
+    const char *hit = (const char *)memchr(p, delim[0], (size_t)(end - p) - delim_len + 1);
+    if (!hit) {
+      return NULL;
+    }
+    if (memcmp(hit, delim, delim_len) == 0) {
+      return hit;
+    }
+    p = hit + 1;
+  }
+  return NULL;
+}
+
+// Push the first len bytes (data, nil) and consume n
+static void socket_push_take(socket_ctx_t *ctx, lua_State *co, size_t len, size_t n) {
+  lua_pushlstring(co, ctx->client.rbuf + ctx->client.rpos, len);
+  lua_pushnil(co);
+  ctx->client.rpos += n;
+  ctx->client.scanned = 0;
+  if (ctx->client.rpos == ctx->client.rlen) {
+    ctx->client.rpos = 0;
+    ctx->client.rlen = 0;
+  }
+}
+
+/*
+ * Push the result of the pending read (read_mode) if the buffer holds enough
+ * for it, or the end-of-stream status once no more data can arrive. Returns
+ * 0 without pushing anything while the reader has to wait.
+ */
+static int socket_deliver(socket_ctx_t *ctx, lua_State *co) {
+  size_t unread = ctx->client.rlen - ctx->client.rpos;
+  switch (ctx->client.read_mode) {
+    case SOCKET_READ_ANY:
+      if (unread > 0) {
+        socket_push_take(ctx, co, unread, unread);
+        return 1;
+      }
+      break;
+    case SOCKET_READ_EXACT:
+      if (unread >= ctx->client.read_n) {
+        socket_push_take(ctx, co, ctx->client.read_n, ctx->client.read_n);
+        return 1;
+      }
+      break;
+    case SOCKET_READ_UNTIL: {
+      const char *data = ctx->client.rbuf + ctx->client.rpos;
+      size_t delim_len = ctx->client.delim_len;
+      size_t window = unread < ctx->client.read_n ? unread : ctx->client.read_n;
+      // continue where the last search stopped, overlapping a partial delimiter
+      size_t from = ctx->client.scanned >= delim_len ? ctx->client.scanned - delim_len + 1 : 0;
+      const char *hit = window > from ? socket_find(data + from, window - from, ctx->client.delim, delim_len) : NULL;
+      if (hit) {
+        size_t n = (size_t)(hit - data) + delim_len;
+        size_t len = n;
+        if (ctx->client.line) {
+          len -= delim_len;
+          if (len > 0 && data[len - 1] == '\r') {
+            len--;
+          }
+        }
+        socket_push_take(ctx, co, len, n);
+        return 1;
+      }
+      ctx->client.scanned = window;
+      if (unread >= ctx->client.read_n) {
+        // the data stays buffered for socket.read
+        lua_pushnil(co);
+        lua_pushfstring(co, "delimiter not found within %d bytes", (int)ctx->client.read_n);
+        return 1;
+      }
+      break;
+    }
+  }
+
+  if (!ctx->client.read_err) {
+    return 0;
+  }
+  lua_pushnil(co);
+  if (ctx->client.read_err != UV_EOF) {
+    lua_pushstring(co, uv_strerror(ctx->client.read_err));
+  } else if (unread > 0) {
+    lua_pushstring(co, "connection closed");  // incomplete frame, still buffered
+  } else {
+    lua_pushnil(co);
+  }
+  return 1;
 }
 
 static void lunet_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  (void)buf;  // points into ctx->client.rbuf
   socket_ctx_t *ctx = (socket_ctx_t *)stream->data;
 
-  uv_read_stop(stream);
+  if (nread == 0) {
+    return;  // EAGAIN
+  }
+  LUNET_TRACE_EVENT(LUNET_EV_TCP_READ, stream, nread > 0 ? nread : 0);
+  if (nread > 0) {
+    LUNET_STAT_ADD(bytes_read, (uint64_t)nread);
+    ctx->client.rlen += (size_t)nread;
+    if (ctx->client.rlen - ctx->client.rpos >= socket_read_limit(ctx)) {
+      socket_read_stop(ctx);
+    }
+  } else {
+    ctx->client.read_err = (int)nread;
+    socket_read_stop(ctx);
+  }
 
   if (ctx->client.read_ref != LUA_NOREF) {
     lua_State *co = ctx->co;
     lua_rawgeti(co, LUA_REGISTRYINDEX, ctx->client.read_ref);
+    lua_State *waiting_co = lua_isthread(co, -1) ? lua_tothread(co, -1) : NULL;
+    lua_pop(co, 1);
+
+    // a framed read keeps waiting until its frame is complete
+    if (waiting_co && !socket_deliver(ctx, waiting_co)) {
+      return;
+    }
     lunet_coref_release(co, ctx->client.read_ref);
     ctx->client.read_ref = LUA_NOREF;
-
-    if (lua_isthread(co, -1)) {
-      lua_State *waiting_co = lua_tothread(co, -1);
-      lua_pop(co, 1);
-
-      if (nread > 0) {
-        lua_pushlstring(waiting_co, buf->base, nread);
-        lua_pushnil(waiting_co);
-      } else if (nread == UV_EOF) {
-        lua_pushnil(waiting_co);
-        lua_pushnil(waiting_co);
-      } else {
-        lua_pushnil(waiting_co);
-        lua_pushstring(waiting_co, uv_strerror(nread));
-      }
-
-      int resume_status = lua_resume(waiting_co, 2);
-      if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-        const char *err = lua_tostring(waiting_co, -1);
-        if (err) {
-          fprintf(stderr, "[lunet] resume error in on_read: %s\n", err);
-        }
-      }
+    if (waiting_co) {
+      lunet_co_resume(waiting_co, 2, socket_read_sites[ctx->client.read_mode]);
     }
   }
-
-  if (buf->base) {
-    free(buf->base);
-  }
 }
 
 static void lunet_listen_cb(uv_stream_t *server, int status) {
@@ -180,13 +432,7 @@ static void lunet_listen_cb(uv_stream_t *server, int status) {
         lua_pushnil(waiting_co);
         lua_pushstring(waiting_co, uv_strerror(status));
 
-        int resume_status = lua_resume(waiting_co, 2);
-        if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-          const char *err = lua_tostring(waiting_co, -1);
-          if (err) {
-            fprintf(stderr, "[lunet] resume error in listen_cb: %s\n", err);
-          }
-        }
+        lunet_co_resume(waiting_co, 2, "socket.accept");
       }
     }
     return;
@@ -199,16 +445,14 @@ static void lunet_listen_cb(uv_stream_t *server, int status) {
   }
 
   client_ctx->co = ctx->co;
-  client_ctx->type = SOCKET_CLIENT;
+  socket_client_init(client_ctx);
   client_ctx->domain = ctx->domain;
-  client_ctx->client.read_ref = LUA_NOREF;
-  client_ctx->client.write_ref = LUA_NOREF;
 
   int ret = 0;
   if (ctx->domain == SOCKET_DOMAIN_TCP) {
-      ret = uv_tcp_init(uv_default_loop(), &client_ctx->u.tcp);
+      ret = uv_tcp_init(default_loop(), &client_ctx->u.tcp);
   } else {
-      ret = uv_pipe_init(uv_default_loop(), &client_ctx->u.pipe, 0);
+      ret = uv_pipe_init(default_loop(), &client_ctx->u.pipe, 0);
   }
 
   if (ret < 0) {
@@ -222,6 +466,7 @@ static void lunet_listen_cb(uv_stream_t *server, int status) {
     uv_close(&client_ctx->u.handle, lunet_close_cb);
     return;
   }
+  LUNET_TRACE_EVENT(LUNET_EV_TCP_ACCEPT, &client_ctx->u.stream, 0);
 
   if (ctx->server.accept_ref != LUA_NOREF) {
     // there is a coroutine waiting for accept, wake it up
@@ -237,13 +482,7 @@ static void lunet_listen_cb(uv_stream_t *server, int status) {
       lua_pushlightuserdata(waiting_co, client_ctx);
       lua_pushnil(waiting_co);
 
-      int resume_status = lua_resume(waiting_co, 2);
-      if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-        const char *err = lua_tostring(waiting_co, -1);
-        if (err) {
-          fprintf(stderr, "[lunet] resume error in listen_cb: %s\n", err);
-        }
-      }
+      lunet_co_resume(waiting_co, 2, "socket.accept");
     }
   } else {
     // there is no coroutine waiting for accept, put the connection into the queue
@@ -294,6 +533,10 @@ int lunet_socket_listen(lua_State *co) {
   ctx->type = SOCKET_SERVER;
   ctx->domain = domain;
   ctx->server.accept_ref = LUA_NOREF;
+  ctx->server.next_listener = NULL;
+  ctx->server.addr = NULL;
+  ctx->server.stopped = 0;
+  ctx->server.released = 0;
   ctx->server.pending_accepts = queue_init();
   if (!ctx->server.pending_accepts) {
     free(ctx);
@@ -302,9 +545,27 @@ int lunet_socket_listen(lua_State *co) {
     return 2;
   }
 
+  // Listening socket handed over by the binary we replaced (lunet.upgrade)
+  int inherited_fd = -1;
+  if (lunet_rt()->worker_count == 1 && !lunet_prefork_is_child()) {
+    char key[300];
+    if (domain == SOCKET_DOMAIN_TCP) {
+      snprintf(key, sizeof(key), "%s:%d", host, port);
+    } else {
+      snprintf(key, sizeof(key), "%s", host);
+    }
+    inherited_fd = lunet_upgrade_take_fd(protocol, key);
+  }
+
   int ret = 0;
   if (domain == SOCKET_DOMAIN_TCP) {
-      if ((ret = uv_tcp_init(uv_default_loop(), &ctx->u.tcp)) < 0) {
+      // In --workers mode the socket must exist before bind so SO_REUSEPORT can be set
+      if (lunet_rt()->worker_count > 1 && !lunet_prefork_is_child()) {
+        ret = uv_tcp_init_ex(default_loop(), &ctx->u.tcp, AF_INET);
+      } else {
+        ret = uv_tcp_init(default_loop(), &ctx->u.tcp);
+      }
+      if (ret < 0) {
         queue_destroy(ctx->server.pending_accepts);
         free(ctx);
         lua_pushnil(co);
@@ -312,7 +573,7 @@ int lunet_socket_listen(lua_State *co) {
         return 2;
       }
   } else {
-      if ((ret = uv_pipe_init(uv_default_loop(), &ctx->u.pipe, 0)) < 0) {
+      if ((ret = uv_pipe_init(default_loop(), &ctx->u.pipe, 0)) < 0) {
         queue_destroy(ctx->server.pending_accepts);
         free(ctx);
         lua_pushnil(co);
@@ -331,10 +592,41 @@ int lunet_socket_listen(lua_State *co) {
         lua_pushstring(co, "invalid host or port");
         return 2;
       }
-      if ((ret = uv_tcp_bind(&ctx->u.tcp, (const struct sockaddr *)&addr, 0)) < 0) {
+      if (inherited_fd >= 0) {
+        if ((ret = uv_tcp_open(&ctx->u.tcp, (uv_os_sock_t)inherited_fd)) < 0) {
+          uv_close(&ctx->u.handle, lunet_close_cb);
+          lua_pushnil(co);
+          lua_pushfstring(co, "failed to adopt inherited listener: %s", uv_strerror(ret));
+          return 2;
+        }
+      } else if (lunet_prefork_is_child()) {
+        // --processes mode: the supervisor owns the bound socket and passes it over IPC
+        if ((ret = lunet_prefork_listen(&ctx->u.tcp, host, port)) < 0) {
+          uv_close(&ctx->u.handle, lunet_close_cb);
+          lua_pushnil(co);
+          lua_pushfstring(co, "failed to get listener from supervisor: %s", uv_strerror(ret));
+          return 2;
+        }
+      } else {
+        if (lunet_rt()->worker_count > 1 && (ret = lunet_set_reuseport(&ctx->u.handle)) < 0) {
+          uv_close(&ctx->u.handle, lunet_close_cb);
+          lua_pushnil(co);
+          lua_pushfstring(co, "failed to set SO_REUSEPORT: %s", uv_strerror(ret));
+          return 2;
+        }
+        if ((ret = uv_tcp_bind(&ctx->u.tcp, (const struct sockaddr *)&addr, 0)) < 0) {
+          uv_close(&ctx->u.handle, lunet_close_cb);
+          lua_pushnil(co);
+          lua_pushfstring(co, "failed to bind: %s", uv_strerror(ret));
+          return 2;
+        }
+      }
+  } else if (inherited_fd >= 0) {
+      // Keep the socket file: the inherited fd is still bound to it
+      if ((ret = uv_pipe_open(&ctx->u.pipe, (uv_file)inherited_fd)) < 0) {
         uv_close(&ctx->u.handle, lunet_close_cb);
         lua_pushnil(co);
-        lua_pushfstring(co, "failed to bind: %s", uv_strerror(ret));
+        lua_pushfstring(co, "failed to adopt inherited listener: %s", uv_strerror(ret));
         return 2;
       }
   } else {
@@ -356,7 +648,23 @@ int lunet_socket_listen(lua_State *co) {
     lua_pushfstring(co, "failed to listen: %s", uv_strerror(ret));
     return 2;
   }
-  
+  LUNET_TRACE_EVENT(LUNET_EV_TCP_LISTEN, &ctx->u.stream, 0);
+
+  if (domain == SOCKET_DOMAIN_TCP) {
+    lua_pushfstring(co, "%s:%d", host, port);
+  } else {
+    lua_pushstring(co, host);
+  }
+  size_t addr_len;
+  const char *addr = lua_tolstring(co, -1, &addr_len);
+  ctx->server.addr = malloc(addr_len + 1);
+  if (ctx->server.addr) {
+    memcpy(ctx->server.addr, addr, addr_len + 1);
+  }
+  lua_pop(co, 1);
+  ctx->server.next_listener = listeners;
+  listeners = ctx;
+
   lua_pushlightuserdata(co, ctx);
   lua_pushnil(co);
   return 2;
@@ -397,6 +705,12 @@ int lunet_socket_accept(lua_State *co) {
     }
   }
 
+  if (listener_ctx->server.stopped) {
+    lua_pushnil(co);
+    lua_pushstring(co, "listener closed");
+    return 2;
+  }
+
   // there is no connection in the queue, wait for new connection
   // save the current coroutine reference
   lunet_coref_create(co, listener_ctx->server.accept_ref);
@@ -452,6 +766,25 @@ int lunet_socket_getpeername(lua_State *L) {
   return 2;
 }
 
+// Resume a reader parked on ctx with nil, "socket is closed"
+static void socket_cancel_reader(lua_State *L, socket_ctx_t *ctx) {
+  if (ctx->client.read_ref == LUA_NOREF) {
+    return;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->client.read_ref);
+  lunet_coref_release(L, ctx->client.read_ref);
+  ctx->client.read_ref = LUA_NOREF;
+  if (lua_isthread(L, -1)) {
+    lua_State *waiting_co = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    lua_pushnil(waiting_co);
+    lua_pushstring(waiting_co, "socket is closed");
+    lunet_co_resume(waiting_co, 2, socket_read_sites[ctx->client.read_mode]);
+  } else {
+    lua_pop(L, 1);
+  }
+}
+
 int lunet_socket_close(lua_State *L) {
   if (!lua_islightuserdata(L, 1)) {
     lua_pushstring(L, "invalid socket handle");
@@ -464,52 +797,225 @@ int lunet_socket_close(lua_State *L) {
     return 1;
   }
 
-  uv_close(&ctx->u.handle, lunet_close_cb);
+  LUNET_TRACE_EVENT(LUNET_EV_TCP_CLOSE, &ctx->u.stream, 0);
+  if (ctx->type == SOCKET_SERVER && ctx->server.stopped) {
+    // handle already closed (or closing) by lunet_socket_stop_listeners
+    socket_ctx_t *client;
+    while ((client = (socket_ctx_t *)queue_dequeue(ctx->server.pending_accepts)) != NULL) {
+      uv_close(&client->u.handle, lunet_close_cb);
+    }
+    ctx->server.released = 1;
+    if (ctx->server.stopped == 2) {
+      lunet_close_cb(&ctx->u.handle);
+    }
+  } else if (ctx->type == SOCKET_CLIENT && ctx->client.writes_pending > 0) {
+    // uv_close would cancel queued writes: let them go out, lunet_write_cb closes
+    if (!ctx->client.closing) {
+      ctx->client.closing = 1;
+      socket_read_stop(ctx);
+      socket_cancel_reader(L, ctx);
+    }
+  } else {
+    if (ctx->type == SOCKET_CLIENT) {
+      socket_cancel_reader(L, ctx);
+    }
+    uv_close(&ctx->u.handle, lunet_close_cb);
+  }
 
   lua_pushnil(L);
   return 1;
 }
 
-int lunet_socket_read(lua_State *co) {
-  if (lunet_ensure_coroutine(co, "socket.read") != 0) {
-    return lua_error(co);
-  }
-
+// Client context of a read call's handle, or NULL with (nil, err) pushed
+static socket_ctx_t *socket_check_reader(lua_State *co) {
   if (!lua_islightuserdata(co, 1)) {
     lua_pushnil(co);
     lua_pushstring(co, "invalid socket handle");
-    return 2;
+    return NULL;
   }
 
   socket_ctx_t *ctx = (socket_ctx_t *)lua_touserdata(co, 1);
   if (!ctx || ctx->type != SOCKET_CLIENT) {
     lua_pushnil(co);
     lua_pushstring(co, "invalid client socket handle");
-    return 2;
+    return NULL;
+  }
+
+  if (ctx->client.closing) {
+    lua_pushnil(co);
+    lua_pushstring(co, "socket is closed");
+    return NULL;
   }
 
   // there is a read already in progress
   if (ctx->client.read_ref != LUA_NOREF) {
     lua_pushnil(co);
     lua_pushstring(co, "another read already in progress");
+    return NULL;
+  }
+  return ctx;
+}
+
+// Serve the read set up in ctx from the buffer, or yield until it can be
+static int socket_read_wait(lua_State *co, socket_ctx_t *ctx) {
+  ctx->client.scanned = 0;
+  int done = socket_deliver(ctx, co);
+
+  // keep reading from here on; resumes after the high-water mark was hit
+  if (!ctx->client.reading && !ctx->client.read_err &&
+      (!done || ctx->client.rlen - ctx->client.rpos < LUNET_SOCKET_READ_HIGH_WATER)) {
+    int ret = uv_read_start(&ctx->u.stream, alloc_buffer, lunet_read_cb);
+    if (ret < 0) {
+      if (done) {
+        return 2;
+      }
+      lua_pushnil(co);
+      lua_pushfstring(co, "failed to start reading: %s", uv_strerror(ret));
+      return 2;
+    }
+    ctx->client.reading = 1;
+  }
+  if (done) {
     return 2;
   }
 
-  // save the coroutine reference
+  // save the coroutine reference and wait for data
   lunet_coref_create(co, ctx->client.read_ref);
+  return lua_yield(co, 0);
+}
 
-  // start reading
-  int ret = uv_read_start(&ctx->u.stream, alloc_buffer, lunet_read_cb);
-  if (ret < 0) {
-    // failed to start reading, clean up the reference
-    lunet_coref_release(co, ctx->client.read_ref);
-    ctx->client.read_ref = LUA_NOREF;
+int lunet_socket_read(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.read") != 0) {
+    return lua_error(co);
+  }
+  socket_ctx_t *ctx = socket_check_reader(co);
+  if (!ctx) {
+    return 2;
+  }
+  ctx->client.read_mode = SOCKET_READ_ANY;
+  return socket_read_wait(co, ctx);
+}
 
+int lunet_socket_read_exact(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.read_exact") != 0) {
+    return lua_error(co);
+  }
+  lua_Integer n = luaL_checkinteger(co, 2);
+  luaL_argcheck(co, n >= 0, 2, "byte count must be >= 0");
+  socket_ctx_t *ctx = socket_check_reader(co);
+  if (!ctx) {
+    return 2;
+  }
+  if (n == 0) {
+    lua_pushliteral(co, "");
     lua_pushnil(co);
-    lua_pushfstring(co, "failed to start reading: %s", uv_strerror(ret));
     return 2;
   }
+  ctx->client.read_mode = SOCKET_READ_EXACT;
+  ctx->client.read_n = (size_t)n;
+  return socket_read_wait(co, ctx);
+}
+
+// read_until and read_line; the delimiter is copied into ctx, the block is kept for later reads
+static int socket_read_delim(lua_State *co, const char *delim, size_t delim_len, int max_arg, int line) {
+  lua_Integer max = luaL_optinteger(co, max_arg, LUNET_SOCKET_READ_HIGH_WATER);
+  luaL_argcheck(co, max > 0, max_arg, "max must be > 0");
+  socket_ctx_t *ctx = socket_check_reader(co);
+  if (!ctx) {
+    return 2;
+  }
+  if (delim_len > ctx->client.delim_cap) {
+    char *copy = (char *)realloc(ctx->client.delim, delim_len);
+    if (!copy) {
+      lua_pushnil(co);
+      lua_pushstring(co, "out of memory");
+      return 2;
+    }
+    ctx->client.delim = copy;
+    ctx->client.delim_cap = delim_len;
+  }
+  memcpy(ctx->client.delim, delim, delim_len);
+  ctx->client.read_mode = SOCKET_READ_UNTIL;
+  ctx->client.read_n = (size_t)max;
+  ctx->client.delim_len = delim_len;
+  ctx->client.line = line;
+  return socket_read_wait(co, ctx);
+}
+
+int lunet_socket_read_until(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.read_until") != 0) {
+    return lua_error(co);
+  }
+  size_t delim_len;
+  const char *delim = luaL_checklstring(co, 2, &delim_len);
+  luaL_argcheck(co, delim_len > 0, 2, "delimiter must not be empty");
+  return socket_read_delim(co, delim, delim_len, 3, 0);
+}
 
+int lunet_socket_read_line(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.read_line") != 0) {
+    return lua_error(co);
+  }
+  return socket_read_delim(co, "\n", 1, 2, 1);
+}
+
+// Client context of a write call's handle, or NULL with the error pushed
+static socket_ctx_t *socket_check_writer(lua_State *co) {
+  if (!lua_islightuserdata(co, 1)) {
+    lua_pushstring(co, "invalid socket handle");
+    return NULL;
+  }
+
+  socket_ctx_t *ctx = (socket_ctx_t *)lua_touserdata(co, 1);
+  if (!ctx || ctx->type != SOCKET_CLIENT) {
+    lua_pushstring(co, "invalid client socket handle");
+    return NULL;
+  }
+
+  if (ctx->client.closing) {
+    lua_pushstring(co, "socket is closed");
+    return NULL;
+  }
+
+  // an earlier write failed after its writer had moved on
+  if (ctx->client.write_err) {
+    lua_pushstring(co, uv_strerror(ctx->client.write_err));
+    return NULL;
+  }
+  return ctx;
+}
+
+/*
+ * Queue write_req behind any writes still in flight (frees it if uv_write
+ * fails). libuv writes as much as the socket takes right away, so the writer
+ * returns without yielding unless the unsent backlog is now above
+ * LUNET_SOCKET_WRITE_HIGH_WATER; then it waits until this request completes.
+ */
+static int socket_write_start(lua_State *co, socket_ctx_t *ctx, write_req_t *write_req, const uv_buf_t *bufs,
+                              unsigned int nbufs, size_t total) {
+  write_req->co_ref = LUA_NOREF;
+  int ret = uv_write(&write_req->req, &ctx->u.stream, bufs, nbufs, lunet_write_cb);
+  if (ret < 0) {
+    // failed to start writing, clean up the resource
+    if (write_req->data_ref != LUA_NOREF) {
+      luaL_unref(co, LUA_REGISTRYINDEX, write_req->data_ref);
+    }
+    lunet_slab_free(write_req, write_req->size);
+
+    lua_pushfstring(co, "failed to start writing: %s", uv_strerror(ret));
+    return 1;
+  }
+  ctx->client.writes_pending++;
+  LUNET_STAT_ADD(bytes_written, total);
+  LUNET_TRACE_EVENT(LUNET_EV_TCP_WRITE, &ctx->u.stream, total);
+
+  if (uv_stream_get_write_queue_size(&ctx->u.stream) <= LUNET_SOCKET_WRITE_HIGH_WATER) {
+    lua_pushnil(co);
+    return 1;
+  }
+
+  // backpressure: wait for this write to complete
+  lunet_coref_create(co, write_req->co_ref);
   return lua_yield(co, 0);
 }
 
@@ -528,15 +1034,8 @@ int lunet_socket_write(lua_State *co) {
     return 1;
   }
 
-  socket_ctx_t *ctx = (socket_ctx_t *)lua_touserdata(co, 1);
-  if (!ctx || ctx->type != SOCKET_CLIENT) {
-    lua_pushstring(co, "invalid client socket handle");
-    return 1;
-  }
-
-  // check if there is a write already in progress
-  if (ctx->client.write_ref != LUA_NOREF) {
-    lua_pushstring(co, "another write already in progress");
+  socket_ctx_t *ctx = socket_check_writer(co);
+  if (!ctx) {
     return 1;
   }
 
@@ -544,44 +1043,119 @@ int lunet_socket_write(lua_State *co) {
   size_t data_len;
   const char *data = lua_tolstring(co, 2, &data_len);
 
-  // allocate write request
-  write_req_t *write_req = malloc(sizeof(write_req_t));
+  // allocate write request and a copy of the data in one block
+  size_t size = sizeof(write_req_t) + data_len;
+  write_req_t *write_req = (write_req_t *)lunet_slab_alloc(size);
   if (!write_req) {
     lua_pushstring(co, "out of memory");
     return 1;
   }
+  write_req->size = size;
+  write_req->ctx = ctx;
+  write_req->data_ref = LUA_NOREF;
+  memcpy(write_req + 1, data, data_len);
+
+  // set the buffer
+  uv_buf_t buf = uv_buf_init((char *)(write_req + 1), data_len);
+  return socket_write_start(co, ctx, write_req, &buf, 1, data_len);
+}
+
+/*
+ * socket.writev(conn, {parts...}): all parts go to one uv_write as separate
+ * buffers. Nothing is copied; the strings are kept alive by a private table
+ * referenced from the registry until the write completes, so the caller may
+ * reuse its table right away.
+ */
+int lunet_socket_writev(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.writev") != 0) {
+    return lua_error(co);
+  }
+
+  if (!lua_islightuserdata(co, 1)) {
+    lua_pushstring(co, "invalid socket handle");
+    return 1;
+  }
 
-  // copy data to heap memory
-  write_req->data = malloc(data_len);
-  if (!write_req->data) {
-    free(write_req);
-    lua_pushstring(co, "out of memory");
+  if (!lua_istable(co, 2)) {
+    lua_pushstring(co, "data must be a table of strings");
+    return 1;
+  }
+
+  socket_ctx_t *ctx = socket_check_writer(co);
+  if (!ctx) {
+    return 1;
+  }
+
+  int nbufs = (int)lua_objlen(co, 2);
+  if (nbufs == 0) {
+    lua_pushnil(co);
     return 1;
   }
-  memcpy(write_req->data, data, data_len);
 
+  size_t size = sizeof(write_req_t) + (size_t)nbufs * sizeof(uv_buf_t);
+  write_req_t *write_req = (write_req_t *)lunet_slab_alloc(size);
+  if (!write_req) {
+    lua_pushstring(co, "out of memory");
+    return 1;
+  }
+  write_req->size = size;
   write_req->ctx = ctx;
+  write_req->data_ref = LUA_NOREF;
+  uv_buf_t *bufs = (uv_buf_t *)(write_req + 1);
+
+  size_t total = 0;
+  lua_createtable(co, nbufs, 0);
+  for (int i = 1; i <= nbufs; i++) {
+    lua_rawgeti(co, 2, i);
+    if (!lua_isstring(co, -1)) {
+      lua_pop(co, 2);
+      lunet_slab_free(write_req, size);
+      lua_pushfstring(co, "part %d must be a string", i);
+      return 1;
+    }
+    size_t len;
+    const char *part = lua_tolstring(co, -1, &len);  // numbers are converted on the stack
+    bufs[i - 1] = uv_buf_init((char *)part, (unsigned int)len);
+    total += len;
+    lua_rawseti(co, -2, i);
+  }
+  write_req->data_ref = luaL_ref(co, LUA_REGISTRYINDEX);
 
-  // set the buffer
-  uv_buf_t buf = uv_buf_init(write_req->data, data_len);
+  return socket_write_start(co, ctx, write_req, bufs, (unsigned int)nbufs, total);
+}
 
-  // save the coroutine reference
-  lunet_coref_create(co, ctx->client.write_ref);
+int lunet_socket_drain(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.drain") != 0) {
+    return lua_error(co);
+  }
 
-  // start writing
-  int ret = uv_write(&write_req->req, &ctx->u.stream, &buf, 1, lunet_write_cb);
-  if (ret < 0) {
-    // failed to start writing, clean up the resource
-    lunet_coref_release(co, ctx->client.write_ref);
-    ctx->client.write_ref = LUA_NOREF;
-    free(write_req->data);
-    free(write_req);
+  if (!lua_islightuserdata(co, 1)) {
+    lua_pushstring(co, "invalid socket handle");
+    return 1;
+  }
 
-    lua_pushfstring(co, "failed to start writing: %s", uv_strerror(ret));
+  socket_ctx_t *ctx = (socket_ctx_t *)lua_touserdata(co, 1);
+  if (!ctx || ctx->type != SOCKET_CLIENT) {
+    lua_pushstring(co, "invalid client socket handle");
+    return 1;
+  }
+
+  if (ctx->client.drain_ref != LUA_NOREF) {
+    lua_pushstring(co, "another drain already in progress");
+    return 1;
+  }
+
+  if (ctx->client.writes_pending == 0) {
+    if (ctx->client.write_err) {
+      lua_pushstring(co, uv_strerror(ctx->client.write_err));
+    } else {
+      lua_pushnil(co);
+    }
     return 1;
   }
 
-  // yield to wait for write to complete
+  // wait for the last queued write
+  lunet_coref_create(co, ctx->client.drain_ref);
   return lua_yield(co, 0);
 }
 
@@ -596,6 +1170,7 @@ typedef struct {
 static void lunet_connect_cb(uv_connect_t *req, int status) {
   connect_ctx_t *ctx = (connect_ctx_t *)req->data;
   lua_State *co = ctx->co;
+  LUNET_TRACE_EVENT(LUNET_EV_TCP_CONNECT, &ctx->ctx->u.stream, 0);
 
   // resume coroutine
   lua_rawgeti(co, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -610,15 +1185,9 @@ static void lunet_connect_cb(uv_connect_t *req, int status) {
     lua_pushstring(co, uv_strerror(status));
   }
 
-  int resume_status = lua_resume(co, 2);
-  if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-    const char *err = lua_tostring(co, -1);
-    if (err) {
-      fprintf(stderr, "[lunet] resume error in connect_cb: %s\n", err);
-    }
-  }
+  lunet_co_resume(co, 2, "socket.connect");
 
-  free(ctx);
+  LUNET_SLAB_FREE(ctx);
 }
 
 int lunet_socket_connect(lua_State *L) {
@@ -648,16 +1217,14 @@ int lunet_socket_connect(lua_State *L) {
   }
 
   ctx->co = L;
-  ctx->type = SOCKET_CLIENT;
+  socket_client_init(ctx);
   ctx->domain = domain;
-  ctx->client.read_ref = LUA_NOREF;
-  ctx->client.write_ref = LUA_NOREF;
 
   int ret = 0;
   if (domain == SOCKET_DOMAIN_TCP) {
-      ret = uv_tcp_init(uv_default_loop(), &ctx->u.tcp);
+      ret = uv_tcp_init(default_loop(), &ctx->u.tcp);
   } else {
-      ret = uv_pipe_init(uv_default_loop(), &ctx->u.pipe, 0);
+      ret = uv_pipe_init(default_loop(), &ctx->u.pipe, 0);
   }
 
   if (ret < 0) {
@@ -669,7 +1236,7 @@ int lunet_socket_connect(lua_State *L) {
 
   ctx->u.handle.data = ctx;
 
-  connect_ctx_t *connect_ctx = malloc(sizeof(connect_ctx_t));
+  connect_ctx_t *connect_ctx = LUNET_SLAB_NEW(connect_ctx_t);
   if (!connect_ctx) {
     uv_close(&ctx->u.handle, lunet_close_cb);
     free(ctx);
@@ -692,7 +1259,7 @@ int lunet_socket_connect(lua_State *L) {
       if (ret < 0) {
         lunet_coref_release(L, connect_ctx->co_ref);
         connect_ctx->co_ref = LUA_NOREF;
-        free(connect_ctx);
+        LUNET_SLAB_FREE(connect_ctx);
         uv_close(&ctx->u.handle, lunet_close_cb);
         free(ctx);
         lua_pushnil(L);
@@ -717,7 +1284,7 @@ int lunet_socket_connect(lua_State *L) {
   if (ret < 0) {
     lunet_coref_release(L, connect_ctx->co_ref);
     connect_ctx->co_ref = LUA_NOREF;
-    free(connect_ctx);
+    LUNET_SLAB_FREE(connect_ctx);
     uv_close(&ctx->u.handle, lunet_close_cb);
     free(ctx);
     lua_pushnil(L);
@@ -730,9 +1297,59 @@ int lunet_socket_connect(lua_State *L) {
 }
 
 int lunet_socket_set_read_buffer_size(lua_State *L) {
-  if (lua_isnumber(L, 1)) {
+  if (lua_isnumber(L, 1) && lua_tointeger(L, 1) > 0) {
     read_buffer_size = lua_tointeger(L, 1);
   }
   lua_pushnil(L);
   return 1;
 }
+
+// Push an array of {address, pending, waiting} for this loop's listeners
+void lunet_socket_push_listeners(lua_State *L) {
+  lua_newtable(L);
+  int i = 0;
+  for (socket_ctx_t *ctx = listeners; ctx; ctx = ctx->server.next_listener) {
+    lua_createtable(L, 0, 3);
+    lua_pushstring(L, ctx->server.addr ? ctx->server.addr : "");
+    lua_setfield(L, -2, "address");
+    lua_pushinteger(L, (lua_Integer)queue_size(ctx->server.pending_accepts));
+    lua_setfield(L, -2, "pending");
+    lua_pushboolean(L, ctx->server.accept_ref != LUA_NOREF);
+    lua_setfield(L, -2, "waiting");
+    lua_rawseti(L, -2, ++i);
+  }
+}
+
+void lunet_socket_each_listener(lunet_socket_listener_fn fn, void *arg) {
+  for (socket_ctx_t *ctx = listeners; ctx; ctx = ctx->server.next_listener) {
+    uv_os_fd_t fd;
+    if (ctx->server.addr && uv_fileno(&ctx->u.handle, &fd) == 0) {
+      fn((int)fd, ctx->domain == SOCKET_DOMAIN_TCP ? "tcp" : "unix", ctx->server.addr, arg);
+    }
+  }
+}
+
+void lunet_socket_stop_listeners(void) {
+  while (listeners) {
+    socket_ctx_t *ctx = listeners;
+    listeners = ctx->server.next_listener;
+    ctx->server.stopped = 1;
+    uv_close(&ctx->u.handle, lunet_close_cb);
+
+    if (ctx->server.accept_ref != LUA_NOREF) {
+      lua_State *co = ctx->co;
+      lua_rawgeti(co, LUA_REGISTRYINDEX, ctx->server.accept_ref);
+      lunet_coref_release(co, ctx->server.accept_ref);
+      ctx->server.accept_ref = LUA_NOREF;
+      if (lua_isthread(co, -1)) {
+        lua_State *waiting_co = lua_tothread(co, -1);
+        lua_pop(co, 1);
+        lua_pushnil(waiting_co);
+        lua_pushstring(waiting_co, "listener closed");
+        lunet_co_resume(waiting_co, 2, "socket.accept");
+      } else {
+        lua_pop(co, 1);
+      }
+    }
+  }
+}
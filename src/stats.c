@@ -0,0 +1,112 @@
+#include "stats.h"
+
+#include <uv.h>
+
+#include "rt.h"
+#include "socket.h"
+
+/*
+ * Runtime metrics snapshot. Counters are maintained unconditionally by the
+ * modules that own them (see lunet_stats_t); handle counts are taken with
+ * uv_walk when stats are requested, so the hot paths pay nothing for them.
+ */
+
+typedef struct {
+  int tcp;
+  int udp;
+  int pipe;
+  int timers;
+  int total;
+} stats_handles_t;
+
+static void stats_walk_cb(uv_handle_t *handle, void *arg) {
+  stats_handles_t *h = (stats_handles_t *)arg;
+  if (uv_is_closing(handle)) {
+    return;
+  }
+  h->total++;
+  switch (uv_handle_get_type(handle)) {
+    case UV_TCP:
+      h->tcp++;
+      break;
+    case UV_UDP:
+      h->udp++;
+      break;
+    case UV_NAMED_PIPE:
+      h->pipe++;
+      break;
+    case UV_TIMER:
+      h->timers++;
+      break;
+    default:
+      break;
+  }
+}
+
+static void stats_set_number(lua_State *L, const char *key, lua_Number value) {
+  lua_pushnumber(L, value);
+  lua_setfield(L, -2, key);
+}
+
+int lunet_stats(lua_State *L) {
+  lunet_rt_t *rt = lunet_rt();
+  if (!rt) {
+    lua_pushnil(L);
+    lua_pushstring(L, "no runtime");
+    return 2;
+  }
+  lunet_stats_t *st = &rt->stats;
+
+  stats_handles_t handles = {0, 0, 0, 0, 0};
+  uv_walk(rt->loop, stats_walk_cb, &handles);
+
+  lua_createtable(L, 0, 16);
+  stats_set_number(L, "corefs", (lua_Number)st->corefs);
+  stats_set_number(L, "ready", (lua_Number)rt->ready_len);
+
+  lua_createtable(L, 0, 5);
+  stats_set_number(L, "tcp", handles.tcp);
+  stats_set_number(L, "udp", handles.udp);
+  stats_set_number(L, "pipe", handles.pipe);
+  stats_set_number(L, "timers", handles.timers);
+  stats_set_number(L, "total", handles.total);
+  lua_setfield(L, -2, "handles");
+
+  lunet_socket_push_listeners(L);
+  lua_setfield(L, -2, "listeners");
+
+  stats_set_number(L, "bytes_read", (lua_Number)st->bytes_read);
+  stats_set_number(L, "bytes_written", (lua_Number)st->bytes_written);
+  stats_set_number(L, "fs_pending", (lua_Number)st->fs_pending);
+  stats_set_number(L, "pool_pending", rt->pool_pending);
+  stats_set_number(L, "work_pending", (lua_Number)(st->fs_pending + rt->pool_pending));
+  stats_set_number(L, "loop_iterations", (lua_Number)st->loop_iterations);
+
+  // utilization since the previous call: 1 - idle/elapsed
+  uint64_t now = uv_hrtime();
+  uint64_t idle = uv_metrics_idle_time(rt->loop);
+  uint64_t elapsed = now - st->util_hrtime;
+  uint64_t idle_delta = idle - st->util_idle;
+  double utilization = elapsed > 0 && idle_delta <= elapsed ? 1.0 - (double)idle_delta / (double)elapsed : 0.0;
+  st->util_hrtime = now;
+  st->util_idle = idle;
+  stats_set_number(L, "idle_time_ms", (lua_Number)idle / 1e6);
+  stats_set_number(L, "utilization", utilization);
+
+  lua_createtable(L, 0, 5);
+  stats_set_number(L, "kb", lua_gc(L, LUA_GCCOUNT, 0));
+  stats_set_number(L, "steps", (lua_Number)st->gc_steps);
+  stats_set_number(L, "cycles", (lua_Number)st->gc_cycles);
+  stats_set_number(L, "step_ms", (lua_Number)st->gc_ns / 1e6);
+  stats_set_number(L, "max_step_ms", (lua_Number)st->gc_max_ns / 1e6);
+  lua_setfield(L, -2, "gc");
+
+  lua_createtable(L, 0, 5);
+  stats_set_number(L, "allocs", (lua_Number)rt->slab.allocs);
+  stats_set_number(L, "reused", (lua_Number)rt->slab.reused);
+  stats_set_number(L, "mallocs", (lua_Number)rt->slab.mallocs);
+  stats_set_number(L, "live", (lua_Number)rt->slab.live);
+  stats_set_number(L, "reserved", (lua_Number)rt->slab.reserved);
+  lua_setfield(L, -2, "slab");
+  return 1;
+}
@@ -1,14 +1,22 @@
 #include "stl.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+#define QUEUE_MIN_CAP 16
 
 // Initialize queue
-queue_t* queue_init(void) {
+queue_t* queue_init(void) { return queue_init_bounded(0); }
+
+// Initialize queue with a hard capacity
+queue_t* queue_init_bounded(size_t max) {
   queue_t* queue = (queue_t*)malloc(sizeof(queue_t));
   if (!queue) return NULL;
-  queue->head = NULL;
-  queue->tail = NULL;
+  queue->items = NULL;
+  queue->head = 0;
   queue->size = 0;
+  queue->cap = 0;
+  queue->max = max;
   return queue;
 }
 
@@ -16,30 +24,41 @@ queue_t* queue_init(void) {
 void queue_destroy(queue_t* queue) {
   if (!queue) return;
 
-  while (!queue_is_empty(queue)) {
-    queue_dequeue(queue);
-  }
+  free(queue->items);
   free(queue);
 }
 
+// Double the ring, unwrapping it so the oldest item lands at index 0
+static int queue_grow(queue_t* queue) {
+  size_t cap = queue->cap ? queue->cap * 2 : QUEUE_MIN_CAP;
+  if (cap < queue->cap) return -1;  // overflow
+
+  void** items = (void**)malloc(cap * sizeof(void*));
+  if (!items) return -1;  // memory allocation failed
+
+  size_t first = queue->cap - queue->head;
+  if (first > queue->size) first = queue->size;
+  if (queue->size) {
+    memcpy(items, queue->items + queue->head, first * sizeof(void*));
+    memcpy(items + first, queue->items, (queue->size - first) * sizeof(void*));
+  }
+  free(queue->items);
+  queue->items = items;
+  queue->head = 0;
+  queue->cap = cap;
+  return 0;
+}
+
 // Enqueue (add to tail)
 int queue_enqueue(queue_t* queue, void* data) {
   if (!queue) return -1;
+  if (queue->max && queue->size >= queue->max) return -1;  // full
 
-  queue_node_t* node = (queue_node_t*)malloc(sizeof(queue_node_t));
-  if (!node) return -1;  // memory allocation failed
-
-  node->data = data;
-  node->next = NULL;
-
-  if (queue->tail) {
-    queue->tail->next = node;
-  } else {
-    // queue is empty, new node is both head and tail
-    queue->head = node;
+  if (queue->size == queue->cap && queue_grow(queue) != 0) {
+    return -1;
   }
 
-  queue->tail = node;
+  queue->items[(queue->head + queue->size) & (queue->cap - 1)] = data;
   queue->size++;
   return 0;
 }
@@ -50,16 +69,8 @@ void* queue_dequeue(queue_t* queue) {
     return NULL;
   }
 
-  queue_node_t* node = queue->head;
-  void* data = node->data;
-
-  queue->head = node->next;
-  if (!queue->head) {
-    // queue becomes empty, tail pointer should also be null
-    queue->tail = NULL;
-  }
-
-  free(node);
+  void* data = queue->items[queue->head];
+  queue->head = (queue->head + 1) & (queue->cap - 1);
   queue->size--;
   return data;
 }
@@ -70,11 +81,11 @@ void* queue_peek(queue_t* queue) {
     return NULL;
   }
 
-  return queue->head->data;
+  return queue->items[queue->head];
 }
 
 // Check if queue is empty
-bool queue_is_empty(queue_t* queue) { return !queue || queue->head == NULL; }
+bool queue_is_empty(queue_t* queue) { return !queue || queue->size == 0; }
 
 // Get queue size
 size_t queue_size(queue_t* queue) { return queue ? queue->size : 0; }
@@ -5,6 +5,7 @@
 
 #include "co.h"
 #include "rt.h"
+#include "slab.h"
 #include "trace.h"
 
 typedef struct {
@@ -13,9 +14,16 @@ typedef struct {
   int co_ref;
 } sleep_ctx_t;
 
+static void lunet_sleep_close_cb(uv_handle_t *handle) {
+  sleep_ctx_t *ctx = (sleep_ctx_t *)handle->data;
+  LUNET_SLAB_FREE(ctx);
+}
+
 static void lunet_sleep_cb(uv_timer_t *timer) {
   sleep_ctx_t *ctx = (sleep_ctx_t *)timer->data;
   lua_State *L = ctx->L;
+  LUNET_TRACE_EVENT(LUNET_EV_WAKE, timer, 0);
+  uv_close((uv_handle_t *)timer, lunet_sleep_close_cb);
 
   // get coroutine reference from registry
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -30,14 +38,7 @@ static void lunet_sleep_cb(uv_timer_t *timer) {
   lua_State *co = lua_tothread(L, -1);
   lua_pop(L, 1);
 
-  int status = lua_resume(co, 0);
-  if (status != LUA_OK && status != LUA_YIELD) {
-    const char *err = lua_tostring(co, -1);
-    if (err) {
-      fprintf(stderr, "[lunet] resume error in sleep_cb: %s\n", err);
-    }
-    lua_pop(co, 1);  // pop error message
-  }
+  lunet_co_resume(co, 0, "sleep");
 }
 // sleep for ms milliseconds
 int lunet_sleep(lua_State *co) {
@@ -51,7 +52,7 @@ int lunet_sleep(lua_State *co) {
     return lua_error(co);
   }
 
-  sleep_ctx_t *ctx = malloc(sizeof(sleep_ctx_t));
+  sleep_ctx_t *ctx = LUNET_SLAB_NEW(sleep_ctx_t);
   if (!ctx) {
     lua_pushstring(co, "lunet.sleep: out of memory");
     return lua_error(co);
@@ -64,9 +65,10 @@ int lunet_sleep(lua_State *co) {
   lunet_coref_create_raw(ctx->L, ctx->co_ref);
 
   // init timer
-  uv_timer_init(uv_default_loop(), &ctx->timer);
+  uv_timer_init(default_loop(), &ctx->timer);
   ctx->timer.data = ctx;
   uv_timer_start(&ctx->timer, lunet_sleep_cb, ms, 0);
+  LUNET_TRACE_EVENT(LUNET_EV_SLEEP, &ctx->timer, ms);
 
   return lua_yield(co, 0);
 }
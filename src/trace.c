@@ -3,6 +3,8 @@
  * 
  * This file is only compiled when LUNET_TRACE is defined.
  * It provides runtime tracking of coroutine references to detect leaks.
+ * Individual create/release events go to the always-on trace ring
+ * (trace_ring.h) rather than stderr.
  */
 
 #ifdef LUNET_TRACE
@@ -67,10 +69,6 @@ void lunet_trace_coref_add(const char *file, int line, int ref) {
       lunet_trace_state.ref_to_loc[ref] = loc;
     }
   }
-  
-  fprintf(stderr, "[TRACE] COREF_ADD at %s:%d (ref=%d, balance=%d, total_created=%d)\n",
-          file, line, ref, lunet_trace_state.coref_balance, 
-          lunet_trace_state.coref_total_created);
 }
 
 void lunet_trace_coref_remove(const char *file, int line, int ref) {
@@ -103,10 +101,6 @@ void lunet_trace_coref_remove(const char *file, int line, int ref) {
     lunet_trace_state.ref_to_loc[ref] = -1; /* Mark as unused */
   }
   
-  fprintf(stderr, "[TRACE] COREF_RELEASE at %s:%d (ref=%d, balance=%d, total_released=%d)\n",
-          file, line, ref, lunet_trace_state.coref_balance,
-          lunet_trace_state.coref_total_released);
-  
   /* Warn on negative balance (double-release) */
   if (lunet_trace_state.coref_balance < 0) {
     fprintf(stderr, "[TRACE] WARNING: Negative coref balance! Possible double-release.\n");
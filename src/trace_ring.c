@@ -0,0 +1,418 @@
+#include "trace_ring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rt.h"
+
+static const char *lunet_trace_event_names[LUNET_EV_COUNT] = {
+    "none",      "spawn",      "resume",     "coref.add",   "coref.release", "sleep",         "wake",
+    "fs.start",  "fs.done",    "tcp.listen", "tcp.accept",  "tcp.connect",   "tcp.read",      "tcp.write",
+    "tcp.close", "udp.bind",   "udp.tx",     "udp.rx",      "udp.recv_wait", "udp.close",     "ready",
+    "yield",     "finish",
+};
+
+const char *lunet_trace_event_name(int event) {
+  if (event <= LUNET_EV_NONE || event >= LUNET_EV_COUNT) {
+    return "?";
+  }
+  return lunet_trace_event_names[event];
+}
+
+int lunet_trace_ring_init(lunet_trace_ring_t *ring, uint32_t capacity) {
+  if (capacity == 0) {
+    lunet_trace_ring_free(ring);
+    return 0;
+  }
+  uint32_t cap = 1;
+  while (cap < capacity) {
+    cap <<= 1;
+  }
+  lunet_trace_rec_t *recs = (lunet_trace_rec_t *)calloc(cap, sizeof(lunet_trace_rec_t));
+  if (!recs) {
+    return UV_ENOMEM;
+  }
+  lunet_trace_ring_free(ring);
+  ring->recs = recs;
+  ring->mask = cap - 1;
+  ring->head = 0;
+  ring->base_clock = lunet_trace_clock();
+  ring->base_ns = uv_hrtime();
+  return 0;
+}
+
+void lunet_trace_ring_free(lunet_trace_ring_t *ring) {
+  free(ring->recs);
+  ring->recs = NULL;
+  ring->mask = 0;
+  ring->head = 0;
+}
+
+// Nanoseconds per clock tick, measured over the ring's lifetime (1.0 when the clock is uv_hrtime)
+static double lunet_trace_ns_per_tick(const lunet_trace_ring_t *ring, uint64_t now) {
+  uint64_t now_ns = uv_hrtime();
+  if (now > ring->base_clock && now_ns > ring->base_ns) {
+    return (double)(now_ns - ring->base_ns) / (double)(now - ring->base_clock);
+  }
+  return 1.0;
+}
+
+// Index of the oldest record still in the ring and within the last `seconds` (0 = all)
+static uint64_t lunet_trace_first(const lunet_trace_ring_t *ring, uint64_t now, double ns_per_tick,
+                                  lua_Number seconds) {
+  uint64_t cap = (uint64_t)ring->mask + 1;
+  uint64_t i = ring->head > cap ? ring->head - cap : 0;
+  if (seconds > 0) {
+    double window = seconds * 1e9;
+    while (i < ring->head && (double)(now - ring->recs[i & ring->mask].ts) * ns_per_tick > window) {
+      i++;
+    }
+  }
+  return i;
+}
+
+// Open path for writing, or push nil, err and return NULL
+static FILE *lunet_trace_open(lua_State *L, const char *path, lunet_rt_t *rt) {
+  if (!rt || !rt->trace.recs) {
+    lua_pushnil(L);
+    lua_pushstring(L, "tracing disabled");
+    return NULL;
+  }
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+  }
+  return f;
+}
+
+static int lunet_trace_close(lua_State *L, FILE *f, lua_Integer written) {
+  if (fclose(f) != 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  lua_pushinteger(L, written);
+  return 1;
+}
+
+int lunet_trace_ring_dump(lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+  lua_Number seconds = luaL_optnumber(L, 2, 0);
+  lunet_rt_t *rt = lunet_rt();
+  FILE *f = lunet_trace_open(L, path, rt);
+  if (!f) {
+    return 2;
+  }
+
+  lunet_trace_ring_t *ring = &rt->trace;
+  uint64_t now = lunet_trace_clock();
+  double ns_per_tick = lunet_trace_ns_per_tick(ring, now);
+
+  // Times are milliseconds before the dump, so the last line is closest to 0
+  fprintf(f, "# lunet trace: worker %d, %llu events recorded, ring holds %llu\n", rt->worker_id,
+          (unsigned long long)ring->head, (unsigned long long)ring->mask + 1);
+  fprintf(f, "# ms event handle size [site]\n");
+  lua_Integer written = 0;
+  for (uint64_t i = lunet_trace_first(ring, now, ns_per_tick, seconds); i < ring->head; i++) {
+    const lunet_trace_rec_t *rec = &ring->recs[i & ring->mask];
+    double ms = -(double)(now - rec->ts) * ns_per_tick / 1e6;
+    if (rec->event == LUNET_EV_FS_DONE) {
+      fprintf(f, "%.3f %s %p %d", ms, lunet_trace_event_name(rec->event), rec->handle, (int32_t)rec->size);
+    } else {
+      fprintf(f, "%.3f %s %p %u", ms, lunet_trace_event_name(rec->event), rec->handle, rec->size);
+    }
+    if (rec->name) {
+      fprintf(f, " %s", rec->name);
+    }
+    fputc('\n', f);
+    written++;
+  }
+  return lunet_trace_close(L, f, written);
+}
+
+/*
+ * Chrome Trace Event export.
+ *
+ * The ring is replayed through a small per-coroutine state machine so that
+ * each coroutine gets its own track with three kinds of slices:
+ *
+ *   run     resume -> yield/finish, labelled with the site that resumed it
+ *   <site>  yield -> the callback that completed its wait (socket.read,
+ *           db.query, fs.stat, sleep, ...)
+ *   queued  that callback -> the actual resume from the ready queue
+ *
+ * Spawn/finish and coroutine reference events are instants on the same
+ * track; I/O events without a coroutine go on a "loop" track. Slices still
+ * open at export time end at the export.
+ */
+
+enum { EXPORT_IDLE = 0, EXPORT_RUN, EXPORT_WAIT, EXPORT_READY };
+
+typedef struct {
+  const void *co;          /* NULL = empty slot */
+  int tid;
+  int state;
+  int requeued;            /* queued itself while running (time slice) */
+  uint64_t since;          /* start of the current state */
+  uint64_t ready_at;
+  const char *site;        /* resume site of the current run */
+  const char *ready_site;  /* callback that made it ready */
+} lunet_export_co_t;
+
+typedef struct {
+  FILE *f;
+  int pid;
+  uint64_t base;
+  double ns_per_tick;
+  lua_Integer written;
+  lunet_export_co_t *cos;
+  size_t cap;
+  size_t len;
+} lunet_export_t;
+
+static size_t export_hash(const void *p, size_t cap) {
+  uintptr_t h = (uintptr_t)p;
+  h ^= h >> 17;
+  h *= (uintptr_t)0x9E3779B97F4A7C15ULL;
+  return (size_t)(h >> 7) & (cap - 1);
+}
+
+static lunet_export_co_t *export_find(lunet_export_t *ex, const void *co) {
+  for (size_t i = export_hash(co, ex->cap);; i = (i + 1) & (ex->cap - 1)) {
+    if (ex->cos[i].co == co) {
+      return &ex->cos[i];
+    }
+    if (!ex->cos[i].co) {
+      return NULL;
+    }
+  }
+}
+
+static void export_ts(lunet_export_t *ex, uint64_t ts) {
+  fprintf(ex->f, "%.3f", (double)(ts - ex->base) * ex->ns_per_tick / 1e3);
+}
+
+static void export_begin(lunet_export_t *ex) { fputs(ex->written++ ? ",\n" : "\n", ex->f); }
+
+static void export_thread_name(lunet_export_t *ex, int tid, const char *name, const void *co) {
+  export_begin(ex);
+  fprintf(ex->f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"", ex->pid,
+          tid);
+  if (co) {
+    fprintf(ex->f, "co %d (%p)", tid, co);
+  } else {
+    fputs(name, ex->f);
+  }
+  fputs("\"}}", ex->f);
+}
+
+// Look up co, adding it (and its track name) if new; NULL on allocation failure
+static lunet_export_co_t *export_co(lunet_export_t *ex, const void *co) {
+  lunet_export_co_t *e = export_find(ex, co);
+  if (e) {
+    return e;
+  }
+  if ((ex->len + 1) * 2 > ex->cap) {
+    size_t cap = ex->cap * 2;
+    lunet_export_co_t *cos = (lunet_export_co_t *)calloc(cap, sizeof(lunet_export_co_t));
+    if (!cos) {
+      return NULL;
+    }
+    lunet_export_co_t *old = ex->cos;
+    size_t old_cap = ex->cap;
+    ex->cos = cos;
+    ex->cap = cap;
+    for (size_t i = 0; i < old_cap; i++) {
+      if (old[i].co) {
+        size_t j = export_hash(old[i].co, cap);
+        while (cos[j].co) {
+          j = (j + 1) & (cap - 1);
+        }
+        cos[j] = old[i];
+      }
+    }
+    free(old);
+  }
+  size_t i = export_hash(co, ex->cap);
+  while (ex->cos[i].co) {
+    i = (i + 1) & (ex->cap - 1);
+  }
+  e = &ex->cos[i];
+  e->co = co;
+  e->tid = (int)++ex->len;
+  export_thread_name(ex, e->tid, NULL, co);
+  return e;
+}
+
+static void export_slice(lunet_export_t *ex, const char *name, const char *cat, int tid, uint64_t from,
+                         uint64_t to, const char *site) {
+  export_begin(ex);
+  fprintf(ex->f, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":", name ? name : "?",
+          cat, ex->pid, tid);
+  export_ts(ex, from);
+  fprintf(ex->f, ",\"dur\":%.3f", (double)(to - from) * ex->ns_per_tick / 1e3);
+  if (site) {
+    fprintf(ex->f, ",\"args\":{\"site\":\"%s\"}", site);
+  }
+  fputc('}', ex->f);
+}
+
+static void export_instant(lunet_export_t *ex, const lunet_trace_rec_t *rec, int tid) {
+  export_begin(ex);
+  fprintf(ex->f, "{\"name\":\"%s\",\"cat\":\"event\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":",
+          lunet_trace_event_name(rec->event), ex->pid, tid);
+  export_ts(ex, rec->ts);
+  fprintf(ex->f, ",\"args\":{\"handle\":\"%p\",\"size\":%d}}", rec->handle,
+          rec->event == LUNET_EV_FS_DONE ? (int)(int32_t)rec->size : (int)rec->size);
+}
+
+// Close whatever slice e is in at time ts
+static void export_close(lunet_export_t *ex, lunet_export_co_t *e, uint64_t ts) {
+  switch (e->state) {
+    case EXPORT_RUN:
+      export_slice(ex, "run", "co", e->tid, e->since, ts, e->site);
+      break;
+    case EXPORT_WAIT:
+      export_slice(ex, "wait", "wait", e->tid, e->since, ts, NULL);
+      break;
+    case EXPORT_READY:
+      if (e->ready_at > e->since) {  // not when it requeued itself
+        export_slice(ex, e->ready_site, "wait", e->tid, e->since, e->ready_at, NULL);
+      }
+      export_slice(ex, "queued", "sched", e->tid, e->ready_at, ts, e->ready_site);
+      break;
+  }
+}
+
+static void export_record(lunet_export_t *ex, const lunet_trace_rec_t *rec) {
+  lunet_export_co_t *e;
+  switch (rec->event) {
+    case LUNET_EV_SPAWN:
+      if ((e = export_co(ex, rec->handle)) != NULL) {
+        export_instant(ex, rec, e->tid);
+      }
+      return;
+    case LUNET_EV_RESUME:
+      if ((e = export_co(ex, rec->handle)) != NULL) {
+        if (e->state == EXPORT_WAIT) {
+          // resumed directly by a callback, without the ready queue
+          export_slice(ex, rec->name, "wait", e->tid, e->since, rec->ts, NULL);
+        } else if (e->state == EXPORT_READY) {
+          export_close(ex, e, rec->ts);
+        }
+        e->state = EXPORT_RUN;
+        e->since = rec->ts;
+        e->site = rec->name;
+        e->requeued = 0;
+      }
+      return;
+    case LUNET_EV_READY:
+      if ((e = export_co(ex, rec->handle)) != NULL) {
+        e->ready_site = rec->name;
+        e->ready_at = rec->ts;
+        if (e->state == EXPORT_RUN) {
+          e->requeued = 1;
+        } else if (e->state == EXPORT_WAIT) {
+          e->state = EXPORT_READY;
+        }
+      }
+      return;
+    case LUNET_EV_YIELD:
+      // a yield after finish only parks the thread in the spawn pool
+      if ((e = export_co(ex, rec->handle)) != NULL && e->state == EXPORT_RUN) {
+        export_close(ex, e, rec->ts);
+        e->state = e->requeued ? EXPORT_READY : EXPORT_WAIT;
+        e->since = rec->ts;
+        if (e->requeued) {
+          e->ready_at = rec->ts;
+          e->requeued = 0;
+        }
+      }
+      return;
+    case LUNET_EV_FINISH:
+      if ((e = export_co(ex, rec->handle)) != NULL) {
+        if (e->state == EXPORT_RUN) {
+          export_close(ex, e, rec->ts);
+          export_instant(ex, rec, e->tid);
+        }
+        e->state = EXPORT_IDLE;
+        e->requeued = 0;
+      }
+      return;
+    default:
+      // references are taken on the waiting coroutine itself in most call sites
+      e = export_find(ex, rec->handle);
+      export_instant(ex, rec, e ? e->tid : 0);
+      return;
+  }
+}
+
+int lunet_trace_ring_export(lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+  lua_Number seconds = luaL_optnumber(L, 2, 0);
+  lunet_rt_t *rt = lunet_rt();
+  FILE *f = lunet_trace_open(L, path, rt);
+  if (!f) {
+    return 2;
+  }
+
+  lunet_trace_ring_t *ring = &rt->trace;
+  lunet_export_t ex;
+  memset(&ex, 0, sizeof(ex));
+  uint64_t now = lunet_trace_clock();
+  ex.f = f;
+  ex.pid = rt->worker_id;
+  ex.ns_per_tick = lunet_trace_ns_per_tick(ring, now);
+  uint64_t first = lunet_trace_first(ring, now, ex.ns_per_tick, seconds);
+  ex.base = first < ring->head ? ring->recs[first & ring->mask].ts : now;
+  ex.cap = 64;
+  ex.cos = (lunet_export_co_t *)calloc(ex.cap, sizeof(lunet_export_co_t));
+  if (!ex.cos) {
+    fclose(f);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+  export_begin(&ex);
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"lunet worker %d\"}}", ex.pid,
+          ex.pid);
+  export_thread_name(&ex, 0, "loop", NULL);
+  for (uint64_t i = first; i < ring->head; i++) {
+    export_record(&ex, &ring->recs[i & ring->mask]);
+  }
+  for (size_t i = 0; i < ex.cap; i++) {
+    if (ex.cos[i].co) {
+      export_close(&ex, &ex.cos[i], now);
+    }
+  }
+  fputs("\n]}\n", f);
+  free(ex.cos);
+  return lunet_trace_close(L, f, ex.written);
+}
+
+int lunet_trace_ring_set_size(lua_State *L) {
+  lua_Integer size = luaL_checkinteger(L, 1);
+  lunet_rt_t *rt = lunet_rt();
+  if (size < 0 || size > LUNET_TRACE_RING_MAX) {
+    lua_pushnil(L);
+    lua_pushstring(L, "size out of range");
+    return 2;
+  }
+  if (!rt) {
+    lua_pushnil(L);
+    lua_pushstring(L, "no runtime");
+    return 2;
+  }
+  if (lunet_trace_ring_init(&rt->trace, (uint32_t)size) < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  lua_pushinteger(L, rt->trace.recs ? (lua_Integer)rt->trace.mask + 1 : 0);
+  return 1;
+}
@@ -14,115 +14,23 @@
 #include <uv.h>
 
 #include "co.h"
+#include "rt.h"
+#include "slab.h"
+#include "socket.h"
 #include "stl.h"
 #include "trace.h"
 
-/*
- * UDP Context Structure
- * Defined here so we can add trace fields if needed
- */
+/* UDP Context Structure */
 typedef struct {
   uv_udp_t handle;
   queue_t *pending;
   lua_State *co;
   int recv_ref;
-#ifdef LUNET_TRACE
-  int trace_tx;
-  int trace_rx;
-#endif
 } udp_ctx_t;
 
-/*
- * UDP-specific tracing macros
- * Zero-cost in release builds (LUNET_TRACE not defined)
- */
-#ifdef LUNET_TRACE
-
-static int udp_trace_tx_count = 0;
-static int udp_trace_rx_count = 0;
-static int udp_trace_bind_count = 0;
-
-static void udp_trace_bind_actual(uv_udp_t *handle) {
-    struct sockaddr_storage addr;
-    int namelen = sizeof(addr);
-    char host[INET6_ADDRSTRLEN];
-    int port = 0;
-    
-    if (uv_udp_getsockname(handle, (struct sockaddr *)&addr, &namelen) == 0) {
-        if (addr.ss_family == AF_INET) {
-            struct sockaddr_in *a4 = (struct sockaddr_in *)&addr;
-            uv_ip4_name(a4, host, sizeof(host));
-            port = ntohs(a4->sin_port);
-        } else if (addr.ss_family == AF_INET6) {
-            struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)&addr;
-            uv_ip6_name(a6, host, sizeof(host));
-            port = ntohs(a6->sin6_port);
-        } else {
-            snprintf(host, sizeof(host), "unknown");
-        }
-    } else {
-        snprintf(host, sizeof(host), "?");
-    }
-    
-    udp_trace_bind_count++;
-    fprintf(stderr, "[UDP_TRACE] BIND #%d %s:%d\n", udp_trace_bind_count, host, port);
-}
-
-#define UDP_TRACE_BIND(handle) udp_trace_bind_actual(handle)
-
-#define UDP_TRACE_TX(ctx, dest_host, dest_port, len) \
-    do { \
-        udp_trace_tx_count++; \
-        (ctx)->trace_tx++; \
-        fprintf(stderr, "[UDP_TRACE] TX #%d -> %s:%d (%zu bytes)\n", \
-                udp_trace_tx_count, (dest_host), (dest_port), (size_t)(len)); \
-    } while(0)
-
-#define UDP_TRACE_RX(ctx, src_host, src_port, len) \
-    do { \
-        udp_trace_rx_count++; \
-        (ctx)->trace_rx++; \
-        fprintf(stderr, "[UDP_TRACE] RX #%d <- %s:%d (%zu bytes)\n", \
-                udp_trace_rx_count, (src_host), (src_port), (size_t)(len)); \
-    } while(0)
-
-#define UDP_TRACE_RECV_WAIT() \
-    fprintf(stderr, "[UDP_TRACE] RECV_WAIT (coroutine yielding)\n")
-
-#define UDP_TRACE_RECV_RESUME(host, port, len) \
-    fprintf(stderr, "[UDP_TRACE] RECV_RESUME <- %s:%d (%zu bytes)\n", \
-            (host), (port), (size_t)(len))
-
-#define UDP_TRACE_RECV_DELIVER(host, port, len) \
-    fprintf(stderr, "[UDP_TRACE] RECV_DELIVER (immediate) <- %s:%d (%zu bytes)\n", \
-            (host), (port), (size_t)(len))
-
-#define UDP_TRACE_CLOSE(ctx) \
-    fprintf(stderr, "[UDP_TRACE] CLOSE (local: tx=%d rx=%d) (global: tx=%d rx=%d)\n", \
-            (ctx)->trace_tx, (ctx)->trace_rx, udp_trace_tx_count, udp_trace_rx_count)
-
-void lunet_udp_trace_summary(void) {
-    fprintf(stderr, "[UDP_TRACE] SUMMARY: binds=%d tx=%d rx=%d\n", \
-            udp_trace_bind_count, udp_trace_tx_count, udp_trace_rx_count);
-}
-
-#else /* !LUNET_TRACE */
-
-#define UDP_TRACE_BIND(handle) ((void)0)
-#define UDP_TRACE_TX(ctx, dest_host, dest_port, len) ((void)0)
-#define UDP_TRACE_RX(ctx, src_host, src_port, len) ((void)0)
-#define UDP_TRACE_RECV_WAIT() ((void)0)
-#define UDP_TRACE_RECV_RESUME(host, port, len) ((void)0)
-#define UDP_TRACE_RECV_DELIVER(host, port, len) ((void)0)
-#define UDP_TRACE_CLOSE(ctx) ((void)0)
-void lunet_udp_trace_summary(void) {}
-
-#endif /* LUNET_TRACE */
-
 typedef struct {
   uv_udp_send_t req;
-  uv_buf_t buf;
-  char *data;
+  uv_buf_t buf;  /* the data follows the struct in the same block */
 } udp_send_ctx_t;
 
 typedef struct {
@@ -157,6 +65,7 @@ static void udp_recv_cb(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf,
     return;
   }
 
+  LUNET_STAT_ADD(bytes_read, (uint64_t)nread);
   msg->data = buf->base;
   msg->len = (size_t)nread;
   msg->port = 0;
@@ -172,9 +81,10 @@ static void udp_recv_cb(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf,
     msg->port = ntohs(a6->sin6_port);
   }
 
-  UDP_TRACE_RX(ctx, msg->host, msg->port, msg->len);
+  LUNET_TRACE_EVENT(LUNET_EV_UDP_RX, &ctx->handle, msg->len);
 
   if (queue_enqueue(ctx->pending, msg) != 0) {
+    // full: drop it, as the kernel would with a full receive buffer
     free(msg->data);
     free(msg);
     return;
@@ -194,21 +104,14 @@ static void udp_recv_cb(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf,
     lua_pop(ctx->co, 1);
     udp_msg_t *to_deliver = (udp_msg_t *)queue_dequeue(ctx->pending);
     if (to_deliver != NULL) {
-      UDP_TRACE_RECV_RESUME(to_deliver->host, to_deliver->port, to_deliver->len);
       lua_pushlstring(waiting_co, to_deliver->data, to_deliver->len);
       lua_pushstring(waiting_co, to_deliver->host);
       lua_pushinteger(waiting_co, to_deliver->port);
       free(to_deliver->data);
       free(to_deliver);
-      int resume_status = lua_resume(waiting_co, 3);
-      if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-        fprintf(stderr, "udp recv resume error: %s\n", lua_tostring(waiting_co, -1));
-      }
+      lunet_co_resume(waiting_co, 3, "udp.recv");
     } else {
-      int resume_status = lua_resume(waiting_co, 0);
-      if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-        fprintf(stderr, "udp recv resume error: %s\n", lua_tostring(waiting_co, -1));
-      }
+      lunet_co_resume(waiting_co, 0, "udp.recv");
     }
   }
 }
@@ -216,8 +119,7 @@ static void udp_recv_cb(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf,
 static void udp_send_cb(uv_udp_send_t *req, int status) {
   (void)status;
   udp_send_ctx_t *send_ctx = (udp_send_ctx_t *)req->data;
-  free(send_ctx->data);
-  free(send_ctx);
+  lunet_slab_free(send_ctx, sizeof(*send_ctx) + send_ctx->buf.len);
 }
 
 int lunet_udp_bind(lua_State *co) {
@@ -232,7 +134,7 @@ int lunet_udp_bind(lua_State *co) {
     lua_pushstring(co, "out of memory");
     return 2;
   }
-  ctx->pending = queue_init();
+  ctx->pending = queue_init_bounded(LUNET_UDP_PENDING_MAX);
   if (ctx->pending == NULL) {
     free(ctx);
     lua_pushnil(co);
@@ -240,8 +142,14 @@ int lunet_udp_bind(lua_State *co) {
     return 2;
   }
 
-  uv_loop_t *loop = uv_default_loop();
-  int ret = uv_udp_init(loop, &ctx->handle);
+  uv_loop_t *loop = default_loop();
+  int ret;
+  if (lunet_rt()->worker_count > 1) {
+    // Create the socket up front so SO_REUSEPORT can be set before bind
+    ret = uv_udp_init_ex(loop, &ctx->handle, strchr(host, ':') != NULL ? AF_INET6 : AF_INET);
+  } else {
+    ret = uv_udp_init(loop, &ctx->handle);
+  }
   if (ret < 0) {
     queue_destroy(ctx->pending);
     free(ctx);
@@ -277,6 +185,13 @@ int lunet_udp_bind(lua_State *co) {
     memcpy(&addr, &a4, sizeof(a4));
   }
 
+  if (lunet_rt()->worker_count > 1 && (ret = lunet_set_reuseport((uv_handle_t *)&ctx->handle)) < 0) {
+    uv_close((uv_handle_t *)&ctx->handle, udp_on_close);
+    lua_pushnil(co);
+    lua_pushfstring(co, "failed to set SO_REUSEPORT: %s", uv_strerror(ret));
+    return 2;
+  }
+
   ret = uv_udp_bind(&ctx->handle, (const struct sockaddr *)&addr, 0);
   if (ret < 0) {
     uv_close((uv_handle_t *)&ctx->handle, udp_on_close);
@@ -293,7 +208,7 @@ int lunet_udp_bind(lua_State *co) {
     return 2;
   }
 
-  UDP_TRACE_BIND(&ctx->handle);
+  LUNET_TRACE_EVENT(LUNET_EV_UDP_BIND, &ctx->handle, 0);
 
   lua_pushlightuserdata(co, ctx);
   lua_pushnil(co);
@@ -339,36 +254,28 @@ int lunet_udp_send(lua_State *co) {
     memcpy(&addr, &a4, sizeof(a4));
   }
 
-  udp_send_ctx_t *send_ctx = (udp_send_ctx_t *)malloc(sizeof(udp_send_ctx_t));
+  udp_send_ctx_t *send_ctx = (udp_send_ctx_t *)lunet_slab_alloc(sizeof(udp_send_ctx_t) + len);
   if (send_ctx == NULL) {
     lua_pushnil(co);
     lua_pushstring(co, "out of memory");
     return 2;
   }
   memset(send_ctx, 0, sizeof(*send_ctx));
-
-  send_ctx->data = (char *)malloc(len);
-  if (send_ctx->data == NULL) {
-    free(send_ctx);
-    lua_pushnil(co);
-    lua_pushstring(co, "out of memory");
-    return 2;
-  }
-  memcpy(send_ctx->data, data, len);
-  send_ctx->buf = uv_buf_init(send_ctx->data, (unsigned int)len);
+  memcpy(send_ctx + 1, data, len);
+  send_ctx->buf = uv_buf_init((char *)(send_ctx + 1), (unsigned int)len);
   send_ctx->req.data = send_ctx;
 
   ret = uv_udp_send(&send_ctx->req, &ctx->handle, &send_ctx->buf, 1,
                     (const struct sockaddr *)&addr, udp_send_cb);
   if (ret < 0) {
-    free(send_ctx->data);
-    free(send_ctx);
+    lunet_slab_free(send_ctx, sizeof(*send_ctx) + len);
     lua_pushnil(co);
     lua_pushfstring(co, "failed to send: %s", uv_strerror(ret));
     return 2;
   }
 
-  UDP_TRACE_TX(ctx, host, port, len);
+  LUNET_TRACE_EVENT(LUNET_EV_UDP_TX, &ctx->handle, len);
+  LUNET_STAT_ADD(bytes_written, len);
 
   lua_pushboolean(co, 1);
   lua_pushnil(co);
@@ -396,7 +303,7 @@ int lunet_udp_recv(lua_State *co) {
 
     ctx->co = co;
     lunet_coref_create(co, ctx->recv_ref);
-    UDP_TRACE_RECV_WAIT();
+    LUNET_TRACE_EVENT(LUNET_EV_UDP_RECV_WAIT, &ctx->handle, 0);
     return lua_yield(co, 0);
   }
 
@@ -408,8 +315,6 @@ int lunet_udp_recv(lua_State *co) {
     return 3;
   }
 
-  UDP_TRACE_RECV_DELIVER(msg->host, msg->port, msg->len);
-
   lua_pushlstring(co, msg->data, msg->len);
   lua_pushstring(co, msg->host);
   lua_pushinteger(co, msg->port);
@@ -450,13 +355,13 @@ int lunet_udp_close(lua_State *L) {
       lua_pushnil(waiting_co);
       lua_pushnil(waiting_co);
       lua_pushstring(waiting_co, "udp closed");
-      lua_resume(waiting_co, 3);
+      lunet_co_resume(waiting_co, 3, "udp.close");
     } else {
       lua_pop(ctx->co, 1);
     }
   }
 
-  UDP_TRACE_CLOSE(ctx);
+  LUNET_TRACE_EVENT(LUNET_EV_UDP_CLOSE, &ctx->handle, 0);
 
   uv_close((uv_handle_t *)&ctx->handle, udp_on_close);
   lua_pushboolean(L, 1);
@@ -0,0 +1,333 @@
+#include "upgrade.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "co.h"
+#include "prefork.h"
+#include "rt.h"
+#include "socket.h"
+#include "trace.h"
+
+#define LUNET_UPGRADE_MAX_FDS 64
+#define LUNET_UPGRADE_ADDR_MAX 256
+
+typedef struct {
+  int fd;
+  char proto[8];
+  char addr[LUNET_UPGRADE_ADDR_MAX];
+} lunet_upgrade_fd_t;
+
+// Set once in main before any loop starts; only the single-worker loop claims fds
+static int g_argc = 0;
+static char **g_argv = NULL;
+static lunet_upgrade_fd_t g_inherited[LUNET_UPGRADE_MAX_FDS];
+static int g_inherited_count = 0;
+static int g_ready_fd = -1;  // set when started by lunet.upgrade
+
+void lunet_upgrade_init(int argc, char **argv) {
+  g_argc = argc;
+  g_argv = argv;
+#ifndef _WIN32
+  char value[LUNET_UPGRADE_MAX_FDS * (LUNET_UPGRADE_ADDR_MAX + 16)];
+  size_t len = sizeof(value);
+  if (uv_os_getenv(LUNET_UPGRADE_ENV, value, &len) != 0) {
+    return;
+  }
+  uv_os_unsetenv(LUNET_UPGRADE_ENV);  // not for our own children
+  g_ready_fd = LUNET_UPGRADE_READY_FD;
+
+  // "fd:proto:addr;fd:proto:addr"
+  char *save = NULL;
+  for (char *entry = strtok_r(value, ";", &save); entry && g_inherited_count < LUNET_UPGRADE_MAX_FDS;
+       entry = strtok_r(NULL, ";", &save)) {
+    char *proto = strchr(entry, ':');
+    char *addr = proto ? strchr(proto + 1, ':') : NULL;
+    if (!addr) {
+      continue;
+    }
+    *proto++ = '\0';
+    *addr++ = '\0';
+    lunet_upgrade_fd_t *in = &g_inherited[g_inherited_count++];
+    in->fd = atoi(entry);
+    snprintf(in->proto, sizeof(in->proto), "%s", proto);
+    snprintf(in->addr, sizeof(in->addr), "%s", addr);
+  }
+#endif
+}
+
+int lunet_upgrade_take_fd(const char *proto, const char *addr) {
+  for (int i = 0; i < g_inherited_count; i++) {
+    lunet_upgrade_fd_t *in = &g_inherited[i];
+    if (in->fd >= 0 && strcmp(in->proto, proto) == 0 && strcmp(in->addr, addr) == 0) {
+      int fd = in->fd;
+      in->fd = -1;
+#ifndef _WIN32
+      fcntl(fd, F_SETFD, FD_CLOEXEC);  // inherited without it
+#endif
+      return fd;
+    }
+  }
+  return -1;
+}
+
+#ifndef _WIN32
+
+typedef struct {
+  int fds[LUNET_UPGRADE_MAX_FDS];
+  int count;
+  char env[LUNET_UPGRADE_MAX_FDS * (LUNET_UPGRADE_ADDR_MAX + 16)];
+  size_t env_len;
+} lunet_upgrade_handoff_t;
+
+static void lunet_upgrade_collect(int fd, const char *proto, const char *addr, void *arg) {
+  lunet_upgrade_handoff_t *h = (lunet_upgrade_handoff_t *)arg;
+  if (h->count == LUNET_UPGRADE_MAX_FDS) {
+    return;
+  }
+  int n = snprintf(h->env + h->env_len, sizeof(h->env) - h->env_len, "%s%d:%s:%s", h->count ? ";" : "",
+                   LUNET_UPGRADE_FD_BASE + h->count, proto, addr);
+  if (n < 0 || (size_t)n >= sizeof(h->env) - h->env_len) {
+    h->env[h->env_len] = '\0';
+    return;
+  }
+  h->env_len += (size_t)n;
+  h->fds[h->count++] = fd;
+}
+
+// Current environment minus any stale hand-off list, plus ours
+static char **lunet_upgrade_build_env(const char *listen_fds) {
+  uv_env_item_t *items = NULL;
+  int count = 0;
+  if (uv_os_environ(&items, &count) < 0) {
+    return NULL;
+  }
+  char **env = (char **)calloc((size_t)count + 2, sizeof(char *));
+  if (!env) {
+    uv_os_free_environ(items, count);
+    return NULL;
+  }
+  int n = 0;
+  for (int i = 0; i < count; i++) {
+    if (strcmp(items[i].name, LUNET_UPGRADE_ENV) == 0) {
+      continue;
+    }
+    size_t len = strlen(items[i].name) + strlen(items[i].value) + 2;
+    if (!(env[n] = (char *)malloc(len))) {
+      break;
+    }
+    snprintf(env[n++], len, "%s=%s", items[i].name, items[i].value);
+  }
+  uv_os_free_environ(items, count);
+
+  size_t len = strlen(LUNET_UPGRADE_ENV) + strlen(listen_fds) + 2;
+  if ((env[n] = (char *)malloc(len))) {
+    snprintf(env[n], len, "%s=%s", LUNET_UPGRADE_ENV, listen_fds);
+  }
+  return env;
+}
+
+static void lunet_upgrade_free_env(char **env) {
+  for (char **e = env; *e; e++) {
+    free(*e);
+  }
+  free(env);
+}
+
+typedef struct {
+  uv_process_t proc;
+  uv_pipe_t ready;  // closed by the new process once its script has loaded
+  lua_State *L;
+  int co_ref;
+  int pid;
+  int listeners;
+  int ok;
+  int open_handles;
+} lunet_upgrade_t;
+
+static void lunet_upgrade_closed_cb(uv_handle_t *handle) {
+  lunet_upgrade_t *u = (lunet_upgrade_t *)handle->data;
+  if (--u->open_handles == 0) {
+    free(u);
+  }
+}
+
+static void lunet_upgrade_alloc_cb(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+  (void)handle;
+  (void)suggested_size;
+  static char scratch[64];
+  *buf = uv_buf_init(scratch, sizeof(scratch));
+}
+
+static void lunet_upgrade_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  lunet_upgrade_t *u = (lunet_upgrade_t *)stream->data;
+  if (nread > 0 && memchr(buf->base, 'R', (size_t)nread)) {
+    u->ok = 1;
+  } else if (nread >= 0) {
+    return;
+  }
+
+  uv_read_stop(stream);
+  uv_close((uv_handle_t *)&u->ready, lunet_upgrade_closed_cb);
+  uv_close((uv_handle_t *)&u->proc, lunet_upgrade_closed_cb);  // does not signal the detached process
+
+  lua_State *L = u->L;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, u->co_ref);
+  lunet_coref_release(L, u->co_ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_State *co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  if (u->ok) {
+    // The new process accepts on the same sockets now; stop here and drain
+    lunet_socket_stop_listeners();
+    fprintf(stderr, "[lunet] upgrade: pid %d took over %d listener%s\n", u->pid, u->listeners,
+            u->listeners == 1 ? "" : "s");
+    lua_pushinteger(co, u->pid);
+    lua_pushnil(co);
+  } else {
+    // Died before loading its script: keep serving from this process
+    lua_pushnil(co);
+    lua_pushfstring(co, "new process %d exited before it was ready", u->pid);
+  }
+  lunet_co_resume(co, 2, "upgrade");
+}
+
+int lunet_upgrade(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "lunet.upgrade") != 0) {
+    return lua_error(co);
+  }
+  lunet_rt_t *rt = lunet_rt();
+  if (!g_argv || rt->worker_count > 1 || lunet_prefork_is_child()) {
+    lua_pushnil(co);
+    lua_pushstring(co, "upgrade needs lunet-run without --workers or --processes");
+    return 2;
+  }
+
+  char exe[4096];
+  size_t exe_len = sizeof(exe);
+  if (uv_exepath(exe, &exe_len) < 0) {
+    lua_pushnil(co);
+    lua_pushstring(co, "cannot resolve lunet executable path");
+    return 2;
+  }
+
+  lunet_upgrade_t *u = (lunet_upgrade_t *)calloc(1, sizeof(lunet_upgrade_t));
+  lunet_upgrade_handoff_t *h = (lunet_upgrade_handoff_t *)calloc(1, sizeof(lunet_upgrade_handoff_t));
+  char **args = (char **)calloc((size_t)g_argc + 1, sizeof(char *));
+  uv_stdio_container_t *stdio =
+      (uv_stdio_container_t *)calloc(LUNET_UPGRADE_FD_BASE + LUNET_UPGRADE_MAX_FDS, sizeof(uv_stdio_container_t));
+  char **env = NULL;
+  if (u && h && args && stdio) {
+    lunet_socket_each_listener(lunet_upgrade_collect, h);
+    env = lunet_upgrade_build_env(h->env);
+  }
+  if (!env) {
+    free(u);
+    free(h);
+    free(args);
+    free(stdio);
+    lua_pushnil(co);
+    lua_pushstring(co, "out of memory");
+    return 2;
+  }
+
+  // Same command line and stdio, a readiness pipe on fd 3, listener i on fd 4 + i
+  args[0] = exe;
+  for (int i = 1; i < g_argc; i++) {
+    args[i] = g_argv[i];
+  }
+  for (int i = 0; i < 3; i++) {
+    stdio[i].flags = UV_INHERIT_FD;
+    stdio[i].data.fd = i;
+  }
+  uv_pipe_init(rt->loop, &u->ready, 0);
+  stdio[LUNET_UPGRADE_READY_FD].flags = (uv_stdio_flags)(UV_CREATE_PIPE | UV_WRITABLE_PIPE);
+  stdio[LUNET_UPGRADE_READY_FD].data.stream = (uv_stream_t *)&u->ready;
+  for (int i = 0; i < h->count; i++) {
+    stdio[LUNET_UPGRADE_FD_BASE + i].flags = UV_INHERIT_FD;
+    stdio[LUNET_UPGRADE_FD_BASE + i].data.fd = h->fds[i];
+  }
+
+  uv_process_options_t options;
+  memset(&options, 0, sizeof(options));
+  options.file = exe;
+  options.args = args;
+  options.env = env;
+  options.stdio = stdio;
+  options.stdio_count = LUNET_UPGRADE_FD_BASE + h->count;
+  options.flags = UV_PROCESS_DETACHED;
+
+  u->proc.data = u;
+  u->ready.data = u;
+  u->open_handles = 2;
+  u->listeners = h->count;
+  int ret = uv_spawn(rt->loop, &u->proc, &options);
+  lunet_upgrade_free_env(env);
+  free(h);
+  free(args);
+  free(stdio);
+  if (ret == 0) {
+    u->pid = u->proc.pid;
+    ret = uv_read_start((uv_stream_t *)&u->ready, lunet_upgrade_alloc_cb, lunet_upgrade_read_cb);
+  }
+  if (ret < 0) {
+    uv_close((uv_handle_t *)&u->ready, lunet_upgrade_closed_cb);
+    uv_close((uv_handle_t *)&u->proc, lunet_upgrade_closed_cb);
+    lua_pushnil(co);
+    lua_pushfstring(co, "failed to start new binary: %s", uv_strerror(ret));
+    return 2;
+  }
+
+  u->L = default_luaL();
+  lua_pushthread(co);
+  lua_xmove(co, u->L, 1);
+  lunet_coref_create_raw(u->L, u->co_ref);
+  return lua_yield(co, 0);
+}
+
+void lunet_upgrade_ready(void) {
+  if (g_ready_fd < 0) {
+    return;
+  }
+  // Best effort: the old process treats EOF without "R" as a failed start
+  ssize_t n = write(g_ready_fd, "R", 1);
+  (void)n;
+  close(g_ready_fd);
+  g_ready_fd = -1;
+
+  // Listeners the new script did not reopen would otherwise stay bound with
+  // nobody accepting, and leak into any process we spawn later
+  for (int i = 0; i < g_inherited_count; i++) {
+    lunet_upgrade_fd_t *in = &g_inherited[i];
+    if (in->fd < 0) {
+      continue;
+    }
+    fcntl(in->fd, F_SETFD, FD_CLOEXEC);
+    close(in->fd);
+    fprintf(stderr, "[lunet] upgrade: dropped unused %s listener %s\n", in->proto, in->addr);
+    in->fd = -1;
+  }
+}
+
+#else  // _WIN32
+
+int lunet_upgrade(lua_State *L) {
+  lua_pushnil(L);
+  lua_pushstring(L, "upgrade is not supported on Windows");
+  return 2;
+}
+
+void lunet_upgrade_ready(void) {}
+
+#endif  // _WIN32
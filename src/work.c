@@ -0,0 +1,350 @@
+#include "work.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "co.h"
+#include "pool.h"
+#include "rt.h"
+#include "serialize.h"
+#include "trace.h"
+
+/*
+ * Run Lua functions on worker VMs.
+ *
+ * Worker VMs are plain lua_States with the standard libraries and the
+ * caller's package.path/cpath, shared by every loop in the process. A job
+ * borrows an idle VM on a libuv threadpool thread, calls module[fn] with the
+ * deserialized arguments and returns the VM afterwards, so modules required
+ * once stay loaded and later jobs only pay for the call itself. Arguments and
+ * results are copied with the serializer; nothing is shared with the loop.
+ * Jobs run on a dedicated pool so CPU-bound Lua cannot starve fs requests on
+ * the libuv threadpool.
+ */
+
+typedef struct work_vm_s {
+  lua_State *L;
+  struct work_vm_s *next;
+} work_vm_t;
+
+typedef struct {
+  uv_work_t req;
+  lua_State *L;
+  int co_ref;
+  char *module;
+  char *fn;
+  lunet_buf_t args;
+  lunet_buf_t results;
+  char *err;
+} work_ctx_t;
+
+static uv_once_t g_work_once = UV_ONCE_INIT;
+static uv_mutex_t g_work_lock;
+static work_vm_t *g_work_idle = NULL;
+static int g_work_idle_count = 0;
+static char *g_work_path = NULL;
+static char *g_work_cpath = NULL;
+
+static lunet_pool_t *g_work_pool = NULL;
+
+static void work_init_once(void) {
+  uv_mutex_init(&g_work_lock);
+  g_work_pool = lunet_pool_new("work", LUNET_WORK_POOL_DEFAULT);
+}
+
+static char *work_strdup(const char *s) {
+  size_t len = strlen(s) + 1;
+  char *copy = (char *)malloc(len);
+  if (copy) {
+    memcpy(copy, s, len);
+  }
+  return copy;
+}
+
+// Remember the first caller's module search paths for new worker VMs
+static void work_capture_paths(lua_State *L) {
+  uv_once(&g_work_once, work_init_once);
+  uv_mutex_lock(&g_work_lock);
+  if (!g_work_path) {
+    lua_getglobal(L, "package");
+    if (lua_istable(L, -1)) {
+      lua_getfield(L, -1, "path");
+      lua_getfield(L, -2, "cpath");
+      if (lua_isstring(L, -2)) g_work_path = work_strdup(lua_tostring(L, -2));
+      if (lua_isstring(L, -1)) g_work_cpath = work_strdup(lua_tostring(L, -1));
+      lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
+  }
+  uv_mutex_unlock(&g_work_lock);
+}
+
+static lua_State *work_vm_new(void) {
+  lua_State *V = luaL_newstate();
+  if (!V) {
+    return NULL;
+  }
+  luaL_openlibs(V);
+  lua_getglobal(V, "package");
+  uv_mutex_lock(&g_work_lock);
+  if (g_work_path) {
+    lua_pushstring(V, g_work_path);
+    lua_setfield(V, -2, "path");
+  }
+  if (g_work_cpath) {
+    lua_pushstring(V, g_work_cpath);
+    lua_setfield(V, -2, "cpath");
+  }
+  uv_mutex_unlock(&g_work_lock);
+  lua_pop(V, 1);
+  return V;
+}
+
+// Borrow an idle VM, creating one if none is free
+static lua_State *work_vm_take(void) {
+  uv_mutex_lock(&g_work_lock);
+  work_vm_t *vm = g_work_idle;
+  if (vm) {
+    g_work_idle = vm->next;
+    g_work_idle_count--;
+  }
+  uv_mutex_unlock(&g_work_lock);
+  if (!vm) {
+    return work_vm_new();
+  }
+  lua_State *V = vm->L;
+  free(vm);
+  return V;
+}
+
+static void work_vm_put(lua_State *V) {
+  work_vm_t *vm = (work_vm_t *)malloc(sizeof(work_vm_t));
+  if (!vm) {
+    lua_close(V);
+    return;
+  }
+  vm->L = V;
+  uv_mutex_lock(&g_work_lock);
+  vm->next = g_work_idle;
+  g_work_idle = vm;
+  g_work_idle_count++;
+  uv_mutex_unlock(&g_work_lock);
+}
+
+// require(module) onto V's stack; returns 0 or -1 with the error on the stack
+static int work_require(lua_State *V, const char *module) {
+  lua_getglobal(V, "require");
+  lua_pushstring(V, module);
+  return lua_pcall(V, 1, 1, 0) == 0 ? 0 : -1;
+}
+
+static void work_fail(work_ctx_t *ctx, lua_State *V, const char *msg) {
+  if (!msg) {
+    msg = lua_isstring(V, -1) ? lua_tostring(V, -1) : "error object is not a string";
+  }
+  ctx->err = work_strdup(msg);
+}
+
+// Runs on a threadpool thread
+static void work_exec(work_ctx_t *ctx, lua_State *V) {
+  int base = lua_gettop(V);
+  const char *err;
+
+  if (work_require(V, ctx->module) != 0) {
+    work_fail(ctx, V, NULL);
+    goto done;
+  }
+  if (!lua_istable(V, -1)) {
+    work_fail(ctx, V, "module did not return a table");
+    goto done;
+  }
+  lua_getfield(V, -1, ctx->fn);
+  if (!lua_isfunction(V, -1)) {
+    work_fail(ctx, V, "no such function in module");
+    goto done;
+  }
+  int nargs = lunet_deserialize(V, ctx->args.data, ctx->args.len);
+  if (nargs < 0) {
+    work_fail(ctx, V, "malformed arguments");
+    goto done;
+  }
+  if (lua_pcall(V, nargs, LUA_MULTRET, 0) != 0) {
+    work_fail(ctx, V, NULL);
+    goto done;
+  }
+  if (lunet_serialize(V, base + 2, lua_gettop(V), &ctx->results, &err) != 0) {
+    work_fail(ctx, V, err);
+  }
+
+done:
+  lua_settop(V, base);
+}
+
+static void work_cb(uv_work_t *req) {
+  work_ctx_t *ctx = (work_ctx_t *)req->data;
+  lua_State *V = work_vm_take();
+  if (!V) {
+    ctx->err = work_strdup("cannot create worker VM");
+    return;
+  }
+  work_exec(ctx, V);
+  work_vm_put(V);
+}
+
+static void work_ctx_free(work_ctx_t *ctx) {
+  lunet_buf_free(&ctx->args);
+  lunet_buf_free(&ctx->results);
+  free(ctx->module);
+  free(ctx->err);
+  free(ctx);
+}
+
+static void work_after_cb(uv_work_t *req, int status) {
+  work_ctx_t *ctx = (work_ctx_t *)req->data;
+  lua_State *L = ctx->L;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in work.run\n");
+    lunet_coref_release(L, ctx->co_ref);
+    work_ctx_free(ctx);
+    return;
+  }
+  lua_State *co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  int nres;
+  if (status < 0) {
+    lua_pushnil(co);
+    lua_pushstring(co, uv_strerror(status));
+    nres = 2;
+  } else if (ctx->err) {
+    lua_pushnil(co);
+    lua_pushstring(co, ctx->err);
+    nres = 2;
+  } else {
+    nres = lunet_deserialize(co, ctx->results.data, ctx->results.len);
+    if (nres < 0) {
+      lua_pushnil(co);
+      lua_pushstring(co, "malformed results");
+      nres = 2;
+    }
+  }
+  // the reference keeps co alive while results are pushed
+  lunet_co_resume(co, nres, "work.run");
+  lunet_coref_release(L, ctx->co_ref);
+  work_ctx_free(ctx);
+}
+
+int lunet_work_create(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "work.run") != 0) {
+    return lua_error(L);
+  }
+  size_t module_len, fn_len;
+  const char *module = luaL_checklstring(L, 1, &module_len);
+  const char *fn = luaL_checklstring(L, 2, &fn_len);
+
+  work_ctx_t *ctx = (work_ctx_t *)calloc(1, sizeof(work_ctx_t));
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  lunet_buf_init(&ctx->args);
+  lunet_buf_init(&ctx->results);
+  const char *err;
+  if (lunet_serialize(L, 3, lua_gettop(L), &ctx->args, &err) != 0) {
+    work_ctx_free(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  // module and fn share one allocation
+  ctx->module = (char *)malloc(module_len + fn_len + 2);
+  if (!ctx->module) {
+    work_ctx_free(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  memcpy(ctx->module, module, module_len + 1);
+  ctx->fn = ctx->module + module_len + 1;
+  memcpy(ctx->fn, fn, fn_len + 1);
+
+  work_capture_paths(L);
+  ctx->L = L;
+  ctx->req.data = ctx;
+  lunet_coref_create(L, ctx->co_ref);
+
+  int ret = lunet_pool_queue_work(g_work_pool, &ctx->req, work_cb, work_after_cb);
+  if (ret < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    work_ctx_free(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, uv_strerror(ret));
+    return 2;
+  }
+  return lua_yield(L, 0);
+}
+
+int lunet_work_prewarm(lua_State *L) {
+  int n = (int)luaL_checkinteger(L, 1);
+  int has_modules = lua_istable(L, 2);
+  work_capture_paths(L);
+
+  for (int i = 0; i < n; i++) {
+    lua_State *V = work_vm_new();
+    if (!V) {
+      break;
+    }
+    if (has_modules) {
+      int count = (int)lua_objlen(L, 2);
+      for (int m = 1; m <= count; m++) {
+        lua_rawgeti(L, 2, m);
+        const char *module = lua_tostring(L, -1);
+        if (module && work_require(V, module) != 0) {
+          const char *msg = lua_tostring(V, -1);
+          lua_pushnil(L);
+          lua_pushstring(L, msg ? msg : "error object is not a string");
+          lua_close(V);
+          return 2;
+        }
+        lua_settop(V, 0);
+        lua_pop(L, 1);
+      }
+    }
+    work_vm_put(V);
+  }
+
+  uv_mutex_lock(&g_work_lock);
+  lua_pushinteger(L, g_work_idle_count);
+  uv_mutex_unlock(&g_work_lock);
+  return 1;
+}
+
+int lunet_work_set_pool_size(lua_State *L) {
+  int size = (int)luaL_checkinteger(L, 1);
+  uv_once(&g_work_once, work_init_once);
+  int ret = g_work_pool ? lunet_pool_resize(g_work_pool, size) : UV_ENOMEM;
+  if (ret < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, uv_strerror(ret));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+int lunet_work_pool_stats(lua_State *L) {
+  uv_once(&g_work_once, work_init_once);
+  if (!g_work_pool) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  lunet_pool_push_stats(L, g_work_pool);
+  return 1;
+}
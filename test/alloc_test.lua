@@ -0,0 +1,59 @@
+--[[
+  Allocator Test
+
+  Spawns a task that churns strings and tables and checks that mem_stats
+  charges its allocations to it and that small blocks are reused.
+
+  Usage:
+    lunet-run test/alloc_test.lua
+]]
+
+local lunet = require("lunet")
+
+local test = require("test.check")
+local check = test.check
+
+local stats, err = lunet.mem_stats()
+if not stats then
+    print("SKIP: alloc (" .. tostring(err) .. ")")
+    return
+end
+check(stats.current > 0 and stats.current <= stats.peak, "current within peak")
+check(stats.reserved >= stats.current, "reserved covers current")
+check(stats.tasks == nil, "no tasks before attribution")
+check(lunet.set_mem_attribution(true) == true, "enable attribution")
+
+local function churn()
+    for i = 1, 20000 do
+        local t = { id = i, name = "row" .. i }
+        t.name = t.name .. ":" .. tostring(t.id)
+    end
+    collectgarbage()
+end
+local churn_task = "test/alloc_test.lua:" .. debug.getinfo(churn, "S").linedefined
+
+lunet.spawn(churn)
+
+lunet.spawn(function()
+    lunet.sleep(1)
+    local m = lunet.mem_stats(true)
+    check(m.small_reused > 0, "small blocks reused")
+    check(m.frees > 0, "frees counted")
+    check(m.current <= m.peak, "current within peak after churn")
+
+    local found
+    for _, t in ipairs(m.tasks or {}) do
+        if t.task == churn_task then
+            found = t
+        end
+    end
+    check(found ~= nil, "churn task listed")
+    check(found and found.bytes > 20000 * 16, "churn task charged")
+
+    local after = lunet.mem_stats()
+    check(after.peak <= m.peak, "reset lowers peak")
+    lunet.set_mem_attribution(false)
+    check(lunet.mem_stats().tasks == nil, "no tasks after disabling")
+
+    test.pass("alloc")
+end)
@@ -0,0 +1,79 @@
+--[[
+  Bytecode Cache Test
+
+  Requires a module through the bytecode cache, checks that an entry holding
+  LuaJIT bytecode was written, then edits the module and checks the edit is
+  picked up instead of the stale entry.
+
+  Usage:
+    LUNET_BYTECODE_CACHE=/tmp/lunet-bc lunet-run test/bccache_test.lua
+    lunet-run --bytecode-cache /tmp/lunet-bc --precompile test/   (warm the cache)
+]]
+
+local lunet = require("lunet")
+local fs = require("lunet.fs")
+
+local CACHE = os.getenv("LUNET_BYTECODE_CACHE")
+local MODDIR = os.tmpname()
+os.remove(MODDIR)
+
+local test = require("test.check")
+local check = test.check
+
+local function write_module(body)
+    local f = assert(io.open(MODDIR .. "/bccache_mod.lua", "w"))
+    f:write(body)
+    f:close()
+end
+
+local function fresh_require()
+    package.loaded.bccache_mod = nil
+    return require("bccache_mod")
+end
+
+if not CACHE then
+    print("SKIP: set LUNET_BYTECODE_CACHE to run the bytecode cache test")
+    return
+end
+
+lunet.spawn(function()
+    os.execute("mkdir -p " .. MODDIR)
+    package.path = MODDIR .. "/?.lua;" .. package.path
+
+    write_module("return { value = 1, line = debug.getinfo(1, 'S').short_src }\n")
+    local mod = fresh_require()
+    check(mod.value == 1, "module loads from source")
+
+    local entries = {}
+    for _, e in ipairs(fs.scandir(CACHE) or {}) do
+        if e.name:match("%.ljbc$") then
+            entries[#entries + 1] = CACHE .. "/" .. e.name
+        end
+    end
+    check(#entries >= 2, "entries written for the script and the module")
+
+    local found = false
+    for _, path in ipairs(entries) do
+        local f = io.open(path, "rb")
+        local data = f and f:read("*a") or ""
+        if f then f:close() end
+        if data:find("bccache_mod.lua", 1, true) then
+            found = data:match("^LUNETBC1") ~= nil and data:find("\27LJ", 1, true) ~= nil
+        end
+    end
+    check(found, "module entry holds LuaJIT bytecode")
+
+    mod = fresh_require()
+    check(mod.value == 1, "module loads from cache")
+    check(mod.line:find("bccache_mod.lua", 1, true) ~= nil, "cached bytecode keeps debug info")
+
+    write_module("return { value = 22 }\n")
+    check(fresh_require().value == 22, "edited module is recompiled")
+
+    local ok, err = pcall(require, "bccache_missing_mod")
+    check(not ok and err:find("no file", 1, true) ~= nil, "missing module error unchanged")
+
+    os.remove(MODDIR .. "/bccache_mod.lua")
+    os.remove(MODDIR)
+    test.pass("bytecode cache")
+end)
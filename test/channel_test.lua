@@ -0,0 +1,75 @@
+--[[
+  Channel Test
+
+  Covers buffered and unbuffered hand-off, blocking send/recv, try_* and
+  close semantics of lunet.channel.
+
+  Usage:
+    lunet-run test/channel_test.lua
+]]
+
+local lunet = require("lunet")
+
+local test = require("test.check")
+local check = test.check
+
+lunet.spawn(function()
+    -- Buffered: values queue up to capacity, then try_send reports full
+    local ch = lunet.channel(2)
+    check(ch:try_send(1) == true, "try_send into empty buffer")
+    check(ch:try_send(2) == true, "try_send into buffer with room")
+    local ok, err = ch:try_send(3)
+    check(ok == nil and err == "channel full", "try_send on full channel")
+    check(#ch == 2, "len reports buffered values")
+    check(ch:recv() == 1 and ch:recv() == 2, "values arrive in order")
+    local v, e = ch:try_recv()
+    check(v == nil and e == "channel empty", "try_recv on empty channel")
+
+    -- Unbuffered: a producer blocks until the consumer takes each value
+    local unbuffered = lunet.channel()
+    local sent = 0
+    lunet.spawn(function()
+        for i = 1, 100 do
+            unbuffered:send(i)
+            sent = i
+        end
+        unbuffered:close()
+    end)
+    local sum = 0
+    while true do
+        local n, rerr = unbuffered:recv()
+        if rerr then
+            check(rerr == "channel closed", "recv after close reports closed")
+            break
+        end
+        sum = sum + n
+    end
+    check(sum == 5050, "received every value from blocking sender, sum=" .. sum)
+    check(sent == 100, "sender finished")
+
+    -- Close wakes parked receivers; buffered values survive close
+    local idle = lunet.channel(0)
+    local woke
+    lunet.spawn(function()
+        local _, cerr = idle:recv()
+        woke = cerr
+    end)
+    local c = lunet.channel(4)
+    lunet.spawn(function()
+        local _, cerr = c:recv()
+        check(cerr == nil, "receiver got a value before close")
+    end)
+    c:send("a")
+    c:send("b")
+    c:close()
+    check(c:recv() == "b", "buffered value still readable after close")
+    local cv, cerr = c:recv()
+    check(cv == nil and cerr == "channel closed", "drained closed channel reports closed")
+    local sok, serr = c:send("x")
+    check(sok == nil and serr == "channel closed", "send on closed channel fails")
+    check(woke == nil, "unrelated parked receiver was not woken")
+    idle:close()
+    lunet.sleep(10)
+    check(woke == "channel closed", "close wakes parked receiver")
+    test.pass("channel")
+end)
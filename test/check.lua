@@ -0,0 +1,38 @@
+--[[
+  Shared assertions for the lunet-run scripts in test/
+
+  A failed check prints "FAIL: <msg>" and makes lunet-run exit with status 1;
+  the script keeps running so one run reports every failure.
+
+  Usage (from the repository root, where "./?.lua" resolves test.check):
+    local test = require("test.check")
+    local check = test.check
+    check(x == 1, "x is 1")
+    test.pass("my feature")  -- prints "PASS: my feature" if nothing failed
+]]
+
+local M = {
+    failed = false,
+    prefix = "",  -- prepended to failure messages, e.g. "worker 2: "
+}
+
+function M.check(cond, msg)
+    if not cond then
+        print("FAIL: " .. M.prefix .. msg)
+        M.failed = true
+        __lunet_exit_code = 1
+    end
+end
+
+-- Record a failure unconditionally, for scripts that stop at the first one
+function M.fail(msg)
+    M.check(false, msg)
+end
+
+function M.pass(name)
+    if not M.failed then
+        print("PASS: " .. name)
+    end
+end
+
+return M
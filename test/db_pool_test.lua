@@ -0,0 +1,52 @@
+--[[
+  DB Pool Test
+
+  Runs concurrent SQLite queries on the driver's dedicated thread pool and
+  checks that filesystem calls still complete while it is busy.
+
+  Usage:
+    lunet-run test/db_pool_test.lua
+]]
+
+local lunet = require("lunet")
+local db = require("lunet.sqlite3")
+local fs = require("lunet.fs")
+
+local test = require("test.check")
+local check = test.check
+
+check(db.set_pool_size(2) == true, "set_pool_size")
+local ok, err = db.set_pool_size(0)
+check(ok == nil and err ~= nil, "pool size must be positive")
+
+lunet.spawn(function()
+    local before = db.pool_stats()
+    check(before.size == 2, "pool size reported")
+
+    local done = 0
+    for i = 1, 8 do
+        lunet.spawn(function()
+            local conn = assert(db.open({path = ":memory:"}))
+            -- a deliberately slow recursive query
+            local rows = db.query(conn, [[
+                WITH RECURSIVE n(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM n WHERE x < 200000)
+                SELECT count(*) AS c FROM n]])
+            check(rows and tonumber(rows[1].c) == 200000, "query " .. i)
+            db.close(conn)
+            done = done + 1
+        end)
+    end
+
+    -- fs runs on the libuv threadpool, not behind the queries
+    local stat = fs.stat("test/db_pool_test.lua")
+    check(stat ~= nil, "fs.stat while database pool is busy")
+    check(done < 8, "fs.stat finished before the queries")
+
+    while done < 8 do
+        lunet.sleep(10)
+    end
+    local after = db.pool_stats()
+    check(after.completed - before.completed >= 16, "open and query ran on the pool")
+    check(after.queued == 0 and after.active == 0, "pool idle at the end")
+    test.pass("db pool")
+end)
@@ -0,0 +1,38 @@
+--[[
+  fs.read Length Test
+
+  fs.read must reject negative lengths and survive absurdly large ones
+  instead of allocating a wrapped-around buffer.
+
+  Usage:
+    lunet-run test/fs_read_test.lua
+]]
+
+local lunet = require("lunet")
+local fs = require("lunet.fs")
+
+local PATH = "test/fs_read_test.lua"
+
+local test = require("test.check")
+local check = test.check
+
+lunet.spawn(function()
+    local fd = assert(fs.open(PATH, "r"))
+
+    local data, err = fs.read(fd, -1)
+    check(data == nil and err == "fs.read length must be >= 0", "negative length rejected: " .. tostring(err))
+    data, err = fs.read(fd, -2 ^ 40)
+    check(data == nil and err ~= nil, "large negative length rejected")
+
+    data, err = fs.read(fd, 64)
+    check(data and #data == 64, "normal read: " .. tostring(err))
+    fs.close(fd)
+
+    -- capped, so either the whole file comes back or the allocation fails cleanly
+    fd = assert(fs.open(PATH, "r"))
+    data, err = fs.read(fd, 2 ^ 52)
+    check((data and data:sub(1, 2) == "--") or err == "fs.read out of memory", "huge length: " .. tostring(err))
+    fs.close(fd)
+
+    test.pass("fs read length")
+end)
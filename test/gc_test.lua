@@ -0,0 +1,52 @@
+--[[
+  Idle GC Test
+
+  Builds garbage between short sleeps and checks that lunet steps the
+  collector while the loop waits, within the configured budget.
+
+  Usage:
+    lunet-run test/gc_test.lua
+]]
+
+local lunet = require("lunet")
+
+local test = require("test.check")
+local check = test.check
+
+lunet.spawn(function()
+    lunet.set_gc({ step = 8, budget = 2 })
+    local before = lunet.stats().gc
+
+    for round = 1, 20 do
+        local t = {}
+        for i = 1, 5000 do
+            t[i] = { round = round, name = "item" .. i }
+        end
+        t = nil
+        lunet.sleep(5)  -- idle: room for GC steps before poll
+    end
+
+    local after = lunet.stats().gc
+    check(after.steps > before.steps, "collector stepped while idle")
+    check(after.cycles > before.cycles, "idle steps finished a cycle")
+    check(after.step_ms > before.step_ms, "step time accounted")
+    -- the budget is 2 ms; only the last step of an iteration can overrun it
+    check(after.max_step_ms < 50, "stepping bounded per iteration")
+
+    lunet.set_gc(false)
+    local off = lunet.stats().gc
+    for _ = 1, 5 do
+        local junk = {}
+        for i = 1, 5000 do
+            junk[i] = { i }
+        end
+        lunet.sleep(5)
+    end
+    check(lunet.stats().gc.steps == off.steps, "no steps when disabled")
+
+    local ok = pcall(lunet.set_gc, { budget = 0 })
+    check(not ok, "zero budget rejected")
+    lunet.set_gc({})
+
+    test.pass("gc")
+end)
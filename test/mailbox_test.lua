@@ -0,0 +1,77 @@
+--[[
+  Mailbox Test
+
+  Worker 1 opens a mailbox; every worker (including 1) sends it one table
+  message. Also covers try_recv, lookup handles, serialization errors and
+  close semantics of lunet.mailbox.
+
+  Usage:
+    lunet-run test/mailbox_test.lua
+    lunet-run --workers 4 test/mailbox_test.lua
+]]
+
+local lunet = require("lunet")
+local mailbox = require("lunet.mailbox")
+
+local id = lunet.worker_id()
+local count = lunet.worker_count()
+
+local test = require("test.check")
+local check = test.check
+test.prefix = "worker " .. id .. ": "
+
+local inbox
+if id == 1 then
+    inbox = assert(mailbox.open("mailbox_test"))
+    local dup, derr = mailbox.open("mailbox_test")
+    check(dup == nil and derr == "mailbox name in use", "duplicate name rejected")
+    local v, e = inbox:try_recv()
+    check(v == nil and e == "mailbox empty", "try_recv on empty mailbox")
+
+    lunet.spawn(function()
+        local seen = {}
+        for _ = 1, count do
+            local msg, err = inbox:recv()
+            check(err == nil, "recv error " .. tostring(err))
+            if msg then
+                check(msg.nested.list[3] == "c" and msg.nested.flag == true, "nested table survives")
+                seen[msg.from] = true
+            end
+        end
+        for w = 1, count do
+            check(seen[w], "message from worker " .. w)
+        end
+
+        -- a receiver parked on a closed mailbox is woken
+        local waiter_err
+        lunet.spawn(function()
+            local _, err = inbox:recv()
+            waiter_err = err
+        end)
+        local remote = assert(mailbox.lookup("mailbox_test"))
+        inbox:close()
+        lunet.sleep(10)
+        check(waiter_err == "mailbox closed", "close wakes parked receiver")
+        local ok, serr = remote:send("late")
+        check(ok == nil and serr == "mailbox closed", "send after close fails")
+        check(mailbox.lookup("mailbox_test") == nil, "name released on close")
+        test.pass("mailbox")
+    end)
+end
+
+lunet.spawn(function()
+    -- other workers may start before worker 1 has opened the mailbox
+    local remote
+    for _ = 1, 100 do
+        remote = mailbox.lookup("mailbox_test")
+        if remote then break end
+        lunet.sleep(10)
+    end
+    check(remote ~= nil, "lookup mailbox")
+    if not remote then return end
+
+    local ok, err = remote:send(function() end)
+    check(ok == nil and err ~= nil, "functions cannot be sent")
+    ok, err = remote:send({from = id, nested = {list = {"a", "b", "c"}, flag = true}})
+    check(ok == true, "send: " .. tostring(err))
+end)
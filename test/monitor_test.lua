@@ -0,0 +1,45 @@
+--[[
+  Monitor Test
+
+  Enables the loop monitor, blocks the loop with a busy coroutine after a
+  sleep, and checks that the slow resume and the resulting lag are recorded.
+  Expect one "[lunet] slow resume: sleep ..." line on stderr.
+
+  Usage:
+    lunet-run test/monitor_test.lua
+]]
+
+local lunet = require("lunet")
+
+local test = require("test.check")
+local check = test.check
+
+local function busy(ms)
+    local deadline = os.clock() + ms / 1000
+    while os.clock() < deadline do end
+end
+
+check(lunet.monitor_stats() == nil, "stats unavailable before enabling")
+lunet.set_monitor({ interval = 10, slow = 30 })
+
+lunet.spawn(function()
+    lunet.sleep(50)  -- let a few lag samples accumulate
+    busy(60)         -- resumed from the sleep timer and hogs the loop
+    lunet.sleep(50)
+
+    local m = lunet.monitor_stats(true)
+    check(m.lag.count >= 3, "lag sampled")
+    check(m.lag.max >= 30, "busy resume shows up as lag")
+    check(m.resume.count >= 2, "resumes timed")
+    check(m.resume.max >= 55, "resume duration recorded")
+    check(m.slow == 1, "one slow resume")
+    check(m.worst_site == "sleep", "worst site is the sleep timer")
+    check(m.resume.p50 <= m.resume.max, "percentiles bounded by max")
+
+    local cleared = lunet.monitor_stats()
+    check(cleared.resume.count == 0 and cleared.slow == 0, "reset clears data")
+
+    lunet.set_monitor(false)
+    check(lunet.monitor_stats() == nil, "disabled")
+    test.pass("monitor")
+end)
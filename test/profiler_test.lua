@@ -0,0 +1,95 @@
+--[[
+  Profiler Test
+
+  Profiles two spawned tasks that burn CPU in different functions and checks
+  the folded output attributes each hot function to the task that ran it.
+
+  Usage:
+    lunet-run test/profiler_test.lua
+]]
+
+local lunet = require("lunet")
+local profiler = require("lunet.profiler")
+
+local test = require("test.check")
+local check = test.check
+
+local function crunch(n)
+    local x = 0
+    for i = 1, n do
+        x = (x + i * 7) % 1000003
+    end
+    return x
+end
+
+local function concat(n)
+    local parts = {}
+    for i = 1, n do
+        parts[#parts + 1] = tostring(i)
+    end
+    return table.concat(parts)
+end
+
+local function busy(fn, ms)
+    local deadline = os.clock() + ms / 1000
+    while os.clock() < deadline do
+        fn(10000)
+    end
+end
+
+check(profiler.stop() == nil, "stop before start reports an error")
+check(profiler.start({ interval = 1 }) == true, "start")
+local ok, err = profiler.start()
+check(ok == nil and err == "profiler already running", "second start rejected")
+
+local running = 2
+local function finish()
+    running = running - 1
+    if running > 0 then
+        return
+    end
+    local folded = profiler.stop()
+    check(type(folded) == "string", "stop returns folded stacks")
+
+    -- LuaJIT names Lua frames "file:linedefined"
+    local crunch_frame = ";[^;]*:" .. debug.getinfo(crunch, "S").linedefined .. ";?"
+    local concat_frame = ";[^;]*:" .. debug.getinfo(concat, "S").linedefined .. ";?"
+    local total, crunch_task, concat_task = 0, false, false
+    for line in folded:gmatch("[^\n]+") do
+        local stack, count = line:match("^(.+) (%d+)$")
+        check(stack ~= nil, "folded line format: " .. line)
+        if stack then
+            total = total + tonumber(count)
+            local task = stack:match("^[^;]+")
+            if (stack .. ";"):find(crunch_frame) then
+                crunch_task = crunch_task or task
+            end
+            if (stack .. ";"):find(concat_frame) then
+                concat_task = concat_task or task
+            end
+        end
+    end
+    check(total >= 50, "samples collected")
+    check(crunch_task and crunch_task:match("^test/profiler_test%.lua:%d+$") ~= nil, "crunch attributed to a task")
+    check(concat_task and concat_task ~= crunch_task, "tasks kept apart")
+
+    local again, err2 = profiler.stop()
+    check(again == nil and err2 == "profiler not running", "stop twice reports an error")
+    test.pass("profiler")
+end
+
+lunet.spawn(function()
+    for _ = 1, 5 do
+        busy(crunch, 20)
+        lunet.sleep(1)
+    end
+    finish()
+end)
+
+lunet.spawn(function()
+    for _ = 1, 5 do
+        busy(concat, 20)
+        lunet.sleep(1)
+    end
+    finish()
+end)
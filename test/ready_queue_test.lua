@@ -0,0 +1,61 @@
+--[[
+  Ready Queue Test
+
+  Wakes more coroutines at once than the resume budget allows and checks that
+  they run in wakeup order, with the excess deferred to later loop iterations.
+
+  Usage:
+    lunet-run test/ready_queue_test.lua
+]]
+
+local lunet = require("lunet")
+
+local test = require("test.check")
+local check = test.check
+
+local N = 10
+
+-- Every coroutine sleeps 0 ms, so all timers fire in one iteration and queue
+-- N wakeups together; record the order and the iteration each one ran in.
+local function wake_all()
+    local order, iter = {}, {}
+    for i = 1, N do
+        lunet.spawn(function()
+            lunet.sleep(0)
+            order[#order + 1] = i
+            iter[i] = lunet.stats().loop_iterations
+        end)
+    end
+    return order, iter
+end
+
+lunet.set_resume_budget(3)
+local order, iter = wake_all()
+
+lunet.spawn(function()
+    lunet.sleep(50)
+    check(#order == N, "all coroutines resumed")
+    for i = 1, N do
+        check(order[i] == i, "FIFO order at position " .. i .. ": " .. tostring(order[i]))
+    end
+    for i = 2, N do
+        if (i - 1) % 3 == 0 then
+            check(iter[i] > iter[i - 1], "wakeup " .. i .. " deferred past the budget")
+        else
+            check(iter[i] == iter[i - 1], "wakeup " .. i .. " in the same iteration")
+        end
+    end
+
+    -- 0 = unlimited: everything queued runs in one iteration
+    lunet.set_resume_budget(0)
+    local order2, iter2 = wake_all()
+    lunet.sleep(50)
+    check(#order2 == N, "all coroutines resumed without a budget")
+    check(iter2[N] == iter2[1], "unlimited budget drains the queue at once")
+
+    local ok = pcall(lunet.set_resume_budget, -1)
+    check(not ok, "negative budget rejected")
+    lunet.set_resume_budget(1024)
+
+    test.pass("ready queue")
+end)
@@ -0,0 +1,72 @@
+--[[
+  Reload Test
+
+  Loads a module from a temp directory, starts a coroutine on the old code,
+  rewrites the module and reloads it. Checks that the running coroutine
+  finishes on the old version, new lookups get the new one, a listener keeps
+  accepting across the reload, and a broken module is rolled back.
+
+  Usage:
+    lunet-run test/reload_test.lua
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local PORT = 20093
+local MODDIR = os.tmpname()
+os.remove(MODDIR)
+os.execute("mkdir -p " .. MODDIR)
+package.path = MODDIR .. "/?.lua;" .. package.path
+
+local test = require("test.check")
+local check = test.check
+
+local function write_module(body)
+    local f = assert(io.open(MODDIR .. "/reload_mod.lua", "w"))
+    f:write(body)
+    f:close()
+end
+
+write_module("return { version = function() return 1 end }\n")
+local old = require("reload_mod")
+
+lunet.spawn(function()
+    local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+
+    local in_flight
+    lunet.spawn(function()
+        local mod = require("reload_mod")
+        lunet.sleep(30)
+        in_flight = mod.version()
+    end)
+
+    write_module("return { version = function() return 2 end }\n")
+    local n, err = lunet.reload("reload_mod")
+    check(n == 1, "reload: " .. tostring(err))
+    check(require("reload_mod").version() == 2, "require returns new code")
+    check(old.version() == 1, "old table untouched")
+
+    lunet.sleep(50)
+    check(in_flight == 1, "in-flight coroutine finished on old code")
+
+    local conn = socket.connect("127.0.0.1", PORT)
+    check(conn ~= nil, "listener survives reload")
+    local peer = conn and socket.accept(listener)
+    check(peer ~= nil, "accept after reload")
+
+    write_module("return { version = \n")
+    n, err = lunet.reload({ "reload_mod" })
+    check(n == nil and err:find("^reload reload_mod:") ~= nil, "broken module reported")
+    check(require("reload_mod").version() == 2, "broken reload rolled back")
+
+    local ok = pcall(lunet.reload, { 42 })
+    check(ok, "bad name does not raise")
+
+    if peer then socket.close(peer) end
+    if conn then socket.close(conn) end
+    socket.close(listener)
+    os.remove(MODDIR .. "/reload_mod.lua")
+    os.remove(MODDIR)
+    test.pass("reload")
+end)
@@ -0,0 +1,63 @@
+--[[
+  Socket Read Buffer Test
+
+  Checks that a connection keeps reading in the background: data that arrives
+  between reads is returned by one socket.read, transfers larger than the
+  high-water mark arrive complete, and EOF follows the buffered data.
+
+  Usage:
+    lunet-run test/socket_buffer_test.lua
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local PORT = 20095
+
+local test = require("test.check")
+local check = test.check
+
+lunet.spawn(function()
+    local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+    local conn = assert(socket.connect("127.0.0.1", PORT))
+    local peer = assert(socket.accept(listener))
+
+    -- first read starts reading; later writes are buffered until the next read
+    socket.write(conn, "x")
+    check(socket.read(peer) == "x", "first read")
+    for _, part in ipairs({ "abc", "def", "ghi" }) do
+        socket.write(conn, part)
+        lunet.sleep(5)
+    end
+    check(socket.read(peer) == "abcdefghi", "chunks returned by one read")
+
+    -- well past the 64 KiB high-water mark while nobody reads
+    local chunk = string.rep("0123456789abcdef", 4096)  -- 64 KiB
+    lunet.spawn(function()
+        for _ = 1, 4 do
+            socket.write(conn, chunk)
+        end
+        socket.close(conn)
+    end)
+    lunet.sleep(20)
+
+    local parts = {}
+    while true do
+        local data, err = socket.read(peer)
+        check(err == nil, "read error: " .. tostring(err))
+        if not data then
+            break
+        end
+        parts[#parts + 1] = data
+    end
+    local all = table.concat(parts)
+    check(#all == 4 * #chunk, "received " .. #all .. " of " .. 4 * #chunk .. " bytes")
+    check(all == string.rep(chunk, 4), "data intact")
+
+    local data, err = socket.read(peer)
+    check(data == nil and err == nil, "EOF repeats after the stream ended")
+
+    socket.close(peer)
+    socket.close(listener)
+    test.pass("socket buffer")
+end)
@@ -0,0 +1,77 @@
+--[[
+  Socket Framing Test
+
+  Exercises socket.read_line, read_until and read_exact with frames split
+  across writes, the max limit, and EOF in the middle of a frame.
+
+  Usage:
+    lunet-run test/socket_framing_test.lua
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local PORT = 20096
+
+local test = require("test.check")
+local check = test.check
+
+lunet.spawn(function()
+    local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+    local conn = assert(socket.connect("127.0.0.1", PORT))
+    local peer = assert(socket.accept(listener))
+
+    lunet.spawn(function()
+        local parts = {
+            "GET / HTTP/1.1\r", "\nHost: x\r\n", "Content-Length: 11\r\n\r", "\nhello",
+            " world", "a: 1\r\n\r\n", "abcdefgh", "xy;", "tail",
+        }
+        for _, part in ipairs(parts) do
+            socket.write(conn, part)
+            lunet.sleep(5)
+        end
+        socket.close(conn)
+    end)
+
+    check(socket.read_line(peer) == "GET / HTTP/1.1", "request line without CRLF")
+    local headers = socket.read_until(peer, "\r\n\r\n")
+    check(headers == "Host: x\r\nContent-Length: 11\r\n\r\n", "headers include the delimiter")
+    local len = tonumber(headers:match("Content%-Length: (%d+)"))
+    check(socket.read_exact(peer, len) == "hello world", "body across two writes")
+    check(socket.read_exact(peer, 0) == "", "zero-length read")
+    check(socket.read_until(peer, "\r\n\r\n", 64) == "a: 1\r\n\r\n", "multi-byte delimiter")
+
+    lunet.sleep(20)
+    local data, err = socket.read_until(peer, ";", 4)
+    check(data == nil and err == "delimiter not found within 4 bytes", "max enforced: " .. tostring(err))
+    check(socket.read_until(peer, ";", 32) == "abcdefghxy;", "data kept after max error")
+
+    data, err = socket.read_line(peer)
+    check(data == nil and err == "connection closed", "EOF mid-line: " .. tostring(err))
+    check(socket.read(peer) == "tail", "partial line still readable")
+    data, err = socket.read_line(peer)
+    check(data == nil and err == nil, "clean EOF")
+
+    socket.close(peer)
+
+    -- a temporary delimiter must survive a full GC while the read is parked
+    local conn2 = assert(socket.connect("127.0.0.1", PORT))
+    local peer2 = assert(socket.accept(listener))
+    local boundary = "b" .. tostring(os.time())
+    lunet.spawn(function()
+        lunet.sleep(10)
+        collectgarbage("collect")
+        collectgarbage("collect")
+        socket.write(conn2, "part one")
+        lunet.sleep(5)
+        collectgarbage("collect")
+        socket.write(conn2, "--" .. boundary .. "rest")
+    end)
+    data, err = socket.read_until(peer2, "--" .. boundary)
+    check(data == "part one--" .. boundary, "concatenated delimiter after GC: " .. tostring(data or err))
+    socket.close(conn2)
+    socket.close(peer2)
+
+    socket.close(listener)
+    test.pass("socket framing")
+end)
@@ -0,0 +1,120 @@
+--[[
+  Socket Write Queue Test
+
+  Several coroutines write to one connection at once; a writer facing a peer
+  that does not read is held back by the high-water mark; socket.drain waits
+  for the queue and reports write errors.
+
+  Usage:
+    lunet-run test/socket_write_queue_test.lua
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local PORT = 20098
+
+local test = require("test.check")
+local check = test.check
+
+lunet.spawn(function()
+    local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+    local conn = assert(socket.connect("127.0.0.1", PORT))
+    local peer = assert(socket.accept(listener))
+
+    -- concurrent writers: no "write in progress" errors, each writer's data in order
+    local done = 0
+    for w = 1, 4 do
+        lunet.spawn(function()
+            for i = 1, 50 do
+                local err = socket.write(conn, string.format("%d:%02d;", w, i))
+                check(err == nil, "concurrent write: " .. tostring(err))
+            end
+            done = done + 1
+        end)
+    end
+    local next_seq = { 0, 0, 0, 0 }
+    for _ = 1, 200 do
+        local msg = socket.read_until(peer, ";")
+        local w, i = msg:match("^(%d):(%d+);$")
+        w, i = tonumber(w), tonumber(i)
+        check(i == next_seq[w] + 1, "writer " .. tostring(w) .. " out of order")
+        next_seq[w] = i
+    end
+    check(done == 4, "all writers finished")
+    check(socket.drain(conn) == nil, "drain with nothing queued")
+
+    -- backpressure: the peer does not read, so the writer must be held back
+    local chunk = string.rep("z", 16 * 1024)
+    local count = 1024  -- 16 MiB, more than the kernel buffers on loopback
+    local written = 0
+    lunet.spawn(function()
+        for _ = 1, count do
+            check(socket.write(conn, chunk) == nil, "bulk write")
+            written = written + 1
+        end
+        check(socket.drain(conn) == nil, "drain after bulk writes")
+        written = written + 1
+    end)
+    lunet.sleep(50)
+    check(written < count, "writer suspended while the peer does not read")
+    local got = 0
+    while got < count * #chunk do
+        local data = socket.read(peer)
+        if not data then
+            break
+        end
+        got = got + #data
+    end
+    check(got == count * #chunk, "all bulk data received")
+    lunet.sleep(10)
+    check(written == count + 1, "writer resumed and drained")
+
+    -- close right after writing: queued data must still arrive before EOF
+    local conn2 = assert(socket.connect("127.0.0.1", PORT))
+    local peer2 = assert(socket.accept(listener))
+    local total = 0
+    local parked_err
+    lunet.spawn(function()
+        local data, err = socket.read(conn2)  -- nothing arrives; close must wake it
+        parked_err = data == nil and err
+    end)
+    lunet.spawn(function()
+        for _ = 1, 16 do
+            check(socket.write(conn2, chunk) == nil, "write before close")
+            total = total + #chunk
+        end
+        socket.close(conn2)
+        check(socket.write(conn2, "late") == "socket is closed", "write after close rejected")
+    end)
+    local received = 0
+    while true do
+        local data, err = socket.read(peer2)
+        check(err == nil, "read before EOF: " .. tostring(err))
+        if not data then
+            break
+        end
+        received = received + #data
+    end
+    check(received == 16 * #chunk and received == total, "write-then-close delivered " .. received .. " bytes")
+    check(parked_err == "socket is closed", "parked reader woken by close: " .. tostring(parked_err))
+    socket.close(peer2)
+
+    -- a failed write is reported by a later write or drain
+    socket.close(peer)
+    lunet.sleep(10)
+    local err
+    for _ = 1, 50 do
+        err = socket.write(conn, chunk)
+        if err then
+            break
+        end
+        lunet.sleep(1)
+    end
+    check(type(err) == "string", "write error after peer closed")
+    check(type(socket.drain(conn)) == "string", "drain reports the error")
+
+    socket.close(conn)
+    socket.close(listener)
+    test.pass("socket write queue")
+end)
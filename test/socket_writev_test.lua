@@ -0,0 +1,49 @@
+--[[
+  Socket Writev Test
+
+  Sends a response as separate parts with socket.writev and checks that the
+  peer receives them joined, in order, and that bad input is rejected.
+
+  Usage:
+    lunet-run test/socket_writev_test.lua
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local PORT = 20097
+
+local test = require("test.check")
+local check = test.check
+
+lunet.spawn(function()
+    local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+    local conn = assert(socket.connect("127.0.0.1", PORT))
+    local peer = assert(socket.accept(listener))
+
+    local body = string.rep("x", 200 * 1024)
+    local parts = { "HTTP/1.1 200 OK\r\nContent-Length: ", #body, "\r\n\r\n", body }
+    local expected = table.concat(parts)
+
+    local before = lunet.stats().bytes_written
+    lunet.spawn(function()
+        local err = socket.writev(conn, parts)
+        check(err == nil, "writev: " .. tostring(err))
+        -- the caller's table can be reused as soon as writev returns
+        parts[4] = nil
+        check(socket.writev(conn, { "a", "", "b" }) == nil, "empty part")
+        check(socket.writev(conn, {}) == nil, "empty table")
+    end)
+
+    check(socket.read_exact(peer, #expected) == expected, "parts arrive joined and in order")
+    check(socket.read_exact(peer, 2) == "ab", "second writev")
+    check(lunet.stats().bytes_written - before == #expected + 2, "bytes written counted")
+
+    check(socket.writev(conn, { "ok", {} }) == "part 2 must be a string", "non-string part rejected")
+    check(socket.writev(conn, "text") == "data must be a table of strings", "non-table rejected")
+
+    socket.close(conn)
+    socket.close(peer)
+    socket.close(listener)
+    test.pass("socket writev")
+end)
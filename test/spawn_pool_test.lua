@@ -0,0 +1,61 @@
+--[[
+  Coroutine Pool Test
+
+  Spawns batches of short tasks and checks that finished coroutines are
+  parked and reused by later spawns.
+
+  Usage:
+    lunet-run test/spawn_pool_test.lua
+]]
+
+local lunet = require("lunet")
+
+local test = require("test.check")
+local fail = test.fail
+
+lunet.set_spawn_pool_size(16)
+
+lunet.spawn(function()
+    local before = lunet.spawn_pool()
+
+    -- Synchronous tasks finish inside spawn and park immediately
+    local ran = 0
+    for _ = 1, 100 do
+        lunet.spawn(function() ran = ran + 1 end)
+    end
+    if ran ~= 100 then
+        return fail("expected 100 tasks to run, got " .. ran)
+    end
+
+    -- Tasks that yield park once their sleep completes
+    local woke = 0
+    for _ = 1, 32 do
+        lunet.spawn(function()
+            lunet.sleep(10)
+            woke = woke + 1
+        end)
+    end
+    lunet.sleep(100)
+    if woke ~= 32 then
+        return fail("expected 32 sleepers to wake, got " .. woke)
+    end
+
+    local stats = lunet.spawn_pool()
+    print(string.format("pool: size=%d idle=%d hits=%d misses=%d",
+        stats.size, stats.idle, stats.hits, stats.misses))
+    if stats.size ~= 16 or stats.idle > 16 then
+        return fail("pool exceeded its size limit")
+    end
+    if stats.hits - before.hits < 99 then
+        return fail("expected back-to-back spawns to reuse the pooled coroutine")
+    end
+
+    -- Errors kill the coroutine instead of returning it to the pool
+    lunet.spawn(function() error("expected test error") end)
+
+    lunet.set_spawn_pool_size(0)
+    if lunet.spawn_pool().idle ~= 0 then
+        return fail("shrinking the pool did not drop idle coroutines")
+    end
+    print("PASS: spawn pool")
+end)
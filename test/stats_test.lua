@@ -0,0 +1,62 @@
+--[[
+  Stats Test
+
+  Drives a TCP echo exchange and a file stat, then checks that lunet.stats()
+  reports handles, listeners, byte counters, loop activity and slab reuse.
+
+  Usage:
+    lunet-run test/stats_test.lua
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+local fs = require("lunet.fs")
+
+local PORT = 20090
+
+local test = require("test.check")
+local check = test.check
+
+lunet.spawn(function()
+    local before = lunet.stats()
+    check(type(before.corefs) == "number", "corefs reported")
+    check(before.utilization >= 0 and before.utilization <= 1, "utilization in [0, 1]")
+
+    local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+    local conn = assert(socket.connect("127.0.0.1", PORT))
+    lunet.sleep(10)  -- let the connection land in the accept queue
+
+    local s = lunet.stats()
+    check(s.handles.tcp >= 3, "listener, client and accepted handles counted")
+    check(#s.listeners == 1 and s.listeners[1].address == "127.0.0.1:" .. PORT, "listener address")
+    check(s.listeners[1].pending == 1, "pending accept counted")
+
+    local peer = socket.accept(listener)
+    socket.write(conn, "hello")
+    check(socket.read(peer) == "hello", "echo read")
+
+    assert(fs.stat("test/stats_test.lua"))
+
+    local after = lunet.stats()
+    check(after.bytes_written - before.bytes_written == 5, "bytes written")
+    check(after.bytes_read - before.bytes_read == 5, "bytes read")
+    check(after.listeners[1].pending == 0, "accept drained the queue")
+    check(after.fs_pending == 0, "no fs requests in flight")
+    check(after.loop_iterations > before.loop_iterations, "loop iterations advance")
+
+    -- sleeps and writes take their contexts from the slab and give them back
+    for _ = 1, 100 do
+        lunet.sleep(0)
+    end
+    local pooled = lunet.stats().slab
+    check(pooled.allocs - after.slab.allocs >= 100, "sleep contexts come from the slab")
+    check(pooled.reused - after.slab.reused >= 90, "sleep contexts reused")
+    check(pooled.mallocs - after.slab.mallocs <= 1, "at most one new chunk")
+
+    socket.close(peer)
+    socket.close(conn)
+    socket.close(listener)
+    lunet.sleep(10)
+    check(#lunet.stats().listeners == 0, "closed listener removed")
+    test.pass("stats")
+end)
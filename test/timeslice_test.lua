@@ -0,0 +1,79 @@
+--[[
+  Time Slicing Test
+
+  A CPU-bound coroutine must not starve a timer-driven coroutine once
+  lunet.set_timeslice is enabled, and its preemptions must be reported.
+
+  Usage:
+    lunet-run test/timeslice_test.lua
+]]
+
+local lunet = require("lunet")
+
+local test = require("test.check")
+local fail = test.fail
+
+-- Hooks do not fire inside compiled traces; keep the busy loop interpreted
+local function busy(ms)
+    local deadline = os.clock() + ms / 1000
+    local n = 0
+    while os.clock() < deadline do
+        n = n + 1
+    end
+    return n
+end
+if jit then jit.off(busy) end
+
+lunet.set_timeslice(5)
+
+local ticks = 0
+local busy_done = false
+
+lunet.spawn(function()
+    while not busy_done do
+        lunet.sleep(10)
+        ticks = ticks + 1
+    end
+end)
+
+lunet.spawn(function()
+    busy(300)
+    busy_done = true
+
+    local overruns, total = lunet.timeslice_overruns()
+    local info = overruns[coroutine.running()]
+    print(string.format("ticks during busy loop: %d, preemptions: %d", ticks, total))
+    if ticks < 5 then
+        return fail("timer coroutine was starved")
+    end
+    if not info or info.count < 1 or not info.where then
+        return fail("busy coroutine has no overrun record")
+    end
+    print("offender: " .. info.where)
+    lunet.set_timeslice(0)
+
+    -- once this task is done its thread is pooled; a task that reuses it
+    -- must not inherit the record
+    local busy_co = coroutine.running()
+    lunet.spawn(function()
+        lunet.sleep(20)
+        local reused, inherited = false, nil
+        for _ = 1, 10 do
+            lunet.spawn(function()
+                if coroutine.running() == busy_co then
+                    reused = true
+                    inherited = lunet.timeslice_overruns()[busy_co]
+                end
+                lunet.sleep(10)  -- hold the thread so the next spawn takes another
+            end)
+        end
+        lunet.sleep(20)
+        if not reused then
+            return fail("busy coroutine's thread was not reused")
+        end
+        if inherited then
+            return fail("reused thread inherited the previous task's overruns")
+        end
+        print("PASS: time slicing")
+    end)
+end)
@@ -0,0 +1,78 @@
+--[[
+  Trace Export Test
+
+  Runs a coroutine that sleeps and waits on a socket read, exports the trace
+  ring as Chrome Trace Event JSON and checks the per-coroutine slices.
+  Open the file in https://ui.perfetto.dev to inspect it by hand.
+
+  Usage:
+    lunet-run test/trace_export_test.lua
+]]
+
+local lunet = require("lunet")
+local trace = require("lunet.trace")
+local socket = require("lunet.socket")
+
+local PORT = 20092
+local TRACE_PATH = os.tmpname()
+
+local test = require("test.check")
+local check = test.check
+
+-- Slices named `name` in category `cat`, as {tid, ts, dur} (microseconds)
+local function slices(json, name, cat)
+    local out = {}
+    local pattern = '{"name":"' .. name:gsub("%.", "%%.") .. '","cat":"' .. cat
+        .. '","ph":"X","pid":%d+,"tid":(%d+),"ts":([%d%.]+),"dur":([%d%.]+)'
+    for tid, ts, dur in json:gmatch(pattern) do
+        out[#out + 1] = { tid = tonumber(tid), ts = tonumber(ts), dur = tonumber(dur) }
+    end
+    return out
+end
+
+lunet.spawn(function()
+    local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+    local conn = assert(socket.connect("127.0.0.1", PORT))
+    local peer = assert(socket.accept(listener))
+
+    lunet.spawn(function()
+        lunet.sleep(30)
+        socket.write(conn, "ping")
+    end)
+
+    lunet.sleep(20)
+    check(socket.read(peer) == "ping", "read")
+
+    local n = trace.export(TRACE_PATH)
+    check(n and n > 0, "events exported")
+    local f = assert(io.open(TRACE_PATH))
+    local json = f:read("*a")
+    f:close()
+    os.remove(TRACE_PATH)
+
+    check(json:match('^{"displayTimeUnit":"ms","traceEvents":%[') ~= nil, "trace header")
+    check(json:match("%]}%s*$") ~= nil, "trace footer")
+    local _, events = json:gsub('"ph":"', "")
+    check(events == n, "export count matches events in file")
+
+    local sleeps = slices(json, "sleep", "wait")
+    check(#sleeps >= 2, "sleep waits on both coroutines")
+    for _, s in ipairs(sleeps) do
+        check(s.dur >= 15000, "sleep wait lasts about as long as the sleep")
+    end
+    local reads = slices(json, "socket.read", "wait")
+    check(#reads == 1 and reads[1].dur >= 5000, "socket.read wait recorded")
+    check(#slices(json, "queued", "sched") >= 3, "ready queue time recorded")
+    check(#slices(json, "run", "co") >= 4, "run slices recorded")
+    check(json:find('"name":"spawn","cat":"event"', 1, true) ~= nil, "spawn instants")
+    check(json:find('"name":"finish","cat":"event"', 1, true) ~= nil, "finish instants")
+    check(json:find('"name":"thread_name","ph":"M","pid":%d+,"tid":0,"args":{"name":"loop"}') ~= nil, "loop track")
+
+    local ok, err = trace.export("/nonexistent-dir/trace.json")
+    check(ok == nil and type(err) == "string", "export reports file errors")
+
+    socket.close(peer)
+    socket.close(conn)
+    socket.close(listener)
+    test.pass("trace export")
+end)
@@ -0,0 +1,92 @@
+--[[
+  Trace Ring Test
+
+  Generates socket, fs and timer activity, dumps the trace ring and checks
+  the decoded events, the time window filter and resizing.
+
+  Usage:
+    lunet-run test/trace_test.lua
+]]
+
+local lunet = require("lunet")
+local trace = require("lunet.trace")
+local socket = require("lunet.socket")
+local fs = require("lunet.fs")
+
+local PORT = 20091
+local TRACE_PATH = os.tmpname()
+
+local test = require("test.check")
+local check = test.check
+
+local function read_trace()
+    local events, last_ms = {}, -math.huge
+    local ordered = true
+    for line in io.lines(TRACE_PATH) do
+        local ms, event, size = line:match("^(%S+) (%S+) %S+ (%-?%d+)")
+        if ms then
+            ms = tonumber(ms)
+            ordered = ordered and ms >= last_ms and ms <= 0
+            last_ms = ms
+            events[#events + 1] = { ms = ms, event = event, size = tonumber(size) }
+        end
+    end
+    return events, ordered
+end
+
+local function count(events, name, size)
+    local n = 0
+    for _, e in ipairs(events) do
+        if e.event == name and (size == nil or e.size == size) then
+            n = n + 1
+        end
+    end
+    return n
+end
+
+lunet.spawn(function()
+    local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+    local conn = assert(socket.connect("127.0.0.1", PORT))
+    local peer = assert(socket.accept(listener))
+    socket.write(conn, "hello")
+    check(socket.read(peer) == "hello", "echo read")
+    assert(fs.stat("test/trace_test.lua"))
+    lunet.sleep(20)
+
+    local n = trace.dump(TRACE_PATH)
+    check(n and n > 0, "events dumped")
+    local events, ordered = read_trace()
+    check(#events == n, "dump count matches lines")
+    check(ordered, "events oldest first, times before the dump")
+    check(count(events, "spawn") >= 1, "spawn recorded")
+    check(count(events, "resume") >= 1, "resumes recorded")
+    check(count(events, "tcp.listen") == 1, "listen recorded")
+    check(count(events, "tcp.connect") == 1, "connect recorded")
+    check(count(events, "tcp.accept") == 1, "accept recorded")
+    check(count(events, "tcp.write", 5) == 1, "write size recorded")
+    check(count(events, "tcp.read", 5) == 1, "read size recorded")
+    check(count(events, "fs.start") == 1 and count(events, "fs.done") == 1, "fs request recorded")
+    check(count(events, "sleep", 20) == 1 and count(events, "wake") == 1, "sleep recorded")
+    check(count(events, "coref.add") == count(events, "coref.release"), "coref events balanced")
+
+    -- only the wake-up and later events fall in the last 10ms
+    local recent = trace.dump(TRACE_PATH, 0.01)
+    check(recent and recent < n, "time window filters old events")
+
+    check(trace.set_size(1000) == 1024, "size rounded to a power of two")
+    for _ = 1, 3 do
+        lunet.sleep(1)
+    end
+    check(trace.dump(TRACE_PATH) and #read_trace() < 20, "resize discards old events")
+
+    check(trace.set_size(0) == 0, "disable")
+    local ok, err = trace.dump(TRACE_PATH)
+    check(ok == nil and err == "tracing disabled", "dump fails when disabled")
+    trace.set_size(16384)
+
+    os.remove(TRACE_PATH)
+    socket.close(peer)
+    socket.close(conn)
+    socket.close(listener)
+    test.pass("trace")
+end)
@@ -1,20 +1,24 @@
 --[[
   UDP Trace Test
   
-  Verifies basic UDP tracing: BIND, TX, and CLOSE statistics.
-  Tests that closing a handle correctly reports local and global tx/rx counts.
+  Verifies basic UDP tracing: BIND, TX, and CLOSE events.
+  Dumps the trace ring after closing the handle and checks that the events
+  were recorded against the same handle.
   
   Usage:
     ./build/lunet test/udp_trace_test.lua
     
-  Expected Trace Output (LUNET_TRACE=ON):
-    [UDP_TRACE] BIND #1 127.0.0.1:<port>
-    [UDP_TRACE] TX #1 -> 127.0.0.1:20001 (4 bytes)
-    [UDP_TRACE] CLOSE (local: tx=1 rx=0) (global: tx=1 rx=0)
+  Expected trace lines (lunet.trace.dump):
+    -1.234 udp.bind 0x... 0
+    -1.100 udp.tx 0x... 4
+    -0.950 udp.close 0x... 0
 ]]
 
 local lunet = require("lunet")
 local udp = require("lunet.udp")
+local trace = require("lunet.trace")
+
+local TRACE_PATH = os.tmpname()
 
 lunet.spawn(function()
     local h, err = udp.bind("127.0.0.1", 0)
@@ -32,4 +36,29 @@ lunet.spawn(function()
     print("Closing handle")
     udp.close(h)
     print("Handle closed")
+
+    assert(trace.dump(TRACE_PATH))
+    local events = {}
+    for line in io.lines(TRACE_PATH) do
+        local event, handle, size = line:match("^%S+ (%S+) (%S+) (%d+)$")
+        if event and event:find("^udp%.") then
+            events[#events + 1] = { event = event, handle = handle, size = tonumber(size) }
+        end
+    end
+    os.remove(TRACE_PATH)
+
+    local ok_trace = #events == 3
+        and events[1].event == "udp.bind"
+        and events[2].event == "udp.tx" and events[2].size == 4
+        and events[3].event == "udp.close"
+        and events[1].handle == events[3].handle
+    if ok_trace then
+        print("PASS: udp trace")
+    else
+        print("FAIL: unexpected udp trace events")
+        for _, e in ipairs(events) do
+            print("  " .. e.event .. " " .. e.handle .. " " .. e.size)
+        end
+        __lunet_exit_code = 1
+    end
 end)
@@ -0,0 +1,65 @@
+--[[
+  Upgrade Test
+
+  The first run listens, then calls lunet.upgrade(), which starts this same
+  script in a new process with the listener inherited. The new process (it
+  finds the marker file) serves one connection and exits. The old process
+  checks that its accept loop was stopped and that a fresh connection is
+  answered by the new process.
+
+  Usage:
+    lunet-run test/upgrade_test.lua
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local PORT = 20094
+local MARKER = "/tmp/lunet_upgrade_test." .. PORT
+
+local test = require("test.check")
+local check = test.check
+
+local marker = io.open(MARKER)
+if marker then
+    -- New process: the listener must be adopted, not bound again
+    marker:close()
+    os.remove(MARKER)
+    lunet.spawn(function()
+        local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+        local client = assert(socket.accept(listener))
+        socket.write(client, "new")
+        socket.close(client)
+        socket.close(listener)
+    end)
+    return
+end
+
+lunet.spawn(function()
+    local listener = assert(socket.listen("tcp", "127.0.0.1", PORT))
+    local accept_err
+    lunet.spawn(function()
+        local client, err = socket.accept(listener)
+        if client then
+            socket.close(client)
+        end
+        accept_err = err
+    end)
+
+    local f = assert(io.open(MARKER, "w"))
+    f:close()
+    local pid, err = lunet.upgrade()
+    check(type(pid) == "number", "upgrade: " .. tostring(err))
+    lunet.sleep(10)
+    check(accept_err == "listener closed", "old accept loop stopped")
+
+    local conn = socket.connect("127.0.0.1", PORT)
+    check(conn ~= nil, "connect after upgrade")
+    if conn then
+        check(socket.read(conn) == "new", "new process answers")
+        socket.close(conn)
+    end
+    socket.close(listener)
+    os.remove(MARKER)
+    test.pass("upgrade")
+end)
@@ -0,0 +1,48 @@
+--[[
+  Work Pool Test
+
+  Runs functions from standard modules on worker VMs, concurrently, and
+  checks argument/result copying and error reporting of lunet.work.
+
+  Usage:
+    lunet-run test/work_test.lua
+]]
+
+local lunet = require("lunet")
+local work = require("lunet.work")
+
+local test = require("test.check")
+local check = test.check
+
+check(work.prewarm(2, {"string"}) >= 2, "prewarm creates VMs")
+
+lunet.spawn(function()
+    check(work.run("string", "rep", "ab", 3) == "ababab", "string.rep on a worker")
+    local a, b = work.run("string", "byte", "AB", 1, 2)
+    check(a == 65 and b == 66, "multiple results")
+    local t = work.run("table", "concat", {"x", "y", "z"}, ",")
+    check(t == "x,y,z", "table argument is copied")
+
+    local v, err = work.run("string", "no_such_fn")
+    check(v == nil and err ~= nil, "missing function reports an error")
+    v, err = work.run("no.such.module", "f")
+    check(v == nil and err ~= nil, "missing module reports an error")
+    v, err = work.run("string", "rep", function() end)
+    check(v == nil and err ~= nil, "functions cannot be passed")
+    v, err = work.run("string", "rep", nil, 1)
+    check(v == nil and err ~= nil, "error raised in the worker is returned")
+
+    -- several jobs in flight at once
+    local done = 0
+    for i = 1, 8 do
+        lunet.spawn(function()
+            local r = work.run("math", "max", i, 4)
+            check(r == math.max(i, 4), "concurrent job " .. i)
+            done = done + 1
+        end)
+    end
+    while done < 8 do
+        lunet.sleep(5)
+    end
+    test.pass("work")
+end)
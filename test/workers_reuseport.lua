@@ -0,0 +1,100 @@
+--[[
+  Worker Mode Test
+
+  Every worker binds the same TCP port (SO_REUSEPORT) and serves a few
+  connections, replying with its worker id. A client in worker 1 connects
+  repeatedly and checks that every reply comes from a valid worker.
+
+  Usage:
+    lunet-run --workers 4 test/workers_reuseport.lua
+    lunet-run --processes 4 test/workers_reuseport.lua   (listener shared by the supervisor)
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local PORT = 20080
+local CONNECTIONS = 32
+local DEADLINE = 5000  -- ms; a worker that never receives "stop" closes on its own
+local id = lunet.worker_id()
+local count = lunet.worker_count()
+
+lunet.spawn(function()
+    local listener, err = socket.listen("tcp", "127.0.0.1", PORT)
+    if not listener then
+        print("FAIL: worker " .. id .. " listen: " .. tostring(err))
+        __lunet_exit_code = 1
+        return
+    end
+    print("worker " .. id .. "/" .. count .. " listening on " .. PORT)
+
+    local stopped = false
+    local function stop()
+        if not stopped then
+            stopped = true
+            socket.close(listener)
+        end
+    end
+
+    -- The kernel picks which worker gets each connection, so a "stop" may never
+    -- reach this one; poll in short steps so the process exits soon after stop()
+    lunet.spawn(function()
+        local waited = 0
+        while not stopped and waited < DEADLINE do
+            lunet.sleep(50)
+            waited = waited + 50
+        end
+        stop()
+    end)
+
+    lunet.spawn(function()
+        while true do
+            local client = socket.accept(listener)
+            if not client then break end
+            lunet.spawn(function()
+                local data = socket.read(client)
+                if data == "who" then
+                    socket.write(client, tostring(id))
+                elseif data == "stop" then
+                    stop()
+                end
+                socket.close(client)
+            end)
+        end
+    end)
+
+    if id ~= 1 then
+        return
+    end
+
+    lunet.sleep(100)  -- let the other workers bind
+    local seen = {}
+    for _ = 1, CONNECTIONS do
+        local conn = assert(socket.connect("127.0.0.1", PORT))
+        socket.write(conn, "who")
+        local reply = tonumber(socket.read(conn))
+        socket.close(conn)
+        if not reply or reply < 1 or reply > count then
+            print("FAIL: unexpected reply " .. tostring(reply))
+            __lunet_exit_code = 1
+            return
+        end
+        seen[reply] = (seen[reply] or 0) + 1
+    end
+    for w = 1, count do
+        print(string.format("worker %d served %d connections", w, seen[w] or 0))
+    end
+
+    -- Ask listeners to close until nobody accepts. With --processes the
+    -- supervisor keeps the port bound, so connect never fails; the attempt cap
+    -- and each worker's deadline cover that case.
+    for _ = 1, count * 64 do
+        local conn = socket.connect("127.0.0.1", PORT)
+        if not conn then break end
+        socket.write(conn, "stop")
+        socket.close(conn)
+        lunet.sleep(5)
+    end
+    stop()
+    print("PASS: worker mode")
+end)
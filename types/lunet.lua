@@ -28,4 +28,230 @@ function lunet.sleep(ms) end
 ---```
 function lunet.spawn(func) end
 
+---Create a channel for passing values between coroutines
+---With capacity 0 (the default) every send waits for a matching receive.
+---@param capacity? integer Number of values buffered before send blocks (default 0)
+---@return lunet.Channel channel
+---@usage
+---```lua
+---local ch = lunet.channel(64)
+---lunet.spawn(function() ch:send("job") end)
+---lunet.spawn(function() print(ch:recv()) end)
+---```
+function lunet.channel(capacity) end
+
+---@class lunet.SpawnPoolStats
+---@field size integer Maximum number of idle coroutines kept for reuse
+---@field idle integer Idle coroutines currently parked in the pool
+---@field hits number Spawns that reused a pooled coroutine
+---@field misses number Spawns that had to create a new coroutine
+
+---Statistics for the coroutine pool used by `lunet.spawn`
+---Finished coroutines are parked and reused by later spawns instead of being
+---left to the GC.
+---@return lunet.SpawnPoolStats stats
+---@usage
+---```lua
+---local pool = lunet.spawn_pool()
+---print(pool.hits, pool.misses, pool.idle .. "/" .. pool.size)
+---```
+function lunet.spawn_pool() end
+
+---Set the maximum number of idle coroutines kept for reuse (default 128)
+---A size of 0 disables recycling.
+---@param size integer
+---@return nil
+function lunet.set_spawn_pool_size(size) end
+
+---Set how many waiting coroutines are resumed per event loop iteration
+---I/O completions do not resume coroutines inside libuv callbacks; they queue
+---them and the loop resumes up to `budget` of them per iteration, in order.
+---The rest wait for the next iteration, so a burst of completions cannot starve
+---timers and new I/O. 0 means no limit. Default 1024.
+---@param budget integer
+---@return nil
+function lunet.set_resume_budget(budget) end
+
+---Enable preemptive time slicing for coroutines started by `lunet.spawn`
+---A count hook checks every 1000 VM instructions whether the running coroutine
+---has used more than `ms` milliseconds since it was resumed. If it has, the
+---coroutine is queued behind other ready coroutines and yields. It is only
+---preempted at points where a yield is legal. 0 disables slicing (default).
+---
+---LuaJIT does not run hooks inside JIT-compiled traces, so a hot loop that
+---gets compiled is not interrupted. Use `jit.off(fn)` on known CPU-heavy
+---functions if they must be sliced.
+---@param ms number Time slice in milliseconds
+---@return nil
+function lunet.set_timeslice(ms) end
+
+---@class lunet.TimesliceOverrun
+---@field count number Times this coroutine was preempted
+---@field where string Source position of the latest preemption ("file.lua:42")
+
+---Coroutines that were preempted by the time slice, and the total count
+---Coroutines are weakly referenced and disappear once collected. A record is
+---dropped when lunet.spawn reuses its thread for a new task.
+---@return table<thread, lunet.TimesliceOverrun> overruns
+---@return number preemptions Total preemptions on this loop
+---@usage
+---```lua
+---local overruns, total = lunet.timeslice_overruns()
+---for co, info in pairs(overruns) do
+---    print(info.where, info.count)
+---end
+---```
+function lunet.timeslice_overruns() end
+
+---Runtime metrics for the current loop
+---Counters are always maintained; the table is built on each call.
+---`utilization` covers the time since the previous `stats()` call (or loop start).
+---@return {corefs: integer, ready: integer, handles: {tcp: integer, udp: integer, pipe: integer, timers: integer, total: integer}, listeners: {address: string, pending: integer, waiting: boolean}[], bytes_read: number, bytes_written: number, fs_pending: integer, pool_pending: integer, work_pending: integer, loop_iterations: number, idle_time_ms: number, utilization: number, gc: {kb: number, steps: number, cycles: number, step_ms: number, max_step_ms: number}, slab: {allocs: number, reused: number, mallocs: number, live: number, reserved: number}}
+---@usage
+---```lua
+---local s = lunet.stats()
+---print(s.handles.tcp, s.bytes_read, string.format("%.0f%%", s.utilization * 100))
+---```
+function lunet.stats() end
+
+---Configure idle-time GC stepping, or disable it with `false`
+---Before the loop blocks waiting for I/O, lunet runs `lua_gc(LUA_GCSTEP, step)`
+---until `budget` ms have passed or the cycle finishes. Nothing runs while
+---coroutines are ready or a timer is due sooner than the budget. On by default
+---with step 16 (KB) and budget 1 (ms). `lunet.stats().gc` reports the time spent.
+---@param opts {step: number?, budget: number?}|false|nil
+---@return nil
+function lunet.set_gc(opts) end
+
+---Enable the event loop monitor, or disable it with `false`
+---A timer samples loop lag every `interval` ms (how late it fires), and every
+---coroutine resume issued by lunet is timed. Resumes taking at least `slow` ms
+---are logged to stderr with their call site: `[lunet] slow resume: db.query 38.2ms`.
+---`slow = 0` records without logging. Calling it again updates the settings and
+---keeps the collected data. Defaults: interval 100, slow 50.
+---@param opts {interval: number?, slow: number?}|false|nil
+---@return nil
+function lunet.set_monitor(opts) end
+
+---@class lunet.MonitorHistogram
+---@field count number Samples recorded
+---@field mean number Milliseconds
+---@field max number Milliseconds
+---@field p50 number Milliseconds
+---@field p90 number Milliseconds
+---@field p99 number Milliseconds
+---@field p999 number Milliseconds
+
+---@class lunet.MonitorStats
+---@field lag lunet.MonitorHistogram Event loop lag samples
+---@field resume lunet.MonitorHistogram Duration of each coroutine resume
+---@field slow number Resumes at or above the slow threshold
+---@field worst_site string? Call site of the longest resume
+---@field worst_ms number? Duration of the longest resume
+
+---Histograms collected by the loop monitor
+---Percentiles come from a log-linear histogram and are accurate to about 6%.
+---@param reset boolean? Clear the data after reading it
+---@return lunet.MonitorStats|nil stats
+---@return string? error "monitor not enabled"
+---@usage
+---```lua
+---lunet.set_monitor({ slow = 20 })
+---local m = lunet.monitor_stats(true)
+---print(m.lag.p99, m.resume.p999, m.worst_site)
+---```
+function lunet.monitor_stats(reset) end
+
+---@class lunet.MemTask
+---@field task string Function passed to `lunet.spawn`, as "file:line"
+---@field bytes number Bytes allocated while it ran (not live bytes)
+---@field allocs number Allocations while it ran
+
+---@class lunet.MemStats
+---@field current number Bytes the Lua state holds now
+---@field peak number Highest `current` since start or the last reset
+---@field reserved number Bytes taken from malloc, including slabs and freelists
+---@field allocs number Blocks handed out
+---@field frees number Blocks returned
+---@field small_allocs number Blocks of 256 bytes or less
+---@field small_reused number Small blocks served from a freelist
+---@field tasks lunet.MemTask[]? Largest first; only with attribution on
+
+---Counters of this worker's Lua allocator
+---@param reset boolean? Reset peak and the counters after reading them
+---@return lunet.MemStats|nil stats
+---@return string? error "lunet allocator not in use"
+---@usage
+---```lua
+---lunet.set_mem_attribution(true)
+---local m = lunet.mem_stats()
+---print(m.current, m.peak, m.tasks[1].task, m.tasks[1].bytes)
+---```
+function lunet.mem_stats(reset) end
+
+---Charge allocations to the task that is running
+---Tasks spawned after this call are tracked; earlier ones count as "other"
+---and code outside any task as "main".
+---@param enable boolean
+---@return boolean|nil ok
+---@return string? error "lunet allocator not in use"
+function lunet.set_mem_attribution(enable) end
+
+---Re-run modules and swap their `package.loaded` entries
+---Coroutines already running keep the functions they hold and finish on the
+---old code; the next `require` returns the new module. Listeners, sockets and
+---DB connections are untouched. All names are cleared before any is loaded,
+---and if one fails every entry is restored. Module bodies must not yield.
+---@param names string|string[] Module name or list of names
+---@return integer|nil count Number of modules reloaded
+---@return string|nil error "reload <name>: <message>"
+---@usage
+---```lua
+---local signal = require("lunet.signal")
+---lunet.spawn(function()
+---    while signal.wait("HUP") do
+---        print(lunet.reload({ "app.routes", "app.handlers" }))
+---    end
+---end)
+---```
+function lunet.reload(names) end
+
+---Replace this process with a fresh lunet-run without dropping connections
+---Starts the current executable with the same command line and hands it every
+---listening socket. In the new process, `socket.listen` on the same address
+---adopts the inherited socket instead of binding. Once the new script has
+---loaded, this process stops accepting: pending `socket.accept` calls return
+---nil, "listener closed". Finish in-flight work and exit. If the new process
+---dies before it is ready, this one keeps serving and an error is returned.
+---Not available with `--workers`, `--processes` or on Windows.
+---@return integer|nil pid Process id of the new lunet-run
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local signal = require("lunet.signal")
+---lunet.spawn(function()
+---    signal.wait("USR2")
+---    if lunet.upgrade() then
+---        draining = true  -- accept loops see "listener closed" and return
+---    end
+---end)
+---```
+function lunet.upgrade() end
+
+---Id of the worker running this script (1..worker_count)
+---In `lunet-run --workers N` mode every worker thread runs the same script with
+---its own event loop and Lua state; with `--processes N` it is the slot of the
+---supervised child process. Otherwise this is always 1.
+---@return integer id
+---@usage
+---```lua
+---local lunet = require('lunet')
+---print("worker " .. lunet.worker_id() .. " of " .. lunet.worker_count())
+---```
+function lunet.worker_id() end
+
+---Number of workers started by lunet-run (1 unless --workers or --processes is used)
+---@return integer count
+function lunet.worker_count() end
+
 return lunet
@@ -0,0 +1,62 @@
+---@meta
+
+---Bounded channel between coroutines of the same loop, created by `lunet.channel`
+---Values are delivered in order. `nil` cannot be sent. A blocked `send` or
+---`recv` parks the coroutine until the other side acts; no polling is involved.
+---@class lunet.Channel
+local Channel = {}
+
+---Send a value, waiting while the channel is full (must be called from coroutine
+---when it may block)
+---@param value any Any non-nil Lua value
+---@return boolean|nil ok true on success, nil if the channel is closed
+---@return string|nil error "channel closed"
+---@usage
+---```lua
+---local ch = lunet.channel(16)
+---lunet.spawn(function()
+---    for i = 1, 100 do ch:send(i) end
+---    ch:close()
+---end)
+---```
+function Channel:send(value) end
+
+---Send a value only if it can be delivered without waiting
+---@param value any Any non-nil Lua value
+---@return boolean|nil ok true on success
+---@return string|nil error "channel full" or "channel closed"
+function Channel:try_send(value) end
+
+---Receive the next value, waiting while the channel is empty (must be called
+---from coroutine when it may block)
+---@return any value The value, or nil once the channel is closed and drained
+---@return string|nil error "channel closed"
+---@usage
+---```lua
+---lunet.spawn(function()
+---    while true do
+---        local v, err = ch:recv()
+---        if err then break end
+---        print(v)
+---    end
+---end)
+---```
+function Channel:recv() end
+
+---Receive a value only if one is available without waiting
+---@return any value
+---@return string|nil error "channel empty" or "channel closed"
+function Channel:try_recv() end
+
+---Close the channel. Parked senders and receivers wake with nil, "channel closed";
+---values already buffered can still be received.
+function Channel:close() end
+
+---Number of buffered values (also available as `#ch`)
+---@return integer
+function Channel:len() end
+
+---@return boolean
+function Channel:is_closed() end
+
+return Channel
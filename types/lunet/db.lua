@@ -49,4 +49,16 @@ function db.exec(conn, sql) end
 ---@return string escaped The escaped string safe for SQL literals
 function db.escape(s) end
 
+---Set the number of threads in this driver's query pool (default 4)
+---Each driver module has its own pool, separate from the libuv threadpool used
+---by `lunet.fs`, so slow queries do not delay filesystem calls.
+---@param n integer Thread count, 1-128
+---@return boolean|nil ok
+---@return string|nil error
+function db.set_pool_size(n) end
+
+---Snapshot of this driver's query pool
+---@return {size: integer, started: integer, queued: integer, active: integer, completed: integer}
+function db.pool_stats() end
+
 return db
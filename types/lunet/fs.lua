@@ -41,7 +41,7 @@ function fs.stat(path) end
 
 ---Read from a file
 ---@param fd integer The file descriptor to read from
----@param size integer The number of bytes to read
+---@param size integer The most bytes to read (>= 0; capped at 2^31-1)
 ---@return string|nil data The data read from the file or nil on error
 ---@return string|nil error Error message if failed
 ---@usage
@@ -0,0 +1,64 @@
+---@meta
+
+---Cross-thread mailboxes, loaded with `require("lunet.mailbox")`
+---A mailbox belongs to the loop that opened it. Any worker can send to it by
+---name; values are copied (serialized), never shared. Supported values are
+---nil, booleans, numbers, strings and tables of those.
+---@class lunet.mailbox
+local mailbox = {}
+
+---Open a mailbox owned by the current loop
+---@param name string Process-wide name, 1-63 bytes
+---@return lunet.Mailbox|nil mailbox
+---@return string|nil error "mailbox name in use" or other error
+function mailbox.open(name) end
+
+---Get a handle for sending to a mailbox owned by any loop
+---@param name string
+---@return lunet.MailboxRemote|nil remote
+---@return string|nil error "no such mailbox"
+function mailbox.lookup(name) end
+
+---Send one value to a named mailbox (lookup + send)
+---@param name string
+---@param value any Non-nil serializable value
+---@return boolean|nil ok
+---@return string|nil error "no such mailbox", "mailbox closed" or a serialization error
+---@usage
+---```lua
+---mailbox.send("logger", {level = "info", msg = "started"})
+---```
+function mailbox.send(name, value) end
+
+---Receiving end of a mailbox, returned by `mailbox.open`
+---@class lunet.Mailbox
+local Mailbox = {}
+
+---Receive the next message, waiting until one arrives (must be called from
+---coroutine when it may block)
+---@return any|nil value
+---@return string|nil error "mailbox closed"
+function Mailbox:recv() end
+
+---Receive a message only if one is already queued
+---@return any|nil value
+---@return string|nil error "mailbox empty" or "mailbox closed"
+function Mailbox:try_recv() end
+
+---Close the mailbox and release its name. Parked receivers get nil, "mailbox closed".
+function Mailbox:close() end
+
+---@return string|nil name nil once closed
+function Mailbox:name() end
+
+---Sending end of a mailbox, returned by `mailbox.lookup`
+---@class lunet.MailboxRemote
+local MailboxRemote = {}
+
+---Send one value without waiting
+---@param value any Non-nil serializable value
+---@return boolean|nil ok
+---@return string|nil error "mailbox closed" or a serialization error
+function MailboxRemote:send(value) end
+
+return mailbox
@@ -0,0 +1,35 @@
+---@meta
+
+---Sampling profiler with per-task attribution, loaded with `require("lunet.profiler")`
+---Built on LuaJIT's profiler. Every sample is charged to the function passed to
+---`lunet.spawn` for the coroutine that was running, and written in the folded
+---stack format that `flamegraph.pl` and speedscope read. Only one loop in the
+---process can profile at a time.
+---@class lunet.profiler
+local profiler = {}
+
+---Start sampling the current loop's Lua state
+---Lines look like `file.lua:10;json:encode;lunet.socket.write 42`: the task
+---label, then Lua frames from outermost to innermost, with `[GC]` or `[JIT]`
+---appended when the VM was collecting or compiling. Time spent outside the VM
+---(libuv callbacks, driver result conversion, pool threads) appears as
+---`task;[C] <site> n`, named after the resume site that was running.
+---@param opts? {interval: integer?, depth: integer?} Sample interval in ms (default 10), Lua frames per sample (default 64)
+---@return boolean|nil ok
+---@return string|nil error "profiler already running"
+function profiler.start(opts) end
+
+---Stop sampling and return the folded stacks
+---@param path? string Write the stacks to this file instead of returning them
+---@return string|number|nil result Folded stacks, or the number of samples written to `path`
+---@return string|nil error "profiler not running" or a file error
+---@usage
+---```lua
+---local profiler = require("lunet.profiler")
+---profiler.start({ interval = 1 })
+---lunet.sleep(30000)
+---profiler.stop("/tmp/lunet.folded")  -- flamegraph.pl /tmp/lunet.folded > flame.svg
+---```
+function profiler.stop(path) end
+
+return profiler
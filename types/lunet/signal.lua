@@ -4,7 +4,7 @@
 local signal = {}
 
 ---Wait for a signal (must be called from coroutine)
----@param name string The name of the signal to wait for ("INT", "TERM", "HUP", "QUIT")
+---@param name string The name of the signal to wait for ("INT", "TERM", "HUP", "QUIT", "USR1", "USR2"; USR1/USR2 not on Windows)
 ---@return string|nil signal The name of the signal that was received or nil on error
 ---@return string|nil error Error message if failed
 ---@usage
@@ -20,6 +20,8 @@ local socket = {}
 function socket.listen(protocol, host, port) end
 
 ---Accept an incoming connection (must be called from coroutine)
+---After `lunet.upgrade` hands the listener to a new process, queued connections
+---are still returned, then accept fails with "listener closed".
 ---@param listener lightuserdata The listener handle from socket.listen()
 ---@return lightuserdata|nil client The client handle or nil on error
 ---@return string|nil error Error message if failed
@@ -51,6 +53,11 @@ function socket.accept(listener) end
 function socket.getpeername(client) end
 
 ---Read data from a socket (must be called from coroutine)
+---
+---After the first call the connection keeps reading in the background. If any
+---bytes are buffered, all of them are returned at once without waiting;
+---otherwise the call waits for the next data. Reading pauses while 64 KiB sit
+---unread and resumes on the next call.
 ---@param client lightuserdata The client handle
 ---@return string|nil data The received data or nil on error/EOF
 ---@return string|nil error Error message if failed
@@ -70,7 +77,62 @@ function socket.getpeername(client) end
 ---```
 function socket.read(client) end
 
+---Read exactly n bytes from a socket (must be called from coroutine)
+---
+---Waits until n bytes are buffered. If the connection closes first, returns
+---nil, "connection closed" and the partial data stays available to socket.read.
+---@param client lightuserdata The client handle
+---@param n integer Number of bytes to read
+---@return string|nil data Exactly n bytes, or nil on error/EOF
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local len = tonumber(socket.read_line(client))
+---local body = socket.read_exact(client, len)
+---```
+function socket.read_exact(client, n) end
+
+---Read up to and including a delimiter (must be called from coroutine)
+---
+---Searches the buffered bytes in C and waits only while the delimiter has not
+---arrived. If it does not appear within max bytes, returns nil and an error and
+---leaves the data buffered. At EOF before the delimiter, returns
+---nil, "connection closed".
+---@param client lightuserdata The client handle
+---@param delim string Delimiter (non-empty)
+---@param max? integer Most bytes to return, delimiter included (default 65536)
+---@return string|nil data The data ending with delim, or nil on error/EOF
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local head = socket.read_until(client, "\r\n\r\n", 8192)
+---```
+function socket.read_until(client, delim, max) end
+
+---Read one line (must be called from coroutine)
+---
+---Like socket.read_until(client, "\n", max), but the returned line has the
+---"\n" or "\r\n" terminator removed.
+---@param client lightuserdata The client handle
+---@param max? integer Most bytes in the line, terminator included (default 65536)
+---@return string|nil line The line without its terminator, or nil on error/EOF
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---while true do
+---    local line, err = socket.read_line(client)
+---    if not line then break end
+---    print(line)
+---end
+---```
+function socket.read_line(client, max) end
+
 ---Write data to a socket (must be called from coroutine)
+---
+---The data is queued behind earlier writes, so several coroutines may write to
+---one connection. The call returns at once unless more than 64 KiB are waiting
+---to be sent; then it waits until this write has gone out. If a queued write
+---fails later, the next write or socket.drain returns the error.
 ---@param client lightuserdata The client handle
 ---@param data string The data to send
 ---@return string|nil error Error message if failed
@@ -86,7 +148,41 @@ function socket.read(client) end
 ---```
 function socket.write(client, data) end
 
+---Write several strings with one call (must be called from coroutine)
+---
+---The parts are handed to the kernel as one vectored write, without joining
+---them first. This avoids a table.concat copy, e.g. for response headers and
+---body. Numbers are converted to strings as in table.concat.
+---Queued and flow-controlled like socket.write.
+---@param client lightuserdata The client handle
+---@param parts string[] The strings to send, in order
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local err = socket.writev(client, {
+---    "HTTP/1.1 200 OK\r\nContent-Length: ", #body, "\r\n\r\n", body,
+---})
+---```
+function socket.writev(client, parts) end
+
+---Wait until all queued writes have been sent (must be called from coroutine)
+---@param client lightuserdata The client handle
+---@return string|nil error The first write error on the connection, if any
+---@usage
+---```lua
+---for _, event in ipairs(events) do
+---    socket.write(client, "data: " .. event .. "\n\n")
+---end
+---local err = socket.drain(client)
+---socket.close(client)
+---```
+function socket.drain(client) end
+
 ---Close a socket or listener
+---
+---Writes still queued on a connection are sent first; the socket closes once
+---they complete. Reads and writes on it fail from the moment close is called,
+---and a coroutine waiting in a read gets nil, "socket is closed".
 ---@param handle lightuserdata The socket handle to close
 ---@usage
 ---```lua
@@ -96,8 +192,8 @@ function socket.write(client, data) end
 ---```
 function socket.close(handle) end
 
----Set the read buffer size for a socket
----@param size integer The new read buffer size
+---Set how many bytes each read from the kernel appends to a connection's buffer
+---@param size integer The read size in bytes (values <= 0 are ignored)
 ---@return nil
 ---@usage
 ---```lua
@@ -0,0 +1,46 @@
+---@meta
+
+---Per-loop event trace, loaded with `require("lunet.trace")`
+---Every loop records spawns, resumes, coroutine references, sleeps, fs requests
+---and socket/UDP I/O into a fixed-size ring of binary records. Recording is
+---always on; records are only decoded when dumped.
+---@class lunet.trace
+local trace = {}
+
+---Write the recorded events of the current loop to a text file, oldest first
+---Each line is `ms event handle size [site]`; `ms` is negative, counting back from
+---the time of the dump.
+---@param path string Output file (overwritten)
+---@param seconds? number Only write events from the last `seconds` seconds
+---@return integer|nil count Number of events written
+---@return string|nil error "tracing disabled" or a file error
+---@usage
+---```lua
+---local trace = require("lunet.trace")
+---trace.dump("/tmp/lunet-trace.txt", 10)
+---```
+function trace.dump(path, seconds) end
+
+---Write the recorded events as Chrome Trace Event JSON (for Perfetto or chrome://tracing)
+---Each coroutine gets a track with `run` slices (resume to yield), wait slices
+---named after the operation that woke it (`socket.read`, `db.query`, `fs.stat`,
+---`sleep`, ...) and `queued` slices (time in the ready queue before resuming).
+---@param path string Output file (overwritten)
+---@param seconds? number Only export events from the last `seconds` seconds
+---@return integer|nil count Number of trace events written
+---@return string|nil error "tracing disabled" or a file error
+---@usage
+---```lua
+---trace.export("/tmp/lunet.json", 10)  -- then open it in https://ui.perfetto.dev
+---```
+function trace.export(path, seconds) end
+
+---Resize the ring of the current loop, discarding recorded events
+---The size is rounded up to a power of two. 0 disables recording. If the new
+---ring cannot be allocated, the old one and its events are kept.
+---@param records integer Number of events to keep (default 16384)
+---@return integer|nil capacity Actual capacity
+---@return string|nil error
+function trace.set_size(records) end
+
+return trace
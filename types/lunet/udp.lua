@@ -21,6 +21,7 @@ function udp.send(handle, host, port, data) end
 
 ---Receive a datagram if one is available.
 ---Returns nils if none are queued (caller can yield/sleep).
+---Up to 4096 datagrams are queued per socket; further ones are dropped.
 ---@param handle lightuserdata
 ---@return string|nil data
 ---@return string|nil peer_host
@@ -0,0 +1,43 @@
+---@meta
+
+---Run Lua functions on a pool of worker VMs, loaded with `require("lunet.work")`
+---Worker VMs run on the libuv threadpool with the standard libraries and the
+---caller's `package.path`/`package.cpath`. They share nothing with the loop:
+---arguments and results are copied (nil, booleans, numbers, strings and tables
+---of those). Required modules stay loaded in each VM between jobs.
+---@class lunet.work
+local work = {}
+
+---Call `require(module)[fn](...)` on a worker VM and wait for its results
+---(must be called from coroutine)
+---@param module string Module name as passed to `require`
+---@param fn string Function name in the module table
+---@param ... any Serializable arguments
+---@return any ... The function's results, or nil and an error message
+---@usage
+---```lua
+---local work = require("lunet.work")
+---lunet.spawn(function()
+---    local html, err = work.run("templates", "render", "index", {user = "ada"})
+---end)
+---```
+function work.run(module, fn, ...) end
+
+---Create worker VMs ahead of time, optionally requiring modules in each
+---@param n integer Number of VMs to create
+---@param modules? string[] Modules to load into every new VM
+---@return integer|nil idle Number of idle worker VMs, or nil on error
+---@return string|nil error Error from requiring a module
+function work.prewarm(n, modules) end
+
+---Set the number of threads that run worker VMs (default 4)
+---@param n integer Thread count, 1-128
+---@return boolean|nil ok
+---@return string|nil error
+function work.set_pool_size(n) end
+
+---Snapshot of the work pool
+---@return {size: integer, started: integer, queued: integer, active: integer, completed: integer}
+function work.pool_stats() end
+
+return work
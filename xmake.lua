@@ -17,18 +17,65 @@ option("trace")
     set_description("Enable LUNET_TRACE for coroutine reference tracking")
 option_end()
 
+-- Single-binary builds (target lunet-app): app directory compiled into the binary
+option("embed")
+    set_default("")
+    set_showmenu(true)
+    set_description("App directory whose .lua files are embedded as bytecode in lunet-app")
+option_end()
+
+option("embed_main")
+    set_default("main")
+    set_showmenu(true)
+    set_description("Embedded module lunet-app runs when started without a script")
+option_end()
+
+option("embed_sqlite3")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Link the SQLite3 driver into lunet-app as a preloaded lunet.sqlite3")
+option_end()
+
+-- 64-bit LuaJIT built with LUAJIT_DISABLE_GC64 rejects custom allocators
+option("gc64")
+    set_default(true)
+    set_showmenu(true)
+    set_description("LuaJIT uses GC64 on 64-bit targets (set to n to always use LuaJIT's allocator)")
+option_end()
+
+if not has_config("gc64") then
+    add_defines("LUNET_LUAJIT_NO_GC64")
+end
+
 -- Common source files for core lunet
 local core_sources = {
     "src/main.c",
+    "src/alloc.c",
+    "src/bccache.c",
+    "src/channel.c",
     "src/co.c",
+    "src/embed.c",
     "src/fs.c",
+    "src/gc.c",
+    "src/mailbox.c",
+    "src/monitor.c",
+    "src/pool.c",
+    "src/prefork.c",
+    "src/profiler.c",
+    "src/reload.c",
     "src/rt.c",
+    "src/serialize.c",
     "src/signal.c",
+    "src/slab.c",
     "src/socket.c",
+    "src/stats.c",
     "src/udp.c",
+    "src/upgrade.c",
     "src/stl.c",
     "src/timer.c",
-    "src/trace.c"
+    "src/trace.c",
+    "src/trace_ring.c",
+    "src/work.c"
 }
 
 -- =============================================================================
@@ -133,6 +180,75 @@ target("lunet-bin")
     end
 target_end()
 
+-- Single static binary: lunet-run plus an app directory embedded as bytecode
+-- Usage: xmake f --embed=app [--embed_main=main] [--embed_sqlite3=y] && xmake build lunet-app
+-- Needs a host `luajit` of the same version the binary links against.
+rule("lunet.embed")
+    on_config(function (target)
+        local appdir = get_config("embed")
+        if not appdir or appdir == "" then
+            raise("lunet-app: set the app directory with xmake f --embed=<dir>")
+        end
+        local out = path.join(target:autogendir(), "lunet_embed.c")
+        target:data_set("lunet.embed.out", out)
+        target:add("files", out, {always_added = true})
+        target:add("defines", "LUNET_EMBED")
+    end)
+    before_build(function (target)
+        local appdir = path.absolute(get_config("embed"))
+        local out = target:data("lunet.embed.out")
+        local main = get_config("embed_main")
+        local args = {path.join(os.projectdir(), "bin/embed_bytecode.lua"), appdir, out,
+                      (main and main ~= "") and main or "-"}
+        for _, file in ipairs(os.files(path.join(appdir, "**.lua"))) do
+            table.insert(args, file)
+        end
+        os.mkdir(path.directory(out))
+        os.vrunv("luajit", args)
+    end)
+rule_end()
+
+target("lunet-app")
+    set_default(false)  -- Only build when explicitly requested
+    set_kind("binary")
+    set_basename("lunet-app")
+    add_rules("lunet.embed")
+
+    add_files(core_sources)
+    add_includedirs("include", {public = true})
+    add_packages("luajit", "libuv")
+
+    if has_config("embed_sqlite3") then
+        add_files("ext/sqlite3/sqlite3.c")
+        add_includedirs("ext/sqlite3")
+        add_packages("sqlite3")
+        add_defines("LUNET_HAS_DB", "LUNET_DB_SQLITE3")
+    end
+
+    if is_plat("linux") then
+        add_defines("_GNU_SOURCE")
+        add_cflags("-pthread")
+        add_ldflags("-pthread")
+        add_syslinks("pthread", "dl", "m")
+    end
+    if is_plat("windows") then
+        add_cflags("/TC")
+        add_syslinks("ws2_32", "iphlpapi", "userenv", "psapi", "advapi32", "user32", "shell32", "ole32", "dbghelp")
+    end
+    if has_config("trace") then
+        add_defines("LUNET_TRACE")
+    end
+target_end()
+
+-- C microbenchmarks; not built by default
+-- Usage: xmake build queue-bench && xmake run queue-bench
+target("queue-bench")
+    set_default(false)
+    set_kind("binary")
+    add_files("bench/queue_bench.c", "src/stl.c")
+    add_includedirs("include")
+target_end()
+
 -- =============================================================================
 -- Database Driver Modules (separate packages)
 -- =============================================================================